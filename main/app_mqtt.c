@@ -1,8 +1,70 @@
 /*
- * app_mqtt.c  (v1.3 -- LWT support)
+ * app_mqtt.c  (v1.12 -- client handle safe across a re-create)
  *
  * Thin wrapper around ESP-IDF's esp_mqtt_client.
  *
+ * CHANGE vs v1.11:
+ *  - The client handle is taken with client_get() / client_put(): callers
+ *    on other tasks (publish, subscribe, outbox size) count themselves in
+ *    s_ctx.users around each esp_mqtt_client_* call.  A re-create first
+ *    swaps the handle to NULL, waits for the count to drop to zero, and
+ *    only then destroys the old client -- no call can still be inside it.
+ *    No lock is held across esp-mqtt calls, so its event handler (which
+ *    subscribes from the esp-mqtt task) cannot deadlock against a caller.
+ *  - QoS>0 publishes are kept (topic + payload, APP_MQTT_KEEP_MAX entries,
+ *    APP_MQTT_KEEP_LEN bytes each) until their PUBACK.  A re-create
+ *    enqueues the unacked ones into the new client's outbox before the
+ *    handle is published, so they go out after its first connect instead
+ *    of being lost with the old outbox.  A message whose ack raced the
+ *    bookkeeping may go out twice, which QoS 1 allows.
+ *  - Events of a client that is being replaced are ignored.
+ *
+ * CHANGE vs v1.10:
+ *  - The transport is fixed when the esp-mqtt client is created, so
+ *    mqtt_client_set_uri() to a broker of the other scheme (mqtt:// <->
+ *    mqtts://) destroys the client and creates a new one with the same
+ *    settings and the new URI.  mqtt_client_reconnect() starts it.  The
+ *    TLS session cache lives in mqtt_tls and survives.
+ *
+ * CHANGE vs v1.9:
+ *  - MQTT_EVENT_DATA goes to the raw callback first, straight from the
+ *    esp-mqtt buffer (no 512 B copy, no NUL clipping).  A message it
+ *    claims stays claimed for its remaining fragments; anything else
+ *    takes the text path as before.
+ *
+ * CHANGE vs v1.8:
+ *  - mqtts:// brokers are carried by mqtt_tls' transport (set as
+ *    network.transport) instead of esp-mqtt's built-in SSL transport, so
+ *    reconnects can resume the previous TLS session.
+ *
+ * CHANGE vs v1.7:
+ *  - manual reconnect maps to network.disable_auto_reconnect +
+ *    network.timeout_ms; reconnect / set_uri / disconnect wrap the
+ *    esp_mqtt_client_* calls of the same name.
+ *
+ * CHANGE vs v1.6:
+ *  - mqtt5 selects session.protocol_ver = MQTT_PROTOCOL_V_5.  With a
+ *    persistent session the CONNECT also carries a Session Expiry Interval
+ *    (CONFIG_MQTT5_SESSION_EXPIRY_S): under MQTT 5 clean-start = 0 alone
+ *    still ends the session at disconnect.
+ *  - mqtt_client_publish_props() sets the publish property slot and the
+ *    user property list right before the publish and frees the list after.
+ *
+ * CHANGE vs v1.5:
+ *  - persistent_session maps to session.disable_clean_session.
+ *  - CONNACK session-present flag latched on MQTT_EVENT_CONNECTED before
+ *    the connection callback runs (mqtt_client_session_present()).
+ *
+ * CHANGE vs v1.4:
+ *  - mqtt_client_subscribe_multiple() wraps esp_mqtt_client_subscribe_multiple.
+ *  - MQTT_EVENT_SUBSCRIBED is forwarded to the subscribed callback with the
+ *    SUBACK return codes (esp-mqtt delivers them in event->data).
+ *
+ * CHANGE vs v1.3:
+ *  - MQTT_EVENT_PUBLISHED is no longer ignored; it is forwarded to the
+ *    published callback so mqtt_service can measure ack latency.
+ *  - mqtt_client_get_outbox_size() wraps esp_mqtt_client_get_outbox_size().
+ *
  * CHANGE vs v1.2:
  *  - mqtt_client_init() accepts lwt_topic/message/qos/retain and wires them
  *    into esp_mqtt_client_config_t.session.last_will.
@@ -12,24 +74,192 @@
 
 #include "app_mqtt.h"
 #include "mqtt_client.h"   /* ESP-IDF MQTT component */
+#include "mqtt_tls.h"      /* [v1.9] resumable TLS transport */
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char *TAG = "app-mqtt";
 
+#ifndef CONFIG_MQTT5_SESSION_EXPIRY_S
+#define CONFIG_MQTT5_SESSION_EXPIRY_S   3600
+#endif
+
+/* [v1.12] Unacked QoS>0 publishes carried over a re-create */
+#define APP_MQTT_KEEP_MAX   8
+#define APP_MQTT_KEEP_LEN   1280        /* topic + payload; larger: not kept */
+
+typedef struct {
+    atomic_int  msg_id;                 /* 0: free (acked or never used) */
+    uint32_t    seq;                    /* publish order, oldest evicted */
+    uint8_t     qos;
+    uint8_t     retain;
+    uint16_t    topic_len;              /* incl. NUL */
+    uint16_t    len;
+    uint8_t    *buf;                    /* topic, then payload */
+} kept_t;
+
 /* -------------------------------------------------------------------------
  * Internal state
  * ------------------------------------------------------------------------- */
 typedef struct {
-    esp_mqtt_client_handle_t client;
+    _Atomic(esp_mqtt_client_handle_t) client;   /* [v1.12] see client_get() */
+    atomic_int               users;             /* [v1.12] calls inside client */
     mqtt_message_cb_t        message_cb;
     void                    *message_ctx;
     mqtt_connection_cb_t     connection_cb;
     void                    *connection_ctx;
+    mqtt_published_cb_t      published_cb;      /* [v1.4] */
+    void                    *published_ctx;
+    mqtt_subscribed_cb_t     subscribed_cb;     /* [v1.5] */
+    void                    *subscribed_ctx;
+    volatile bool            session_present;   /* [v1.6] from last CONNACK */
+    bool                     v5;                /* [v1.7] protocol 5.0 */
+    uint32_t                 connect_timeout_ms; /* [v1.8] 0 = auto reconnect */
+    mqtt_raw_cb_t            raw_cb;            /* [v1.10] */
+    void                    *raw_ctx;
+    bool                     raw_claimed;       /* [v1.10] current message */
+    /* [v1.11] Settings kept to re-create the client on a scheme change */
+    bool                     tls;               /* client has the TLS transport */
+    bool                     started;
+    bool                     recreate;          /* re-create failed: retry */
+    char                     client_id[64];
+    char                     lwt_topic[96];
+    char                     lwt_message[32];
+    int                      lwt_qos;
+    int                      lwt_retain;
+    bool                     persistent_session;
+    /* [v1.12] Publish task adds, event handler frees by msg_id */
+    kept_t                   kept[APP_MQTT_KEEP_MAX];
+    uint32_t                 kept_seq;
+    uint32_t                 kept_dropped;  /* not kept: evicted, too large */
 } app_mqtt_ctx_t;
 
+/* Upper bound on filters per SUBSCRIBE built by subscribe_multiple() */
+#define APP_MQTT_SUBSCRIBE_MAX  24
+
 static app_mqtt_ctx_t s_ctx = {0};
 
+/* -------------------------------------------------------------------------
+ * [v1.12] Client handle and kept publishes
+ * ------------------------------------------------------------------------- */
+
+/* Handle for one esp_mqtt_client_* call, NULL while there is none (or it
+ * is being replaced).  Counting in before the load means a re-create that
+ * swapped the handle out waits for this call; client_put() after it. */
+static esp_mqtt_client_handle_t client_get(void)
+{
+    atomic_fetch_add(&s_ctx.users, 1);
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) atomic_fetch_sub(&s_ctx.users, 1);
+    return c;
+}
+
+static void client_put(void)
+{
+    atomic_fetch_sub(&s_ctx.users, 1);
+}
+
+/* Take the handle away from other tasks; returns it once none is using it */
+static esp_mqtt_client_handle_t client_detach(void)
+{
+    esp_mqtt_client_handle_t c = atomic_exchange(&s_ctx.client, NULL);
+    while (atomic_load(&s_ctx.users) > 0) vTaskDelay(1);
+    return c;
+}
+
+/* Publish task: copy an accepted QoS>0 publish until its ack */
+static void keep_publish(int msg_id, const char *topic, const char *data,
+                         size_t len, int qos, int retain)
+{
+    size_t tlen = strlen(topic) + 1;
+    if (tlen + len > APP_MQTT_KEEP_LEN) {
+        s_ctx.kept_dropped++;
+        return;
+    }
+
+    /* A free slot, else the oldest -- whose message is then not carried */
+    kept_t *k = NULL;
+    for (int i = 0; i < APP_MQTT_KEEP_MAX; i++) {
+        kept_t *e = &s_ctx.kept[i];
+        if (atomic_load(&e->msg_id) == 0) {
+            k = e;
+            break;
+        }
+        if (k == NULL || (int32_t)(e->seq - k->seq) < 0) k = e;
+    }
+    if (atomic_exchange(&k->msg_id, 0) != 0) s_ctx.kept_dropped++;
+
+    if (k->buf == NULL) k->buf = malloc(APP_MQTT_KEEP_LEN);
+    if (k->buf == NULL) {
+        s_ctx.kept_dropped++;
+        return;
+    }
+    memcpy(k->buf, topic, tlen);
+    memcpy(k->buf + tlen, data, len);
+    k->topic_len = (uint16_t)tlen;
+    k->len       = (uint16_t)len;
+    k->qos       = (uint8_t)qos;
+    k->retain    = (uint8_t)retain;
+    k->seq       = s_ctx.kept_seq++;
+    atomic_store(&k->msg_id, msg_id);
+}
+
+/* Event handler: PUBACK / PUBCOMP for msg_id */
+static void keep_acked(int msg_id)
+{
+    for (int i = 0; i < APP_MQTT_KEEP_MAX; i++) {
+        int expect = msg_id;
+        if (atomic_compare_exchange_strong(&s_ctx.kept[i].msg_id, &expect, 0)) return;
+    }
+}
+
+/* Re-create: unacked publishes into the new client's outbox, oldest first.
+ * The handle is detached, so the publish task is not adding meanwhile. */
+static void keep_requeue(esp_mqtt_client_handle_t c)
+{
+    kept_t *order[APP_MQTT_KEEP_MAX];
+    int n = 0;
+    for (int i = 0; i < APP_MQTT_KEEP_MAX; i++) {
+        kept_t *e = &s_ctx.kept[i];
+        if (atomic_load(&e->msg_id) == 0) continue;
+        int j = n++;
+        while (j > 0 && (int32_t)(order[j - 1]->seq - e->seq) > 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = e;
+    }
+
+    int moved = 0;
+    for (int i = 0; i < n; i++) {
+        kept_t *k = order[i];
+        int id = esp_mqtt_client_enqueue(c, (const char *)k->buf,
+                                         (const char *)k->buf + k->topic_len,
+                                         k->len, k->qos, k->retain, true);
+        atomic_store(&k->msg_id, id > 0 ? id : 0);
+        if (id > 0) moved++;
+        else        s_ctx.kept_dropped++;
+    }
+    if (n > 0) {
+        ESP_LOGI(TAG, "%d of %d unacked publish(es) carried to the new client "
+                 "(%u not kept since start)", moved, n, (unsigned)s_ctx.kept_dropped);
+    }
+}
+
+static void keep_clear(void)
+{
+    for (int i = 0; i < APP_MQTT_KEEP_MAX; i++) {
+        atomic_store(&s_ctx.kept[i].msg_id, 0);
+        free(s_ctx.kept[i].buf);
+        s_ctx.kept[i].buf = NULL;
+    }
+}
+
 /* -------------------------------------------------------------------------
  * ESP-IDF MQTT event handler
  * ------------------------------------------------------------------------- */
@@ -40,10 +270,15 @@ static void mqtt_event_handler(void *handler_args,
 {
     esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
 
+    /* [v1.12] A client being replaced: its state no longer matters */
+    if (event->client != atomic_load(&s_ctx.client)) return;
+
     switch ((esp_mqtt_event_id_t)event_id) {
 
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        s_ctx.session_present = (event->session_present != 0);
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED (session_present=%d)",
+                 s_ctx.session_present);
         if (s_ctx.connection_cb) {
             s_ctx.connection_cb(true, s_ctx.connection_ctx);
         }
@@ -51,12 +286,29 @@ static void mqtt_event_handler(void *handler_args,
 
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        s_ctx.session_present = false;
         if (s_ctx.connection_cb) {
             s_ctx.connection_cb(false, s_ctx.connection_ctx);
         }
         break;
 
     case MQTT_EVENT_DATA:
+        /* [v1.10] First look for the raw callback, per fragment */
+        if (s_ctx.raw_cb) {
+            if (event->current_data_offset == 0) {
+                s_ctx.raw_claimed = s_ctx.raw_cb(event->topic, event->topic_len,
+                                                 (const uint8_t *)event->data,
+                                                 event->data_len, 0,
+                                                 event->total_data_len,
+                                                 s_ctx.raw_ctx);
+                if (s_ctx.raw_claimed) break;
+            } else if (s_ctx.raw_claimed) {
+                s_ctx.raw_cb(NULL, 0, (const uint8_t *)event->data,
+                             event->data_len, event->current_data_offset,
+                             event->total_data_len, s_ctx.raw_ctx);
+                break;
+            }
+        }
         if (event->topic && event->data) {
             /* Null-terminate safely into local buffers */
             char topic[128] = {0};
@@ -74,6 +326,23 @@ static void mqtt_event_handler(void *handler_args,
         }
         break;
 
+    case MQTT_EVENT_PUBLISHED:
+        /* [v1.4] PUBACK (QoS1) / PUBCOMP (QoS2) for event->msg_id */
+        keep_acked(event->msg_id);                          /* [v1.12] */
+        if (s_ctx.published_cb) {
+            s_ctx.published_cb(event->msg_id, s_ctx.published_ctx);
+        }
+        break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+        /* [v1.5] event->data holds one SUBACK return code per filter */
+        if (s_ctx.subscribed_cb) {
+            s_ctx.subscribed_cb(event->msg_id, (const uint8_t *)event->data,
+                                event->data ? event->data_len : 0,
+                                s_ctx.subscribed_ctx);
+        }
+        break;
+
     case MQTT_EVENT_ERROR:
         ESP_LOGW(TAG, "MQTT_EVENT_ERROR");
         break;
@@ -86,93 +355,301 @@ static void mqtt_event_handler(void *handler_args,
 /* -------------------------------------------------------------------------
  * Public API
  * ------------------------------------------------------------------------- */
-esp_err_t mqtt_client_init(const char *broker_uri,
-                            const char *client_id,
-                            const char *lwt_topic,
-                            const char *lwt_message,
-                            int         lwt_qos,
-                            int         lwt_retain)
+/* esp-mqtt client for `broker_uri` from the settings in s_ctx */
+static esp_err_t client_create(const char *broker_uri)
 {
-    if (s_ctx.client != NULL) {
-        ESP_LOGW(TAG, "Already initialised -- call deinit first");
-        return ESP_ERR_INVALID_STATE;
-    }
-
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = broker_uri,
-        .credentials.client_id = client_id,
+        .credentials.client_id = s_ctx.client_id,
     };
 
     /* [v1.3] Wire LWT if a topic was provided */
-    if (lwt_topic && lwt_topic[0] != '\0') {
-        mqtt_cfg.session.last_will.topic   = lwt_topic;
-        mqtt_cfg.session.last_will.msg     = lwt_message ? lwt_message : "";
-        mqtt_cfg.session.last_will.msg_len = lwt_message ? strlen(lwt_message) : 0;
-        mqtt_cfg.session.last_will.qos     = lwt_qos;
-        mqtt_cfg.session.last_will.retain  = lwt_retain;
-        ESP_LOGI(TAG, "LWT configured: topic=%s msg=%s qos=%d retain=%d",
-                 lwt_topic, lwt_message, lwt_qos, lwt_retain);
+    if (s_ctx.lwt_topic[0] != '\0') {
+        mqtt_cfg.session.last_will.topic   = s_ctx.lwt_topic;
+        mqtt_cfg.session.last_will.msg     = s_ctx.lwt_message;
+        mqtt_cfg.session.last_will.msg_len = strlen(s_ctx.lwt_message);
+        mqtt_cfg.session.last_will.qos     = s_ctx.lwt_qos;
+        mqtt_cfg.session.last_will.retain  = s_ctx.lwt_retain;
+    }
+
+    /* [v1.6] clean-session 0: broker keeps subscriptions + queued QoS>0 */
+    mqtt_cfg.session.disable_clean_session = s_ctx.persistent_session;
+
+    /* [v1.8] caller decides when and where to reconnect */
+    if (s_ctx.connect_timeout_ms > 0) {
+        mqtt_cfg.network.disable_auto_reconnect = true;
+        mqtt_cfg.network.timeout_ms             = (int)s_ctx.connect_timeout_ms;
+    }
+
+    /* [v1.7] */
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (s_ctx.v5) mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_5;
+#endif
+
+    /* [v1.9] Client takes ownership of the transport */
+    const bool tls = mqtt_tls_uri_is_tls(broker_uri);
+    if (tls) {
+        mqtt_cfg.network.transport = mqtt_tls_transport_create();
+        if (mqtt_cfg.network.transport == NULL) {
+            ESP_LOGE(TAG, "TLS transport alloc failed");
+            return ESP_ERR_NO_MEM;
+        }
     }
 
-    s_ctx.client = esp_mqtt_client_init(&mqtt_cfg);
-    if (s_ctx.client == NULL) {
+    esp_mqtt_client_handle_t c = esp_mqtt_client_init(&mqtt_cfg);
+    if (c == NULL) {
         ESP_LOGE(TAG, "esp_mqtt_client_init failed");
+        if (mqtt_cfg.network.transport) esp_transport_destroy(mqtt_cfg.network.transport);
         return ESP_FAIL;
     }
 
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (s_ctx.v5 && s_ctx.persistent_session) {
+        esp_mqtt5_connection_property_config_t conn = {
+            .session_expiry_interval = CONFIG_MQTT5_SESSION_EXPIRY_S,
+        };
+        esp_mqtt5_client_set_connect_property(c, &conn);
+    }
+#endif
+
     esp_err_t ret = esp_mqtt_client_register_event(
-        s_ctx.client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+        c, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register MQTT events: %s", esp_err_to_name(ret));
-        esp_mqtt_client_destroy(s_ctx.client);
-        s_ctx.client = NULL;
+        esp_mqtt_client_destroy(c);
+        return ret;
+    }
+
+    keep_requeue(c);                                    /* [v1.12] */
+    s_ctx.tls      = tls;
+    s_ctx.started  = false;
+    s_ctx.recreate = false;
+    atomic_store(&s_ctx.client, c);                     /* visible last */
+    return ESP_OK;
+}
+
+esp_err_t mqtt_client_init(const char *broker_uri,
+                            const char *client_id,
+                            const char *lwt_topic,
+                            const char *lwt_message,
+                            int         lwt_qos,
+                            int         lwt_retain,
+                            bool        persistent_session,
+                            bool        mqtt5)
+{
+    if (atomic_load(&s_ctx.client) != NULL) {
+        ESP_LOGW(TAG, "Already initialised -- call deinit first");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* [v1.7] */
+#ifndef CONFIG_MQTT_PROTOCOL_5
+    if (mqtt5) {
+        ESP_LOGW(TAG, "MQTT 5 requested but CONFIG_MQTT_PROTOCOL_5 is off -- using 3.1.1");
+        mqtt5 = false;
+    }
+#endif
+
+    snprintf(s_ctx.client_id, sizeof(s_ctx.client_id), "%s", client_id ? client_id : "");
+    snprintf(s_ctx.lwt_topic, sizeof(s_ctx.lwt_topic), "%s", lwt_topic ? lwt_topic : "");
+    snprintf(s_ctx.lwt_message, sizeof(s_ctx.lwt_message), "%s", lwt_message ? lwt_message : "");
+    s_ctx.lwt_qos            = lwt_qos;
+    s_ctx.lwt_retain         = lwt_retain;
+    s_ctx.persistent_session = persistent_session;
+    s_ctx.v5                 = mqtt5;
+
+    if (s_ctx.lwt_topic[0] != '\0') {
+        ESP_LOGI(TAG, "LWT configured: topic=%s msg=%s qos=%d retain=%d",
+                 s_ctx.lwt_topic, s_ctx.lwt_message, lwt_qos, lwt_retain);
+    }
+
+    esp_err_t ret = client_create(broker_uri);
+    if (ret != ESP_OK) {
+        s_ctx.v5 = false;
         return ret;
     }
 
-    ESP_LOGI(TAG, "MQTT client initialised: broker=%s client_id=%s",
-             broker_uri, client_id);
+    ESP_LOGI(TAG, "MQTT client initialised: broker=%s client_id=%s session=%s proto=%s",
+             broker_uri, s_ctx.client_id, persistent_session ? "persistent" : "clean",
+             mqtt5 ? "5.0" : "3.1.1");
     return ESP_OK;
 }
 
+/* start / stop / set_uri / reconnect / disconnect / deinit: service task
+ * only, the one task that replaces the client -- plain loads suffice */
+
 esp_err_t mqtt_client_start(void)
 {
-    if (s_ctx.client == NULL) return ESP_ERR_INVALID_STATE;
-    return esp_mqtt_client_start(s_ctx.client);
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) return ESP_ERR_INVALID_STATE;
+    esp_err_t ret = esp_mqtt_client_start(c);
+    if (ret == ESP_OK) s_ctx.started = true;
+    return ret;
 }
 
 esp_err_t mqtt_client_stop(void)
 {
-    if (s_ctx.client == NULL) return ESP_ERR_INVALID_STATE;
-    return esp_mqtt_client_stop(s_ctx.client);
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) return ESP_ERR_INVALID_STATE;
+    return esp_mqtt_client_stop(c);
 }
 
-void mqtt_client_deinit(void)
+void mqtt_client_set_manual_reconnect(uint32_t connect_timeout_ms)
 {
-    if (s_ctx.client != NULL) {
-        esp_mqtt_client_destroy(s_ctx.client);
-        s_ctx.client = NULL;
+    s_ctx.connect_timeout_ms = connect_timeout_ms;
+}
+
+esp_err_t mqtt_client_set_uri(const char *uri)
+{
+    if (uri == NULL) return ESP_ERR_INVALID_ARG;
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) {
+        /* A failed re-create is retried; before init there is nothing to do */
+        return s_ctx.recreate ? client_create(uri) : ESP_ERR_INVALID_STATE;
+    }
+    if (mqtt_tls_uri_is_tls(uri) == s_ctx.tls) {
+        return esp_mqtt_client_set_uri(c, uri);
     }
+
+    /* [v1.11] Other scheme: the transport cannot be swapped -- new client
+     * [v1.12] once no other task is inside the old one */
+    ESP_LOGI(TAG, "Scheme change -- re-creating the client for %s", uri);
+    esp_mqtt_client_destroy(client_detach());
+    s_ctx.session_present = false;
+    s_ctx.raw_claimed     = false;
+    s_ctx.recreate        = true;
+    return client_create(uri);
+}
+
+esp_err_t mqtt_client_reconnect(void)
+{
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) return ESP_ERR_INVALID_STATE;
+    if (!s_ctx.started) return mqtt_client_start();     /* [v1.11] re-created */
+    return esp_mqtt_client_reconnect(c);
+}
+
+esp_err_t mqtt_client_disconnect(void)
+{
+    esp_mqtt_client_handle_t c = atomic_load(&s_ctx.client);
+    if (c == NULL) return ESP_ERR_INVALID_STATE;
+    return esp_mqtt_client_disconnect(c);
+}
+
+void mqtt_client_deinit(void)
+{
+    esp_mqtt_client_handle_t c = client_detach();       /* [v1.12] */
+    if (c != NULL) esp_mqtt_client_destroy(c);
+    keep_clear();
+    s_ctx.v5       = false;
+    s_ctx.started  = false;
+    s_ctx.recreate = false;
 }
 
 int mqtt_client_publish(const char *topic, const char *data,
                         size_t len, int qos, int retain)
 {
-    if (s_ctx.client == NULL) return -1;
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
     int payload_len = (len > 0) ? (int)len : (int)strlen(data);
-    return esp_mqtt_client_publish(s_ctx.client, topic, data,
-                                    payload_len, qos, retain);
+    int msg_id = esp_mqtt_client_publish(c, topic, data, payload_len, qos, retain);
+    if (qos > 0 && msg_id > 0) {                        /* [v1.12] */
+        keep_publish(msg_id, topic, data, (size_t)payload_len, qos, retain);
+    }
+    client_put();                   /* after keep: a re-create waits for it */
+    return msg_id;
+}
+
+int mqtt_client_publish_props(const char *topic, const char *data,
+                              size_t len, int qos, int retain,
+                              const mqtt_client_pub_props_t *props)
+{
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (!s_ctx.v5 || props == NULL) {
+        return mqtt_client_publish(topic, data, len, qos, retain);
+    }
+    /* Held over both calls: the property slot belongs to this client */
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
+
+    esp_mqtt5_publish_property_config_t prop = {
+        .topic_alias             = props->topic_alias,
+        .message_expiry_interval = props->message_expiry_s,
+    };
+    if (props->user_key != NULL && props->user_value != NULL) {
+        esp_mqtt5_user_property_item_t item = {
+            .key   = props->user_key,
+            .value = props->user_value,
+        };
+        esp_mqtt5_client_set_user_property(&prop.user_property, &item, 1);
+    }
+
+    int msg_id = -1;
+    if (esp_mqtt5_client_set_publish_property(c, &prop) == ESP_OK) {
+        msg_id = mqtt_client_publish(topic, data, len, qos, retain);
+    }
+    if (prop.user_property != NULL) {
+        esp_mqtt5_client_delete_user_property(prop.user_property);
+    }
+    client_put();
+    return msg_id;
+#else
+    return mqtt_client_publish(topic, data, len, qos, retain);
+#endif
+}
+
+bool mqtt_client_is_v5(void)
+{
+    return s_ctx.v5;
 }
 
 int mqtt_client_subscribe(const char *topic, int qos)
 {
-    if (s_ctx.client == NULL) return -1;
-    return esp_mqtt_client_subscribe(s_ctx.client, topic, qos);
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
+    int msg_id = esp_mqtt_client_subscribe(c, topic, qos);
+    client_put();
+    return msg_id;
+}
+
+int mqtt_client_subscribe_multiple(const char *const *topics, const int *qos,
+                                   int count)
+{
+    if (count <= 0 || count > APP_MQTT_SUBSCRIBE_MAX) return -1;
+    esp_mqtt_topic_t list[APP_MQTT_SUBSCRIBE_MAX];
+    for (int i = 0; i < count; i++) {
+        list[i].filter = topics[i];
+        list[i].qos    = qos[i];
+    }
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
+    int msg_id = esp_mqtt_client_subscribe_multiple(c, list, count);
+    client_put();
+    return msg_id;
 }
 
 int mqtt_client_unsubscribe(const char *topic)
 {
-    if (s_ctx.client == NULL) return -1;
-    return esp_mqtt_client_unsubscribe(s_ctx.client, topic);
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
+    int msg_id = esp_mqtt_client_unsubscribe(c, topic);
+    client_put();
+    return msg_id;
+}
+
+int mqtt_client_get_outbox_size(void)
+{
+    esp_mqtt_client_handle_t c = client_get();
+    if (c == NULL) return -1;
+    int size = esp_mqtt_client_get_outbox_size(c);
+    client_put();
+    return size;
+}
+
+
+bool mqtt_client_session_present(void)
+{
+    return s_ctx.session_present;
 }
 
 void mqtt_client_set_message_callback(mqtt_message_cb_t cb, void *ctx)
@@ -181,8 +658,27 @@ void mqtt_client_set_message_callback(mqtt_message_cb_t cb, void *ctx)
     s_ctx.message_ctx = ctx;
 }
 
+void mqtt_client_set_raw_callback(mqtt_raw_cb_t cb, void *ctx)
+{
+    s_ctx.raw_cb      = cb;
+    s_ctx.raw_ctx     = ctx;
+    s_ctx.raw_claimed = false;
+}
+
 void mqtt_client_set_connection_callback(mqtt_connection_cb_t cb, void *ctx)
 {
     s_ctx.connection_cb  = cb;
     s_ctx.connection_ctx = ctx;
 }
+
+void mqtt_client_set_published_callback(mqtt_published_cb_t cb, void *ctx)
+{
+    s_ctx.published_cb  = cb;
+    s_ctx.published_ctx = ctx;
+}
+
+void mqtt_client_set_subscribed_callback(mqtt_subscribed_cb_t cb, void *ctx)
+{
+    s_ctx.subscribed_cb  = cb;
+    s_ctx.subscribed_ctx = ctx;
+}
@@ -1,8 +1,67 @@
 /*
- * app_mqtt.h  (v1.3 -- LWT support)
+ * app_mqtt.h  (v1.12 -- client handle safe across a re-create)
  *
  * Thin wrapper around ESP-IDF's esp_mqtt_client.
  *
+ * CHANGE vs v1.11:
+ *  - Publish / subscribe / outbox calls may run on any task while the
+ *    service task re-creates the client: the re-create waits until none
+ *    of them is inside the old client.  Unacked QoS>0 publishes (the last
+ *    8) are moved to the new client's outbox instead of being lost.
+ *
+ * CHANGE vs v1.10:
+ *  - mqtt_client_set_uri() across schemes (mqtt:// <-> mqtts://) re-creates
+ *    the client, so failover lists may mix plain and TLS brokers.
+ *
+ * CHANGE vs v1.9:
+ *  - mqtt_client_set_raw_callback(): sees every PUBLISH first, unclipped
+ *    and binary-safe, one call per esp-mqtt fragment.  Returning true
+ *    claims the message (all its fragments); the text callback then never
+ *    sees it.
+ *
+ * CHANGE vs v1.8:
+ *  - mqtt_client_init() with an mqtts:// URI uses mqtt_tls' transport:
+ *    CA bundle / PEM and client certificate from Kconfig, TLS session
+ *    resumed on reconnect.  Failover lists may mix mqtt:// and mqtts://
+ *    brokers (v1.11).
+ *
+ * CHANGE vs v1.7:
+ *  - mqtt_client_set_manual_reconnect(): before init, turns off esp-mqtt's
+ *    own reconnect loop and bounds each connect attempt.  The caller then
+ *    drives reconnects with mqtt_client_reconnect(), optionally after
+ *    mqtt_client_set_uri() to switch brokers.
+ *  - mqtt_client_disconnect().
+ *
+ * CHANGE vs v1.6:
+ *  - mqtt_client_init() gains mqtt5: connect with protocol version 5
+ *    (needs CONFIG_MQTT_PROTOCOL_5 in the esp-mqtt component; ignored with
+ *    a warning otherwise).
+ *  - mqtt_client_publish_props(): publish with topic alias, message expiry
+ *    and one user property.  esp-mqtt keeps publish properties in a single
+ *    per-client slot consumed by the next publish, so the caller must be
+ *    the only task that publishes.
+ *  - mqtt_client_is_v5().
+ *
+ * CHANGE vs v1.5:
+ *  - mqtt_client_init() gains persistent_session: connects with
+ *    clean-session = 0 (session.disable_clean_session) so the broker keeps
+ *    subscriptions and queued QoS>0 messages across disconnects.  Requires
+ *    a client_id that is stable across reboots.
+ *  - mqtt_client_session_present(): CONNACK session-present flag of the
+ *    current connection, valid inside the connection callback.
+ *
+ * CHANGE vs v1.4:
+ *  - mqtt_client_subscribe_multiple(): several filters in one SUBSCRIBE
+ *    packet (esp_mqtt_client_subscribe_multiple).
+ *  - mqtt_client_set_subscribed_callback(): fired on MQTT_EVENT_SUBSCRIBED
+ *    with the SUBACK return codes, one per filter.
+ *
+ * CHANGE vs v1.3:
+ *  - mqtt_client_set_published_callback(): fired on MQTT_EVENT_PUBLISHED
+ *    (PUBACK/PUBCOMP received) with the msg_id returned by publish().
+ *  - mqtt_client_get_outbox_size(): bytes currently held in the esp-mqtt
+ *    outbox (unacked QoS>0 messages waiting for retransmit).
+ *
  * CHANGE vs v1.2:
  *  - mqtt_client_init() gains four LWT parameters:
  *      lwt_topic, lwt_message, lwt_qos, lwt_retain
@@ -16,6 +75,7 @@
 #include "esp_err.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,18 +90,44 @@ extern "C" {
  * @param lwt_message  Last-will payload string
  * @param lwt_qos      Last-will QoS (0, 1, or 2)
  * @param lwt_retain   1 = broker retains LWT message
+ * @param persistent_session  [v1.6] true = clean-session 0
+ * @param mqtt5        [v1.7] true = MQTT 5.0
  */
 esp_err_t mqtt_client_init(const char *broker_uri,
                             const char *client_id,
                             const char *lwt_topic,
                             const char *lwt_message,
                             int         lwt_qos,
-                            int         lwt_retain);
+                            int         lwt_retain,
+                            bool        persistent_session,
+                            bool        mqtt5);
 
 esp_err_t mqtt_client_start(void);
 esp_err_t mqtt_client_stop(void);
 void      mqtt_client_deinit(void);
 
+/**
+ * [v1.8] Call before mqtt_client_init().  connect_timeout_ms > 0 disables
+ * esp-mqtt's automatic reconnect and sets the network timeout, so a dead
+ * broker fails an attempt within that time; 0 restores the defaults.
+ */
+void      mqtt_client_set_manual_reconnect(uint32_t connect_timeout_ms);
+
+/** [v1.8] Broker URI for the next connect attempt.
+ *  [v1.11] A URI of the other scheme (mqtt:// vs mqtts://) re-creates the
+ *  client with the same settings.
+ *  [v1.12] Waits for calls of other tasks to leave the old client; its
+ *  unacked QoS>0 publishes are enqueued in the new one. */
+esp_err_t mqtt_client_set_uri(const char *uri);
+
+/** [v1.8] Start a connect attempt; fails unless the client is waiting to
+ *  reconnect (i.e. disconnected with manual reconnect enabled).
+ *  [v1.11] Starts a client re-created by mqtt_client_set_uri(). */
+esp_err_t mqtt_client_reconnect(void);
+
+/** [v1.8] Send DISCONNECT and drop the connection (no LWT). */
+esp_err_t mqtt_client_disconnect(void);
+
 /**
  * Publish a message.
  * @param len  Payload length in bytes; pass 0 to use strlen(data).
@@ -50,15 +136,72 @@ void      mqtt_client_deinit(void);
 int mqtt_client_publish(const char *topic, const char *data,
                         size_t len, int qos, int retain);
 
+/** [v1.7] MQTT 5 publish properties; zero / NULL fields are omitted */
+typedef struct {
+    uint16_t    topic_alias;        /* 0 = none; with alias, topic may be "" */
+    uint32_t    message_expiry_s;   /* 0 = never expires                    */
+    const char *user_key;           /* one user property, NULL = none       */
+    const char *user_value;
+} mqtt_client_pub_props_t;
+
+/**
+ * [v1.7] Publish with MQTT 5 properties.  Same as mqtt_client_publish()
+ * when the connection is not MQTT 5 or props is NULL.  Not thread-safe
+ * against other publishers -- see header notes.
+ */
+int mqtt_client_publish_props(const char *topic, const char *data,
+                              size_t len, int qos, int retain,
+                              const mqtt_client_pub_props_t *props);
+
+/** [v1.7] true if the client was initialised for MQTT 5. */
+bool mqtt_client_is_v5(void);
+
 int mqtt_client_subscribe(const char *topic, int qos);
+
+/**
+ * [v1.5] Subscribe to `count` filters with a single SUBSCRIBE packet.
+ * @return message ID >= 0 on success, -1 on failure.
+ */
+int mqtt_client_subscribe_multiple(const char *const *topics, const int *qos,
+                                   int count);
 int mqtt_client_unsubscribe(const char *topic);
 
+/**
+ * [v1.4] Bytes queued in the esp-mqtt outbox, or -1 if not initialised.
+ */
+int mqtt_client_get_outbox_size(void);
+
+/**
+ * [v1.6] true if the broker resumed an existing session on the current
+ * connection (CONNACK session-present = 1).  Always false with a clean
+ * session.
+ */
+bool mqtt_client_session_present(void);
+
 /** Callbacks registered by mqtt_service */
 typedef void (*mqtt_message_cb_t)(const char *topic, const char *data, void *ctx);
 typedef void (*mqtt_connection_cb_t)(bool connected, void *ctx);
+typedef void (*mqtt_published_cb_t)(int msg_id, void *ctx);      /* [v1.4] */
+/* [v1.5] codes: SUBACK return codes (n may be 0 if none were reported) */
+typedef void (*mqtt_subscribed_cb_t)(int msg_id, const uint8_t *codes, int n,
+                                     void *ctx);
+
+/*
+ * [v1.10] Raw payload callback.  Messages larger than esp-mqtt's receive
+ * buffer arrive in fragments: offset is the fragment's position in the
+ * payload, total the whole payload length.  topic is only valid (and
+ * the return value only used) on the first fragment, offset 0; later
+ * fragments of a claimed message get topic NULL.
+ */
+typedef bool (*mqtt_raw_cb_t)(const char *topic, int topic_len,
+                              const uint8_t *data, int len,
+                              int offset, int total, void *ctx);
 
 void mqtt_client_set_message_callback(mqtt_message_cb_t cb, void *ctx);
+void mqtt_client_set_raw_callback(mqtt_raw_cb_t cb, void *ctx);   /* [v1.10] */
 void mqtt_client_set_connection_callback(mqtt_connection_cb_t cb, void *ctx);
+void mqtt_client_set_published_callback(mqtt_published_cb_t cb, void *ctx);
+void mqtt_client_set_subscribed_callback(mqtt_subscribed_cb_t cb, void *ctx);
 
 #ifdef __cplusplus
 }
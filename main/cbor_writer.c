@@ -0,0 +1,200 @@
+/*
+ * cbor_writer.c - Minimal streaming CBOR (RFC 8949) encoder
+ *
+ * Every data item starts with an initial byte: major type in the top three
+ * bits, "additional information" in the low five.  Arguments < 24 fit in
+ * the initial byte; larger ones follow big-endian in 1, 2, 4 or 8 bytes.
+ */
+
+#include "cbor_writer.h"
+#include <string.h>
+
+#define MT_UINT     0
+#define MT_NINT     1
+#define MT_BYTES    2
+#define MT_TEXT     3
+#define MT_ARRAY    4
+#define MT_MAP      5
+#define MT_SIMPLE   7
+
+#define AI_INDEF    31
+#define SIMPLE_FALSE 0xF4
+#define SIMPLE_TRUE  0xF5
+#define SIMPLE_NULL  0xF6
+#define FLOAT16      0xF9
+#define FLOAT32      0xFA
+#define BREAK        0xFF
+
+/* -------------------------------------------------------------------------
+ * Low-level output
+ * ------------------------------------------------------------------------- */
+
+static bool reserve(cbor_writer_t *w, size_t n)
+{
+    if (w->overflow) return false;
+    if (w->cap - w->len < n) {
+        w->overflow = true;
+        return false;
+    }
+    return true;
+}
+
+static void put_byte(cbor_writer_t *w, uint8_t b)
+{
+    if (reserve(w, 1)) w->buf[w->len++] = b;
+}
+
+static void put_be(cbor_writer_t *w, uint64_t v, int nbytes)
+{
+    if (!reserve(w, (size_t)nbytes)) return;
+    for (int i = nbytes - 1; i >= 0; i--) {
+        w->buf[w->len++] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void put_head(cbor_writer_t *w, uint8_t major, uint64_t arg)
+{
+    uint8_t mt = (uint8_t)(major << 5);
+
+    if (arg < 24) {
+        put_byte(w, mt | (uint8_t)arg);
+    } else if (arg <= 0xFF) {
+        put_byte(w, mt | 24);
+        put_be(w, arg, 1);
+    } else if (arg <= 0xFFFF) {
+        put_byte(w, mt | 25);
+        put_be(w, arg, 2);
+    } else if (arg <= 0xFFFFFFFFULL) {
+        put_byte(w, mt | 26);
+        put_be(w, arg, 4);
+    } else {
+        put_byte(w, mt | 27);
+        put_be(w, arg, 8);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Float helpers
+ * ------------------------------------------------------------------------- */
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+/* Returns true and fills *half if f converts to binary16 without loss. */
+static bool float_to_half_exact(float f, uint16_t *half)
+{
+    uint32_t u    = float_bits(f);
+    uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+    int32_t  exp  = (int32_t)((u >> 23) & 0xFF);
+    uint32_t man  = u & 0x7FFFFF;
+
+    if (exp == 0 && man == 0) {                 /* +/- zero */
+        *half = sign;
+        return true;
+    }
+    if (exp == 0xFF) {                          /* inf / NaN */
+        if (man != 0 && (man & 0x1FFF) != 0) return false;
+        *half = (uint16_t)(sign | 0x7C00 | (man >> 13));
+        return true;
+    }
+
+    int32_t e = exp - 127 + 15;
+    if (e >= 31) return false;                  /* too large for half */
+
+    if (e >= 1) {                               /* normal half */
+        if (man & 0x1FFF) return false;         /* low 13 bits would be lost */
+        *half = (uint16_t)(sign | (uint16_t)(e << 10) | (uint16_t)(man >> 13));
+        return true;
+    }
+
+    /* Subnormal half: shift the implicit leading 1 into the mantissa */
+    int32_t shift = 14 - e;                     /* 13 + (1 - e) */
+    if (shift > 24) return false;
+    uint32_t full = man | 0x800000;
+    if (full & ((1u << shift) - 1)) return false;
+    *half = (uint16_t)(sign | (uint16_t)(full >> shift));
+    return true;
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap)
+{
+    w->buf      = buf;
+    w->cap      = (buf != NULL) ? cap : 0;
+    w->len      = 0;
+    w->overflow = false;
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t v)
+{
+    put_head(w, MT_UINT, v);
+}
+
+void cbor_put_int(cbor_writer_t *w, int64_t v)
+{
+    if (v >= 0) {
+        put_head(w, MT_UINT, (uint64_t)v);
+    } else {
+        /* CBOR negative integers encode -1 - n */
+        put_head(w, MT_NINT, (uint64_t)(-1 - v));
+    }
+}
+
+void cbor_put_bool(cbor_writer_t *w, bool v)
+{
+    put_byte(w, v ? SIMPLE_TRUE : SIMPLE_FALSE);
+}
+
+void cbor_put_null(cbor_writer_t *w)
+{
+    put_byte(w, SIMPLE_NULL);
+}
+
+void cbor_put_float(cbor_writer_t *w, float v)
+{
+    uint16_t half;
+    if (float_to_half_exact(v, &half)) {
+        put_byte(w, FLOAT16);
+        put_be(w, half, 2);
+    } else {
+        put_byte(w, FLOAT32);
+        put_be(w, float_bits(v), 4);
+    }
+}
+
+void cbor_put_text_n(cbor_writer_t *w, const char *s, size_t n)
+{
+    put_head(w, MT_TEXT, n);
+    if (n > 0 && reserve(w, n)) {
+        memcpy(&w->buf[w->len], s, n);
+        w->len += n;
+    }
+}
+
+void cbor_put_text(cbor_writer_t *w, const char *s)
+{
+    cbor_put_text_n(w, s ? s : "", s ? strlen(s) : 0);
+}
+
+void cbor_put_bytes(cbor_writer_t *w, const void *data, size_t n)
+{
+    put_head(w, MT_BYTES, n);
+    if (n > 0 && reserve(w, n)) {
+        memcpy(&w->buf[w->len], data, n);
+        w->len += n;
+    }
+}
+
+void cbor_begin_array(cbor_writer_t *w, size_t n) { put_head(w, MT_ARRAY, n); }
+void cbor_begin_map(cbor_writer_t *w, size_t n)   { put_head(w, MT_MAP, n);   }
+
+void cbor_begin_array_indef(cbor_writer_t *w) { put_byte(w, (MT_ARRAY << 5) | AI_INDEF); }
+void cbor_begin_map_indef(cbor_writer_t *w)   { put_byte(w, (MT_MAP << 5) | AI_INDEF);   }
+void cbor_end(cbor_writer_t *w)               { put_byte(w, BREAK); }
@@ -0,0 +1,86 @@
+/*
+ * cbor_writer.h - Minimal streaming CBOR (RFC 8949) encoder
+ *
+ * Writes directly into a caller-supplied buffer -- no heap, no recursion,
+ * no intermediate tree.  Only the subset needed for telemetry is provided:
+ * unsigned/negative integers, text/byte strings, bool/null, floats, and
+ * definite or indefinite-length arrays and maps.
+ *
+ * Overflow handling: once a write would exceed the buffer, the writer is
+ * latched into the overflow state and every further call is a no-op.
+ * Check cbor_writer_ok() once after encoding instead of after every call.
+ *
+ * Usage:
+ *   uint8_t buf[64];
+ *   cbor_writer_t w;
+ *   cbor_writer_init(&w, buf, sizeof(buf));
+ *   cbor_begin_map(&w, 2);
+ *   cbor_put_text(&w, "uptime_s"); cbor_put_uint(&w, 3742);
+ *   cbor_put_text(&w, "t");        cbor_put_float(&w, 21.5f);
+ *   if (cbor_writer_ok(&w)) publish(buf, cbor_writer_len(&w));
+ */
+
+#ifndef CBOR_WRITER_H
+#define CBOR_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   len;
+    bool     overflow;
+} cbor_writer_t;
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap);
+
+static inline bool   cbor_writer_ok(const cbor_writer_t *w)  { return !w->overflow; }
+static inline size_t cbor_writer_len(const cbor_writer_t *w) { return w->len; }
+
+/* Checkpoint: drop everything written after `len` and clear the overflow
+ * latch.  Take the checkpoint with cbor_writer_len(). */
+static inline void cbor_writer_rewind(cbor_writer_t *w, size_t len)
+{
+    if (len <= w->cap) {
+        w->len      = len;
+        w->overflow = false;
+    }
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint64_t v);
+void cbor_put_int(cbor_writer_t *w, int64_t v);
+void cbor_put_bool(cbor_writer_t *w, bool v);
+void cbor_put_null(cbor_writer_t *w);
+
+/**
+ * Shortest lossless float: half precision (3 bytes) when the value survives
+ * the round trip -- true for every DS18B20 reading, which is a multiple of
+ * 1/16 degC -- otherwise single precision (5 bytes).
+ */
+void cbor_put_float(cbor_writer_t *w, float v);
+
+void cbor_put_text(cbor_writer_t *w, const char *s);
+void cbor_put_text_n(cbor_writer_t *w, const char *s, size_t n);
+void cbor_put_bytes(cbor_writer_t *w, const void *data, size_t n);
+
+/* Definite-length containers: caller states the element count up front.
+ * For maps, n is the number of key/value PAIRS. */
+void cbor_begin_array(cbor_writer_t *w, size_t n);
+void cbor_begin_map(cbor_writer_t *w, size_t n);
+
+/* Indefinite-length containers, closed with cbor_end(). */
+void cbor_begin_array_indef(cbor_writer_t *w);
+void cbor_begin_map_indef(cbor_writer_t *w);
+void cbor_end(cbor_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CBOR_WRITER_H */
@@ -0,0 +1,630 @@
+/*
+ * config_store.c - Versioned runtime configuration, NVS-backed
+ *
+ * NVS layout: one blob "cfg" in namespace "appcfg" holding stored_cfg_t.
+ * nvs_set_blob() writes the new entry before erasing the old one, so a
+ * power cut during an update leaves either the old or the new blob.
+ *
+ * Migration: a blob is never thrown away whole -- after an OTA a node that
+ * lost its remotely set broker could not reach the broker that confirms
+ * the image.  Same schema: the stored prefix of app_config_t is kept (see
+ * CONFIG_STORE_SCHEMA).  Older schemas: every field their layout had is
+ * moved to its current offset (k_legacy); the rest takes the defaults.  If the result does not validate, only the broker fields
+ * are kept.  The blob is rewritten at the next config_store_set().
+ *
+ * Writers (config_store_set) are serialised with an atomic flag; updates
+ * are rare (boot, remote config), so a contending writer just sleeps a
+ * tick and retries.
+ */
+
+#include "config_store.h"
+#include "json_writer.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "config-store";
+
+#define NVS_NAMESPACE   "appcfg"
+#define NVS_KEY         "cfg"
+
+/* Defaults -- same fallbacks as the services that used to own them */
+#ifndef CONFIG_MQTT_BROKER_URI
+#define CONFIG_MQTT_BROKER_URI          "mqtt://192.168.1.1"
+#endif
+#ifndef CONFIG_MQTT_BROKER_BACKUP_URIS
+#define CONFIG_MQTT_BROKER_BACKUP_URIS  ""
+#endif
+#ifndef CONFIG_MQTT_HEALTH_INTERVAL_MS
+#define CONFIG_MQTT_HEALTH_INTERVAL_MS  30000
+#endif
+#ifndef CONFIG_DS18B20_PERIOD_MS
+#define CONFIG_DS18B20_PERIOD_MS        30000
+#endif
+#ifndef CONFIG_DS18B20_RESOLUTION
+#define CONFIG_DS18B20_RESOLUTION       12
+#endif
+#ifndef CONFIG_DS18B20_FILTER_SLEW
+#define CONFIG_DS18B20_FILTER_SLEW      500
+#endif
+#ifndef CONFIG_DS18B20_FILTER_EMA
+#define CONFIG_DS18B20_FILTER_EMA       100
+#endif
+#ifdef CONFIG_DS18B20_FILTER_MEDIAN
+#define FILTER_MEDIAN_DEFAULT           true
+#else
+#define FILTER_MEDIAN_DEFAULT           false
+#endif
+#ifndef CONFIG_DS18B20_REPORT_DEADBAND
+#define CONFIG_DS18B20_REPORT_DEADBAND  10
+#endif
+#ifndef CONFIG_DS18B20_REPORT_MIN_MS
+#define CONFIG_DS18B20_REPORT_MIN_MS    0
+#endif
+#ifndef CONFIG_DS18B20_REPORT_MAX_S
+#define CONFIG_DS18B20_REPORT_MAX_S     600
+#endif
+#ifndef CONFIG_OLED_CONTRAST
+#define CONFIG_OLED_CONTRAST            127
+#endif
+
+#define HEALTH_MS_MIN       1000
+#define SENSOR_MS_MIN       100
+#define SENSOR_MS_MAX       3600000
+#define FILTER_SLEW_MAX     10000       /* 100 degC/s */
+#define REPORT_DB_MAX       10000       /* 100 degC */
+#define REPORT_MIN_MS_MAX   3600000
+#define REPORT_MAX_S_MAX    86400
+
+typedef struct {
+    uint16_t     schema;
+    uint16_t     size;
+    uint32_t     gen;
+    app_config_t cfg;
+} stored_cfg_t;
+
+#define STORED_HDR      offsetof(stored_cfg_t, cfg)
+
+/* app_config_t as older schemas stored it: 2 added sensor_bits, 3 the
+ * report_* fields, 4 the filter_* fields, each before the display ones */
+typedef struct {
+    char     broker_uri[128];
+    char     broker_backups[192];
+    uint32_t health_interval_ms;
+    uint32_t sensor_period_ms;
+    uint8_t  display_contrast;
+    bool     display_clear_offline;
+} cfg_v1_t;
+
+typedef struct {
+    char     broker_uri[128];
+    char     broker_backups[192];
+    uint32_t health_interval_ms;
+    uint32_t sensor_period_ms;
+    char     sensor_bits[96];
+    uint8_t  display_contrast;
+    bool     display_clear_offline;
+} cfg_v2_t;
+
+typedef struct {
+    char     broker_uri[128];
+    char     broker_backups[192];
+    uint32_t health_interval_ms;
+    uint32_t sensor_period_ms;
+    char     sensor_bits[96];
+    uint16_t report_deadband;
+    uint32_t report_min_ms;
+    uint32_t report_max_s;
+    uint8_t  display_contrast;
+    bool     display_clear_offline;
+} cfg_v3_t;
+
+/* Where each field of an old layout lives in today's */
+typedef struct {
+    uint16_t from, to, len;
+} field_map_t;
+
+#define FIELD(t, f) { offsetof(t, f), offsetof(app_config_t, f), \
+                      sizeof(((app_config_t *)0)->f) }
+
+static const field_map_t k_v1[] = {
+    FIELD(cfg_v1_t, broker_uri),        FIELD(cfg_v1_t, broker_backups),
+    FIELD(cfg_v1_t, health_interval_ms), FIELD(cfg_v1_t, sensor_period_ms),
+    FIELD(cfg_v1_t, display_contrast),  FIELD(cfg_v1_t, display_clear_offline),
+};
+static const field_map_t k_v2[] = {
+    FIELD(cfg_v2_t, broker_uri),        FIELD(cfg_v2_t, broker_backups),
+    FIELD(cfg_v2_t, health_interval_ms), FIELD(cfg_v2_t, sensor_period_ms),
+    FIELD(cfg_v2_t, sensor_bits),
+    FIELD(cfg_v2_t, display_contrast),  FIELD(cfg_v2_t, display_clear_offline),
+};
+static const field_map_t k_v3[] = {
+    FIELD(cfg_v3_t, broker_uri),        FIELD(cfg_v3_t, broker_backups),
+    FIELD(cfg_v3_t, health_interval_ms), FIELD(cfg_v3_t, sensor_period_ms),
+    FIELD(cfg_v3_t, sensor_bits),
+    FIELD(cfg_v3_t, report_deadband),   FIELD(cfg_v3_t, report_min_ms),
+    FIELD(cfg_v3_t, report_max_s),
+    FIELD(cfg_v3_t, display_contrast),  FIELD(cfg_v3_t, display_clear_offline),
+};
+
+static const struct {
+    const field_map_t *map;
+    int                n;
+} k_legacy[CONFIG_STORE_SCHEMA] = {
+    [1] = { k_v1, sizeof(k_v1) / sizeof(k_v1[0]) },
+    [2] = { k_v2, sizeof(k_v2) / sizeof(k_v2[0]) },
+    [3] = { k_v3, sizeof(k_v3) / sizeof(k_v3[0]) },
+};
+
+typedef struct {
+    const char        *name;
+    config_listener_t  fn;
+    void              *ctx;
+    atomic_bool        ready;
+} listener_slot_t;
+
+static app_config_t    s_cfg;
+static atomic_uint     s_seq;           /* odd while s_cfg is written */
+static atomic_uint     s_gen;
+static atomic_flag     s_writer = ATOMIC_FLAG_INIT;
+
+static listener_slot_t s_listeners[CONFIG_STORE_LISTENERS_MAX];
+static atomic_int      s_reserved;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static void set_defaults(app_config_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    strncpy(c->broker_uri, CONFIG_MQTT_BROKER_URI, sizeof(c->broker_uri) - 1);
+    strncpy(c->broker_backups, CONFIG_MQTT_BROKER_BACKUP_URIS,
+            sizeof(c->broker_backups) - 1);
+    c->health_interval_ms    = CONFIG_MQTT_HEALTH_INTERVAL_MS;
+    c->sensor_period_ms      = CONFIG_DS18B20_PERIOD_MS;
+    snprintf(c->sensor_bits, sizeof(c->sensor_bits), "%d", CONFIG_DS18B20_RESOLUTION);
+    c->filter_slew           = CONFIG_DS18B20_FILTER_SLEW;
+    c->filter_ema            = CONFIG_DS18B20_FILTER_EMA;
+    c->filter_median         = FILTER_MEDIAN_DEFAULT;
+    c->report_deadband       = CONFIG_DS18B20_REPORT_DEADBAND;
+    c->report_min_ms         = CONFIG_DS18B20_REPORT_MIN_MS;
+    c->report_max_s          = CONFIG_DS18B20_REPORT_MAX_S;
+    c->display_contrast      = CONFIG_OLED_CONTRAST;
+    c->display_clear_offline = true;
+}
+
+/* "12" or "9,D506473B2D600028:12,..." -- bits 9..12, ROM 16 hex digits */
+static bool sensor_bits_valid(const char *s)
+{
+    while (*s) {
+        const char *colon = strchr(s, ':');
+        const char *comma = strchr(s, ',');
+        if (colon != NULL && (comma == NULL || colon < comma)) {
+            if (colon - s != 16) return false;
+            for (const char *h = s; h < colon; h++) {
+                if (!isxdigit((unsigned char)*h)) return false;
+            }
+            s = colon + 1;
+        }
+        if (s[0] != '9' && !(s[0] == '1' && s[1] >= '0' && s[1] <= '2')) return false;
+        s += (s[0] == '9') ? 1 : 2;
+        if (*s == ',') s++;
+        else if (*s != '\0') return false;
+    }
+    return true;
+}
+
+static const char *validate(const app_config_t *c)
+{
+    /* Terminators first: every string check below relies on them */
+    if (memchr(c->broker_uri, '\0', sizeof(c->broker_uri)) == NULL ||
+        memchr(c->broker_backups, '\0', sizeof(c->broker_backups)) == NULL ||
+        memchr(c->sensor_bits, '\0', sizeof(c->sensor_bits)) == NULL) {
+        return "too long";
+    }
+    if (strstr(c->broker_uri, "://") == NULL)         return "bad broker";
+    if (c->health_interval_ms != 0 && c->health_interval_ms < HEALTH_MS_MIN) {
+        return "health_ms";
+    }
+    if (c->sensor_period_ms < SENSOR_MS_MIN || c->sensor_period_ms > SENSOR_MS_MAX) {
+        return "sensor_ms";
+    }
+    if (!sensor_bits_valid(c->sensor_bits)) return "sensor_bits";
+    if (c->filter_slew > FILTER_SLEW_MAX)             return "filter_slew";
+    if (c->filter_ema < 1 || c->filter_ema > 100)     return "filter_ema";
+    if (c->report_deadband > REPORT_DB_MAX)           return "report_db";
+    if (c->report_min_ms > REPORT_MIN_MS_MAX)         return "report_min_ms";
+    if (c->report_max_s > REPORT_MAX_S_MAX ||
+        (c->report_max_s != 0 && c->report_max_s * 1000u < c->report_min_ms)) {
+        return "report_max_s";
+    }
+    return NULL;
+}
+
+static uint32_t diff(const app_config_t *a, const app_config_t *b)
+{
+    uint32_t m = 0;
+    if (strcmp(a->broker_uri, b->broker_uri) != 0 ||
+        strcmp(a->broker_backups, b->broker_backups) != 0) {
+        m |= CONFIG_CHANGED_BROKERS;
+    }
+    if (a->health_interval_ms != b->health_interval_ms) m |= CONFIG_CHANGED_HEALTH;
+    if (a->sensor_period_ms   != b->sensor_period_ms ||
+        strcmp(a->sensor_bits, b->sensor_bits) != 0 ||
+        a->filter_slew        != b->filter_slew ||
+        a->filter_ema         != b->filter_ema ||
+        a->filter_median      != b->filter_median ||
+        a->report_deadband    != b->report_deadband ||
+        a->report_min_ms      != b->report_min_ms ||
+        a->report_max_s       != b->report_max_s) {
+        m |= CONFIG_CHANGED_SENSOR;
+    }
+    if (a->display_contrast      != b->display_contrast ||
+        a->display_clear_offline != b->display_clear_offline) {
+        m |= CONFIG_CHANGED_DISPLAY;
+    }
+    return m;
+}
+
+static void publish_ram(const app_config_t *c)
+{
+    atomic_fetch_add(&s_seq, 1);
+    memcpy(&s_cfg, c, sizeof(s_cfg));
+    atomic_fetch_add(&s_seq, 1);
+}
+
+static esp_err_t persist(const app_config_t *c, uint32_t gen)
+{
+    stored_cfg_t blob = {
+        .schema = CONFIG_STORE_SCHEMA,
+        .size   = sizeof(app_config_t),
+        .gen    = gen,
+        .cfg    = *c,
+    };
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(h, NVS_KEY, &blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err;
+}
+
+static void notify(const app_config_t *c, uint32_t changed)
+{
+    int n = atomic_load(&s_reserved);
+    if (n > CONFIG_STORE_LISTENERS_MAX) n = CONFIG_STORE_LISTENERS_MAX;
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_listeners[i].ready)) {
+            s_listeners[i].fn(c, changed, s_listeners[i].ctx);
+        }
+    }
+}
+
+static bool parse_u32(const char *v, size_t n, uint32_t max, uint32_t *out)
+{
+    char buf[12];
+    if (n == 0 || n >= sizeof(buf)) return false;
+    memcpy(buf, v, n);
+    buf[n] = '\0';
+
+    char *end;
+    unsigned long x = strtoul(buf, &end, 10);
+    if (*end != '\0' || x > max) return false;
+    *out = (uint32_t)x;
+    return true;
+}
+
+static bool copy_str(char *dst, size_t size, const char *v, size_t n)
+{
+    if (n >= size) return false;
+    memcpy(dst, v, n);
+    dst[n] = '\0';
+    return true;
+}
+
+/* One "key=value" entry in [p, end) applied to *c */
+static const char *apply_one(app_config_t *c, const char *p, const char *end)
+{
+    const char *eq = memchr(p, '=', (size_t)(end - p));
+    if (eq == NULL) return "missing '='";
+
+    size_t      klen = (size_t)(eq - p);
+    const char *v    = eq + 1;
+    size_t      vlen = (size_t)(end - v);
+    uint32_t    x;
+
+#define KEY_IS(k)   (klen == strlen(k) && memcmp(p, k, klen) == 0)
+    if (KEY_IS("broker")) {
+        return copy_str(c->broker_uri, sizeof(c->broker_uri), v, vlen) ? NULL : "broker";
+    }
+    if (KEY_IS("backups")) {
+        return copy_str(c->broker_backups, sizeof(c->broker_backups), v, vlen) ? NULL : "backups";
+    }
+    if (KEY_IS("health_ms")) {
+        if (!parse_u32(v, vlen, UINT32_MAX, &x)) return "health_ms";
+        c->health_interval_ms = x;
+        return NULL;
+    }
+    if (KEY_IS("sensor_ms")) {
+        if (!parse_u32(v, vlen, UINT32_MAX, &x)) return "sensor_ms";
+        c->sensor_period_ms = x;
+        return NULL;
+    }
+    if (KEY_IS("sensor_bits")) {
+        return copy_str(c->sensor_bits, sizeof(c->sensor_bits), v, vlen) ? NULL : "sensor_bits";
+    }
+    if (KEY_IS("filter_slew")) {
+        if (!parse_u32(v, vlen, FILTER_SLEW_MAX, &x)) return "filter_slew";
+        c->filter_slew = (uint16_t)x;
+        return NULL;
+    }
+    if (KEY_IS("filter_ema")) {
+        if (!parse_u32(v, vlen, 100, &x)) return "filter_ema";
+        c->filter_ema = (uint8_t)x;
+        return NULL;
+    }
+    if (KEY_IS("filter_median")) {
+        if (!parse_u32(v, vlen, 1, &x)) return "filter_median";
+        c->filter_median = (x != 0);
+        return NULL;
+    }
+    if (KEY_IS("report_db")) {
+        if (!parse_u32(v, vlen, REPORT_DB_MAX, &x)) return "report_db";
+        c->report_deadband = (uint16_t)x;
+        return NULL;
+    }
+    if (KEY_IS("report_min_ms")) {
+        if (!parse_u32(v, vlen, UINT32_MAX, &x)) return "report_min_ms";
+        c->report_min_ms = x;
+        return NULL;
+    }
+    if (KEY_IS("report_max_s")) {
+        if (!parse_u32(v, vlen, UINT32_MAX, &x)) return "report_max_s";
+        c->report_max_s = x;
+        return NULL;
+    }
+    if (KEY_IS("contrast")) {
+        if (!parse_u32(v, vlen, 255, &x)) return "contrast";
+        c->display_contrast = (uint8_t)x;
+        return NULL;
+    }
+    if (KEY_IS("clear_offline")) {
+        if (!parse_u32(v, vlen, 1, &x)) return "clear_offline";
+        c->display_clear_offline = (x != 0);
+        return NULL;
+    }
+#undef KEY_IS
+    return "unknown key";
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+/* Blob body (`avail` bytes) into `m`, which holds the defaults.  Same
+ * schema: the stored prefix; older: every field it has, moved to today's
+ * offset.  @return bytes taken from the blob, 0 = schema unknown */
+static size_t migrate(const stored_cfg_t *hdr, const uint8_t *body, size_t avail,
+                      app_config_t *m)
+{
+    if (hdr->schema == CONFIG_STORE_SCHEMA) {
+        size_t keep = hdr->size;
+        if (keep > avail) keep = avail;
+        if (keep > sizeof(*m)) keep = sizeof(*m);
+        memcpy(m, body, keep);
+        return keep;
+    }
+    if (hdr->schema == 0 || hdr->schema > CONFIG_STORE_SCHEMA) return 0;
+
+    size_t keep = 0;
+    for (int i = 0; i < k_legacy[hdr->schema].n; i++) {
+        const field_map_t *f = &k_legacy[hdr->schema].map[i];
+        if (f->from + f->len > avail) break;
+        memcpy((uint8_t *)m + f->to, body + f->from, f->len);
+        keep = f->from + f->len;
+    }
+    return keep;
+}
+
+esp_err_t config_store_init(void)
+{
+    app_config_t c;
+    set_defaults(&c);
+    uint32_t gen = 0;
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &h);
+    if (err == ESP_OK) {
+        uint8_t *raw = NULL;
+        size_t len = 0;
+        err = nvs_get_blob(h, NVS_KEY, NULL, &len);
+        if (err == ESP_OK && len > STORED_HDR) {
+            raw = malloc(len);
+            err = raw ? nvs_get_blob(h, NVS_KEY, raw, &len) : ESP_ERR_NO_MEM;
+        }
+        nvs_close(h);
+
+        if (err == ESP_OK && raw != NULL) {
+            stored_cfg_t hdr;
+            memcpy(&hdr, raw, STORED_HDR);
+            app_config_t m = c;
+            size_t keep = migrate(&hdr, raw + STORED_HDR, len - STORED_HDR, &m);
+            if (keep == 0) {
+                ESP_LOGW(TAG, "Stored config schema %u unknown -- using defaults",
+                         (unsigned)hdr.schema);
+            } else if (validate(&m) == NULL) {
+                c = m;
+            } else {
+                /* Keep what reaches the broker; it can fix the rest */
+                memcpy(c.broker_uri, m.broker_uri, sizeof(c.broker_uri));
+                memcpy(c.broker_backups, m.broker_backups, sizeof(c.broker_backups));
+                if (validate(&c) != NULL) set_defaults(&c);
+                ESP_LOGW(TAG, "Stored config invalid -- kept the broker list only");
+            }
+            if (keep != 0) {
+                gen = hdr.gen;
+                if (hdr.schema != CONFIG_STORE_SCHEMA || keep != sizeof(app_config_t)) {
+                    ESP_LOGW(TAG, "Stored config schema %u, %u B -- migrated, "
+                             "new fields at defaults", (unsigned)hdr.schema,
+                             (unsigned)keep);
+                }
+            }
+        }
+        free(raw);
+    }
+
+    publish_ram(&c);
+    atomic_store(&s_gen, gen);
+    ESP_LOGI(TAG, "Config gen %u: broker=%s health=%u ms sensor=%u ms",
+             (unsigned)gen, c.broker_uri, (unsigned)c.health_interval_ms,
+             (unsigned)c.sensor_period_ms);
+    return ESP_OK;
+}
+
+void config_store_get(app_config_t *out)
+{
+    for (;;) {
+        unsigned seq = atomic_load(&s_seq);
+        if (seq & 1) {
+            vTaskDelay(1);              /* writer mid-copy */
+            continue;
+        }
+        memcpy(out, &s_cfg, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load(&s_seq) == seq) return;
+    }
+}
+
+uint32_t config_store_generation(void)
+{
+    return atomic_load(&s_gen);
+}
+
+esp_err_t config_store_set(const app_config_t *cfg)
+{
+    if (cfg == NULL) return ESP_ERR_INVALID_ARG;
+    const char *why = validate(cfg);
+    if (why != NULL) {
+        ESP_LOGW(TAG, "Rejected config: %s", why);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    while (atomic_flag_test_and_set(&s_writer)) vTaskDelay(1);
+
+    app_config_t cur;
+    config_store_get(&cur);
+    uint32_t changed = diff(&cur, cfg);
+    if (changed == 0) {
+        atomic_flag_clear(&s_writer);
+        return ESP_OK;
+    }
+
+    uint32_t  gen = atomic_load(&s_gen) + 1;
+    esp_err_t err = persist(cfg, gen);
+    if (err != ESP_OK) {
+        atomic_flag_clear(&s_writer);
+        ESP_LOGE(TAG, "NVS write failed (%s) -- config unchanged", esp_err_to_name(err));
+        return err;
+    }
+    publish_ram(cfg);
+    atomic_store(&s_gen, gen);
+
+    app_config_t snap = *cfg;
+    atomic_flag_clear(&s_writer);
+
+    ESP_LOGI(TAG, "Config gen %u committed (changed 0x%x)", (unsigned)gen,
+             (unsigned)changed);
+    notify(&snap, changed);
+    return ESP_OK;
+}
+
+esp_err_t config_store_apply_text(const char *spec, const char **err,
+                                  uint32_t *changed)
+{
+    const char *dummy;
+    if (err == NULL) err = &dummy;
+    *err = NULL;
+    if (changed) *changed = 0;
+    if (spec == NULL) return ESP_ERR_INVALID_ARG;
+
+    app_config_t cur, next;
+    config_store_get(&cur);
+    next = cur;
+
+    const char *p = spec;
+    while (*p) {
+        while (*p == ';' || *p == ' ' || *p == '\n') p++;
+        if (*p == '\0') break;
+
+        const char *end = p;
+        while (*end && *end != ';' && *end != '\n') end++;
+        if ((*err = apply_one(&next, p, end)) != NULL) return ESP_ERR_INVALID_ARG;
+        p = end;
+    }
+
+    if ((*err = validate(&next)) != NULL) return ESP_ERR_INVALID_ARG;
+    if (changed) *changed = diff(&cur, &next);
+    return config_store_set(&next);
+}
+
+esp_err_t config_store_subscribe(const char *name, config_listener_t fn,
+                                 void *ctx)
+{
+    if (name == NULL || fn == NULL) return ESP_ERR_INVALID_ARG;
+
+    int n = atomic_load(&s_reserved);
+    if (n > CONFIG_STORE_LISTENERS_MAX) n = CONFIG_STORE_LISTENERS_MAX;
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_listeners[i].ready) &&
+            strcmp(s_listeners[i].name, name) == 0) {
+            return ESP_OK;
+        }
+    }
+
+    int idx = atomic_fetch_add(&s_reserved, 1);
+    if (idx >= CONFIG_STORE_LISTENERS_MAX) {
+        ESP_LOGE(TAG, "Listener table full -- '%s' not registered", name);
+        return ESP_ERR_NO_MEM;
+    }
+    s_listeners[idx].name = name;
+    s_listeners[idx].fn   = fn;
+    s_listeners[idx].ctx  = ctx;
+    atomic_store(&s_listeners[idx].ready, true);
+    return ESP_OK;
+}
+
+size_t config_store_write_json(char *buf, size_t size)
+{
+    app_config_t c;
+    config_store_get(&c);
+
+    json_writer_t w;
+    json_writer_init(&w, buf, size);
+    json_begin_object(&w);
+    json_key(&w, "gen");           json_put_uint(&w, config_store_generation());
+    json_key(&w, "broker");        json_put_str(&w, c.broker_uri);
+    json_key(&w, "backups");       json_put_str(&w, c.broker_backups);
+    json_key(&w, "health_ms");     json_put_uint(&w, c.health_interval_ms);
+    json_key(&w, "sensor_ms");     json_put_uint(&w, c.sensor_period_ms);
+    json_key(&w, "sensor_bits");   json_put_str(&w, c.sensor_bits);
+    json_key(&w, "filter_slew");   json_put_uint(&w, c.filter_slew);
+    json_key(&w, "filter_ema");    json_put_uint(&w, c.filter_ema);
+    json_key(&w, "filter_median"); json_put_bool(&w, c.filter_median);
+    json_key(&w, "report_db");     json_put_uint(&w, c.report_deadband);
+    json_key(&w, "report_min_ms"); json_put_uint(&w, c.report_min_ms);
+    json_key(&w, "report_max_s");  json_put_uint(&w, c.report_max_s);
+    json_key(&w, "contrast");      json_put_uint(&w, c.display_contrast);
+    json_key(&w, "clear_offline"); json_put_bool(&w, c.display_clear_offline);
+    json_end_object(&w);
+    return json_writer_ok(&w) ? json_writer_len(&w) : 0;
+}
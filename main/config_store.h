@@ -0,0 +1,146 @@
+/*
+ * config_store.h - Versioned runtime configuration, NVS-backed
+ *
+ * The settings that can change without a reboot live here: broker list,
+ * health interval, sensor period, resolution, filtering and reporting, and
+ * display behaviour.  Defaults come from sdkconfig; changes are persisted
+ * in NVS (namespace "appcfg") and survive reboots.
+ *
+ * Update semantics:
+ *   config_store_set() validates the whole new config, writes it to NVS
+ *   and only then swaps it in -- a rejected or unpersistable update leaves
+ *   the running config untouched.  Every committed change bumps the
+ *   generation number.
+ *
+ *   Readers take a snapshot with config_store_get() and never block on a
+ *   writer: the RAM copy is guarded by a sequence counter (odd while being
+ *   written) and a reader that raced a swap simply copies again, so it
+ *   always sees one complete generation, old or new.
+ *
+ * Change notifications: services register a listener; after each commit
+ * every listener is called with the new config and a mask of the changed
+ * groups.  Listeners run on the writer's task and must not block -- post
+ * to the service's own queue or set a flag, like the health providers.
+ *
+ * Remote updates: mqtt_service feeds payloads from /<MACID>/config to
+ * config_store_apply_text():
+ *   "health_ms=10000;sensor_ms=5000"
+ *   "broker=mqtts://10.0.0.5;backups=mqtts://10.0.0.6,mqtts://10.0.0.7"
+ *   "sensor_ms=100;sensor_bits=9,D506473B2D600028:12"
+ *   "report_db=25;report_max_s=900"
+ *   "filter_ema=30;filter_median=1"
+ * Keys: broker, backups, health_ms (0 = off), sensor_ms, sensor_bits,
+ * filter_slew, filter_ema, filter_median, report_db, report_min_ms,
+ * report_max_s, contrast (0-255), clear_offline (0|1).
+ *
+ * sensor_bits: DS18B20 resolution, 9-12.  A bare number applies to every
+ * sensor, <16 hex ROM>:<bits> entries override it for one sensor.
+ *
+ * filter_*: DS18B20 sample filter (ds18b20_filter.h).  filter_slew is the
+ * fastest believable change in hundredths of a degree per second (0 = no
+ * check), filter_ema the weight of a new sample in percent (100 = no
+ * smoothing), filter_median (0|1) the median of the last three samples.
+ *
+ * report_*: DS18B20 report-on-change.  A reading is published when it
+ * differs from the last one published by more than report_db hundredths
+ * of a degree (0 = publish every reading), but not sooner than
+ * report_min_ms after it; report_max_s (0 = never) is the longest a
+ * sensor stays silent.
+ */
+
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* app_config_t is append-only from schema 4 on: new fields go at the end
+ * and a stored blob of the same schema is read up to its own size, the
+ * fields it lacks taking their defaults (a longer blob, from newer
+ * firmware, is cut).  Bump only when a field moves, shrinks or changes
+ * meaning, and add the old layout to k_legacy in config_store.c. */
+#define CONFIG_STORE_SCHEMA         4
+
+#ifndef CONFIG_STORE_LISTENERS_MAX
+#define CONFIG_STORE_LISTENERS_MAX  8
+#endif
+
+typedef struct {
+    char     broker_uri[128];
+    char     broker_backups[192];
+    uint32_t health_interval_ms;     /* 0 = health disabled */
+    uint32_t sensor_period_ms;       /* DS18B20 cycle */
+    char     sensor_bits[96];        /* DS18B20 resolution spec, see above */
+    uint16_t filter_slew;            /* 0.01 degC/s, 0 = off */
+    uint8_t  filter_ema;             /* percent, 100 = off */
+    bool     filter_median;
+    uint16_t report_deadband;        /* 0.01 degC, 0 = every reading */
+    uint32_t report_min_ms;
+    uint32_t report_max_s;           /* heartbeat, 0 = off */
+    uint8_t  display_contrast;
+    bool     display_clear_offline;  /* clear text zone on MQTT loss */
+} app_config_t;
+
+/* Change mask bits passed to listeners */
+#define CONFIG_CHANGED_BROKERS      (1u << 0)
+#define CONFIG_CHANGED_HEALTH       (1u << 1)
+#define CONFIG_CHANGED_SENSOR       (1u << 2)
+#define CONFIG_CHANGED_DISPLAY      (1u << 3)
+
+typedef void (*config_listener_t)(const app_config_t *cfg, uint32_t changed,
+                                  void *ctx);
+
+/** Load from NVS (defaults if absent).  Call once after nvs_flash_init(). */
+esp_err_t config_store_init(void);
+
+/** Consistent snapshot of the current config. */
+void      config_store_get(app_config_t *out);
+
+/** Number of committed changes, persisted across reboots. */
+uint32_t  config_store_generation(void);
+
+/**
+ * Validate, persist and swap in `cfg`, then notify listeners.
+ * @return ESP_OK (also when nothing changed), ESP_ERR_INVALID_ARG on a
+ *         value out of range, or the NVS error
+ */
+esp_err_t config_store_set(const app_config_t *cfg);
+
+/**
+ * Apply a "key=value;key=value" update (see header) on top of the current
+ * config, all keys or none.
+ * @param err      optional, set to a short reason on failure
+ * @param changed  optional, receives the change mask
+ */
+esp_err_t config_store_apply_text(const char *spec, const char **err,
+                                  uint32_t *changed);
+
+/**
+ * Register a change listener.  Idempotent by name, lock-free, safe to
+ * call again from a service restarted by the supervisor.
+ */
+esp_err_t config_store_subscribe(const char *name, config_listener_t fn,
+                                 void *ctx);
+
+/**
+ * Current config as JSON, e.g.
+ *   {"gen":3,"broker":"mqtt://...","backups":"","health_ms":30000,
+ *    "sensor_ms":30000,"sensor_bits":"12","filter_slew":500,
+ *    "filter_ema":100,"filter_median":true,"report_db":10,
+ *    "report_min_ms":0,"report_max_s":600,"contrast":127,
+ *    "clear_offline":true}
+ * @return length written, 0 if it did not fit
+ */
+size_t    config_store_write_json(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_STORE_H */
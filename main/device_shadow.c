@@ -0,0 +1,398 @@
+/*
+ * device_shadow.c - Desired / reported device state with delta publishing
+ *
+ * Keys are reported from several tasks (esp-mqtt for relays, display,
+ * mqtt service) and read by the tick and the RPC workers.  The values sit
+ * behind one spin flag, held only to compare and copy a few dozen bytes;
+ * apply functions and publishing run outside it.
+ *
+ * Dirty tracking: `changed` counts changes of a key, `sent` is the count
+ * the last published delta carried.  A change that lands between building
+ * a delta and its publish keeps the key dirty.
+ */
+
+#include "device_shadow.h"
+#include "mqtt_rpc.h"           /* mqtt_rpc_json_get(), "shadow" method */
+#include "mqtt_service.h"
+#include "health_payload.h"
+#include "json_writer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "shadow";
+
+#define SHADOW_TOPIC_LEN    64
+
+typedef struct {
+    const char             *key;
+    device_shadow_type_t    type;
+    device_shadow_apply_t   apply;
+    void                   *ctx;
+    atomic_bool             ready;
+    /* under s_lock */
+    bool                    has_reported;
+    bool                    has_desired;
+    uint32_t                changed;
+    uint32_t                sent;
+    char                    reported[DEVICE_SHADOW_VALUE_LEN];
+    char                    desired[DEVICE_SHADOW_VALUE_LEN];
+} shadow_key_t;
+
+static shadow_key_t s_keys[DEVICE_SHADOW_KEYS_MAX];
+static atomic_int   s_reserved;
+static atomic_flag  s_lock = ATOMIC_FLAG_INIT;
+
+/* under s_lock */
+static uint32_t     s_v;            /* reported document version */
+static uint32_t     s_base;         /* version the last delta left it at */
+static uint32_t     s_dv;           /* last desired version seen */
+static bool         s_dv_dirty;     /* dv not yet acknowledged in a delta */
+
+static atomic_bool  s_resync;
+static char         s_desired_topic[SHADOW_TOPIC_LEN];
+static char         s_reported_topic[SHADOW_TOPIC_LEN];
+
+static struct {
+    atomic_uint pub;
+    atomic_uint bytes;
+    atomic_uint appl;
+    atomic_uint bad;
+} s_stats;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static void lock(void)   { while (atomic_flag_test_and_set(&s_lock)) vTaskDelay(1); }
+static void unlock(void) { atomic_flag_clear(&s_lock); }
+
+static int key_count(void)
+{
+    int n = atomic_load(&s_reserved);
+    return n > DEVICE_SHADOW_KEYS_MAX ? DEVICE_SHADOW_KEYS_MAX : n;
+}
+
+static shadow_key_t *find(const char *key)
+{
+    int n = key_count();
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_keys[i].ready) && strcmp(s_keys[i].key, key) == 0) {
+            return &s_keys[i];
+        }
+    }
+    return NULL;
+}
+
+static void report(const char *key, const char *text)
+{
+    shadow_key_t *k = find(key);
+    if (k == NULL) return;
+
+    lock();
+    if (!k->has_reported || strcmp(k->reported, text) != 0) {
+        strncpy(k->reported, text, sizeof(k->reported) - 1);
+        k->reported[sizeof(k->reported) - 1] = '\0';
+        k->has_reported = true;
+        k->changed++;
+        s_v++;
+    }
+    unlock();
+}
+
+/* Desired JSON value -> the text form reported values use */
+static bool normalise(device_shadow_type_t type, const char *in,
+                      char *out, size_t size)
+{
+    switch (type) {
+    case DEVICE_SHADOW_BOOL:
+        if (strcmp(in, "true") != 0 && strcmp(in, "false") != 0) return false;
+        break;
+    case DEVICE_SHADOW_INT: {
+        char *end;
+        long long v = strtoll(in, &end, 10);
+        if (end == in || *end != '\0') return false;
+        snprintf(out, size, "%lld", v);
+        return true;
+    }
+    case DEVICE_SHADOW_STR:
+        break;
+    }
+    strncpy(out, in, size - 1);
+    out[size - 1] = '\0';
+    return true;
+}
+
+static void json_put_value(json_writer_t *w, const shadow_key_t *k, const char *text)
+{
+    json_key(w, k->key);
+    switch (k->type) {
+    case DEVICE_SHADOW_BOOL: json_put_bool(w, strcmp(text, "true") == 0);   break;
+    case DEVICE_SHADOW_INT:  json_put_int(w, strtoll(text, NULL, 10));      break;
+    case DEVICE_SHADOW_STR:  json_put_str(w, text);                         break;
+    }
+}
+
+static void field_value(health_writer_t *hw, const shadow_key_t *k, const char *text)
+{
+    switch (k->type) {
+    case DEVICE_SHADOW_BOOL: health_field_bool(hw, k->key, strcmp(text, "true") == 0); break;
+    case DEVICE_SHADOW_INT:  health_field_int(hw, k->key, strtoll(text, NULL, 10));    break;
+    case DEVICE_SHADOW_STR:  health_field_str(hw, k->key, text);                       break;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * RPC "shadow" -> {"v":12,"dv":7,"reported":{...},"desired":{...}}
+ * ------------------------------------------------------------------------- */
+
+static esp_err_t rpc_shadow(const char *params, health_writer_t *result, void *ctx)
+{
+    (void)params;
+    (void)ctx;
+    int n = key_count();
+
+    lock();
+    health_field_uint(result, "v",  s_v);
+    health_field_uint(result, "dv", s_dv);
+    health_begin_object(result, "reported");
+    for (int i = 0; i < n; i++) {
+        const shadow_key_t *k = &s_keys[i];
+        if (atomic_load(&k->ready) && k->has_reported) field_value(result, k, k->reported);
+    }
+    health_end_object(result);
+    health_begin_object(result, "desired");
+    for (int i = 0; i < n; i++) {
+        const shadow_key_t *k = &s_keys[i];
+        if (atomic_load(&k->ready) && k->has_desired) field_value(result, k, k->desired);
+    }
+    health_end_object(result);
+    unlock();
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * Health
+ *   "shadow":{"v":12,"dv":7,"pub":9,"bytes":612,"appl":3,"bad":0}
+ * ------------------------------------------------------------------------- */
+
+static void shadow_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    health_begin_object(hw, "shadow");
+    health_field_uint(hw, "v",     s_v);        /* torn read costs one sample */
+    health_field_uint(hw, "dv",    s_dv);
+    health_field_uint(hw, "pub",   atomic_load(&s_stats.pub));
+    health_field_uint(hw, "bytes", atomic_load(&s_stats.bytes));
+    health_field_uint(hw, "appl",  atomic_load(&s_stats.appl));
+    health_field_uint(hw, "bad",   atomic_load(&s_stats.bad));
+    health_end_object(hw);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t device_shadow_init(const char *topic_prefix)
+{
+    if (topic_prefix == NULL ||
+        strlen(topic_prefix) + strlen("/reported") >= SHADOW_TOPIC_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(s_desired_topic,  sizeof(s_desired_topic),  "%s/desired",  topic_prefix);
+    snprintf(s_reported_topic, sizeof(s_reported_topic), "%s/reported", topic_prefix);
+
+    mqtt_rpc_register("shadow", rpc_shadow, NULL, 0);
+    return health_payload_register("shadow", shadow_health_fields, NULL);
+}
+
+esp_err_t device_shadow_register(const char *key, device_shadow_type_t type,
+                                 device_shadow_apply_t apply, void *ctx)
+{
+    if (key == NULL || strlen(key) >= DEVICE_SHADOW_KEY_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (find(key) != NULL) return ESP_OK;
+
+    int idx = atomic_fetch_add(&s_reserved, 1);
+    if (idx >= DEVICE_SHADOW_KEYS_MAX) {
+        ESP_LOGE(TAG, "Key table full -- '%s' not registered", key);
+        return ESP_ERR_NO_MEM;
+    }
+    s_keys[idx].key   = key;
+    s_keys[idx].type  = type;
+    s_keys[idx].apply = apply;
+    s_keys[idx].ctx   = ctx;
+    atomic_store(&s_keys[idx].ready, true);
+    return ESP_OK;
+}
+
+void device_shadow_report_bool(const char *key, bool v)
+{
+    report(key, v ? "true" : "false");
+}
+
+void device_shadow_report_int(const char *key, int64_t v)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%" PRId64, v);
+    report(key, text);
+}
+
+void device_shadow_report_str(const char *key, const char *v)
+{
+    report(key, v != NULL ? v : "");
+}
+
+const char *device_shadow_desired_topic(void)
+{
+    return s_desired_topic;
+}
+
+void device_shadow_set_desired(const char *json)
+{
+    char state[DEVICE_SHADOW_DELTA_LEN];
+    char num[12];
+    if (json == NULL || json[0] == '\0') return;   /* retained doc cleared */
+
+    if (!mqtt_rpc_json_get(json, "v", num, sizeof(num)) ||
+        !mqtt_rpc_json_get(json, "state", state, sizeof(state))) {
+        ESP_LOGW(TAG, "Desired document without v/state -- ignored");
+        atomic_fetch_add(&s_stats.bad, 1);
+        return;
+    }
+    uint32_t v = (uint32_t)strtoul(num, NULL, 10);
+
+    lock();
+    if (v < s_dv) {
+        uint32_t dv = s_dv;
+        unlock();
+        ESP_LOGW(TAG, "Desired v%u older than v%u -- ignored", (unsigned)v, (unsigned)dv);
+        return;
+    }
+    if (v != s_dv) s_dv_dirty = true;
+    s_dv = v;
+    unlock();
+
+    int n = key_count();
+    for (int i = 0; i < n; i++) {
+        shadow_key_t *k = &s_keys[i];
+        char raw[DEVICE_SHADOW_VALUE_LEN];
+        char want[DEVICE_SHADOW_VALUE_LEN];
+        if (!atomic_load(&k->ready) ||
+            !mqtt_rpc_json_get(state, k->key, raw, sizeof(raw))) {
+            continue;
+        }
+        if (!normalise(k->type, raw, want, sizeof(want))) {
+            ESP_LOGW(TAG, "Desired %s: bad value '%s'", k->key, raw);
+            atomic_fetch_add(&s_stats.bad, 1);
+            continue;
+        }
+
+        lock();
+        strcpy(k->desired, want);
+        k->has_desired = true;
+        bool differs = !k->has_reported || strcmp(k->reported, want) != 0;
+        unlock();
+
+        if (!differs || k->apply == NULL) continue;
+        atomic_fetch_add(&s_stats.appl, 1);
+        esp_err_t err = k->apply(k->key, want, k->ctx);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Apply %s=%s failed: %s", k->key, want, esp_err_to_name(err));
+        }
+    }
+}
+
+void device_shadow_on_connect(void)
+{
+    atomic_store(&s_resync, true);
+}
+
+void device_shadow_tick(void)
+{
+    if (s_reported_topic[0] == '\0') return;
+
+    bool full = atomic_exchange(&s_resync, false);
+    uint32_t snap[DEVICE_SHADOW_KEYS_MAX];
+    bool     in_delta[DEVICE_SHADOW_KEYS_MAX] = { false };
+    int      keys = 0;
+    int      n = key_count();
+    int      cut = n;           /* first key that did not fit */
+
+    char buf[DEVICE_SHADOW_DELTA_LEN];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+
+    lock();
+    uint32_t v = s_v;
+    json_begin_object(&w);
+    json_key(&w, "v");
+    json_put_uint(&w, v);
+    if (!full) {
+        json_key(&w, "base");
+        json_put_uint(&w, s_base);
+    }
+    json_key(&w, "dv");
+    json_put_uint(&w, s_dv);
+    if (full) {
+        json_key(&w, "full");
+        json_put_bool(&w, true);
+    }
+    json_key(&w, "state");
+    json_begin_object(&w);
+    for (int i = 0; i < n; i++) {
+        shadow_key_t *k = &s_keys[i];
+        if (!atomic_load(&k->ready) || !k->has_reported) continue;
+        if (!full && k->changed == k->sent) continue;
+
+        /* Keep room for the closing braces and "more"; the rest goes next tick */
+        json_writer_mark_t m = json_writer_mark(&w);
+        json_put_value(&w, k, k->reported);
+        if (!json_writer_ok(&w) || json_writer_len(&w) + 14 >= sizeof(buf)) {
+            json_writer_rewind(&w, &m);
+            cut = i;
+            break;
+        }
+        snap[i]     = k->changed;
+        in_delta[i] = true;
+        keys++;
+    }
+    bool dv_dirty = s_dv_dirty;
+    unlock();
+
+    if (keys == 0 && !full && !dv_dirty) return;
+    json_end_object(&w);
+    if (cut < n) {
+        /* Not at "v" yet: the keys from `cut` on follow with base = v */
+        json_key(&w, "more");
+        json_put_bool(&w, true);
+    }
+    json_end_object(&w);
+    if (!json_writer_ok(&w)) {
+        ESP_LOGE(TAG, "Delta overflow");
+        return;
+    }
+
+    if (mqtt_service_try_publish(s_reported_topic, buf, json_writer_len(&w),
+                                 1 /*qos*/, false) != ESP_OK) {
+        if (full) atomic_store(&s_resync, true);
+        return;                                     /* still dirty: next tick */
+    }
+    atomic_fetch_add(&s_stats.pub, 1);
+    atomic_fetch_add(&s_stats.bytes, (unsigned)json_writer_len(&w));
+
+    lock();
+    for (int i = 0; i < n; i++) {
+        if (in_delta[i]) s_keys[i].sent = snap[i];
+        else if (full && i >= cut) s_keys[i].sent = s_keys[i].changed - 1;
+    }
+    s_base = v;
+    s_dv_dirty = false;
+    unlock();
+}
@@ -0,0 +1,124 @@
+/*
+ * device_shadow.h - Desired / reported device state with delta publishing
+ *
+ * Services register the pieces of state they own (relays, display text,
+ * config generation) as typed keys.  The node keeps two documents:
+ *
+ *   reported   what the device actually is, updated by the owners through
+ *              device_shadow_report_*(); every change bumps its version "v"
+ *   desired    what the control plane wants, received retained on
+ *              /<MACID>/shadow/desired with the control plane's version:
+ *
+ *                {"v":7,"state":{"relay1":true,"text":"Line one"}}
+ *
+ * Deltas: changed reported keys are collected and published by
+ * device_shadow_tick() (service loop, every 100 ms) as one message on
+ * /<MACID>/shadow/reported (QoS 1, not retained):
+ *
+ *   {"v":12,"base":11,"dv":7,"state":{"relay1":true}}
+ *
+ * "base" is the version the previous delta left the document at: a
+ * consumer holding version `base` applies the delta, anyone else asks for
+ * the full document (RPC "shadow") or waits for the next resync.  Changes
+ * between two ticks coalesce into one delta.  Nothing is published while
+ * nothing changes -- no polling.
+ *
+ * A delta too large for one message ends with "more":true: the document is
+ * not at its "v" yet, the remaining keys follow on the next tick in a delta
+ * whose "base" is that "v".  A consumer holds a complete version only
+ * after a message without "more".
+ *
+ * Resync: device_shadow_on_connect() makes the next tick publish every key
+ * with "full":true and no "base" (keys that do not fit follow as above).
+ * The desired topic is SUBSCRIBEd again on every connect, also when the
+ * broker kept the session, so the retained desired document is redelivered
+ * and reconciled after any reconnect.
+ *
+ * Reconciliation: a desired document older than the last one seen ("v"
+ * lower than "dv") is ignored.  Otherwise each key whose desired value
+ * differs from the reported one is handed to its apply function; the owner
+ * acts and reports the result, which goes out in the next delta.  Keys
+ * without an apply function are reported only.  The same document
+ * arriving again therefore only corrects drift.
+ *
+ * Values: bool (true/false), int, or string up to DEVICE_SHADOW_VALUE_LEN-1
+ * chars (escapes in desired strings are not decoded).  The desired
+ * document is limited by app_mqtt's 511-byte message buffer.
+ *
+ * Registration is lock-free and idempotent by key, like health_payload.
+ */
+
+#ifndef DEVICE_SHADOW_H
+#define DEVICE_SHADOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DEVICE_SHADOW_KEYS_MAX
+#define DEVICE_SHADOW_KEYS_MAX      12
+#endif
+#define DEVICE_SHADOW_KEY_LEN       16
+#define DEVICE_SHADOW_VALUE_LEN     68
+#define DEVICE_SHADOW_DELTA_LEN     512
+
+typedef enum {
+    DEVICE_SHADOW_BOOL,
+    DEVICE_SHADOW_INT,
+    DEVICE_SHADOW_STR,
+} device_shadow_type_t;
+
+/**
+ * Bring the device to a desired value -- runs on the esp-mqtt task, so it
+ * must not block.
+ * @param value  "true"/"false", decimal, or the string
+ */
+typedef esp_err_t (*device_shadow_apply_t)(const char *key, const char *value,
+                                           void *ctx);
+
+/**
+ * Set the topic prefix (e.g. "/AABBCCA1B2C3/shadow", copied) and register
+ * the RPC method "shadow" (both documents) and the health provider:
+ *
+ *   "shadow":{"v":12,"dv":7,"pub":9,"bytes":612,"appl":3,"bad":0}
+ *
+ * pub/bytes count published deltas, appl the apply calls, bad the desired
+ * documents or values that did not parse.  Safe to call again after a
+ * service restart.
+ */
+esp_err_t device_shadow_init(const char *topic_prefix);
+
+/**
+ * Register a key.  `key` must point to static storage.
+ * @param apply  NULL for reported-only state
+ */
+esp_err_t device_shadow_register(const char *key, device_shadow_type_t type,
+                                 device_shadow_apply_t apply, void *ctx);
+
+/** Record the current value; a change is published with the next delta. */
+void device_shadow_report_bool(const char *key, bool v);
+void device_shadow_report_int(const char *key, int64_t v);
+void device_shadow_report_str(const char *key, const char *v);
+
+/** Desired topic to subscribe, e.g. "/AABBCCA1B2C3/shadow/desired". */
+const char *device_shadow_desired_topic(void);
+
+/** Retained desired document received.  esp-mqtt task. */
+void device_shadow_set_desired(const char *json);
+
+/** Broker connection up: publish the full document on the next tick. */
+void device_shadow_on_connect(void);
+
+/** Publish pending changes as one delta.  Call periodically while connected. */
+void device_shadow_tick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEVICE_SHADOW_H */
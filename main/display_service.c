@@ -25,11 +25,29 @@
  *   (<MACID> is the full 12-char upper-hex Ethernet MAC, e.g. AABBCCA1B2C3)
  *   Topic subscription is handled by mqtt_service.c -- this service only
  *   exposes the display_service_set_text() / display_service_set_time() API.
+ *
+ * HEALTH
+ *   Registers "display" with health_payload: running flag, MQTT state as
+ *   last shown, number of panel redraws and queue-full drops.
+ *
+ * SHADOW
+ *   Owns the "text" key of device_shadow: a desired text is applied through
+ *   display_service_set_text(), and the task reports what the text zone
+ *   holds once it has been drawn ("" after an offline clear).
+ *
+ * RUNTIME CONFIG
+ *   Contrast and the offline behaviour come from config_store and follow
+ *   it live: a change notification posts DISPLAY_MSG_CONFIG, the task
+ *   sends the SSD1306 contrast command and keeps or clears the text zone
+ *   on the next MQTT loss accordingly.
  */
 
 #include "display_service.h"
 #include "display_font.h"
 #include "priorities.h"
+#include "health_payload.h"
+#include "config_store.h"
+#include "device_shadow.h"
 #include "esp_lcd_panel_io.h"
 #include "esp_lcd_panel_ops.h"
 #include "esp_lcd_panel_vendor.h"
@@ -43,6 +61,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdatomic.h>
 
 static const char *TAG = "display";
 
@@ -59,6 +78,7 @@ static const char *TAG = "display";
 
 #define OLED_W      128
 #define OLED_H       64
+#define SSD1306_CMD_SET_CONTRAST  0x81
 #define OLED_PAGES  (OLED_H / 8)           /* 8  */
 #define FB_SIZE     (OLED_W * OLED_PAGES)  /* 1024 bytes */
 
@@ -90,6 +110,7 @@ typedef enum {
     DISPLAY_MSG_TIME,
     DISPLAY_MSG_TEXT,
     DISPLAY_MSG_MQTT_STATE,
+    DISPLAY_MSG_CONFIG,
     DISPLAY_MSG_STOP,
 } display_msg_type_t;
 
@@ -99,6 +120,10 @@ typedef struct {
         char time_str[6];             /* "HH:MM\0" */
         char text[MAX_TEXT_LEN];      /* arbitrary string from /<MACID>/text */
         bool connected;
+        struct {
+            uint8_t contrast;
+            bool    clear_offline;
+        } cfg;
     } data;
 } display_msg_t;
 
@@ -107,6 +132,9 @@ typedef struct {
     QueueHandle_t  queue;
     TaskHandle_t   task_handle;
     volatile bool  is_running;
+    volatile bool  shown_online;   /* clock drawn (true) or dashes (false) */
+    uint32_t       redraws;        /* written by display_task only */
+    atomic_uint    dropped;        /* queue-full drops, any caller task */
 } display_ctx_t;
 
 static display_ctx_t s_ctx = {0};
@@ -406,6 +434,13 @@ static void hw_cleanup(i2c_master_bus_handle_t   bus,
     if (bus)   i2c_del_master_bus(bus);
 }
 
+static void set_contrast(esp_lcd_panel_io_handle_t io, uint8_t contrast)
+{
+    if (esp_lcd_panel_io_tx_param(io, SSD1306_CMD_SET_CONTRAST, &contrast, 1) != ESP_OK) {
+        ESP_LOGW(TAG, "Contrast %u not applied", contrast);
+    }
+}
+
 static inline void fb_flush(esp_lcd_panel_handle_t panel)
 {
     esp_lcd_panel_draw_bitmap(panel, 0, 0, OLED_W, OLED_H, s_fb);
@@ -430,6 +465,11 @@ static void display_task(void *arg)
         return;
     }
 
+    app_config_t cfg;
+    config_store_get(&cfg);
+    set_contrast(io, cfg.display_contrast);
+    bool clear_offline = cfg.display_clear_offline;
+
     /* Initial state: dashes in clock zone, empty text zone */
     memset(s_fb, 0, FB_SIZE);
     fb_draw_clock_dashes();
@@ -474,6 +514,7 @@ static void display_task(void *arg)
         case DISPLAY_MSG_TEXT: {
             word_wrap(msg.data.text, cur_line1, cur_line2);
             redraw = true;
+            device_shadow_report_str("text", msg.data.text);
             ESP_LOGI(TAG, "Text: '%s' / '%s'", cur_line1, cur_line2);
             break;
         }
@@ -481,15 +522,25 @@ static void display_task(void *arg)
         case DISPLAY_MSG_MQTT_STATE:
             mqtt_connected = msg.data.connected;
             if (!mqtt_connected) {
-                /* Clear everything on disconnect */
+                /* Clock reverts to dashes; text too unless configured to stay */
                 strncpy(cur_time, "----", sizeof(cur_time) - 1);
-                cur_line1[0] = '\0';
-                cur_line2[0] = '\0';
+                if (clear_offline) {
+                    cur_line1[0] = '\0';
+                    cur_line2[0] = '\0';
+                    device_shadow_report_str("text", "");
+                }
                 ESP_LOGI(TAG, "MQTT offline -- clearing display");
             }
             redraw = true;
             break;
 
+        case DISPLAY_MSG_CONFIG:
+            set_contrast(io, msg.data.cfg.contrast);
+            clear_offline = msg.data.cfg.clear_offline;
+            ESP_LOGI(TAG, "Config: contrast=%u clear_offline=%d",
+                     msg.data.cfg.contrast, clear_offline);
+            break;
+
         case DISPLAY_MSG_STOP:
             s_ctx.is_running = false;
             break;
@@ -504,6 +555,8 @@ static void display_task(void *arg)
             }
             fb_draw_text_zone(cur_line1, cur_line2);
             fb_flush(panel);
+            s_ctx.shown_online = mqtt_connected;
+            s_ctx.redraws++;
         }
     }
 
@@ -515,6 +568,49 @@ static void display_task(void *arg)
     vTaskDelete(NULL);
 }
 
+/* ══════════════════════════════════════════════════════════════════════════
+ * Health payload provider -- runs on the mqtt publish task
+ *   "display":{"run":true,"online":true,"redraws":57,"drop":0}
+ * ══════════════════════════════════════════════════════════════════════════ */
+
+static void display_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    health_begin_object(hw, "display");
+    health_field_bool(hw, "run",     s_ctx.is_running);
+    health_field_bool(hw, "online",  s_ctx.shown_online);
+    health_field_uint(hw, "redraws", s_ctx.redraws);
+    health_field_uint(hw, "drop",    atomic_load(&s_ctx.dropped));
+    health_end_object(hw);
+}
+
+/* ══════════════════════════════════════════════════════════════════════════
+ * config_store listener -- runs on the writer's task, never blocks
+ * ══════════════════════════════════════════════════════════════════════════ */
+
+static void display_config_changed(const app_config_t *cfg, uint32_t changed,
+                                   void *ctx)
+{
+    (void)ctx;
+    if (!(changed & CONFIG_CHANGED_DISPLAY) || !s_ctx.is_running || !s_ctx.queue) return;
+    display_msg_t msg = { .type = DISPLAY_MSG_CONFIG,
+                          .data.cfg.contrast      = cfg->display_contrast,
+                          .data.cfg.clear_offline = cfg->display_clear_offline };
+    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE) {
+        atomic_fetch_add(&s_ctx.dropped, 1);
+        ESP_LOGW(TAG, "Queue full -- config dropped");
+    }
+}
+
+/* Shadow apply for "text" -- queued like any other text update */
+static esp_err_t display_text_apply(const char *key, const char *value, void *ctx)
+{
+    (void)key;
+    (void)ctx;
+    display_service_set_text(value);
+    return ESP_OK;
+}
+
 /* ══════════════════════════════════════════════════════════════════════════
  * Public API
  * ══════════════════════════════════════════════════════════════════════════ */
@@ -525,6 +621,9 @@ void display_service_start(void)
     s_ctx.queue = xQueueCreate(8, sizeof(display_msg_t));
     if (!s_ctx.queue) { ESP_LOGE(TAG, "Queue alloc failed"); return; }
     s_ctx.is_running = true;
+    health_payload_register("display", display_health_fields, NULL);
+    config_store_subscribe("display", display_config_changed, NULL);
+    device_shadow_register("text", DEVICE_SHADOW_STR, display_text_apply, NULL);
     if (xTaskCreate(display_task, "display", 4096, NULL,
                     PRIO_DISPLAY_SERVICE, &s_ctx.task_handle) != pdPASS) {
         ESP_LOGE(TAG, "Task create failed");
@@ -552,8 +651,10 @@ void display_service_set_time(const char *time_str)
     if (!s_ctx.is_running || !s_ctx.queue || !time_str) return;
     display_msg_t msg = { .type = DISPLAY_MSG_TIME };
     strncpy(msg.data.time_str, time_str, sizeof(msg.data.time_str) - 1);
-    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE)
+    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE) {
+        atomic_fetch_add(&s_ctx.dropped, 1);
         ESP_LOGW(TAG, "Queue full -- time dropped");
+    }
 }
 
 void display_service_set_text(const char *text)
@@ -563,8 +664,10 @@ void display_service_set_text(const char *text)
     if (text) {
         strncpy(msg.data.text, text, sizeof(msg.data.text) - 1);
     }
-    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE)
+    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE) {
+        atomic_fetch_add(&s_ctx.dropped, 1);
         ESP_LOGW(TAG, "Queue full -- text dropped");
+    }
 }
 
 void display_service_set_mqtt_connected(bool connected)
@@ -572,5 +675,7 @@ void display_service_set_mqtt_connected(bool connected)
     if (!s_ctx.queue) return;
     display_msg_t msg = { .type = DISPLAY_MSG_MQTT_STATE,
                           .data.connected = connected };
-    xQueueSend(s_ctx.queue, &msg, 0);
+    if (xQueueSend(s_ctx.queue, &msg, 0) != pdTRUE) {
+        atomic_fetch_add(&s_ctx.dropped, 1);
+    }
 }
@@ -16,12 +16,14 @@
  *   - Payload is word-wrapped to 2 lines, each centred.
  *   - Explicit '\n' in payload forces a line break.
  *   - Empty payload clears the text zone.
- *   - On MQTT disconnect both zones revert to "----" / blank.
+ *   - On MQTT disconnect both zones revert to "----" / blank (the text is
+ *     kept when config_store's display_clear_offline is off).
  *
  * GPIO defaults (override in sdkconfig):
  *   CONFIG_OLED_SDA_GPIO   default 7
  *   CONFIG_OLED_SCL_GPIO   default 8
  *   CONFIG_OLED_I2C_ADDR   default 0x3C
+ *   CONFIG_OLED_CONTRAST   default 127 (runtime: config_store "contrast")
  */
 
 #ifndef DISPLAY_SERVICE_H
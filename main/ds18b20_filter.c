@@ -0,0 +1,92 @@
+/*
+ * ds18b20_filter.c - Rejection, median-of-3 and EMA for DS18B20 samples
+ *
+ * The slew check compares against the newest accepted raw sample, not the
+ * filtered output, so the EMA lag does not turn a steady ramp into
+ * rejections.  Its limit never drops below SLEW_FLOOR_C -- one 9-bit step
+ * -- so a fast cycle at low resolution is not rejected for quantisation.
+ */
+
+#include "ds18b20_filter.h"
+#include <math.h>
+#include <string.h>
+
+#define RANGE_MIN_C         -55.0f      /* datasheet measuring range */
+#define RANGE_MAX_C         125.0f
+#define POWER_ON_C          85.0f       /* scratchpad value after power-up */
+#define POWER_ON_NEAR_C     1.0f        /* 85.0 is believed next to this */
+#define SLEW_FLOOR_C        0.5f
+
+void ds18b20_filter_reset(ds18b20_filter_t *f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+/* Newest accepted raw sample; f->n > 0 */
+static float newest(const ds18b20_filter_t *f)
+{
+    return f->win[(f->head + 2) % 3];
+}
+
+static void push(ds18b20_filter_t *f, float x)
+{
+    f->win[f->head] = x;
+    f->head = (uint8_t)((f->head + 1) % 3);
+    if (f->n < 3) f->n++;
+}
+
+static float median3(float a, float b, float c)
+{
+    if (a > b) { float t = a; a = b; b = t; }
+    if (b > c) b = c;
+    return a > b ? a : b;
+}
+
+ds18b20_filter_result_t ds18b20_filter_update(ds18b20_filter_t *f,
+                                              const ds18b20_filter_cfg_t *cfg,
+                                              float raw, int64_t now_us,
+                                              float *out)
+{
+    if (!(raw >= RANGE_MIN_C && raw <= RANGE_MAX_C)) return DS18B20_FILTER_RANGE;
+
+    ds18b20_filter_result_t why = DS18B20_FILTER_OK;
+    if (raw == POWER_ON_C &&
+        (f->n == 0 || fabsf(newest(f) - POWER_ON_C) > POWER_ON_NEAR_C)) {
+        why = DS18B20_FILTER_POWER_ON;
+    } else if (cfg->slew > 0 && f->n > 0) {
+        float limit = (float)cfg->slew / 100.0f *
+                      (float)(now_us - f->last_us) / 1e6f;
+        if (limit < SLEW_FLOOR_C) limit = SLEW_FLOOR_C;
+        if (fabsf(raw - newest(f)) > limit) why = DS18B20_FILTER_SLEW;
+    }
+
+    if (why != DS18B20_FILTER_OK) {
+        if (++f->run < DS18B20_FILTER_RESEED) return why;
+        f->n = 0;                                   /* a real step: restart */
+    }
+    f->run = 0;
+
+    const bool first = (f->n == 0);
+    push(f, raw);
+    f->last_us = now_us;
+
+    float x = raw;
+    if (cfg->median && f->n == 3) x = median3(f->win[0], f->win[1], f->win[2]);
+
+    if (first || cfg->ema >= 100) f->out = x;
+    else                          f->out += (float)cfg->ema / 100.0f * (x - f->out);
+
+    *out = f->out;
+    return DS18B20_FILTER_OK;
+}
+
+const char *ds18b20_filter_result_str(ds18b20_filter_result_t r)
+{
+    switch (r) {
+    case DS18B20_FILTER_OK:         return "ok";
+    case DS18B20_FILTER_RANGE:      return "range";
+    case DS18B20_FILTER_POWER_ON:   return "85";
+    case DS18B20_FILTER_SLEW:       return "slew";
+    }
+    return "?";
+}
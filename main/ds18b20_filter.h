@@ -0,0 +1,79 @@
+/*
+ * ds18b20_filter.h - Per-sensor DS18B20 sample filter
+ *
+ * Every good read goes through three stages before it is published,
+ * queued or compared against the report deadband:
+ *
+ *   1. rejection  values the probe cannot measure (outside -55..125 degC,
+ *                 which includes the -127 "disconnected" value of other
+ *                 stacks), the 85.0 degC power-on scratchpad of a probe that
+ *                 lost power before its conversion, and jumps faster than
+ *                 the slew limit since the last accepted sample
+ *   2. median     of the last three accepted samples (optional) -- removes
+ *                 a single spike the slew limit let through
+ *   3. EMA        y += a * (x - y), a = ema / 100; 100 turns it off
+ *
+ * A real step (probe moved into hot water, or a sensor really at 85 degC)
+ * would be rejected for ever, so after DS18B20_FILTER_RESEED rejections in
+ * a row the slew and power-on checks accept the sample and restart the
+ * median and the EMA from it.  Range rejections never reseed.
+ *
+ * The state belongs to the task that owns the sensor's bus; nothing here
+ * locks.
+ */
+
+#ifndef DS18B20_FILTER_H
+#define DS18B20_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DS18B20_FILTER_RESEED   3
+
+typedef struct {
+    uint16_t slew;          /* 0.01 degC per second, 0 = no slew check */
+    uint8_t  ema;           /* weight of a new sample in percent, 1..100 */
+    bool     median;        /* median of 3 before the EMA */
+} ds18b20_filter_cfg_t;
+
+typedef struct {
+    float    win[3];        /* last accepted samples, ring */
+    uint8_t  n;             /* samples in win */
+    uint8_t  head;
+    uint8_t  run;           /* rejections in a row */
+    float    out;           /* EMA state */
+    int64_t  last_us;       /* 0 = nothing accepted yet */
+} ds18b20_filter_t;
+
+typedef enum {
+    DS18B20_FILTER_OK,
+    DS18B20_FILTER_RANGE,
+    DS18B20_FILTER_POWER_ON,
+    DS18B20_FILTER_SLEW,
+} ds18b20_filter_result_t;
+
+/** Forget every sample (new sensor in the table slot). */
+void ds18b20_filter_reset(ds18b20_filter_t *f);
+
+/**
+ * Feed one read taken at `now_us`.
+ * @param out  the filtered value, written only on DS18B20_FILTER_OK
+ * @return DS18B20_FILTER_OK or why the sample was dropped
+ */
+ds18b20_filter_result_t ds18b20_filter_update(ds18b20_filter_t *f,
+                                              const ds18b20_filter_cfg_t *cfg,
+                                              float raw, int64_t now_us,
+                                              float *out);
+
+/** Short name of a result for logs ("range", "85", "slew"). */
+const char *ds18b20_filter_result_str(ds18b20_filter_result_t r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DS18B20_FILTER_H */
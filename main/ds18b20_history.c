@@ -0,0 +1,381 @@
+/*
+ * ds18b20_history.c - Delta-encoded DS18B20 series with 1 min / 15 min rollups
+ *
+ * Per series, one PSRAM buffer: RAW_BLOCKS raw blocks, then the 1-minute
+ * and 15-minute rollup rings.  The bookkeeping (heads, open buckets) stays
+ * in internal RAM.
+ *
+ * Raw block: block_hdr_t, then count - 1 records of
+ *   varint(dt)  10 ms units since the previous sample
+ *   varint(zz)  zigzag of the value change, 0.01 degC
+ * A block takes records while RECORD_MAX bytes are left.  Time in 10 ms
+ * units wraps after 497 days of uptime.
+ *
+ * Rollup bucket n covers [n * step, (n + 1) * step) ms since boot; the
+ * ring holds the newest `used` closed buckets ending at `last`.
+ */
+
+#include "ds18b20_history.h"
+#include "ds18b20_temp.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "ds18b20-hist";
+
+#ifndef CONFIG_DS18B20_HISTORY_RAW_KB
+#define CONFIG_DS18B20_HISTORY_RAW_KB   8
+#endif
+#ifndef CONFIG_DS18B20_HISTORY_1M_H
+#define CONFIG_DS18B20_HISTORY_1M_H     48
+#endif
+#ifndef CONFIG_DS18B20_HISTORY_15M_D
+#define CONFIG_DS18B20_HISTORY_15M_D    14
+#endif
+
+#define RAW_BLOCK       256
+#define RAW_BLOCKS      (CONFIG_DS18B20_HISTORY_RAW_KB * 1024 / RAW_BLOCK)
+#define RAW_KEEP_MS     (3600 * 1000LL)
+#define RAW_TICK_MS     10
+#define RECORD_MAX      8               /* 5-byte dt + 3-byte value */
+#define M1_CAP          (CONFIG_DS18B20_HISTORY_1M_H * 60)
+#define M15_CAP         (CONFIG_DS18B20_HISTORY_15M_D * 96)
+#define EMPTY           INT16_MIN       /* rollup_t.min of an empty bucket */
+#define QUERY_TRIES     4
+
+typedef struct {
+    uint32_t t0;                        /* RAW_TICK_MS units */
+    int16_t  v0;
+    uint16_t count;                     /* samples, the first one included */
+} block_hdr_t;
+
+typedef struct {
+    int16_t min, max, avg;
+} rollup_t;
+
+typedef struct {
+    rollup_t *rec;
+    uint16_t  cap;
+    uint16_t  head;                     /* next record written */
+    uint16_t  used;
+    int64_t   last;                     /* bucket of the newest record */
+    int64_t   open;                     /* bucket being accumulated */
+    int32_t   sum;
+    uint16_t  n;                        /* samples in the open bucket */
+    int16_t   min, max;
+} tier_t;
+
+typedef struct {
+    uint64_t    rom;                    /* 0 = free */
+    atomic_uint seq;                    /* odd while the sensor task appends */
+    int64_t     last_ms;                /* newest sample, picks the series to reuse */
+    uint8_t    *raw;                    /* PSRAM; the rollup rings follow */
+    uint16_t    raw_head;               /* block being filled */
+    uint16_t    raw_used;               /* blocks holding samples */
+    uint16_t    raw_fill;               /* bytes used in raw_head */
+    uint32_t    raw_last_t;
+    int16_t     raw_last_v;
+    tier_t      tier[2];                /* 1 min, 15 min */
+} series_t;
+
+static const uint32_t s_step_ms[] = { 0, 60 * 1000, 15 * 60 * 1000 };
+
+static series_t s_series[DS18B20_MAX_SENSORS];
+static int      s_used;
+static bool     s_nomem_logged;
+
+/* -------------------------------------------------------------------------
+ * Encoding
+ * ------------------------------------------------------------------------- */
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* NULL if the varint runs past `end` (torn copy) */
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+    uint32_t x = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t b = *p++;
+        x |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t zigzag(int32_t v)   { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t  unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+/* -------------------------------------------------------------------------
+ * Append -- sensor task
+ * ------------------------------------------------------------------------- */
+
+static void raw_add(series_t *s, uint32_t t, int16_t v)
+{
+    uint8_t     *blk = s->raw + (size_t)s->raw_head * RAW_BLOCK;
+    block_hdr_t  hdr;
+
+    if (s->raw_used > 0 && s->raw_fill + RECORD_MAX <= RAW_BLOCK) {
+        uint8_t *p = put_varint(blk + s->raw_fill, t - s->raw_last_t);
+        p = put_varint(p, zigzag((int32_t)v - s->raw_last_v));
+        s->raw_fill = (uint16_t)(p - blk);
+        memcpy(&hdr, blk, sizeof(hdr));
+        hdr.count++;
+    } else {
+        if (s->raw_used > 0) {
+            s->raw_head = (uint16_t)((s->raw_head + 1) % RAW_BLOCKS);
+            blk = s->raw + (size_t)s->raw_head * RAW_BLOCK;
+        }
+        if (s->raw_used < RAW_BLOCKS) s->raw_used++;
+        hdr = (block_hdr_t){ .t0 = t, .v0 = v, .count = 1 };
+        s->raw_fill = sizeof(hdr);
+    }
+    memcpy(blk, &hdr, sizeof(hdr));
+    s->raw_last_t = t;
+    s->raw_last_v = v;
+}
+
+static void tier_put(tier_t *t, int64_t bucket, rollup_t r)
+{
+    if (t->used > 0) {
+        int64_t gap = bucket - t->last - 1;            /* buckets without readings */
+        if (gap >= t->cap) {
+            t->used = 0;
+        } else {
+            for (; gap > 0; gap--) {
+                t->rec[t->head] = (rollup_t){ .min = EMPTY };
+                t->head = (uint16_t)((t->head + 1) % t->cap);
+                if (t->used < t->cap) t->used++;
+            }
+        }
+    }
+    t->rec[t->head] = r;
+    t->head = (uint16_t)((t->head + 1) % t->cap);
+    if (t->used < t->cap) t->used++;
+    t->last = bucket;
+}
+
+static void tier_add(tier_t *t, uint32_t step_ms, int64_t ms, int16_t v)
+{
+    const int64_t bucket = ms / step_ms;
+    if (t->n > 0 && bucket != t->open) {
+        tier_put(t, t->open, (rollup_t){
+            .min = t->min, .max = t->max, .avg = (int16_t)(t->sum / t->n) });
+        t->n = 0;
+    }
+    if (t->n == 0) {
+        t->open = bucket;
+        t->sum  = 0;
+        t->min  = v;
+        t->max  = v;
+    }
+    if (v < t->min) t->min = v;
+    if (v > t->max) t->max = v;
+    t->sum += v;
+    t->n++;
+}
+
+/* Series of `rom`, a new or reused one if it has none; NULL without PSRAM */
+static series_t *series_for(uint64_t rom)
+{
+    series_t *oldest = NULL;
+    for (int i = 0; i < s_used; i++) {
+        if (s_series[i].rom == rom) return &s_series[i];
+        if (oldest == NULL || s_series[i].last_ms < oldest->last_ms) oldest = &s_series[i];
+    }
+
+    series_t *s = oldest;
+    if (s_used < DS18B20_MAX_SENSORS) {
+        /* No PSRAM left: this sensor goes without history, nobody is evicted */
+        const size_t size = (size_t)RAW_BLOCKS * RAW_BLOCK +
+                            (size_t)(M1_CAP + M15_CAP) * sizeof(rollup_t);
+        uint8_t *buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (buf == NULL) {
+            if (!s_nomem_logged) {
+                ESP_LOGW(TAG, "No PSRAM for another series (%u B)", (unsigned)size);
+                s_nomem_logged = true;
+            }
+            return NULL;
+        }
+        s      = &s_series[s_used];
+        s->raw = buf;
+        s->tier[0].rec = (rollup_t *)(buf + (size_t)RAW_BLOCKS * RAW_BLOCK);
+        s->tier[1].rec = s->tier[0].rec + M1_CAP;
+        s_used++;
+    } else {
+        ESP_LOGI(TAG, "Series of %016" PRIX64 " reused for %016" PRIX64, s->rom, rom);
+    }
+
+    atomic_fetch_add(&s->seq, 1);
+    s->rom        = rom;
+    s->raw_head   = 0;
+    s->raw_used   = 0;
+    s->raw_fill   = 0;
+    for (int k = 0; k < 2; k++) {
+        s->tier[k].cap  = (uint16_t)(k == 0 ? M1_CAP : M15_CAP);
+        s->tier[k].head = 0;
+        s->tier[k].used = 0;
+        s->tier[k].n    = 0;
+    }
+    atomic_fetch_add(&s->seq, 1);
+    return s;
+}
+
+void ds18b20_history_add(uint64_t rom, int64_t now_us, float temp)
+{
+    series_t *s = series_for(rom);
+    if (s == NULL) return;
+
+    const int64_t ms = now_us / 1000;
+    const int16_t v  = (int16_t)lroundf(temp * 100.0f);
+
+    atomic_fetch_add(&s->seq, 1);
+    raw_add(s, (uint32_t)(ms / RAW_TICK_MS), v);
+    tier_add(&s->tier[0], s_step_ms[DS18B20_HISTORY_1M], ms, v);
+    tier_add(&s->tier[1], s_step_ms[DS18B20_HISTORY_15M], ms, v);
+    s->last_ms = ms;
+    atomic_fetch_add(&s->seq, 1);
+}
+
+/* -------------------------------------------------------------------------
+ * Query -- RPC workers, under the series' sequence counter
+ * ------------------------------------------------------------------------- */
+
+typedef struct {
+    int64_t                  from, to;
+    ds18b20_history_point_t *out;
+    int                      max;
+    int                      n;
+    int64_t                  next;
+} page_t;
+
+/* false once the page is full */
+static bool page_put(page_t *pg, const ds18b20_history_point_t *p)
+{
+    if (p->ms < pg->from || p->ms > pg->to) return true;
+    if (pg->n == pg->max) {
+        pg->next = p->ms;
+        return false;
+    }
+    pg->out[pg->n++] = *p;
+    return true;
+}
+
+static bool copy_raw(const series_t *s, page_t *pg)
+{
+    const int64_t keep = esp_timer_get_time() / 1000 - RAW_KEEP_MS;
+    if (pg->from < keep) pg->from = keep;
+
+    for (int k = 0; k < s->raw_used; k++) {
+        const int      b   = (s->raw_head + RAW_BLOCKS - s->raw_used + 1 + k) % RAW_BLOCKS;
+        const uint8_t *blk = s->raw + (size_t)b * RAW_BLOCK;
+        const uint8_t *end = blk + RAW_BLOCK;
+        block_hdr_t    hdr;
+        memcpy(&hdr, blk, sizeof(hdr));
+
+        const uint8_t *p = blk + sizeof(hdr);
+        uint32_t t = hdr.t0;
+        int32_t  v = hdr.v0;
+        for (int r = 0; r < hdr.count; r++) {
+            if (r > 0) {
+                uint32_t dt, zz;
+                if ((p = get_varint(p, end, &dt)) == NULL ||
+                    (p = get_varint(p, end, &zz)) == NULL) {
+                    return false;
+                }
+                t += dt;
+                v += unzigzag(zz);
+            }
+            const ds18b20_history_point_t pt = {
+                .ms = (int64_t)t * RAW_TICK_MS,
+                .min = (int16_t)v, .max = (int16_t)v, .avg = (int16_t)v,
+            };
+            if (!page_put(pg, &pt)) return true;
+        }
+    }
+    return true;
+}
+
+static void copy_rollup(const tier_t *t, uint32_t step_ms, page_t *pg)
+{
+    for (int k = 0; k < t->used; k++) {
+        const rollup_t *r = &t->rec[(t->head + t->cap - t->used + k) % t->cap];
+        const ds18b20_history_point_t pt = {
+            .ms    = (t->last - t->used + 1 + k) * (int64_t)step_ms,
+            .min   = r->min, .max = r->max, .avg = r->avg,
+            .empty = (r->min == EMPTY),
+        };
+        if (!page_put(pg, &pt)) return;
+    }
+}
+
+esp_err_t ds18b20_history_query(uint64_t rom, ds18b20_history_tier_t tier,
+                                int64_t from_ms, int64_t to_ms,
+                                ds18b20_history_point_t *out, int max,
+                                int *count, int64_t *next_ms)
+{
+    if (rom == 0 || max <= 0 || tier > DS18B20_HISTORY_15M) return ESP_ERR_INVALID_ARG;
+
+    for (int attempt = 0; attempt < QUERY_TRIES; attempt++) {
+        const series_t *s = NULL;
+        const int used = s_used;
+        for (int i = 0; i < used; i++) {
+            if (s_series[i].rom == rom) {
+                s = &s_series[i];
+                break;
+            }
+        }
+        if (s == NULL) return ESP_ERR_NOT_FOUND;
+
+        const unsigned seq = atomic_load(&s->seq);
+        if (seq & 1) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        page_t pg = { .from = from_ms, .to = to_ms, .out = out, .max = max, .next = -1 };
+        bool ok = true;
+        if (tier == DS18B20_HISTORY_RAW) ok = copy_raw(s, &pg);
+        else copy_rollup(&s->tier[tier - 1], s_step_ms[tier], &pg);
+
+        if (ok && atomic_load(&s->seq) == seq && s->rom == rom) {
+            *count   = pg.n;
+            *next_ms = pg.next;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+uint32_t ds18b20_history_step_ms(ds18b20_history_tier_t tier)
+{
+    return tier <= DS18B20_HISTORY_15M ? s_step_ms[tier] : 0;
+}
+
+int ds18b20_history_series(void)
+{
+    return s_used;
+}
+
+uint32_t ds18b20_history_kb(void)
+{
+    const uint32_t per = (uint32_t)RAW_BLOCKS * RAW_BLOCK +
+                         (uint32_t)(M1_CAP + M15_CAP) * sizeof(rollup_t);
+    return (uint32_t)s_used * per / 1024;
+}
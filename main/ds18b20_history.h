@@ -0,0 +1,82 @@
+/*
+ * ds18b20_history.h - In-device DS18B20 time series in PSRAM
+ *
+ * Every filtered reading is kept per sensor (by ROM code) in three tiers:
+ *
+ *   raw    every sample of the last hour, as far as
+ *          CONFIG_DS18B20_HISTORY_RAW_KB holds them
+ *   1m     min / max / avg per minute, CONFIG_DS18B20_HISTORY_1M_H hours
+ *   15m    min / max / avg per 15 minutes, CONFIG_DS18B20_HISTORY_15M_D days
+ *
+ * Raw samples are delta-encoded in 256-byte blocks: an absolute time and
+ * value, then per sample a varint time delta (10 ms units) and a zigzag
+ * varint value delta (0.01 degC) -- about 3 bytes a sample, so the 8 KB
+ * default holds an hour down to a period of about 1.5 s.  Rollups are
+ * 6-byte records whose time follows from their position; a bucket
+ * without readings is marked empty.  A full ring overwrites its oldest
+ * block or record.
+ *
+ * Times are milliseconds since boot, like the batch frames' "ts".
+ *
+ * Memory: one PSRAM buffer per ROM code, allocated at its first reading
+ * and never freed (like the sensor table).  With more ROM codes than
+ * DS18B20_MAX_SENSORS, the series silent for longest is reused.
+ *
+ * Only the sensor task appends.  Queries (RPC workers) copy a page under
+ * the series' sequence counter and retry if it moved, like
+ * config_store_get().
+ */
+
+#ifndef DS18B20_HISTORY_H
+#define DS18B20_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    DS18B20_HISTORY_RAW,
+    DS18B20_HISTORY_1M,
+    DS18B20_HISTORY_15M,
+} ds18b20_history_tier_t;
+
+typedef struct {
+    int64_t ms;             /* sample time, or start of the bucket */
+    int16_t min;            /* 0.01 degC; raw: all three the same */
+    int16_t max;
+    int16_t avg;
+    bool    empty;          /* bucket without readings */
+} ds18b20_history_point_t;
+
+/** Record a reading of `rom` taken at `now_us` (sensor task only). */
+void ds18b20_history_add(uint64_t rom, int64_t now_us, float temp);
+
+/**
+ * Copy up to `max` points of `rom` with from_ms <= time <= to_ms, oldest
+ * first.  Rollup tiers give every bucket in the range, empty ones
+ * included, but not the one still being filled.
+ * @param next_ms  time of the first point that did not fit, -1 if none
+ * @return ESP_ERR_NOT_FOUND if `rom` has no series, ESP_ERR_TIMEOUT if
+ *         appends kept interrupting the copy
+ */
+esp_err_t ds18b20_history_query(uint64_t rom, ds18b20_history_tier_t tier,
+                                int64_t from_ms, int64_t to_ms,
+                                ds18b20_history_point_t *out, int max,
+                                int *count, int64_t *next_ms);
+
+/** Bucket length of a rollup tier in ms, 0 for raw. */
+uint32_t ds18b20_history_step_ms(ds18b20_history_tier_t tier);
+
+/** Series in use and PSRAM they hold, for the health payload. */
+int      ds18b20_history_series(void);
+uint32_t ds18b20_history_kb(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DS18B20_HISTORY_H */
@@ -0,0 +1,364 @@
+/*
+ * ds18b20_rom_map.c - ROM code hash for DS18B20 identity and aliases
+ *
+ * Table: ROM_MAP_SLOTS entries, linear probing from a multiplicative hash
+ * of the 48-bit serial (the family byte is always 0x28, the top byte is a
+ * CRC).  An entry lives while it has an index or an alias; removal shifts
+ * the following run back (no tombstones), so a lookup stops at the first
+ * empty slot.  Occupancy is capped at 3/4 of the slots; 32 B per slot,
+ * 8 KB at the default 64 sensors.
+ *
+ * NVS layout: blob "alias" in namespace "ds18b20", an array of
+ * alias_rec_t.  Written whole on every alias change -- rare, by hand.
+ */
+
+#include "ds18b20_rom_map.h"
+#include "ds18b20_temp.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ds18b20-rom";
+
+#define NVS_NAMESPACE   "ds18b20"
+#define NVS_KEY         "alias"
+
+/* Up to MAX_SENSORS tracked plus MAX_SENSORS aliased ROM codes, <= 3/4 full */
+#if DS18B20_MAX_SENSORS <= 24
+#define ROM_MAP_SLOTS   64
+#elif DS18B20_MAX_SENSORS <= 48
+#define ROM_MAP_SLOTS   128
+#elif DS18B20_MAX_SENSORS <= 96
+#define ROM_MAP_SLOTS   256
+#else
+#define ROM_MAP_SLOTS   1024
+#endif
+#define ROM_MAP_MASK    (ROM_MAP_SLOTS - 1)
+#define ROM_MAP_FILL    (ROM_MAP_SLOTS * 3 / 4)
+
+typedef struct {
+    uint64_t rom;                       /* 0 = empty */
+    int16_t  index;                     /* -1 = not on a bus */
+    char     alias[DS18B20_ALIAS_LEN];  /* "" = none */
+} entry_t;
+
+typedef struct {
+    uint64_t rom;
+    char     alias[DS18B20_ALIAS_LEN];
+} alias_rec_t;
+
+static entry_t     s_map[ROM_MAP_SLOTS];
+static int         s_used;
+static int         s_aliases;
+static atomic_uint s_seq;               /* odd while s_map is written */
+static atomic_flag s_writer = ATOMIC_FLAG_INIT;
+static atomic_flag s_saver  = ATOMIC_FLAG_INIT;     /* alias change + NVS write */
+static atomic_bool s_loaded;
+
+/* -------------------------------------------------------------------------
+ * Hash table -- writers hold s_writer and bump s_seq around changes
+ * ------------------------------------------------------------------------- */
+
+static uint32_t home(uint64_t rom)
+{
+    return (uint32_t)(((rom >> 8) * 0x9E3779B97F4A7C15ULL) >> 40) & ROM_MAP_MASK;
+}
+
+/* Slot holding `rom`, or the empty slot where it would go */
+static uint32_t probe(uint64_t rom)
+{
+    uint32_t i = home(rom);
+    while (s_map[i].rom != 0 && s_map[i].rom != rom) i = (i + 1) & ROM_MAP_MASK;
+    return i;
+}
+
+static void write_begin(void)
+{
+    while (atomic_flag_test_and_set(&s_writer)) vTaskDelay(1);
+    atomic_fetch_add(&s_seq, 1);
+}
+
+static void write_end(void)
+{
+    atomic_fetch_add(&s_seq, 1);
+    atomic_flag_clear(&s_writer);
+}
+
+/* Entry for `rom`, created if absent; NULL when the table is full */
+static entry_t *upsert(uint64_t rom)
+{
+    uint32_t i = probe(rom);
+    if (s_map[i].rom == 0) {
+        if (s_used >= ROM_MAP_FILL) return NULL;
+        s_map[i].rom      = rom;
+        s_map[i].index    = -1;
+        s_map[i].alias[0] = '\0';
+        s_used++;
+    }
+    return &s_map[i];
+}
+
+/* Drop the entry at slot i if nothing refers to it any more */
+static void release(uint32_t i)
+{
+    if (s_map[i].index >= 0 || s_map[i].alias[0] != '\0') return;
+
+    /* Backward shift: move later members of the run into the hole */
+    for (uint32_t j = (i + 1) & ROM_MAP_MASK; s_map[j].rom != 0;
+         j = (j + 1) & ROM_MAP_MASK) {
+        uint32_t k = home(s_map[j].rom);
+        bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (stays) continue;
+        s_map[i] = s_map[j];
+        i = j;
+    }
+    memset(&s_map[i], 0, sizeof(s_map[i]));
+    s_used--;
+}
+
+/* Copy of the entry for `rom`; false if there is none */
+static bool lookup(uint64_t rom, entry_t *out)
+{
+    if (rom == 0) return false;
+    for (;;) {
+        unsigned seq = atomic_load(&s_seq);
+        if (seq & 1) {
+            vTaskDelay(1);              /* writer mid-change */
+            continue;
+        }
+        uint32_t i = home(rom);
+        for (int n = 0; n < ROM_MAP_SLOTS && s_map[i].rom != 0 && s_map[i].rom != rom; n++) {
+            i = (i + 1) & ROM_MAP_MASK;
+        }
+        memcpy(out, &s_map[i], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load(&s_seq) == seq) return out->rom == rom;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * NVS
+ * ------------------------------------------------------------------------- */
+
+/* Copy the aliases into recs (DS18B20_MAX_SENSORS long) -- caller holds
+ * s_writer; the NVS write happens after write_end() */
+static int collect(alias_rec_t *recs)
+{
+    int n = 0;
+    for (int i = 0; i < ROM_MAP_SLOTS && n < DS18B20_MAX_SENSORS; i++) {
+        if (s_map[i].rom == 0 || s_map[i].alias[0] == '\0') continue;
+        recs[n].rom = s_map[i].rom;
+        memcpy(recs[n].alias, s_map[i].alias, DS18B20_ALIAS_LEN);
+        n++;
+    }
+    return n;
+}
+
+/* Caller holds s_saver, so the last change is also the last one written */
+static esp_err_t persist(const alias_rec_t *recs, int n)
+{
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = n > 0 ? nvs_set_blob(h, NVS_KEY, recs, (size_t)n * sizeof(alias_rec_t))
+                    : nvs_erase_key(h, NVS_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    return err;
+}
+
+static bool alias_ok(const char *a)
+{
+    size_t n = strlen(a);
+    if (n == 0 || n >= DS18B20_ALIAS_LEN) return false;
+    if (strcmp(a, "batch") == 0 || strcmp(a, "cbor") == 0) return false;  /* topic levels */
+    uint64_t rom;
+    if (ds18b20_rom_parse(a, &rom)) return false;   /* reads as another probe's name */
+    for (size_t i = 0; i < n; i++) {
+        char c = a[i];
+        if (!isalnum((unsigned char)c) && c != '_' && c != '.' && c != '-') return false;
+    }
+    return true;
+}
+
+/* Another ROM code already has this alias -- caller holds s_writer */
+static bool alias_taken(const char *alias)
+{
+    for (int i = 0; i < ROM_MAP_SLOTS; i++) {
+        if (s_map[i].rom != 0 && strcmp(s_map[i].alias, alias) == 0) return true;
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t ds18b20_rom_map_init(void)
+{
+    if (atomic_exchange(&s_loaded, true)) return ESP_OK;
+
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return ESP_OK;
+
+    size_t len = 0;
+    esp_err_t err = nvs_get_blob(h, NVS_KEY, NULL, &len);
+    if (err != ESP_OK || len == 0 || len % sizeof(alias_rec_t) != 0) {
+        nvs_close(h);
+        return ESP_OK;
+    }
+    alias_rec_t *recs = malloc(len);
+    if (recs == NULL) {
+        nvs_close(h);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(h, NVS_KEY, recs, &len);
+    nvs_close(h);
+
+    int n = err == ESP_OK ? (int)(len / sizeof(alias_rec_t)) : 0;
+    write_begin();
+    for (int i = 0; i < n; i++) {
+        recs[i].alias[DS18B20_ALIAS_LEN - 1] = '\0';
+        if (recs[i].rom == 0 || !alias_ok(recs[i].alias)) continue;
+        entry_t *e = upsert(recs[i].rom);
+        if (e == NULL) break;
+        if (e->alias[0] == '\0') s_aliases++;
+        memcpy(e->alias, recs[i].alias, DS18B20_ALIAS_LEN);
+    }
+    write_end();
+    free(recs);
+
+    ESP_LOGI(TAG, "%d alias(es) loaded", s_aliases);
+    return ESP_OK;
+}
+
+void ds18b20_rom_map_clear_index(void)
+{
+    write_begin();
+    for (uint32_t i = 0; i < ROM_MAP_SLOTS; ) {
+        if (s_map[i].rom == 0 || s_map[i].index < 0) {
+            i++;
+            continue;
+        }
+        s_map[i].index = -1;
+        uint32_t before = (uint32_t)s_used;
+        release(i);
+        if ((uint32_t)s_used == before) i++;   /* kept: alias */
+        /* else something may have shifted into slot i -- look again */
+    }
+    write_end();
+}
+
+esp_err_t ds18b20_rom_map_set_index(uint64_t rom, int index)
+{
+    if (rom == 0) return ESP_ERR_INVALID_ARG;
+    write_begin();
+    entry_t *e = upsert(rom);
+    if (e != NULL) e->index = (int16_t)index;
+    write_end();
+    return e != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+int ds18b20_rom_map_find(uint64_t rom)
+{
+    entry_t e;
+    return lookup(rom, &e) ? e.index : -1;
+}
+
+esp_err_t ds18b20_rom_map_set_alias(uint64_t rom, const char *alias)
+{
+    if (rom == 0) return ESP_ERR_INVALID_ARG;
+    if (alias == NULL) alias = "";
+    if (alias[0] != '\0' && !alias_ok(alias)) return ESP_ERR_INVALID_ARG;
+
+    alias_rec_t *recs = malloc(DS18B20_MAX_SENSORS * sizeof(alias_rec_t));
+    if (recs == NULL) return ESP_ERR_NO_MEM;
+
+    while (atomic_flag_test_and_set(&s_saver)) vTaskDelay(1);
+    write_begin();
+    esp_err_t err   = ESP_OK;
+    int       nrecs = -1;                   /* >= 0: changed, write to NVS */
+    uint32_t  i     = probe(rom);
+    bool      had = s_map[i].rom == rom && s_map[i].alias[0] != '\0';
+
+    if (alias[0] == '\0') {
+        if (had) {
+            s_map[i].alias[0] = '\0';
+            s_aliases--;
+            release(i);
+            nrecs = collect(recs);
+        }
+    } else if (had && strcmp(s_map[i].alias, alias) == 0) {
+        /* unchanged */
+    } else if (alias_taken(alias)) {
+        err = ESP_ERR_INVALID_STATE;    /* two probes, one topic */
+    } else if (!had && s_aliases >= DS18B20_MAX_SENSORS) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        entry_t *e = upsert(rom);
+        if (e == NULL) {
+            err = ESP_ERR_NO_MEM;
+        } else {
+            if (!had) s_aliases++;
+            snprintf(e->alias, sizeof(e->alias), "%s", alias);
+            nrecs = collect(recs);
+        }
+    }
+    write_end();
+
+    if (nrecs >= 0) err = persist(recs, nrecs);
+    atomic_flag_clear(&s_saver);
+    free(recs);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "%016" PRIX64 " -> '%s'", rom, alias);
+    } else {
+        ESP_LOGW(TAG, "Alias '%s' for %016" PRIX64 ": %s", alias, rom,
+                 esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool ds18b20_rom_map_alias(uint64_t rom, char *out, size_t size)
+{
+    entry_t e;
+    if (!lookup(rom, &e) || e.alias[0] == '\0') return false;
+    snprintf(out, size, "%s", e.alias);
+    return true;
+}
+
+void ds18b20_rom_name(uint64_t rom, char *out, size_t size)
+{
+    if (!ds18b20_rom_map_alias(rom, out, size)) {
+        snprintf(out, size, "%016" PRIX64, rom);
+    }
+}
+
+bool ds18b20_rom_parse(const char *hex, uint64_t *rom)
+{
+    if (hex == NULL || strlen(hex) != 16) return false;
+    uint64_t v = 0;
+    for (int i = 0; i < 16; i++) {
+        char c = hex[i];
+        int  d = isdigit((unsigned char)c) ? c - '0'
+               : isxdigit((unsigned char)c) ? toupper((unsigned char)c) - 'A' + 10 : -1;
+        if (d < 0) return false;
+        v = (v << 4) | (uint64_t)d;
+    }
+    *rom = v;
+    return true;
+}
+
+int ds18b20_rom_map_alias_count(void)
+{
+    return s_aliases;
+}
@@ -0,0 +1,81 @@
+/*
+ * ds18b20_rom_map.h - DS18B20 identity: ROM code -> table index and location
+ *
+ * Sensors are identified by their 64-bit 1-Wire ROM code, not by their
+ * enumeration index, which shifts when a probe fails or one is added.
+ * A small open-addressing hash (linear probing, at least twice as many
+ * slots as DS18B20_MAX_SENSORS) maps a ROM code to
+ *
+ *   index   the sensor's current position in the ds18b20_temp table, -1
+ *           while the probe is not on a bus; set by the sensor task at
+ *           every table (re)build
+ *   alias   an optional location name ("coldroom-3"), kept in NVS
+ *           (namespace "ds18b20", blob "alias"); swapping a probe means
+ *           moving its alias to the new ROM code
+ *
+ * Readers are lock-free and O(1): they copy under a sequence counter that
+ * is odd while a writer is at work, like config_store_get().  Writers (the
+ * sensor task and the "alias" RPC) serialise on an atomic flag; an alias
+ * change writes NVS after releasing it.
+ *
+ * Aliases are 1..DS18B20_ALIAS_LEN-1 chars of [A-Za-z0-9_.-], so they can
+ * stand in for the ROM code as a topic level ("batch" and "cbor" are taken,
+ * and so is anything that parses as a ROM code: 16 hex digits).
+ */
+
+#ifndef DS18B20_ROM_MAP_H
+#define DS18B20_ROM_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DS18B20_ALIAS_LEN       16
+#define DS18B20_ROM_HEX_LEN     17      /* 16 hex digits + NUL */
+
+/** Load the aliases from NVS.  Once; later calls do nothing. */
+esp_err_t ds18b20_rom_map_init(void);
+
+/** Mark every ROM code as not on a bus (sensor task, before a rebuild). */
+void ds18b20_rom_map_clear_index(void);
+
+/** Record the table index of `rom` (sensor task, during a rebuild). */
+esp_err_t ds18b20_rom_map_set_index(uint64_t rom, int index);
+
+/** Table index of `rom`, -1 if the sensor is not in the table. */
+int ds18b20_rom_map_find(uint64_t rom);
+
+/**
+ * Set, change or (with "" / NULL) remove the alias of `rom` and persist
+ * the alias map.
+ * @return ESP_ERR_INVALID_ARG for a bad name, ESP_ERR_INVALID_STATE if
+ *         another ROM code has it, ESP_ERR_NO_MEM if the map is full, or
+ *         the NVS error (the alias is in effect until the next boot)
+ */
+esp_err_t ds18b20_rom_map_set_alias(uint64_t rom, const char *alias);
+
+/** Copy the alias of `rom` into `out`; false if it has none. */
+bool ds18b20_rom_map_alias(uint64_t rom, char *out, size_t size);
+
+/**
+ * The sensor's name for topics and logs: its alias, else the ROM code as
+ * 16 upper-case hex digits.  `size` >= DS18B20_ROM_HEX_LEN.
+ */
+void ds18b20_rom_name(uint64_t rom, char *out, size_t size);
+
+/** Parse 16 hex digits; false if `hex` is anything else. */
+bool ds18b20_rom_parse(const char *hex, uint64_t *rom);
+
+/** Aliases stored, for the health payload. */
+int ds18b20_rom_map_alias_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DS18B20_ROM_MAP_H */
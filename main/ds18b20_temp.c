@@ -27,6 +27,85 @@
  *        multi  sensor:  /ESP32P4/AABBCCA1B2C3/temperature/0
  *                        /ESP32P4/AABBCCA1B2C3/temperature/1  ...
  *      s_mac_id is populated by mqtt_service before this task publishes.
+ *
+ *  [CBOR] Binary payload option
+ *      When mqtt_service reports MQTT_PAYLOAD_FORMAT_CBOR each reading is
+ *      published as a single CBOR float (half precision -- 3 bytes, exact
+ *      for the sensor's 1/16 degC steps) on the same topic + "/cbor".
+ *      The "%.2f" text is only formatted for JSON.  Bytes and cycles per
+ *      message of both encodings: make -C tools/host bench.
+ *
+ *  [BATCH] Batched multi-sensor frames
+ *      CONFIG_DS18B20_PUBLISH_{SINGLE,BATCH,BOTH}: per-sensor topics, one
+ *      frame per cycle on /<MAC>/temperature/batch (ROM id, value, read
+ *      time and quality of every sensor), or both.
+ *
+ *  [HEALTH] Health payload provider
+ *      Registers "ds18b20": sensor count, messages, read errors, age of
+ *      the last good reading and the last value of every sensor.
+ *
+ *  [NB] Non-blocking publish
+ *      Readings go out through mqtt_service_try_publish().  One refused
+ *      with WOULD_BLOCK / NO_MEM is skipped and counted as "skip".
+ *
+ *  [CFG] Runtime-configurable cycle
+ *      The period is config_store sensor_period_ms.  A change wakes the
+ *      task, which re-times the current wait; the wait is sliced for the
+ *      supervisor heartbeat and is_healthy() scales with the period.
+ *
+ *  [RPC] On-demand query
+ *      "temps" RPC method: ROM id and last value of every sensor and the
+ *      age of the last good reading.
+ *
+ *  [BCAST] Bus-wide conversion
+ *      One reset + Skip ROM + Convert T starts every sensor on a bus; the
+ *      scratchpads are then read one by one with Match ROM.  A failed
+ *      broadcast counts the cycle's reads as errors.
+ *
+ *  [RES] Per-sensor resolution, exact conversion time
+ *      config_store sensor_bits sets the resolution, per ROM if given, at
+ *      start and on change.  The cycle waits the conversion time of the
+ *      finest resolution on the bus, or polls read slots when every
+ *      sensor has VDD (Read Power Supply at start).
+ *
+ *  [BUS] Several buses, sensor table sized at run time
+ *      CONFIG_DS18B20_BUS_GPIOS lists up to DS18B20_MAX_BUSES GPIOs.  The
+ *      table grows to CONFIG_DS18B20_MAX_SENSORS; sensors past it are
+ *      counted.  Buses 1..n have a worker task, the sensor task runs bus 0
+ *      and joins the rest.  A bus not done within BUS_JOIN_MS counts its
+ *      reads as failed and gets no new cycle until it is done.  Batch
+ *      frames, health "t" and RPC "temps" are chunked; past BATCH_CHUNK
+ *      sensors the cycle goes out as batch frames only.
+ *
+ *  [ROM] ROM codes cached in NVS, background re-scan
+ *      ROM codes per GPIO in NVS ("ds18b20"); a valid cache and a presence
+ *      pulse skip the search.  Each bus is searched again after its cycle
+ *      every CONFIG_DS18B20_RESCAN_S (and once after a cached start); a
+ *      change rewrites the cache and the table is rebuilt in its
+ *      never-freed chunks.  A GPIO with no sensors gets no bus and is only
+ *      reset when due (at most EMPTY_RETRY_S apart while the table is
+ *      empty); a presence pulse rebuilds the table.
+ *
+ *  [ID] Sensors identified by ROM code
+ *      Topics are /<MAC>/temperature/<alias or ROM hex>; readings, batch
+ *      frames and RPC "temps" carry the ROM code and "loc".
+ *      ds18b20_rom_map.c keeps the ROM -> index / alias hash and the
+ *      aliases (RPC "alias").
+ *
+ *  [RPT] Report on change
+ *      A sensor is published when it moved more than report_db from its
+ *      last report, not sooner than report_min_ms, or after report_max_s
+ *      as a heartbeat.  Only an accepted publish counts; the event queue
+ *      gets every reading.  Health "sent" / "supp".
+ *
+ *  [FILT] Sample filter
+ *      Good reads pass ds18b20_filter (config_store filter_*) on the bus's
+ *      task.  A rejected sample fails the read; "rej" and "crc" per sensor
+ *      in RPC "temps", summed in health.
+ *
+ *  [HIST] History in PSRAM
+ *      Filtered readings also go to ds18b20_history (raw last hour, 1 min
+ *      and 15 min rollups); RPC "history" pages through one tier.
  */
 
 #include "ds18b20_temp.h"
@@ -38,7 +117,24 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "onewire_bus.h"
+#include "onewire_cmd.h"
+#include "onewire_crc.h"
 #include "ds18b20.h"
+#include "cbor_writer.h"
+#include "health_payload.h"
+#include "config_store.h"
+#include "mqtt_rpc.h"
+#include "ds18b20_rom_map.h"
+#include "ds18b20_filter.h"
+#include "ds18b20_history.h"
+#include "nvs.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 static const char *TAG = "ds18b20-temp";
 
@@ -53,10 +149,101 @@ extern char s_mac_id[];
 /* Seconds without a successful reading before is_healthy() returns false */
 #define HEALTH_STALE_S   120
 
+/* [CFG] Longest sleep between heartbeats (supervisor timeout is 60 s) */
+#define HEARTBEAT_SLICE_MS  10000
+
+/* [BATCH] Publish mode -- per-sensor topics, one batched frame, or both */
+#if defined(CONFIG_DS18B20_PUBLISH_BATCH)
+#define DS18B20_PUBLISH_SINGLE   0
+#define DS18B20_PUBLISH_BATCH    1
+#elif defined(CONFIG_DS18B20_PUBLISH_BOTH)
+#define DS18B20_PUBLISH_SINGLE   1
+#define DS18B20_PUBLISH_BATCH    1
+#else
+#define DS18B20_PUBLISH_SINGLE   1
+#define DS18B20_PUBLISH_BATCH    0
+#endif
+
+/* [BCAST] DS18B20 function commands, sent after Skip ROM */
+#define DS18B20_CMD_CONVERT_T    0x44
+#define DS18B20_CMD_READ_POWER   0xB4
+
+#ifndef CONFIG_DS18B20_RESOLUTION
+#define CONFIG_DS18B20_RESOLUTION   12
+#endif
+
+/* [RES] Read-slot poll interval while a conversion runs (>= one tick) */
+#define CONVERSION_POLL_MS  10
+
+/* [RES] Datasheet max conversion time for 9, 10, 11, 12 bit (93.75 ms ...) */
+static const uint16_t s_conv_ms[4] = { 94, 188, 375, 750 };
+
+/* [BUS] Table growth step, bus worker stack, longest wait for a bus */
+#define SENSOR_TABLE_STEP   8
+#define SENSOR_CHUNKS       ((DS18B20_MAX_SENSORS + SENSOR_TABLE_STEP - 1) / SENSOR_TABLE_STEP)
+#define BUS_WORKER_STACK    3072
+#define BUS_JOIN_MS         5000
+
+/* [BUS] Sensors per batch frame / health array / RPC reply */
+#define BATCH_CHUNK         16
+#define HEALTH_TEMPS_MAX    16
+#define RPC_TEMPS_MAX       8
+#define HISTORY_PAGE        32      /* [HIST] points per "history" reply */
+
+/* [BATCH] ~75 B of JSON per sensor (+22 with "loc") plus the frame header */
+#define DS18B20_BATCH_FRAME_SIZE  (64 + BATCH_CHUNK * 104)
+
+/* [ROM] Seconds between bus searches, 0 = only at an uncached start */
+#ifndef CONFIG_DS18B20_RESCAN_S
+#define CONFIG_DS18B20_RESCAN_S     600
+#endif
+#define EMPTY_RETRY_S       60      /* [ROM] longest wait with no sensor at all */
+#define ROM_NVS_NAMESPACE   "ds18b20"
+#define DS18B20_FAMILY_CODE 0x28
+
 /* -------------------------------------------------------------------------
  * Service context
  * ------------------------------------------------------------------------- */
 
+/** One sensor's result for the current conversion cycle [BATCH]. */
+typedef struct {
+    float    temperature;
+    int64_t  read_us;       /* esp_timer_get_time() when the read completed */
+    bool     ok;            /* false: read failed, temperature is stale     */
+} cycle_sample_t;
+
+/* [BUS] Written by its bus's pipeline only; read by the sensor task after
+ * the join and, without locking, by health / RPC (a torn read costs one
+ * sample). */
+typedef struct {
+    ds18b20_device_handle_t handle;
+    uint64_t                address;        /* [BATCH] ROM id */
+    float                   last_temperature;
+    cycle_sample_t          cur;
+    uint8_t                 bus;
+    uint8_t                 bits;           /* [RES] 0 = not set */
+    bool                    due;            /* [RPT] publish this cycle */
+    float                   reported;       /* [RPT] last value published */
+    int64_t                 reported_us;    /* [RPT] 0 = not yet */
+    ds18b20_filter_t        filter;         /* [FILT] */
+    uint32_t                rejected;       /* [FILT] samples dropped */
+    uint32_t                crc_errors;     /* [FILT] */
+} sensor_t;
+
+typedef struct {
+    onewire_bus_handle_t    handle;
+    int                     gpio;
+    int                     first;          /* sensors [first, first + count) */
+    int                     count;
+    bool                    parasite;       /* [RES] */
+    uint32_t                conv_ms;        /* [RES] last wait */
+    TaskHandle_t            worker;         /* NULL: run by the sensor task */
+    atomic_uint             done_cycle;
+    atomic_bool             busy;           /* worker given a cycle, not done */
+    int                     seen;           /* [ROM] ROM codes at init */
+    int64_t                 next_scan_us;   /* [ROM] */
+} bus_t;
+
 typedef struct {
     QueueHandle_t  event_queue;
     TaskHandle_t   task_handle;
@@ -64,181 +251,1309 @@ typedef struct {
     uint32_t       message_count;
     int64_t        last_reading_us;   /* esp_timer_get_time() at last good read */
 
-    onewire_bus_handle_t    bus;
-    ds18b20_device_handle_t sensors[DS18B20_MAX_SENSORS];
+    bus_t                   buses[DS18B20_MAX_BUSES];         /* [BUS] */
+    int                     bus_count;
+    sensor_t               *chunks[SENSOR_CHUNKS];            /* [ROM] never freed */
+    int                     sensor_cap;
     int                     sensor_count;
-    float                   last_temperatures[DS18B20_MAX_SENSORS];
+    uint32_t                sensors_over;                     /* [BUS] not tracked */
+    QueueHandle_t           bus_done;                         /* [BUS] bus index */
+    volatile uint32_t       cycle;                            /* [BUS] */
+    uint32_t                joined;                           /* [BUS] bus mask */
+    volatile bool           workers_run;                      /* [ROM] */
+    atomic_bool             rebuild;                          /* [ROM] */
+    int64_t                 next_init_us;                     /* [ROM] probe `empty` */
+    int                     empty[DS18B20_MAX_BUSES];         /* [ROM] GPIOs, nobody */
+    int                     empty_count;
+    uint32_t                cached;                           /* [ROM] */
+    uint32_t                init_ms;                          /* [ROM] */
+    atomic_uint             scans;                            /* [ROM] */
+    atomic_uint             scan_changes;                     /* [ROM] */
+    atomic_uint             read_errors;                      /* [HEALTH] */
+    uint32_t                publish_skipped;                  /* [NB] */
+    atomic_uint             period_ms;                        /* [CFG] */
+    atomic_bool             res_changed;                      /* [RES] */
+    atomic_uint             report_db;                        /* [RPT] 0.01 degC */
+    atomic_uint             report_min_ms;                    /* [RPT] */
+    atomic_uint             report_max_s;                     /* [RPT] */
+    uint32_t                reports_sent;                     /* [RPT] */
+    uint32_t                reports_suppressed;               /* [RPT] */
+    bool                    single_off;                       /* [BUS] > BATCH_CHUNK */
+    atomic_uint             filter_slew;                      /* [FILT] 0.01 degC/s */
+    atomic_uint             filter_ema;                       /* [FILT] percent */
+    atomic_bool             filter_median;                    /* [FILT] */
+    atomic_uint             rejected;                         /* [FILT] */
+    atomic_uint             crc_errors;                       /* [FILT] */
 } ds18b20_temp_ctx_t;
 
 static ds18b20_temp_ctx_t s_ctx = {0};
 
+/* [ROM] Sensor i; the caller keeps i below sensor_count */
+static inline sensor_t *sensor_at(int i)
+{
+    return &s_ctx.chunks[i / SENSOR_TABLE_STEP][i % SENSOR_TABLE_STEP];
+}
+
+/* -------------------------------------------------------------------------
+ * [RES] Resolution and conversion timing
+ * ------------------------------------------------------------------------- */
+
+/* [RES] Resolution for `rom` in a sensor_bits spec (see config_store.h) */
+static uint8_t bits_for(const char *spec, uint64_t rom)
+{
+    uint8_t all = CONFIG_DS18B20_RESOLUTION;
+    char    hex[17];
+    snprintf(hex, sizeof(hex), "%016" PRIX64, rom);
+
+    for (const char *p = spec; *p; ) {
+        const char *colon = strchr(p, ':');
+        const char *comma = strchr(p, ',');
+        if (colon != NULL && (comma == NULL || colon < comma)) {
+            if (strncasecmp(p, hex, 16) == 0) return (uint8_t)atoi(colon + 1);
+        } else {
+            all = (uint8_t)atoi(p);
+        }
+        if (comma == NULL) break;
+        p = comma + 1;
+    }
+    return all;
+}
+
+/* [RES] Write changed resolutions to the scratchpads -- buses idle */
+static void apply_resolution(void)
+{
+    app_config_t cfg;
+    config_store_get(&cfg);
+
+    for (int i = 0; i < s_ctx.sensor_count; i++) {
+        sensor_t *s = sensor_at(i);
+        uint8_t bits = bits_for(cfg.sensor_bits, s->address);
+        if (bits < 9 || bits > 12) bits = 12;
+        if (bits == s->bits) continue;
+
+        esp_err_t err = ds18b20_set_resolution(s->handle,
+                                               (ds18b20_resolution_t)(bits - 9));
+        if (err != ESP_OK) {
+            /* Unknown state: time it like a power-on default (12 bit) */
+            ESP_LOGW(TAG, "Resolution for sensor[%d] not set: %s",
+                     i, esp_err_to_name(err));
+            s->bits = 0;
+            continue;
+        }
+        s->bits = bits;
+        ESP_LOGI(TAG, "Sensor[%d] %u-bit", i, (unsigned)bits);
+    }
+}
+
+/* [RES] Any sensor without VDD pulls the bus low after Read Power Supply */
+static bool bus_has_parasite(const bus_t *b)
+{
+    static const uint8_t cmd[] = { ONEWIRE_CMD_SKIP_ROM, DS18B20_CMD_READ_POWER };
+    uint8_t vdd = 0;
+
+    if (onewire_bus_reset(b->handle) != ESP_OK ||
+        onewire_bus_write_bytes(b->handle, cmd, sizeof(cmd)) != ESP_OK ||
+        onewire_bus_read_bit(b->handle, &vdd) != ESP_OK) {
+        return true;                    /* unknown: do not poll */
+    }
+    return vdd == 0;
+}
+
+/* [RES] Wait until the conversion started by convert_all() is done */
+static void wait_conversion(bus_t *b)
+{
+    uint8_t bits = 9;
+    for (int i = b->first; i < b->first + b->count; i++) {
+        uint8_t sb = sensor_at(i)->bits ? sensor_at(i)->bits : 12;
+        if (sb > bits) bits = sb;
+    }
+    const uint32_t max_ms = s_conv_ms[bits - 9];
+    const int64_t  t0     = esp_timer_get_time();
+
+    /* vTaskDelay(n) may return up to a tick early -- round up, add one */
+    TickType_t max_ticks = (max_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS + 1;
+
+    if (b->parasite) {
+        vTaskDelay(max_ticks);
+    } else {
+        TickType_t step = pdMS_TO_TICKS(CONVERSION_POLL_MS);
+        if (step == 0) step = 1;
+        TickType_t start = xTaskGetTickCount();
+        for (;;) {
+            vTaskDelay(step);
+            uint8_t done = 0;
+            if (onewire_bus_read_bit(b->handle, &done) == ESP_OK && done) break;
+            if (xTaskGetTickCount() - start >= max_ticks) break;
+        }
+    }
+    b->conv_ms = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+}
+
 /* -------------------------------------------------------------------------
  * Hardware init / cleanup
  * ------------------------------------------------------------------------- */
 
-static esp_err_t hw_init(void)
+/* [BUS] Room for one more sensor; false at CONFIG_DS18B20_MAX_SENSORS */
+static bool sensor_table_grow(void)
+{
+    if (s_ctx.sensor_count >= DS18B20_MAX_SENSORS) return false;
+    if (s_ctx.sensor_count < s_ctx.sensor_cap) return true;
+
+    /* [ROM] A new chunk, not a realloc: readers may hold a pointer */
+    sensor_t *c = calloc(SENSOR_TABLE_STEP, sizeof(sensor_t));
+    if (c == NULL) {
+        ESP_LOGE(TAG, "No memory for %d sensors",
+                 s_ctx.sensor_cap + SENSOR_TABLE_STEP);
+        return false;
+    }
+    s_ctx.chunks[s_ctx.sensor_cap / SENSOR_TABLE_STEP] = c;
+    s_ctx.sensor_cap += SENSOR_TABLE_STEP;
+    return true;
+}
+
+/* -------------------------------------------------------------------------
+ * [ROM] ROM code cache and bus search
+ * ------------------------------------------------------------------------- */
+
+/* Time of the next periodic search after `now`; never with RESCAN_S 0 */
+static int64_t next_scan(int64_t now)
+{
+    return CONFIG_DS18B20_RESCAN_S > 0 ? now + CONFIG_DS18B20_RESCAN_S * 1000000LL
+                                       : INT64_MAX;
+}
+
+/* Seconds until the empty GPIOs are probed again, 0 = never.  With no
+ * sensor at all the wait is capped at EMPTY_RETRY_S, also with RESCAN_S 0 */
+static int empty_retry_s(void)
+{
+    if (s_ctx.empty_count == 0) return 0;
+    if (s_ctx.sensor_count > 0) return CONFIG_DS18B20_RESCAN_S;
+    return CONFIG_DS18B20_RESCAN_S > 0 && CONFIG_DS18B20_RESCAN_S < EMPTY_RETRY_S
+           ? CONFIG_DS18B20_RESCAN_S : EMPTY_RETRY_S;
+}
+
+/* Does anybody answer the reset on one of the empty GPIOs? */
+static bool empty_answers(void)
+{
+    onewire_bus_rmt_config_t rmt_cfg = { .max_rx_bytes = 10 };
+    for (int i = 0; i < s_ctx.empty_count; i++) {
+        onewire_bus_config_t bus_cfg = {
+            .bus_gpio_num = s_ctx.empty[i],
+            .flags        = { .en_pull_up = true },
+        };
+        onewire_bus_handle_t h;
+        if (onewire_new_bus_rmt(&bus_cfg, &rmt_cfg, &h) != ESP_OK) continue;
+        bool present = onewire_bus_reset(h) == ESP_OK;
+        onewire_bus_del(h);
+        if (present) {
+            ESP_LOGI(TAG, "GPIO%d: presence pulse -- rebuilding", s_ctx.empty[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Family code and CRC-8 of a ROM code read back from NVS */
+static bool rom_valid(uint64_t rom)
+{
+    uint8_t b[8];
+    for (int k = 0; k < 8; k++) b[k] = (uint8_t)(rom >> (8 * k));
+    return b[0] == DS18B20_FAMILY_CODE && onewire_crc8(0, b, 7) == b[7];
+}
+
+/* Cached ROM codes of the bus on `gpio`; 0 if none or not valid */
+static int rom_cache_load(int gpio, uint64_t *roms, int max)
+{
+    char key[12];
+    snprintf(key, sizeof(key), "gpio%d", gpio);
+
+    nvs_handle_t h;
+    if (nvs_open(ROM_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return 0;
+    size_t len = (size_t)max * sizeof(uint64_t);
+    esp_err_t err = nvs_get_blob(h, key, roms, &len);
+    nvs_close(h);
+    if (err != ESP_OK || len == 0 || len % sizeof(uint64_t) != 0) return 0;
+
+    int n = (int)(len / sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        if (!rom_valid(roms[i])) {
+            ESP_LOGW(TAG, "GPIO%d: ROM cache corrupt -- searching the bus", gpio);
+            return 0;
+        }
+    }
+    return n;
+}
+
+static void rom_cache_save(int gpio, const uint64_t *roms, int n)
+{
+    char key[12];
+    snprintf(key, sizeof(key), "gpio%d", gpio);
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(ROM_NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = n > 0 ? nvs_set_blob(h, key, roms, (size_t)n * sizeof(uint64_t))
+                    : nvs_erase_key(h, key);
+        if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "GPIO%d: ROM cache not saved: %s", gpio, esp_err_to_name(err));
+    }
+}
+
+/*
+ * Search the bus: up to `max` DS18B20 ROM codes into `roms`, *found is the
+ * number of devices seen.  -1 if the search failed part way.
+ */
+static int scan_bus(onewire_bus_handle_t bus, uint64_t *roms, int max, int *found)
 {
-    ESP_LOGI(TAG, "Initialising DS18B20 on GPIO%d", DS18B20_DEFAULT_GPIO);
+    onewire_device_iter_handle_t iter = NULL;
+    esp_err_t err = onewire_new_device_iter(bus, &iter);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create device iterator: %s", esp_err_to_name(err));
+        return -1;
+    }
+
+    onewire_device_t dev;
+    int n = 0;
+    *found = 0;
+    while ((err = onewire_device_iter_get_next(iter, &dev)) == ESP_OK) {
+        if ((dev.address & 0xFF) != DS18B20_FAMILY_CODE) continue;
+        (*found)++;
+        if (n < max) roms[n++] = dev.address;
+    }
+    onewire_del_device_iter(iter);
+    return err == ESP_ERR_NOT_FOUND ? n : -1;
+}
+
+/* [BUS] Create the bus on `gpio` and append its sensors to the table */
+static esp_err_t bus_init(bus_t *b, int gpio)
+{
+    ESP_LOGI(TAG, "Initialising DS18B20 bus %d on GPIO%d", s_ctx.bus_count, gpio);
 
     onewire_bus_config_t bus_cfg = {
-        .bus_gpio_num = DS18B20_DEFAULT_GPIO,
+        .bus_gpio_num = gpio,
         .flags        = { .en_pull_up = true },
     };
     onewire_bus_rmt_config_t rmt_cfg = { .max_rx_bytes = 10 };
 
-    esp_err_t ret = onewire_new_bus_rmt(&bus_cfg, &rmt_cfg, &s_ctx.bus);
+    memset(b, 0, sizeof(*b));
+    b->gpio  = gpio;
+    b->first = s_ctx.sensor_count;
+
+    uint64_t *roms = malloc(DS18B20_MAX_SENSORS * sizeof(uint64_t));
+    if (roms == NULL) return ESP_ERR_NO_MEM;
+
+    esp_err_t ret = onewire_new_bus_rmt(&bus_cfg, &rmt_cfg, &b->handle);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create 1-Wire bus: %s", esp_err_to_name(ret));
+        free(roms);
         return ret;
     }
 
-    onewire_device_iter_handle_t iter = NULL;
-    ret = onewire_new_device_iter(s_ctx.bus, &iter);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to create device iterator: %s", esp_err_to_name(ret));
-        return ret;
+    /* [ROM] Cached codes if somebody answers the reset, else a full search */
+    int  found = rom_cache_load(gpio, roms, DS18B20_MAX_SENSORS);
+    int  n     = found;
+    bool cached = n > 0 && onewire_bus_reset(b->handle) == ESP_OK;
+    if (cached) {
+        b->next_scan_us = 0;                    /* confirm after the first cycle */
+    } else {
+        n = scan_bus(b->handle, roms, DS18B20_MAX_SENSORS, &found);
+        if (n < 0) {
+            ESP_LOGW(TAG, "GPIO%d: bus search failed", gpio);
+            n = found = 0;
+        } else {
+            rom_cache_save(gpio, roms, n);
+        }
+        b->next_scan_us = next_scan(esp_timer_get_time());
     }
+    b->seen = n;
 
-    s_ctx.sensor_count = 0;
-    onewire_device_t dev;
-    esp_err_t search;
+    uint32_t over = (uint32_t)(found - n);
+    for (int i = 0; i < n; i++) {
+        if (!sensor_table_grow()) {
+            over += (uint32_t)(n - i);
+            break;
+        }
+        sensor_t *s = sensor_at(s_ctx.sensor_count);
+        onewire_device_t dev = { .bus = b->handle, .address = roms[i] };
+        ds18b20_config_t ds_cfg = {};
+        if (ds18b20_new_device_from_enumeration(&dev, &ds_cfg, &s->handle) == ESP_OK) {
+            memset(&s->cur, 0, sizeof(s->cur));
+            s->address          = roms[i];
+            s->bus              = (uint8_t)s_ctx.bus_count;
+            s->bits             = 0;
+            s->last_temperature = 0.0f;
+            s->due              = false;
+            s->reported         = NAN;                              /* [RPT] */
+            s->reported_us      = 0;
+            s->rejected         = 0;                                /* [FILT] */
+            s->crc_errors       = 0;
+            ds18b20_filter_reset(&s->filter);
+            ESP_LOGI(TAG, "%s DS18B20[%d] addr=%016" PRIX64, cached ? "Cached" : "Found",
+                     s_ctx.sensor_count, s->address);
+            s_ctx.sensor_count++;
+        }
+    }
+    free(roms);
 
-    do {
-        search = onewire_device_iter_get_next(iter, &dev);
-        if (search != ESP_OK) break;
+    if (over > 0) {
+        ESP_LOGW(TAG, "GPIO%d: %u sensor(s) beyond the table limit (%d) ignored",
+                 gpio, (unsigned)over, DS18B20_MAX_SENSORS);
+        s_ctx.sensors_over += over;
+    }
+    b->count = s_ctx.sensor_count - b->first;
+    if (cached) s_ctx.cached += (uint32_t)b->count;
+    if (b->count == 0) {
+        ESP_LOGW(TAG, "No DS18B20 sensors on GPIO%d", gpio);
+        onewire_bus_del(b->handle);
+        b->handle = NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
 
-        ds18b20_config_t ds_cfg = {};
-        if (ds18b20_new_device_from_enumeration(
-                &dev, &ds_cfg,
-                &s_ctx.sensors[s_ctx.sensor_count]) == ESP_OK) {
+    /* [RES] Power mode decides how the conversion wait is timed */
+    b->parasite = bus_has_parasite(b);
+    ESP_LOGI(TAG, "GPIO%d: %d sensor(s), %s power", gpio, b->count,
+             b->parasite ? "parasite" : "external");
+    return ESP_OK;
+}
 
-            uint64_t addr = 0;
-            ds18b20_get_device_address(s_ctx.sensors[s_ctx.sensor_count], &addr);
-            ESP_LOGI(TAG, "Found DS18B20[%d] addr=%016llX",
-                     s_ctx.sensor_count, addr);
+static void hw_cleanup(void)
+{
+    /* The table itself is kept for the next start: health / RPC may be
+     * reading it right now */
+    int n = s_ctx.sensor_count;
+    s_ctx.sensor_count = 0;
+    ds18b20_rom_map_clear_index();                                  /* [ID] */
+    for (int i = 0; i < n; i++) {
+        if (sensor_at(i)->handle != NULL) {
+            ds18b20_del_device(sensor_at(i)->handle);
+            sensor_at(i)->handle = NULL;
+        }
+    }
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        if (s_ctx.buses[b].handle != NULL) {
+            onewire_bus_del(s_ctx.buses[b].handle);
+            s_ctx.buses[b].handle = NULL;
+        }
+    }
+    s_ctx.bus_count = 0;
+}
 
-            s_ctx.last_temperatures[s_ctx.sensor_count] = 0.0f;
-            s_ctx.sensor_count++;
+static esp_err_t hw_init(void)
+{
+    const int64_t t0 = esp_timer_get_time();
+    s_ctx.sensor_count = 0;
+    s_ctx.sensors_over = 0;
+    s_ctx.bus_count    = 0;
+    s_ctx.cached       = 0;
 
-            if (s_ctx.sensor_count >= DS18B20_MAX_SENSORS) {
-                ESP_LOGI(TAG, "Max sensors (%d) reached", DS18B20_MAX_SENSORS);
-                break;
-            }
+    /* [BUS] "6" or "6,7,15" */
+    const char *p = CONFIG_DS18B20_BUS_GPIOS;
+    s_ctx.empty_count = 0;
+    while (*p && s_ctx.bus_count < DS18B20_MAX_BUSES) {
+        char *end;
+        long gpio = strtol(p, &end, 10);
+        if (end == p) break;
+        if (bus_init(&s_ctx.buses[s_ctx.bus_count], (int)gpio) == ESP_OK) {
+            s_ctx.bus_count++;
+        } else if (s_ctx.empty_count < DS18B20_MAX_BUSES) {
+            s_ctx.empty[s_ctx.empty_count++] = (int)gpio;
         }
-    } while (search != ESP_ERR_NOT_FOUND);
+        p = end;
+        while (*p == ',' || *p == ' ') p++;
+    }
+    if (*p) {
+        ESP_LOGW(TAG, "CONFIG_DS18B20_BUS_GPIOS: '%s' not used (max %d buses)",
+                 p, DS18B20_MAX_BUSES);
+    }
 
-    onewire_del_device_iter(iter);
+    /* [ROM] Empty GPIOs are probed on their own; a presence pulse rebuilds */
+    const int retry_s = empty_retry_s();
+    s_ctx.next_init_us = retry_s > 0 ? esp_timer_get_time() + retry_s * 1000000LL
+                                     : INT64_MAX;
+    s_ctx.init_ms = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+
+    for (int i = 0; i < s_ctx.sensor_count; i++) {                  /* [ID] */
+        if (ds18b20_rom_map_set_index(sensor_at(i)->address, i) != ESP_OK) {
+            ESP_LOGW(TAG, "ROM map full -- sensor[%d] not indexed", i);
+        }
+    }
 
     if (s_ctx.sensor_count == 0) {
         ESP_LOGW(TAG, "No DS18B20 sensors found");
+        hw_cleanup();
         return ESP_ERR_NOT_FOUND;
     }
 
-    ESP_LOGI(TAG, "Found %d sensor(s)", s_ctx.sensor_count);
+    apply_resolution();                                             /* [RES] */
+
+    ESP_LOGI(TAG, "Found %d sensor(s) on %d bus(es) in %u ms (%u cached)",
+             s_ctx.sensor_count, s_ctx.bus_count, (unsigned)s_ctx.init_ms,
+             (unsigned)s_ctx.cached);
     return ESP_OK;
 }
 
-static void hw_cleanup(void)
+/* [BCAST] Start a conversion on every sensor: one bus transaction */
+static esp_err_t convert_all(const bus_t *b)
 {
-    for (int i = 0; i < s_ctx.sensor_count; i++) {
-        if (s_ctx.sensors[i] != NULL) {
-            ds18b20_del_device(s_ctx.sensors[i]);
-            s_ctx.sensors[i] = NULL;
+    static const uint8_t cmd[] = { ONEWIRE_CMD_SKIP_ROM, DS18B20_CMD_CONVERT_T };
+
+    esp_err_t err = onewire_bus_reset(b->handle);
+    if (err == ESP_OK) err = onewire_bus_write_bytes(b->handle, cmd, sizeof(cmd));
+    return err;
+}
+
+/* -------------------------------------------------------------------------
+ * [BUS] Per-bus pipeline: broadcast, wait, read every sensor of the bus
+ * ------------------------------------------------------------------------- */
+
+static void run_bus(bus_t *b, uint32_t cycle)
+{
+    const ds18b20_filter_cfg_t fcfg = {                             /* [FILT] */
+        .slew   = (uint16_t)atomic_load(&s_ctx.filter_slew),
+        .ema    = (uint8_t)atomic_load(&s_ctx.filter_ema),
+        .median = atomic_load(&s_ctx.filter_median),
+    };
+
+    for (int i = b->first; i < b->first + b->count; i++) {
+        sensor_at(i)->cur.ok = false;
+    }
+
+    esp_err_t conv = convert_all(b);                                /* [BCAST] */
+    if (conv != ESP_OK) {
+        ESP_LOGW(TAG, "GPIO%d: Convert T broadcast failed: %s",
+                 b->gpio, esp_err_to_name(conv));
+        atomic_fetch_add(&s_ctx.read_errors, (unsigned)b->count);
+    } else {
+        wait_conversion(b);                                         /* [RES] */
+
+        for (int i = b->first; i < b->first + b->count; i++) {
+            sensor_t *s = sensor_at(i);
+            float temp;
+            esp_err_t err = ds18b20_get_temperature(s->handle, &temp);
+            s->cur.read_us = esp_timer_get_time();
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "Read failed for sensor[%d]: %s",
+                         i, esp_err_to_name(err));
+                atomic_fetch_add(&s_ctx.read_errors, 1);
+                if (err == ESP_ERR_INVALID_CRC) {                   /* [FILT] */
+                    s->crc_errors++;
+                    atomic_fetch_add(&s_ctx.crc_errors, 1);
+                }
+                s->cur.temperature = s->last_temperature;
+                continue;
+            }
+            /* [FILT] Reject glitches, then median / EMA */
+            const float raw = temp;
+            ds18b20_filter_result_t fr =
+                ds18b20_filter_update(&s->filter, &fcfg, raw, s->cur.read_us, &temp);
+            if (fr != DS18B20_FILTER_OK) {
+                ESP_LOGW(TAG, "Sensor[%d]: %.2f°C dropped (%s)",
+                         i, raw, ds18b20_filter_result_str(fr));
+                s->rejected++;
+                atomic_fetch_add(&s_ctx.rejected, 1);
+                s->cur.temperature = s->last_temperature;
+                continue;
+            }
+            s->cur.temperature  = temp;
+            s->cur.ok           = true;
+            s->last_temperature = temp;
         }
     }
-    /* Uncomment if your SDK version exports onewire_del_bus():
-     * if (s_ctx.bus != NULL) { onewire_del_bus(s_ctx.bus); s_ctx.bus = NULL; }
-     */
+    atomic_store(&b->done_cycle, cycle);
+}
+
+/*
+ * [ROM] Search the bus again when due -- by the task that owns it, after its
+ * cycle.  A different set of ROM codes is cached and the sensor task
+ * rebuilds the table from it before the next cycle.
+ */
+static void rescan_bus(bus_t *b)
+{
+    const int64_t now = esp_timer_get_time();
+    if (now < b->next_scan_us) return;
+    b->next_scan_us = next_scan(now);
+
+    uint64_t *roms = malloc(DS18B20_MAX_SENSORS * sizeof(uint64_t));
+    if (roms == NULL) return;
+
+    int found;
+    int n = scan_bus(b->handle, roms, DS18B20_MAX_SENSORS, &found);
+    atomic_fetch_add(&s_ctx.scans, 1);
+
+    /* Same set: as many codes as at init, every tracked sensor among them */
+    int tracked = 0;
+    for (int j = 0; j < n; j++) {
+        int idx = ds18b20_rom_map_find(roms[j]);                    /* [ID] */
+        if (idx >= b->first && idx < b->first + b->count) tracked++;
+    }
+    bool same = n == b->seen && tracked == b->count;
+
+    if (n >= 0 && !same) {
+        ESP_LOGW(TAG, "GPIO%d: %d sensor(s) now, %d before -- rebuilding",
+                 b->gpio, n, b->seen);
+        rom_cache_save(b->gpio, roms, n);
+        atomic_fetch_add(&s_ctx.scan_changes, 1);
+        atomic_store(&s_ctx.rebuild, true);
+    }
+    free(roms);
+}
+
+static void bus_worker(void *arg)
+{
+    bus_t  *b   = arg;
+    uint8_t idx = (uint8_t)(b - s_ctx.buses);
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!s_ctx.workers_run) break;
+        run_bus(b, s_ctx.cycle);
+        atomic_store(&b->busy, false);
+        xQueueSend(s_ctx.bus_done, &idx, 0);
+        rescan_bus(b);                                              /* [ROM] */
+    }
+    b->worker = NULL;
+    vTaskDelete(NULL);
+}
+
+/* Workers for buses 1..n-1; a bus without one is run by the sensor task */
+static void start_bus_workers(void)
+{
+    s_ctx.workers_run = true;
+    if (s_ctx.bus_count < 2) return;
+    if (s_ctx.bus_done == NULL) {
+        s_ctx.bus_done = xQueueCreate(DS18B20_MAX_BUSES, sizeof(uint8_t));
+        if (s_ctx.bus_done == NULL) return;
+    }
+    xQueueReset(s_ctx.bus_done);
+
+    for (int b = 1; b < s_ctx.bus_count; b++) {
+        atomic_store(&s_ctx.buses[b].busy, false);
+        if (xTaskCreate(bus_worker, "ds18b20-bus", BUS_WORKER_STACK,
+                        &s_ctx.buses[b], PRIO_DS18B20_SERVICE,
+                        &s_ctx.buses[b].worker) != pdPASS) {
+            ESP_LOGW(TAG, "No worker for GPIO%d -- read in sequence",
+                     s_ctx.buses[b].gpio);
+            s_ctx.buses[b].worker = NULL;
+        }
+    }
+}
+
+static void stop_bus_workers(void)
+{
+    s_ctx.workers_run = false;
+    for (int b = 1; b < s_ctx.bus_count; b++) {
+        TaskHandle_t w = s_ctx.buses[b].worker;
+        if (w != NULL) xTaskNotifyGive(w);
+    }
+    for (int waited = 0; waited < BUS_JOIN_MS; waited += 10) {
+        bool busy = false;
+        for (int b = 1; b < s_ctx.bus_count; b++) {
+            if (s_ctx.buses[b].worker != NULL) busy = true;
+        }
+        if (!busy) return;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    ESP_LOGE(TAG, "Bus worker did not stop");
+}
+
+/* Mask of the buses that finished `cycle` */
+static uint32_t buses_done(uint32_t cycle)
+{
+    uint32_t m = 0;
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        if (atomic_load(&s_ctx.buses[b].done_cycle) == cycle) m |= 1u << b;
+    }
+    return m;
+}
+
+/*
+ * One conversion cycle on every bus at once; false if a bus timed out.
+ * A worker still busy with an earlier cycle is not given this one, and
+ * s_ctx.joined keeps the buses done at the join: the sensor task only
+ * touches their sensors until the next cycle.
+ */
+static bool run_cycle(uint32_t cycle)
+{
+    const uint32_t all = (1u << s_ctx.bus_count) - 1;
+    uint32_t skipped = 0;
+
+    s_ctx.cycle = cycle;
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        bus_t *bus = &s_ctx.buses[b];
+        if (bus->worker == NULL) continue;
+        if (atomic_exchange(&bus->busy, true)) {
+            skipped |= 1u << b;
+            continue;
+        }
+        xTaskNotifyGive(bus->worker);
+    }
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        if (s_ctx.buses[b].worker == NULL) run_bus(&s_ctx.buses[b], cycle);
+    }
+
+    /* Join: every dispatched bus must have finished this cycle */
+    const TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        if ((buses_done(cycle) | skipped) == all) break;
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= pdMS_TO_TICKS(BUS_JOIN_MS)) break;
+        uint8_t idx;
+        xQueueReceive(s_ctx.bus_done, &idx, pdMS_TO_TICKS(BUS_JOIN_MS) - waited);
+    }
+
+    s_ctx.joined = buses_done(cycle);
+    if (s_ctx.joined == all) return true;
+
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        bus_t *bus = &s_ctx.buses[b];
+        if (s_ctx.joined & (1u << b)) continue;
+        if (skipped & (1u << b)) {
+            ESP_LOGW(TAG, "GPIO%d: earlier cycle still running -- skipped", bus->gpio);
+        } else {
+            ESP_LOGE(TAG, "GPIO%d: cycle not finished in %d ms", bus->gpio, BUS_JOIN_MS);
+        }
+        atomic_fetch_add(&s_ctx.read_errors, (unsigned)bus->count);
+    }
+    return false;
+}
+
+/* Sensor i's bus finished the last cycle in time: its fields are stable */
+static bool sensor_joined(int i)
+{
+    return (s_ctx.joined & (1u << sensor_at(i)->bus)) != 0;
+}
+
+/* Reading of sensor i valid this cycle: its bus joined and the read worked */
+static bool sample_ok(int i)
+{
+    return sensor_joined(i) && sensor_at(i)->cur.ok;
+}
+
+/* -------------------------------------------------------------------------
+ * MQTT publishing
+ * ------------------------------------------------------------------------- */
+
+/* [NB] Backpressure is expected on a slow link -- count it, don't shout */
+static void note_publish_failure(const char *topic, esp_err_t err)
+{
+    if (err == MQTT_SERVICE_ERR_WOULD_BLOCK || err == ESP_ERR_NO_MEM ||
+        err == MQTT_SERVICE_ERR_RATE_LIMITED) {
+        s_ctx.publish_skipped++;
+        ESP_LOGD(TAG, "Skipped %s: MQTT backpressure", topic);
+    } else {
+        ESP_LOGW(TAG, "Publish %s failed: %s", topic, esp_err_to_name(err));
+    }
+}
+
+/* [RPT] Does sensor s go out this cycle?  ok: it was read this cycle */
+static bool report_due(const sensor_t *s, bool ok, int64_t now)
+{
+    const uint32_t db = atomic_load(&s_ctx.report_db);
+    if (db == 0 || s->reported_us == 0) return true;
+
+    const int64_t  since = now - s->reported_us;
+    const uint32_t max_s = atomic_load(&s_ctx.report_max_s);
+    if (max_s > 0 && since >= (int64_t)max_s * 1000000LL) return true;  /* heartbeat */
+    if (!ok) return false;
+    if (since < (int64_t)atomic_load(&s_ctx.report_min_ms) * 1000LL) return false;
+    if (isnan(s->reported)) return true;            /* last report was q=0 */
+    return fabsf(s->cur.temperature - s->reported) * 100.0f > (float)db;
+}
+
+/* [RPT] A publish carrying sensor s was accepted.  mqtt_service gives the
+ * rate-limit verdict at enqueue, so accepted means it goes out (or, on a
+ * coalesce rule, is replaced only by a newer value of the same topic). */
+static void mark_reported(sensor_t *s, bool ok, int64_t now)
+{
+    s->reported    = ok ? s->cur.temperature : NAN;
+    s->reported_us = now;
+    s_ctx.reports_sent++;
+}
+
+/* [ID] Per-sensor topic: /<MAC>/temperature/<alias or ROM>[/cbor]
+ * [RPT] NAN (failed read, heartbeat) goes out as null */
+static bool publish_single(const char *name, float temp)
+{
+    char topic[72];
+
+    /* [7] Topic includes full MAC for per-unit uniqueness */
+    snprintf(topic, sizeof(topic),
+             "%s/%s/temperature/%s", MQTT_TOPIC_ROOT, s_mac_id, name);
+
+    esp_err_t pub;
+    if (mqtt_service_get_payload_format() == MQTT_PAYLOAD_FORMAT_CBOR) {
+        /* [CBOR] bare float item: 3 bytes for any DS18B20 value */
+        uint8_t cbuf[8];
+        cbor_writer_t w;
+        cbor_writer_init(&w, cbuf, sizeof(cbuf));
+        if (isnan(temp)) cbor_put_null(&w);
+        else             cbor_put_float(&w, temp);
+        strncat(topic, MQTT_CBOR_SUFFIX, sizeof(topic) - strlen(topic) - 1);
+        pub = mqtt_service_try_publish(topic, cbuf, cbor_writer_len(&w),
+                                       0, false);
+    } else {
+        char value[32];
+        if (isnan(temp)) snprintf(value, sizeof(value), "null");
+        else             snprintf(value, sizeof(value), "%.2f", temp);
+        pub = mqtt_service_try_publish(topic, value, 0, 0, false);
+    }
+
+    if (pub == ESP_OK) {
+        s_ctx.message_count++;
+        ESP_LOGI(TAG, "Published %s -> %.2f", topic, temp);
+    } else {
+        note_publish_failure(topic, pub);
+    }
+    return pub == ESP_OK;
+}
+
+/*
+ * [BATCH] Whole cycle on one topic: /<MAC>/temperature/batch[/cbor]
+ *
+ * JSON:
+ *   {"ts":123456,"n":3,"s":[{"rom":"D506473B2D600028","t":16.44,"ts":123401,"q":1},
+ *                           {"rom":"6805473B4A510028","t":null,"ts":123455,"q":0}, ...]}
+ * CBOR: same shape; "rom" is the 64-bit address as an unsigned integer.
+ * [ID] Aliased sensors add "loc":"coldroom-3".
+ *
+ * ts are milliseconds since boot (the node has no wall clock);
+ * q=1 means the value was read this cycle, q=0 means the read failed.
+ *
+ * [BUS] More than BATCH_CHUNK sensors go out as several frames with the
+ * same "ts" and "n" (the total); all but the last carry "more":true, all
+ * but the first "part":N.
+ *
+ * [RPT] Only the sensors due for a report are in the frames; "n" counts
+ * those, not the whole table.
+ */
+static esp_err_t publish_batch_part(const char *topic, int part, const int *idx,
+                                    int count, int total, bool more,
+                                    int64_t now_ms)
+{
+    static char frame[DS18B20_BATCH_FRAME_SIZE];    /* sensor task only */
+    size_t len = 0;
+
+    if (mqtt_service_get_payload_format() == MQTT_PAYLOAD_FORMAT_CBOR) {
+        cbor_writer_t w;
+        cbor_writer_init(&w, (uint8_t *)frame, sizeof(frame));
+        cbor_begin_map(&w, 3 + (part > 0) + more);
+        cbor_put_text(&w, "ts"); cbor_put_int(&w, now_ms);
+        cbor_put_text(&w, "n");  cbor_put_uint(&w, (uint64_t)total);
+        if (part > 0) { cbor_put_text(&w, "part"); cbor_put_uint(&w, (uint64_t)part); }
+        cbor_put_text(&w, "s");
+        cbor_begin_array(&w, (size_t)count);
+        for (int k = 0; k < count; k++) {
+            const int       i  = idx[k];
+            const sensor_t *s  = sensor_at(i);
+            const bool      ok = sample_ok(i);
+            const int64_t   ts = sensor_joined(i) ? s->cur.read_us / 1000 : now_ms;
+            char loc[DS18B20_ALIAS_LEN];
+            const bool named = ds18b20_rom_map_alias(s->address, loc, sizeof(loc));
+            cbor_begin_map(&w, 4 + named);
+            cbor_put_text(&w, "rom"); cbor_put_uint(&w, s->address);
+            if (named) { cbor_put_text(&w, "loc"); cbor_put_text(&w, loc); }
+            cbor_put_text(&w, "t");
+            if (ok) cbor_put_float(&w, s->cur.temperature);
+            else    cbor_put_null(&w);
+            cbor_put_text(&w, "ts"); cbor_put_int(&w, ts);
+            cbor_put_text(&w, "q");  cbor_put_uint(&w, ok ? 1 : 0);
+        }
+        if (more) { cbor_put_text(&w, "more"); cbor_put_bool(&w, true); }
+        if (!cbor_writer_ok(&w)) return ESP_ERR_INVALID_SIZE;
+        len = cbor_writer_len(&w);
+    } else {
+        int n = snprintf(frame, sizeof(frame), "{\"ts\":%" PRId64 ",\"n\":%d",
+                         now_ms, total);
+        if (part > 0 && n > 0 && (size_t)n < sizeof(frame)) {
+            n += snprintf(frame + n, sizeof(frame) - (size_t)n, ",\"part\":%d", part);
+        }
+        if (n > 0 && (size_t)n < sizeof(frame)) {
+            n += snprintf(frame + n, sizeof(frame) - (size_t)n, ",\"s\":[");
+        }
+        for (int k = 0; k < count && n > 0 && (size_t)n < sizeof(frame); k++) {
+            const int       i  = idx[k];
+            const sensor_t *s  = sensor_at(i);
+            const bool      ok = sample_ok(i);
+            const int64_t   ts = sensor_joined(i) ? s->cur.read_us / 1000 : now_ms;
+            char tbuf[16] = "null";
+            char loc[DS18B20_ALIAS_LEN + 10] = "";
+            char alias[DS18B20_ALIAS_LEN];
+            if (ok) snprintf(tbuf, sizeof(tbuf), "%.2f", s->cur.temperature);
+            if (ds18b20_rom_map_alias(s->address, alias, sizeof(alias))) {
+                snprintf(loc, sizeof(loc), ",\"loc\":\"%s\"", alias);
+            }
+            n += snprintf(frame + n, sizeof(frame) - (size_t)n,
+                          "%s{\"rom\":\"%016" PRIX64 "\"%s,\"t\":%s,\"ts\":%" PRId64 ",\"q\":%d}",
+                          k > 0 ? "," : "", s->address, loc, tbuf,
+                          ts, ok ? 1 : 0);
+        }
+        if (n > 0 && (size_t)n < sizeof(frame)) {
+            n += snprintf(frame + n, sizeof(frame) - (size_t)n,
+                          more ? "],\"more\":true}" : "]}");
+        }
+        if (n <= 0 || (size_t)n >= sizeof(frame)) return ESP_ERR_INVALID_SIZE;
+        len = (size_t)n;
+    }
+
+    esp_err_t pub = mqtt_service_try_publish(topic, frame, len, 0, false);
+    if (pub == ESP_OK) {
+        s_ctx.message_count++;
+        ESP_LOGI(TAG, "Published %s part %d (%d sensors, %u B)",
+                 topic, part, count, (unsigned)len);
+    }
+    return pub;
+}
+
+/* [RPT] `due` sensors are flagged; `now` is the cycle's report time */
+static void publish_batch(int due, int64_t now)
+{
+    char topic[72];
+    snprintf(topic, sizeof(topic), "%s/%s/temperature/batch",
+             MQTT_TOPIC_ROOT, s_mac_id);
+    if (mqtt_service_get_payload_format() == MQTT_PAYLOAD_FORMAT_CBOR) {
+        strncat(topic, MQTT_CBOR_SUFFIX, sizeof(topic) - strlen(topic) - 1);
+    }
+
+    const int64_t now_ms = esp_timer_get_time() / 1000;
+    int idx[BATCH_CHUNK];
+    int count = 0;
+    int done  = 0;
+    for (int i = 0, part = 0; i < s_ctx.sensor_count; i++) {
+        if (!sensor_at(i)->due) continue;
+        idx[count++] = i;
+        if (count < BATCH_CHUNK && done + count < due) continue;
+
+        const bool more = done + count < due;
+        esp_err_t pub = publish_batch_part(topic, part++, idx, count, due, more,
+                                           now_ms);
+        if (pub == ESP_ERR_INVALID_SIZE) {
+            ESP_LOGW(TAG, "Batch frame overflow (%d sensors)", count);
+            return;
+        }
+        if (pub != ESP_OK) {
+            /* Later parts without the earlier ones are of no use */
+            note_publish_failure(topic, pub);
+            return;
+        }
+        for (int k = 0; k < count; k++) {
+            mark_reported(sensor_at(idx[k]), sample_ok(idx[k]), now);
+        }
+        done += count;
+        count = 0;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * [HEALTH] Health payload provider -- runs on the mqtt publish task
+ *   "ds18b20":{"n":3,"buses":1,"over":0,"msgs":120,"err":0,"skip":0,
+ *              "sent":130,"supp":410,"rej":2,"crc":0,"hist":3,"hist_kb":98,
+ *              "conv_ms":612,"init_ms":9,"cached":3,"scans":2,"chg":0,
+ *              "alias":2,"age_s":12,"t":[16.44,16.50,17.06]}
+ * age_s is -1 until the first good reading.  "t" holds the first
+ * HEALTH_TEMPS_MAX sensors (RPC "temps" has them all), conv_ms is the
+ * slowest bus, "over" the sensors found beyond CONFIG_DS18B20_MAX_SENSORS.
+ * [ROM] init_ms is the last table (re)build, cached the sensors it took
+ * from NVS, scans / chg the re-scans and those that found a change.
+ * [ID] alias is the number of ROM codes with a location name.
+ * [RPT] sent counts sensor readings that went out (a batch frame carries
+ * several), supp the good readings held back by the deadband.
+ * [FILT] rej / crc sum the per-sensor counts shown by RPC "temps".
+ * [HIST] hist is the number of series kept, hist_kb the PSRAM they hold.
+ * ------------------------------------------------------------------------- */
+static void ds18b20_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    const int     n    = s_ctx.sensor_count;
+    const int64_t last = s_ctx.last_reading_us;
+
+    uint32_t conv_ms = 0;
+    for (int b = 0; b < s_ctx.bus_count; b++) {
+        if (s_ctx.buses[b].conv_ms > conv_ms) conv_ms = s_ctx.buses[b].conv_ms;
+    }
+
+    health_begin_object(hw, "ds18b20");
+    health_field_int(hw,  "n",    n);
+    health_field_int(hw,  "buses", s_ctx.bus_count);                  /* [BUS] */
+    health_field_uint(hw, "over", s_ctx.sensors_over);                /* [BUS] */
+    health_field_uint(hw, "msgs", s_ctx.message_count);
+    health_field_uint(hw, "err",  atomic_load(&s_ctx.read_errors));
+    health_field_uint(hw, "skip", s_ctx.publish_skipped);             /* [NB] */
+    health_field_uint(hw, "sent", s_ctx.reports_sent);                /* [RPT] */
+    health_field_uint(hw, "supp", s_ctx.reports_suppressed);          /* [RPT] */
+    health_field_uint(hw, "rej",  atomic_load(&s_ctx.rejected));      /* [FILT] */
+    health_field_uint(hw, "crc",  atomic_load(&s_ctx.crc_errors));    /* [FILT] */
+    health_field_int(hw,  "hist", ds18b20_history_series());          /* [HIST] */
+    health_field_uint(hw, "hist_kb", ds18b20_history_kb());
+    health_field_uint(hw, "conv_ms", conv_ms);                        /* [RES] */
+    health_field_uint(hw, "init_ms", s_ctx.init_ms);                  /* [ROM] */
+    health_field_uint(hw, "cached", s_ctx.cached);                    /* [ROM] */
+    health_field_uint(hw, "scans", atomic_load(&s_ctx.scans));        /* [ROM] */
+    health_field_uint(hw, "chg",  atomic_load(&s_ctx.scan_changes));  /* [ROM] */
+    health_field_int(hw,  "alias", ds18b20_rom_map_alias_count());    /* [ID] */
+    health_field_int(hw,  "age_s",
+                     last > 0 ? (esp_timer_get_time() - last) / 1000000LL : -1);
+    health_begin_array(hw, "t");
+    for (int i = 0; i < n && i < HEALTH_TEMPS_MAX; i++) {
+        health_field_float(hw, NULL, sensor_at(i)->last_temperature, 2);
+    }
+    health_end_array(hw);
+    health_end_object(hw);
+}
+
+/* -------------------------------------------------------------------------
+ * [RPC] "temps" {"from":16} ->
+ *   {"age_s":12,"n":40,"next":24,
+ *    "s":[{"rom":"D506473B2D600028","bus":0,"t":16.50,"rej":0,"crc":0},...]}
+ * At most RPC_TEMPS_MAX sensors per reply from index "from" (default 0);
+ * "next" is where the following page starts, absent on the last one.
+ * [ID] {"rom":"D506473B2D600028"} answers for that sensor only; aliased
+ * sensors add "loc".
+ * [FILT] rej / crc: samples the filter dropped, scratchpad CRC failures.
+ * Runs on an RPC worker; reads the same snapshots as the health provider.
+ * ------------------------------------------------------------------------- */
+static void rpc_sensor(health_writer_t *result, int i)
+{
+    const sensor_t *s = sensor_at(i);
+    char rom[DS18B20_ROM_HEX_LEN];
+    char loc[DS18B20_ALIAS_LEN];
+    snprintf(rom, sizeof(rom), "%016" PRIX64, s->address);
+    health_begin_object(result, NULL);
+    health_field_str(result, "rom", rom);
+    if (ds18b20_rom_map_alias(s->address, loc, sizeof(loc))) {
+        health_field_str(result, "loc", loc);                       /* [ID] */
+    }
+    health_field_int(result, "bus", s->bus);
+    health_field_float(result, "t", s->last_temperature, 2);
+    health_field_uint(result, "rej", s->rejected);                  /* [FILT] */
+    health_field_uint(result, "crc", s->crc_errors);
+    health_end_object(result);
+}
+
+static esp_err_t ds18b20_rpc_temps(const char *params, health_writer_t *result,
+                                   void *ctx)
+{
+    (void)ctx;
+    if (!s_ctx.is_running) return ESP_ERR_INVALID_STATE;
+
+    const int     n    = s_ctx.sensor_count;
+    const int64_t last = s_ctx.last_reading_us;
+
+    int  from = 0;
+    int  end  = -1;
+    char val[DS18B20_ROM_HEX_LEN + 2];
+    if (mqtt_rpc_json_get(params, "rom", val, sizeof(val))) {       /* [ID] */
+        uint64_t rom;
+        if (!ds18b20_rom_parse(val, &rom)) return ESP_ERR_INVALID_ARG;
+        from = ds18b20_rom_map_find(rom);
+        if (from < 0 || from >= n) return ESP_ERR_NOT_FOUND;
+        end = from + 1;
+    } else if (mqtt_rpc_json_get(params, "from", val, sizeof(val))) {
+        from = atoi(val);
+    }
+    if (from < 0) return ESP_ERR_INVALID_ARG;
+
+    if (end < 0) end = from + RPC_TEMPS_MAX;
+    if (end > n) end = n;
+
+    health_field_int(result, "age_s",
+                     last > 0 ? (esp_timer_get_time() - last) / 1000000LL : -1);
+    health_field_int(result, "n", n);                                 /* [BUS] */
+    if (end < n && end - from > 1) health_field_int(result, "next", end);
+    health_begin_array(result, "s");
+    for (int i = from; i < end; i++) rpc_sensor(result, i);
+    health_end_array(result);
+    return ESP_OK;
+}
+
+/*
+ * [ID] "alias" {"rom":"D506473B2D600028","loc":"coldroom-3"} ->
+ *   {"rom":"D506473B2D600028","loc":"coldroom-3"}
+ * An empty "loc" removes the alias.  The new topic is used from the next
+ * cycle.  Runs on an RPC worker.
+ */
+static esp_err_t ds18b20_rpc_alias(const char *params, health_writer_t *result,
+                                   void *ctx)
+{
+    (void)ctx;
+    char     hex[DS18B20_ROM_HEX_LEN + 2];
+    char     loc[DS18B20_ALIAS_LEN + 2];
+    uint64_t rom;
+
+    if (!mqtt_rpc_json_get(params, "rom", hex, sizeof(hex)) ||
+        !ds18b20_rom_parse(hex, &rom) ||
+        !mqtt_rpc_json_get(params, "loc", loc, sizeof(loc))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ds18b20_rom_map_set_alias(rom, loc);
+    if (err != ESP_OK) return err;
+
+    snprintf(hex, sizeof(hex), "%016" PRIX64, rom);
+    health_field_str(result, "rom", hex);
+    health_field_str(result, "loc", loc);
+    return ESP_OK;
+}
+
+/*
+ * [HIST] "history" {"rom":"D506473B2D600028","tier":"1m","from":0,"to":7200000} ->
+ *   {"rom":"D506473B2D600028","tier":"1m","now":7260000,"t0":0,"step":60000,
+ *    "p":[[16.44,16.56,16.50],null,...],"next":1920000}
+ * tier "raw" (the default) answers "p":[[ts,t],...] without t0 / step.
+ * Times are ms since boot; "from" defaults to 0, "to" to now.  At most
+ * HISTORY_PAGE points per reply; "next" is the "from" of the following
+ * page.  Rollup entries are [min,max,avg], null for a bucket without
+ * readings.  Runs on an RPC worker.
+ */
+static esp_err_t ds18b20_rpc_history(const char *params, health_writer_t *result,
+                                     void *ctx)
+{
+    (void)ctx;
+    static const char *const tiers[] = { "raw", "1m", "15m" };
+    char     val[DS18B20_ROM_HEX_LEN + 2];
+    uint64_t rom;
+
+    if (!mqtt_rpc_json_get(params, "rom", val, sizeof(val)) ||
+        !ds18b20_rom_parse(val, &rom)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ds18b20_history_tier_t tier = DS18B20_HISTORY_RAW;
+    if (mqtt_rpc_json_get(params, "tier", val, sizeof(val))) {
+        if      (strcmp(val, "1m")  == 0) tier = DS18B20_HISTORY_1M;
+        else if (strcmp(val, "15m") == 0) tier = DS18B20_HISTORY_15M;
+        else if (strcmp(val, "raw") != 0) return ESP_ERR_INVALID_ARG;
+    }
+    const int64_t now_ms = esp_timer_get_time() / 1000;
+    int64_t from = 0;
+    int64_t to   = now_ms;
+    if (mqtt_rpc_json_get(params, "from", val, sizeof(val))) from = strtoll(val, NULL, 10);
+    if (mqtt_rpc_json_get(params, "to", val, sizeof(val)))   to   = strtoll(val, NULL, 10);
+    if (from < 0 || to < from) return ESP_ERR_INVALID_ARG;
+
+    ds18b20_history_point_t p[HISTORY_PAGE];
+    int     n;
+    int64_t next;
+    esp_err_t err = ds18b20_history_query(rom, tier, from, to, p, HISTORY_PAGE,
+                                          &n, &next);
+    if (err != ESP_OK) return err;
+
+    snprintf(val, sizeof(val), "%016" PRIX64, rom);
+    health_field_str(result, "rom", val);
+    health_field_str(result, "tier", tiers[tier]);
+    health_field_int(result, "now", now_ms);
+    if (tier != DS18B20_HISTORY_RAW && n > 0) {
+        health_field_int(result, "t0", p[0].ms);
+        health_field_uint(result, "step", ds18b20_history_step_ms(tier));
+    }
+    health_begin_array(result, "p");
+    for (int i = 0; i < n; i++) {
+        if (tier == DS18B20_HISTORY_RAW) {
+            health_begin_array(result, NULL);
+            health_field_int(result, NULL, p[i].ms);
+            health_field_float(result, NULL, p[i].avg / 100.0f, 2);
+            health_end_array(result);
+        } else if (p[i].empty) {
+            health_field_null(result, NULL);
+        } else {
+            health_begin_array(result, NULL);
+            health_field_float(result, NULL, p[i].min / 100.0f, 2);
+            health_field_float(result, NULL, p[i].max / 100.0f, 2);
+            health_field_float(result, NULL, p[i].avg / 100.0f, 2);
+            health_end_array(result);
+        }
+    }
+    health_end_array(result);
+    if (next >= 0) health_field_int(result, "next", next);
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * [CFG] Cycle period
+ * ------------------------------------------------------------------------- */
+
+/* Settings read by the sensor task and the bus workers */
+static void load_config(const app_config_t *cfg)
+{
+    atomic_store(&s_ctx.period_ms, cfg->sensor_period_ms);
+    atomic_store(&s_ctx.filter_slew, cfg->filter_slew);             /* [FILT] */
+    atomic_store(&s_ctx.filter_ema, cfg->filter_ema);
+    atomic_store(&s_ctx.filter_median, cfg->filter_median);
+    atomic_store(&s_ctx.report_db, cfg->report_deadband);           /* [RPT] */
+    atomic_store(&s_ctx.report_min_ms, cfg->report_min_ms);
+    atomic_store(&s_ctx.report_max_s, cfg->report_max_s);
+}
+
+/* config_store listener -- runs on the writer's task */
+static void ds18b20_config_changed(const app_config_t *cfg, uint32_t changed,
+                                   void *ctx)
+{
+    (void)ctx;
+    if (!(changed & CONFIG_CHANGED_SENSOR)) return;
+
+    load_config(cfg);
+    atomic_store(&s_ctx.res_changed, true);                         /* [RES] */
+    TaskHandle_t task = s_ctx.task_handle;
+    if (s_ctx.is_running && task != NULL) xTaskNotifyGive(task);
+}
+
+/* Sleep until period_ms after `start`; a period change re-times the wait */
+static void wait_next_cycle(TickType_t start)
+{
+    while (s_ctx.is_running) {
+        TickType_t period  = pdMS_TO_TICKS(atomic_load(&s_ctx.period_ms));
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= period) return;
+
+        TickType_t left = period - elapsed;
+        if (left > pdMS_TO_TICKS(HEARTBEAT_SLICE_MS)) left = pdMS_TO_TICKS(HEARTBEAT_SLICE_MS);
+        ulTaskNotifyTake(pdTRUE, left);
+        supervisor_heartbeat("ds18b20-temp");
+    }
 }
 
 /* -------------------------------------------------------------------------
  * Internal task
  * ------------------------------------------------------------------------- */
 
+/* [ROM] Rebuild the table from the ROM cache -- workers stopped meanwhile */
+static void rebuild_table(void)
+{
+    ESP_LOGI(TAG, "Rebuilding sensor table");
+    stop_bus_workers();
+    hw_cleanup();
+    if (hw_init() != ESP_OK) {
+        ESP_LOGW(TAG, "No sensors after rebuild -- probing again in %d s",
+                 empty_retry_s());
+    }
+    start_bus_workers();
+}
+
+/* [ROM] Empty GPIOs due: rebuild only if one of them answers now */
+static bool empty_due(void)
+{
+    const int64_t now = esp_timer_get_time();
+    if (now < s_ctx.next_init_us) return false;
+    if (empty_answers()) return true;
+    s_ctx.next_init_us = now + empty_retry_s() * 1000000LL;
+    return false;
+}
+
 static void ds18b20_temp_task(void *arg)
 {
     ESP_LOGI(TAG, "Task starting");
+    start_bus_workers();                                            /* [BUS] */
+    uint32_t cycle = 0;
 
     while (s_ctx.is_running) {
-        /* Trigger conversion on all sensors */
+        TickType_t cycle_start = xTaskGetTickCount();               /* [CFG] */
+
+        if (atomic_exchange(&s_ctx.rebuild, false) || empty_due()) { /* [ROM] */
+            rebuild_table();
+        }
+        if (atomic_exchange(&s_ctx.res_changed, false)) {           /* [RES] */
+            apply_resolution();
+        }
+
+        /* [BUS] Every bus converts and reads at the same time */
+        run_cycle(++cycle);
+
+        /* [RPT] Which sensors are due for a report */
+        const bool    online = mqtt_service_can_publish();
+        const int64_t now    = esp_timer_get_time();
+        int due = 0;
         for (int i = 0; i < s_ctx.sensor_count; i++) {
-            esp_err_t err = ds18b20_trigger_temperature_conversion(s_ctx.sensors[i]);
-            if (err != ESP_OK) {
-                ESP_LOGW(TAG, "Trigger failed for sensor[%d]: %s",
-                         i, esp_err_to_name(err));
-            }
+            sensor_t  *s  = sensor_at(i);
+            const bool ok = sample_ok(i);
+            s->due = online && report_due(s, ok, now);
+            if (s->due) due++;
+            else if (ok && online) s_ctx.reports_suppressed++;
         }
 
-        /* Wait for 12-bit conversion (max 750 ms) */
-        vTaskDelay(pdMS_TO_TICKS(800));
+        /* [BUS] Too many sensors for a message each: batch frames instead */
+        const bool single = DS18B20_PUBLISH_SINGLE &&
+                            s_ctx.sensor_count <= BATCH_CHUNK;
+        const bool batch  = DS18B20_PUBLISH_BATCH || !single;
+        if (DS18B20_PUBLISH_SINGLE && single == s_ctx.single_off) {
+            s_ctx.single_off = !single;
+            if (single) ESP_LOGI(TAG, "%d sensors -- per-sensor topics again",
+                                 s_ctx.sensor_count);
+            else        ESP_LOGW(TAG, "%d sensors > %d -- publishing batch frames "
+                                 "instead of per-sensor topics",
+                                 s_ctx.sensor_count, BATCH_CHUNK);
+        }
 
         bool any_ok = false;
         for (int i = 0; i < s_ctx.sensor_count; i++) {
-            float temp;
-            esp_err_t err = ds18b20_get_temperature(s_ctx.sensors[i], &temp);
-            if (err != ESP_OK) {
-                ESP_LOGW(TAG, "Read failed for sensor[%d]: %s",
-                         i, esp_err_to_name(err));
-                continue;
-            }
+            if (!sample_ok(i)) continue;
+            const float    temp = sensor_at(i)->cur.temperature;
+            const uint64_t rom  = sensor_at(i)->address;
+            char name[DS18B20_ROM_HEX_LEN];
+            ds18b20_rom_name(rom, name, sizeof(name));                  /* [ID] */
 
-            s_ctx.last_temperatures[i] = temp;
-            s_ctx.last_reading_us      = esp_timer_get_time();
+            s_ctx.last_reading_us = sensor_at(i)->cur.read_us;
             any_ok = true;
 
-            ESP_LOGI(TAG, "Sensor[%d]: %.2f°C (count=%" PRIu32 ")",
-                     i, temp, s_ctx.message_count);
+            ESP_LOGI(TAG, "Sensor[%d] %s: %.2f°C (count=%" PRIu32 ")",
+                     i, name, temp, s_ctx.message_count);
 
             /*
              * FIX: push a ds18b20_reading_t instead of temperature + i*1000.
              */
             if (s_ctx.event_queue != NULL) {
                 ds18b20_reading_t reading = {
+                    .rom          = rom,
                     .sensor_index = i,
                     .temperature  = temp,
                 };
                 if (xQueueSend(s_ctx.event_queue, &reading, 0) != pdTRUE) {
-                    ESP_LOGW(TAG, "Queue full -- reading dropped for sensor[%d]", i);
+                    ESP_LOGW(TAG, "Queue full -- reading dropped for %s", name);
                 }
             }
 
-            /* Publish via MQTT */
-            if (mqtt_service_can_publish()) {
-                char topic[64];
-                char value[32];
+            ds18b20_history_add(rom, sensor_at(i)->cur.read_us, temp);      /* [HIST] */
 
-                snprintf(value, sizeof(value), "%.2f", temp);
+            /* Publish via MQTT -- per-sensor topics, changed values only */
+            if (single && sensor_at(i)->due &&
+                publish_single(name, temp)) {
+                mark_reported(sensor_at(i), true, now);                 /* [RPT] */
+            }
+        }
 
-                /* [7] Topic includes full MAC for per-unit uniqueness */
-                if (s_ctx.sensor_count > 1) {
-                    snprintf(topic, sizeof(topic),
-                             "%s/%s/temperature/%d", MQTT_TOPIC_ROOT, s_mac_id, i);
-                } else {
-                    snprintf(topic, sizeof(topic),
-                             "%s/%s/temperature", MQTT_TOPIC_ROOT, s_mac_id);
-                }
+        /* [RPT] Heartbeat of a sensor whose read failed: null, q=0 */
+        for (int i = 0; single && i < s_ctx.sensor_count; i++) {
+            sensor_t *s = sensor_at(i);
+            if (!s->due || sample_ok(i)) continue;
+            char name[DS18B20_ROM_HEX_LEN];
+            ds18b20_rom_name(s->address, name, sizeof(name));
+            if (publish_single(name, NAN)) mark_reported(s, false, now);
+        }
 
-                esp_err_t pub = mqtt_service_publish(topic, value, 0, false);
-                if (pub == ESP_OK) {
-                    s_ctx.message_count++;
-                    ESP_LOGI(TAG, "Published %s -> %s", topic, value);
-                } else {
-                    ESP_LOGW(TAG, "Publish failed: %s", esp_err_to_name(pub));
-                }
-            }
+        /* [BATCH] One frame (or BATCH_CHUNK-sized parts) for the whole cycle;
+         * failed sensors due for a heartbeat go out as "t":null,"q":0 */
+        if (batch && due > 0) {
+            publish_batch(due, now);
         }
 
         if (!any_ok) {
             ESP_LOGW(TAG, "No successful readings this cycle");
         }
 
+        /* [ROM] Buses without a worker are searched here, after publishing */
+        for (int b = 0; b < s_ctx.bus_count; b++) {
+            if (s_ctx.buses[b].worker == NULL) rescan_bus(&s_ctx.buses[b]);
+        }
+
         /* Pet heartbeat so supervisor can detect if we get stuck */
         supervisor_heartbeat("ds18b20-temp");
 
-        vTaskDelay(pdMS_TO_TICKS(30000));
+        wait_next_cycle(cycle_start);                               /* [CFG] */
     }
 
     ESP_LOGI(TAG, "Task stopping");
+    stop_bus_workers();                                             /* [BUS] */
     hw_cleanup();
     vTaskDelete(NULL);
 }
@@ -267,6 +1582,8 @@ void ds18b20_temp_service_start(void)
         }
     }
 
+    ds18b20_rom_map_init();                                         /* [ID] */
+
     esp_err_t err = hw_init();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Hardware init failed: %s", esp_err_to_name(err));
@@ -278,6 +1595,25 @@ void ds18b20_temp_service_start(void)
     s_ctx.is_running    = true;
     s_ctx.message_count = 0;
     s_ctx.last_reading_us = 0;
+    atomic_store(&s_ctx.read_errors, 0);
+    s_ctx.publish_skipped = 0;
+    s_ctx.reports_sent       = 0;
+    s_ctx.reports_suppressed = 0;
+    atomic_store(&s_ctx.rejected, 0);
+    atomic_store(&s_ctx.crc_errors, 0);
+    atomic_store(&s_ctx.scans, 0);
+    atomic_store(&s_ctx.scan_changes, 0);
+
+    /* [CFG] Period, filter and reporting from the config store, followed live */
+    app_config_t cfg;
+    config_store_get(&cfg);
+    load_config(&cfg);
+    config_store_subscribe("ds18b20", ds18b20_config_changed, NULL);
+
+    health_payload_register("ds18b20", ds18b20_health_fields, NULL);  /* [HEALTH] */
+    mqtt_rpc_register("temps", ds18b20_rpc_temps, NULL, 0);           /* [RPC] */
+    mqtt_rpc_register("alias", ds18b20_rpc_alias, NULL, 0);           /* [ID] */
+    mqtt_rpc_register("history", ds18b20_rpc_history, NULL, 0);       /* [HIST] */
 
     BaseType_t rc = xTaskCreate(
         ds18b20_temp_task,
@@ -295,7 +1631,8 @@ void ds18b20_temp_service_start(void)
         vQueueDelete(s_ctx.event_queue);
         s_ctx.event_queue = NULL;
     } else {
-        ESP_LOGI(TAG, "Service started (%d sensor(s))", s_ctx.sensor_count);
+        ESP_LOGI(TAG, "Service started (%d sensor(s), %d bus(es))",
+                 s_ctx.sensor_count, s_ctx.bus_count);
     }
 }
 
@@ -327,8 +1664,12 @@ bool ds18b20_temp_service_is_healthy(void)
         return true;
     }
 
+    /* [CFG] Allow three missed cycles at long periods */
+    int64_t stale_s = 3LL * atomic_load(&s_ctx.period_ms) / 1000;
+    if (stale_s < HEALTH_STALE_S) stale_s = HEALTH_STALE_S;
+
     int64_t age_s = (esp_timer_get_time() - s_ctx.last_reading_us) / 1000000LL;
-    return age_s < HEALTH_STALE_S;
+    return age_s < stale_s;
 }
 
 uint32_t ds18b20_temp_service_get_message_count(void)
@@ -344,18 +1685,27 @@ int ds18b20_temp_service_get_sensor_count(void)
 float ds18b20_temp_service_get_last_temperature(int idx)
 {
     if (idx >= 0 && idx < s_ctx.sensor_count) {
-        return s_ctx.last_temperatures[idx];
+        return sensor_at(idx)->last_temperature;
     }
     return 0.0f;
 }
 
+/* [ID] Last value of the sensor with ROM code `rom` */
+esp_err_t ds18b20_temp_service_get_temperature_by_rom(uint64_t rom, float *out)
+{
+    int idx = ds18b20_rom_map_find(rom);
+    if (idx < 0 || idx >= s_ctx.sensor_count) return ESP_ERR_NOT_FOUND;
+    *out = sensor_at(idx)->last_temperature;
+    return ESP_OK;
+}
+
 esp_err_t ds18b20_temp_service_trigger_conversion(void)
 {
     if (s_ctx.sensor_count == 0) return ESP_ERR_INVALID_STATE;
-
-    for (int i = 0; i < s_ctx.sensor_count; i++) {
-        esp_err_t err = ds18b20_trigger_temperature_conversion(s_ctx.sensors[i]);
-        if (err != ESP_OK) return err;
+    esp_err_t ret = ESP_OK;
+    for (int b = 0; b < s_ctx.bus_count; b++) {                     /* [BUS] */
+        esp_err_t err = convert_all(&s_ctx.buses[b]);               /* [BCAST] */
+        if (err != ESP_OK) ret = err;
     }
-    return ESP_OK;
+    return ret;
 }
@@ -24,8 +24,18 @@ extern "C" {
  * Configuration
  * ------------------------------------------------------------------------- */
 
-#define DS18B20_MAX_SENSORS     4   /* Maximum DS18B20 sensors on the bus */
-#define DS18B20_DEFAULT_GPIO    6   /* 1-Wire bus GPIO pin */
+#ifndef CONFIG_DS18B20_MAX_SENSORS
+#define CONFIG_DS18B20_MAX_SENSORS  64
+#endif
+#ifndef CONFIG_DS18B20_BUS_GPIOS
+#define CONFIG_DS18B20_BUS_GPIOS    "6"
+#endif
+
+/* Sensor table limit across all buses (the table grows on demand) */
+#define DS18B20_MAX_SENSORS     CONFIG_DS18B20_MAX_SENSORS
+/* 1-Wire buses, one RMT TX/RX channel pair each (GPIOs from
+ * CONFIG_DS18B20_BUS_GPIOS, comma separated) */
+#define DS18B20_MAX_BUSES       4
 
 /* -------------------------------------------------------------------------
  * Types
@@ -38,8 +48,9 @@ extern "C" {
  * receive an unambiguous struct with clearly typed fields.
  */
 typedef struct {
-    int   sensor_index;   /**< Zero-based index of the sensor */
-    float temperature;    /**< Temperature in degrees Celsius */
+    uint64_t rom;            /**< 64-bit 1-Wire ROM code -- the sensor's identity */
+    int      sensor_index;   /**< Current table index; shifts when probes come or go */
+    float    temperature;    /**< Temperature in degrees Celsius */
 } ds18b20_reading_t;
 
 /* -------------------------------------------------------------------------
@@ -64,6 +75,9 @@ bool           ds18b20_temp_service_is_healthy(void);
 uint32_t       ds18b20_temp_service_get_message_count(void);
 int            ds18b20_temp_service_get_sensor_count(void);
 float          ds18b20_temp_service_get_last_temperature(int sensor_index);
+
+/** Last value of the sensor with ROM code `rom`; ESP_ERR_NOT_FOUND if absent. */
+esp_err_t      ds18b20_temp_service_get_temperature_by_rom(uint64_t rom, float *out);
 esp_err_t      ds18b20_temp_service_trigger_conversion(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,397 @@
+/*
+ * health_payload.c - Extensible health payload assembly
+ *
+ * Registry layout: s_reserved is bumped with fetch_add to claim a slot; the
+ * slot becomes visible to the publish task only once `ready` is stored, so
+ * a half-filled slot is never called.
+ *
+ * Chunk framing reserves HEALTH_TAIL_RESERVE bytes up front so that the
+ * closing ,"more":true} (or its CBOR equivalent) always fits, together with
+ * the brace of an object cut between its members.
+ */
+
+#include "health_payload.h"
+#include "esp_log.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "health";
+
+#define HEALTH_TAIL_RESERVE   16
+
+typedef struct {
+    const char           *name;
+    health_provider_fn_t  fn;
+    void                 *ctx;
+    atomic_bool           ready;
+} provider_slot_t;
+
+static provider_slot_t s_providers[HEALTH_PROVIDERS_MAX];
+static atomic_int      s_reserved;
+static atomic_uint     s_dropped;
+
+static int provider_count(void)
+{
+    int n = atomic_load(&s_reserved);
+    return n < HEALTH_PROVIDERS_MAX ? n : HEALTH_PROVIDERS_MAX;
+}
+
+/* -------------------------------------------------------------------------
+ * Checkpoints -- hide the two writers' different mark types
+ * ------------------------------------------------------------------------- */
+
+typedef union {
+    json_writer_mark_t json;
+    size_t             cbor;
+} hw_mark_t;
+
+static hw_mark_t hw_mark(const health_writer_t *hw)
+{
+    hw_mark_t m;
+    if (hw->cbor) m.cbor = cbor_writer_len(&hw->u.cbor);
+    else          m.json = json_writer_mark(&hw->u.json);
+    return m;
+}
+
+static void hw_rewind(health_writer_t *hw, const hw_mark_t *m)
+{
+    if (hw->cbor) cbor_writer_rewind(&hw->u.cbor, m->cbor);
+    else          json_writer_rewind(&hw->u.json, &m->json);
+}
+
+static bool hw_ok(const health_writer_t *hw)
+{
+    return hw->cbor ? cbor_writer_ok(&hw->u.cbor) : json_writer_ok(&hw->u.json);
+}
+
+static size_t hw_len(const health_writer_t *hw)
+{
+    return hw->cbor ? cbor_writer_len(&hw->u.cbor) : json_writer_len(&hw->u.json);
+}
+
+static size_t mark_len(const health_writer_t *hw, const hw_mark_t *m)
+{
+    return hw->cbor ? m->cbor : m->json.len;
+}
+
+/* Give back the tail reserve so the closing members can be written */
+static void hw_release_tail(health_writer_t *hw)
+{
+    if (hw->cbor) hw->u.cbor.cap += HEALTH_TAIL_RESERVE;
+    else          hw->u.json.cap += HEALTH_TAIL_RESERVE;
+}
+
+/* -------------------------------------------------------------------------
+ * Member splitting
+ *
+ * Depth 1 is the chunk object.  A member written with a key at depth 1 or
+ * 2 is a unit, except an object opened at depth 1: that is a parent and
+ * its members are the units (an empty parent counts as one unit itself).
+ * Units are numbered in the order the provider writes them.  Units below
+ * `skip` went out in an earlier chunk and are rewound as soon as they are
+ * complete; a parent left with none of its units is rewound too.  `fit`
+ * remembers where the last unit ended while the writer was still ok, so an
+ * overflow can be cut back to a member boundary.
+ * ------------------------------------------------------------------------- */
+
+enum { ROLE_NONE, ROLE_UNIT, ROLE_PARENT };
+
+#define SPLIT_DEPTH  3          /* deepest container whose role matters */
+
+struct health_split {
+    uint16_t  skip;             /* units sent in earlier chunks          */
+    uint16_t  unit;             /* index of the next unit                */
+    uint16_t  fit;              /* units complete at fit_mark            */
+    uint8_t   fit_depth;        /* 2: fit_mark is inside a parent        */
+    uint8_t   depth;            /* containers open                       */
+    uint8_t   role[SPLIT_DEPTH + 1];
+    uint16_t  first[SPLIT_DEPTH + 1];   /* parent: first unit inside      */
+    hw_mark_t start[SPLIT_DEPTH + 1];   /* before the key that opened it  */
+    hw_mark_t fit_mark;
+};
+
+static bool is_unit_key(const health_writer_t *hw, const char *key)
+{
+    struct health_split *s = hw->split;
+    return s != NULL && key != NULL && (s->depth == 1 || s->depth == 2);
+}
+
+/* A unit (or empty parent) starting at `m` is complete */
+static void unit_done(health_writer_t *hw, const hw_mark_t *m)
+{
+    struct health_split *s = hw->split;
+    uint16_t k = s->unit++;
+
+    if (k < s->skip) {
+        hw_rewind(hw, m);
+    } else if (hw_ok(hw)) {
+        s->fit       = k + 1;
+        s->fit_depth = s->depth;
+        s->fit_mark  = hw_mark(hw);
+    }
+}
+
+static void container_open(health_writer_t *hw, const char *key,
+                           const hw_mark_t *m, bool object)
+{
+    struct health_split *s = hw->split;
+    if (s == NULL) return;
+
+    uint8_t kd = s->depth;                  /* depth the key went to */
+    uint8_t d  = ++s->depth;
+    if (d > SPLIT_DEPTH) return;
+
+    s->role[d] = ROLE_NONE;
+    if (key == NULL || (kd != 1 && kd != 2)) return;
+    s->role[d]  = (object && kd == 1) ? ROLE_PARENT : ROLE_UNIT;
+    s->first[d] = s->unit;
+    s->start[d] = *m;
+}
+
+static void container_close(health_writer_t *hw)
+{
+    struct health_split *s = hw->split;
+    if (s == NULL) return;
+
+    uint8_t d = s->depth--;
+    if (d > SPLIT_DEPTH) return;
+
+    if (s->role[d] == ROLE_UNIT) {
+        unit_done(hw, &s->start[d]);
+    } else if (s->role[d] == ROLE_PARENT) {
+        if (s->unit == s->first[d])         unit_done(hw, &s->start[d]);
+        else if (s->unit <= s->skip)        hw_rewind(hw, &s->start[d]);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Field writer
+ * ------------------------------------------------------------------------- */
+
+static void put_key(health_writer_t *hw, const char *key)
+{
+    if (key == NULL) return;
+    if (hw->cbor) cbor_put_text(&hw->u.cbor, key);
+    else          json_key(&hw->u.json, key);
+}
+
+/* Bracket a scalar member: rewind / fit bookkeeping once it is written */
+#define LEAF(hw, key, body)                                         \
+    do {                                                            \
+        bool      unit_ = is_unit_key(hw, key);                     \
+        hw_mark_t m_;                                               \
+        if (unit_) m_ = hw_mark(hw);                                \
+        put_key(hw, key);                                           \
+        body;                                                       \
+        if (unit_) unit_done(hw, &m_);                              \
+    } while (0)
+
+void health_field_int(health_writer_t *hw, const char *key, int64_t v)
+{
+    LEAF(hw, key,
+         if (hw->cbor) cbor_put_int(&hw->u.cbor, v);
+         else          json_put_int(&hw->u.json, v));
+}
+
+void health_field_uint(health_writer_t *hw, const char *key, uint64_t v)
+{
+    LEAF(hw, key,
+         if (hw->cbor) cbor_put_uint(&hw->u.cbor, v);
+         else          json_put_uint(&hw->u.json, v));
+}
+
+void health_field_bool(health_writer_t *hw, const char *key, bool v)
+{
+    LEAF(hw, key,
+         if (hw->cbor) cbor_put_bool(&hw->u.cbor, v);
+         else          json_put_bool(&hw->u.json, v));
+}
+
+void health_field_str(health_writer_t *hw, const char *key, const char *s)
+{
+    LEAF(hw, key,
+         if (hw->cbor) cbor_put_text(&hw->u.cbor, s);
+         else          json_put_str(&hw->u.json, s));
+}
+
+void health_field_null(health_writer_t *hw, const char *key)
+{
+    LEAF(hw, key,
+         if (hw->cbor) cbor_put_null(&hw->u.cbor);
+         else          json_put_null(&hw->u.json));
+}
+
+void health_field_float(health_writer_t *hw, const char *key, float v, int decimals)
+{
+    LEAF(hw, key,
+         if (hw->cbor) {
+             if (isnan(v)) cbor_put_null(&hw->u.cbor);
+             else          cbor_put_float(&hw->u.cbor, v);
+         } else {
+             json_put_float(&hw->u.json, v, decimals);
+         });
+}
+
+void health_begin_object(health_writer_t *hw, const char *key)
+{
+    hw_mark_t m = hw_mark(hw);
+    put_key(hw, key);
+    if (hw->cbor) cbor_begin_map_indef(&hw->u.cbor);
+    else          json_begin_object(&hw->u.json);
+    container_open(hw, key, &m, true);
+}
+
+void health_end_object(health_writer_t *hw)
+{
+    if (hw->cbor) cbor_end(&hw->u.cbor);
+    else          json_end_object(&hw->u.json);
+    container_close(hw);
+}
+
+void health_begin_array(health_writer_t *hw, const char *key)
+{
+    hw_mark_t m = hw_mark(hw);
+    put_key(hw, key);
+    if (hw->cbor) cbor_begin_array_indef(&hw->u.cbor);
+    else          json_begin_array(&hw->u.json);
+    container_open(hw, key, &m, false);
+}
+
+void health_end_array(health_writer_t *hw)
+{
+    if (hw->cbor) cbor_end(&hw->u.cbor);
+    else          json_end_array(&hw->u.json);
+    container_close(hw);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t health_payload_register(const char *name, health_provider_fn_t fn,
+                                  void *ctx)
+{
+    if (name == NULL || fn == NULL) return ESP_ERR_INVALID_ARG;
+
+    int n = provider_count();
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_providers[i].ready) &&
+            strcmp(s_providers[i].name, name) == 0) {
+            return ESP_OK;
+        }
+    }
+
+    int idx = atomic_fetch_add(&s_reserved, 1);
+    if (idx >= HEALTH_PROVIDERS_MAX) {
+        ESP_LOGE(TAG, "Provider table full -- '%s' not registered", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_providers[idx].name = name;
+    s_providers[idx].fn   = fn;
+    s_providers[idx].ctx  = ctx;
+    atomic_store(&s_providers[idx].ready, true);
+
+    ESP_LOGI(TAG, "Provider '%s' registered (%d)", name, idx);
+    return ESP_OK;
+}
+
+void health_payload_begin(health_payload_iter_t *it, uint32_t seq)
+{
+    it->seq  = seq;
+    it->part = 0;
+    it->next   = 0;
+    it->member = 0;
+    it->done   = false;
+}
+
+size_t health_payload_next(health_payload_iter_t *it, bool cbor,
+                           void *buf, size_t size)
+{
+    if (it->done || buf == NULL || size < HEALTH_PAYLOAD_CHUNK_MIN) return 0;
+
+    health_writer_t hw = { .cbor = cbor };
+    if (cbor) cbor_writer_init(&hw.u.cbor, buf, size - HEALTH_TAIL_RESERVE);
+    else      json_writer_init(&hw.u.json, buf, size - HEALTH_TAIL_RESERVE);
+
+    health_begin_object(&hw, NULL);
+    health_field_uint(&hw, "seq", it->seq);
+    if (it->part > 0) health_field_uint(&hw, "part", it->part);
+
+    const size_t empty = hw_len(&hw);
+    const int    n     = provider_count();
+    bool         more  = false;
+    bool         close = false;     /* cut inside a parent object */
+
+    while (it->next < n) {
+        provider_slot_t *p = &s_providers[it->next];
+        if (!atomic_load(&p->ready)) {
+            it->next++;
+            it->member = 0;
+            continue;
+        }
+
+        struct health_split split = { .skip = it->member, .depth = 1 };
+        hw_mark_t m = hw_mark(&hw);
+        hw.split = &split;
+        p->fn(&hw, p->ctx);
+        hw.split = NULL;
+        if (hw_ok(&hw)) {
+            it->next++;
+            it->member = 0;
+            continue;
+        }
+
+        if (it->member == 0 && mark_len(&hw, &m) > empty) {
+            /* Try it whole in a message of its own first */
+            hw_rewind(&hw, &m);
+            more = true;
+            break;
+        }
+
+        if (split.fit > it->member) {
+            /* Send the members that fit, resume after them */
+            hw_rewind(&hw, &split.fit_mark);
+            close      = (split.fit_depth == 2);
+            it->member = split.fit;
+            more       = true;
+            break;
+        }
+
+        /* Member `it->member` does not fit on its own -- skip it */
+        ESP_LOGE(TAG, "Provider '%s': member %u exceeds %u B -- dropped",
+                 p->name, (unsigned)it->member, (unsigned)size);
+        atomic_fetch_add(&s_dropped, 1);
+        hw_rewind(&hw, &m);
+        it->member++;
+    }
+
+    hw_release_tail(&hw);
+    if (close) health_end_object(&hw);
+    if (more)  health_field_bool(&hw, "more", true);
+    health_end_object(&hw);
+
+    it->part++;
+    it->done = !more;
+    return hw_ok(&hw) ? hw_len(&hw) : 0;
+}
+
+esp_err_t health_payload_write(health_writer_t *hw, const char *name)
+{
+    bool found = false;
+    int  n     = provider_count();
+    for (int i = 0; i < n; i++) {
+        provider_slot_t *p = &s_providers[i];
+        if (!atomic_load(&p->ready)) continue;
+        if (name != NULL && strcmp(p->name, name) != 0) continue;
+        p->fn(hw, p->ctx);
+        found = true;
+    }
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+uint32_t health_payload_get_dropped(void)
+{
+    return atomic_load(&s_dropped);
+}
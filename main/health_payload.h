@@ -0,0 +1,147 @@
+/*
+ * health_payload.h - Extensible health payload assembly
+ *
+ * Services contribute fields to the periodic health message by registering
+ * a provider.  The mqtt publish task walks the registry once per health
+ * interval and every provider writes its fields through a small format-
+ * agnostic API, so one provider serves both the JSON and the CBOR payload.
+ *
+ * Provider conventions:
+ *   - write a single object keyed by the provider name, e.g.
+ *       "ds18b20":{"n":3,"msgs":120,"t":[16.44,16.50,null]}
+ *     (the "core" and "mqtt" providers in mqtt_service.c write flat keys
+ *      to keep the pre-existing payload layout)
+ *   - read state without blocking: snapshots of volatile/atomic fields,
+ *     never a queue round-trip -- providers run on the publish task, and
+ *     one at a time on an RPC worker for the "stats" method, so they only
+ *     read and never update state of their own
+ *   - keep each member small; a provider as a whole may outgrow a message
+ *
+ * Chunking: if a provider's output does not fit in the remaining buffer the
+ * writer is rewound to just before it, the payload is closed with
+ * "more":true, and assembly resumes with that provider in the next message.
+ * Every message carries "seq"; continuation messages add "part":N.
+ *
+ *   {"seq":41,"uptime_s":3742,...,"more":true}
+ *   {"seq":41,"part":1,"ds18b20":{...},"display":{...}}
+ *
+ * A provider that does not fit even in a message of its own is split
+ * between its members: the top-level keys it writes and, for an object
+ * among them, that object's keys.  The continuation opens the enclosing
+ * object again with the remaining members, so a consumer merges chunks one
+ * object level deep:
+ *
+ *   {"seq":41,"part":1,"cmd_us":{"relay":{...},"text":{...}},"more":true}
+ *   {"seq":41,"part":2,"cmd_us":{"ota":{...}},"cmd_drop":0}
+ *
+ * Only a single member larger than a message is dropped (ESP_LOGE, counted
+ * by health_payload_get_dropped()).  The provider is run again for every
+ * chunk, so a member that appears or disappears in between may be sent
+ * twice or skipped in that one payload.
+ *
+ * Registration is lock-free (atomic slot reservation) and idempotent by
+ * name, so a service restarted by the supervisor may register again.
+ */
+
+#ifndef HEALTH_PAYLOAD_H
+#define HEALTH_PAYLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "json_writer.h"
+#include "cbor_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef HEALTH_PROVIDERS_MAX
+#define HEALTH_PROVIDERS_MAX        16
+#endif
+
+/* Smallest buffer health_payload_next() accepts */
+#define HEALTH_PAYLOAD_CHUNK_MIN    128
+
+struct health_split;
+
+/* -------------------------------------------------------------------------
+ * Field writer -- wraps either a json_writer_t or a cbor_writer_t
+ * ------------------------------------------------------------------------- */
+typedef struct {
+    bool cbor;
+    union {
+        json_writer_t json;
+        cbor_writer_t cbor;
+    } u;
+    struct health_split *split;     /* health_payload_next() only, else NULL */
+} health_writer_t;
+
+/* Object members.  `key` may be NULL only for elements inside an array. */
+void health_field_int(health_writer_t *hw, const char *key, int64_t v);
+void health_field_uint(health_writer_t *hw, const char *key, uint64_t v);
+void health_field_bool(health_writer_t *hw, const char *key, bool v);
+void health_field_str(health_writer_t *hw, const char *key, const char *s);
+void health_field_null(health_writer_t *hw, const char *key);
+
+/** JSON prints `decimals` fraction digits; CBOR uses the shortest lossless
+ *  float.  NaN is written as null in both. */
+void health_field_float(health_writer_t *hw, const char *key, float v, int decimals);
+
+void health_begin_object(health_writer_t *hw, const char *key);
+void health_end_object(health_writer_t *hw);
+void health_begin_array(health_writer_t *hw, const char *key);
+void health_end_array(health_writer_t *hw);
+
+/* -------------------------------------------------------------------------
+ * Provider registry
+ * ------------------------------------------------------------------------- */
+typedef void (*health_provider_fn_t)(health_writer_t *hw, void *ctx);
+
+/**
+ * Register a field provider.  `name` must point to static storage.
+ * Registering a name that already exists is a no-op.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_NO_MEM if the table is full
+ */
+esp_err_t health_payload_register(const char *name, health_provider_fn_t fn,
+                                  void *ctx);
+
+/* -------------------------------------------------------------------------
+ * Assembly
+ * ------------------------------------------------------------------------- */
+typedef struct {
+    uint32_t seq;       /* health message number, repeated in every chunk */
+    uint8_t  part;      /* index of the next chunk                       */
+    uint8_t  next;      /* provider to resume from                       */
+    uint16_t member;    /* members of `next` sent in earlier chunks      */
+    bool     done;      /* all providers emitted                         */
+} health_payload_iter_t;
+
+void health_payload_begin(health_payload_iter_t *it, uint32_t seq);
+
+/**
+ * Build the next chunk into buf.  Call until it->done is true.
+ *
+ * @return encoded length (JSON is also NUL-terminated), or 0 on failure
+ */
+size_t health_payload_next(health_payload_iter_t *it, bool cbor,
+                           void *buf, size_t size);
+
+/**
+ * Run one provider (name) or all of them (NULL) into the object currently
+ * open in `hw`, outside the periodic payload -- e.g. an on-demand query.
+ * Not chunked: the caller checks its writer for overflow.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if no provider has that name
+ */
+esp_err_t health_payload_write(health_writer_t *hw, const char *name);
+
+/** Members skipped because they exceeded an empty chunk on their own. */
+uint32_t health_payload_get_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEALTH_PAYLOAD_H */
@@ -0,0 +1,192 @@
+/*
+ * json_writer.c - Minimal streaming JSON encoder
+ *
+ * Separator rule: before any value or key, emit ',' if the enclosing
+ * container already has a member -- unless the value completes a
+ * "key": pair, in which case the ',' went out before the key.
+ */
+
+#include "json_writer.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* -------------------------------------------------------------------------
+ * Low-level output
+ * ------------------------------------------------------------------------- */
+
+static bool reserve(json_writer_t *w, size_t n)
+{
+    if (w->overflow) return false;
+    if (w->cap - w->len < n) {
+        w->overflow = true;
+        return false;
+    }
+    return true;
+}
+
+static void put_raw(json_writer_t *w, const char *s, size_t n)
+{
+    if (!reserve(w, n)) return;
+    memcpy(&w->buf[w->len], s, n);
+    w->len += n;
+    w->buf[w->len] = '\0';
+}
+
+static void put_char(json_writer_t *w, char c)
+{
+    put_raw(w, &c, 1);
+}
+
+/* Emits the ',' separator if needed and marks the container non-empty */
+static void begin_item(json_writer_t *w)
+{
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    uint32_t bit = 1u << w->depth;
+    if (w->has_members & bit) put_char(w, ',');
+    w->has_members |= bit;
+}
+
+static void put_quoted(json_writer_t *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    put_char(w, '"');
+    for (const char *p = s; *p && !w->overflow; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            put_raw(w, esc, 2);
+        } else if (c < 0x20) {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+            put_raw(w, esc, 6);
+        } else {
+            put_char(w, (char)c);
+        }
+    }
+    put_char(w, '"');
+}
+
+static void open_container(json_writer_t *w, char c)
+{
+    begin_item(w);
+    put_char(w, c);
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        w->overflow = true;         /* nesting limit: treat as overflow */
+        return;
+    }
+    w->depth++;
+    w->has_members &= ~(1u << w->depth);
+}
+
+static void close_container(json_writer_t *w, char c)
+{
+    if (w->depth > 0) w->depth--;
+    w->after_key = false;
+    put_char(w, c);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size)
+{
+    w->buf         = buf;
+    w->cap         = (buf != NULL && size > 0) ? size - 1 : 0;
+    w->len         = 0;
+    w->has_members = 0;
+    w->depth       = 0;
+    w->after_key   = false;
+    w->overflow    = (w->buf == NULL || size == 0);
+    if (!w->overflow) w->buf[0] = '\0';
+}
+
+json_writer_mark_t json_writer_mark(const json_writer_t *w)
+{
+    json_writer_mark_t m = {
+        .len         = w->len,
+        .has_members = w->has_members,
+        .depth       = w->depth,
+        .after_key   = w->after_key,
+    };
+    return m;
+}
+
+void json_writer_rewind(json_writer_t *w, const json_writer_mark_t *m)
+{
+    w->len         = m->len;
+    w->has_members = m->has_members;
+    w->depth       = m->depth;
+    w->after_key   = m->after_key;
+    w->overflow    = false;
+    if (w->cap > 0) w->buf[w->len] = '\0';
+}
+
+void json_begin_object(json_writer_t *w) { open_container(w, '{');  }
+void json_end_object(json_writer_t *w)   { close_container(w, '}'); }
+void json_begin_array(json_writer_t *w)  { open_container(w, '[');  }
+void json_end_array(json_writer_t *w)    { close_container(w, ']'); }
+
+void json_key(json_writer_t *w, const char *key)
+{
+    begin_item(w);
+    put_quoted(w, key ? key : "");
+    put_char(w, ':');
+    w->after_key = true;
+}
+
+void json_put_int(json_writer_t *w, int64_t v)
+{
+    char tmp[24];
+    int n = snprintf(tmp, sizeof(tmp), "%" PRId64, v);
+    begin_item(w);
+    put_raw(w, tmp, (size_t)n);
+}
+
+void json_put_uint(json_writer_t *w, uint64_t v)
+{
+    char tmp[24];
+    int n = snprintf(tmp, sizeof(tmp), "%" PRIu64, v);
+    begin_item(w);
+    put_raw(w, tmp, (size_t)n);
+}
+
+void json_put_bool(json_writer_t *w, bool v)
+{
+    begin_item(w);
+    if (v) put_raw(w, "true", 4);
+    else   put_raw(w, "false", 5);
+}
+
+void json_put_null(json_writer_t *w)
+{
+    begin_item(w);
+    put_raw(w, "null", 4);
+}
+
+void json_put_float(json_writer_t *w, float v, int decimals)
+{
+    if (isnan(v) || isinf(v)) {
+        json_put_null(w);
+        return;
+    }
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.*f", decimals, (double)v);
+    if (n < 0 || (size_t)n >= sizeof(tmp)) {
+        json_put_null(w);           /* absurd magnitude -- not representable */
+        return;
+    }
+    begin_item(w);
+    put_raw(w, tmp, (size_t)n);
+}
+
+void json_put_str(json_writer_t *w, const char *s)
+{
+    begin_item(w);
+    put_quoted(w, s ? s : "");
+}
@@ -0,0 +1,90 @@
+/*
+ * json_writer.h - Minimal streaming JSON encoder
+ *
+ * The JSON counterpart of cbor_writer: writes straight into a caller-
+ * supplied char buffer, no heap, no recursion, no intermediate tree.
+ * Separators are inserted automatically -- callers never emit ',' or ':'.
+ *
+ * Overflow handling: once a write would exceed the buffer, the writer is
+ * latched into the overflow state and every further call is a no-op.
+ * Check json_writer_ok() once after encoding.  The buffer is always left
+ * NUL-terminated at json_writer_len().
+ *
+ * Checkpoints: json_writer_mark() / json_writer_rewind() let a caller undo
+ * everything written since the mark (including an overflow), e.g. to drop
+ * a member that did not fit and carry it over into the next message.
+ *
+ * Usage:
+ *   char buf[128];
+ *   json_writer_t w;
+ *   json_writer_init(&w, buf, sizeof(buf));
+ *   json_begin_object(&w);
+ *   json_key(&w, "uptime_s"); json_put_int(&w, 3742);
+ *   json_key(&w, "ip");       json_put_str(&w, "192.168.1.42");
+ *   json_end_object(&w);
+ *   if (json_writer_ok(&w)) publish(buf, json_writer_len(&w));
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum container nesting depth */
+#define JSON_WRITER_MAX_DEPTH   16
+
+typedef struct {
+    char     *buf;
+    size_t    cap;          /* bytes usable for text, excluding the NUL */
+    size_t    len;
+    uint32_t  has_members;  /* bit d: container at depth d is non-empty */
+    uint8_t   depth;
+    bool      after_key;    /* next value completes a "key": pair       */
+    bool      overflow;
+} json_writer_t;
+
+typedef struct {
+    size_t    len;
+    uint32_t  has_members;
+    uint8_t   depth;
+    bool      after_key;
+} json_writer_mark_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size);
+
+static inline bool   json_writer_ok(const json_writer_t *w)  { return !w->overflow; }
+static inline size_t json_writer_len(const json_writer_t *w) { return w->len; }
+
+json_writer_mark_t json_writer_mark(const json_writer_t *w);
+void               json_writer_rewind(json_writer_t *w, const json_writer_mark_t *m);
+
+void json_begin_object(json_writer_t *w);
+void json_end_object(json_writer_t *w);
+void json_begin_array(json_writer_t *w);
+void json_end_array(json_writer_t *w);
+
+/** Object member name; must be followed by exactly one value. */
+void json_key(json_writer_t *w, const char *key);
+
+void json_put_int(json_writer_t *w, int64_t v);
+void json_put_uint(json_writer_t *w, uint64_t v);
+void json_put_bool(json_writer_t *w, bool v);
+void json_put_null(json_writer_t *w);
+
+/** Fixed-point float with `decimals` fraction digits; NaN/inf become null. */
+void json_put_float(json_writer_t *w, float v, int decimals);
+
+/** Quoted string; '"', '\\' and control characters are escaped. */
+void json_put_str(json_writer_t *w, const char *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_WRITER_H */
@@ -8,6 +8,7 @@
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "system.h"
+#include "config_store.h"
 
 void app_main(void)
 {
@@ -23,6 +24,9 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
     
+    // Runtime config (NVS-backed) before any service reads it
+    config_store_init();
+    
     ESP_LOGI("main", "Bootloader starting. Heap free: %"PRIu32, 
             esp_get_free_heap_size());
     
@@ -0,0 +1,398 @@
+/*
+ * mqtt_brokers.c - Broker list, health and selection for mqtt_service
+ *
+ * The probe is a plain non-blocking TCP connect + select(): it proves the
+ * broker's port accepts connections without an MQTT session, so it can
+ * run while the client is connected elsewhere.  It runs on its own task
+ * (getaddrinfo() and select() block); the request carries a copy of
+ * host and port, so the task never reads the table.
+ */
+
+#include "mqtt_brokers.h"
+#include "priorities.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *TAG = "mqtt-brokers";
+
+#define BACKOFF_MIN_US      1000000LL
+#define BACKOFF_MAX_US      60000000LL
+#define RTT_UNKNOWN         UINT32_MAX
+
+#define PROBE_TIMEOUT_MS    1000
+#define PROBE_LOST_US       ((PROBE_TIMEOUT_MS + 4000) * 1000LL)   /* DNS included */
+#define PROBE_FRESH_US      60000000LL      /* older RTTs are re-probed */
+#define PROBE_POLL_US       20000LL
+#define PROBE_STACK         3072
+
+/* Probe hand-back word: tag (16) | state (8) | ms (32) */
+#define PROBE_WORD(tag, st, ms) \
+    (((uint64_t)(tag) << 40) | ((uint64_t)(st) << 32) | (uint32_t)(ms))
+#define PROBE_TAG(w)        ((uint16_t)((w) >> 40))
+#define PROBE_STATE(w)      ((mqtt_probe_state_t)(((w) >> 32) & 0xFF))
+#define PROBE_MS(w)         ((uint32_t)(w))
+
+typedef struct {
+    char        uri[MQTT_BROKER_URI_LEN];
+    char        host[64];
+    uint16_t    port;
+    int64_t     retry_at_us;        /* back-off end, 0 = not backing off */
+    int64_t     backoff_us;
+    atomic_uint rtt_ms;             /* moving average, RTT_UNKNOWN = none */
+    atomic_uint failures;           /* failed connect attempts since boot */
+    _Atomic uint64_t probe;         /* PROBE_WORD, see header */
+    uint16_t    tag;                /* of the last probe started */
+    int64_t     probe_us;           /* pending probe started, 0 = none */
+    int64_t     probed_us;          /* last probe finished, 0 = never */
+    mqtt_probe_state_t last;        /* its result */
+} broker_t;
+
+typedef struct {
+    uint8_t     idx;
+    uint16_t    tag;
+    uint16_t    port;
+    char        host[64];
+} probe_req_t;
+
+static broker_t      s_brokers[MQTT_BROKERS_MAX];
+static int           s_count;
+static atomic_int    s_current = -1;
+static atomic_uint   s_switches;
+static atomic_uint   s_switch_ms;   /* duration of the last switchover */
+static QueueHandle_t s_probe_q;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+/* scheme://[user@]host[:port][/path] -> host, port (scheme default) */
+static bool parse_uri(const char *uri, char *host, size_t hsize, uint16_t *port)
+{
+    const char *p = strstr(uri, "://");
+    if      (strncmp(uri, "mqtts://", 8) == 0) *port = 8883;
+    else if (strncmp(uri, "wss://", 6) == 0)   *port = 443;
+    else if (strncmp(uri, "ws://", 5) == 0)    *port = 80;
+    else                                       *port = 1883;
+    p = p ? p + 3 : uri;
+
+    const char *at = strchr(p, '@');
+    const char *sl = strchr(p, '/');
+    if (at != NULL && (sl == NULL || at < sl)) p = at + 1;
+
+    size_t n = strcspn(p, ":/");
+    if (n == 0 || n >= hsize) return false;
+    memcpy(host, p, n);
+    host[n] = '\0';
+
+    if (p[n] == ':') {
+        long v = strtol(p + n + 1, NULL, 10);
+        if (v <= 0 || v > 65535) return false;
+        *port = (uint16_t)v;
+    }
+    return true;
+}
+
+static void add_broker(const char *uri, size_t len)
+{
+    if (s_count >= MQTT_BROKERS_MAX) {
+        ESP_LOGW(TAG, "Broker list full -- ignoring '%.*s'", (int)len, uri);
+        return;
+    }
+    if (len == 0 || len >= MQTT_BROKER_URI_LEN) return;
+
+    broker_t *b = &s_brokers[s_count];
+    memset(b->uri, 0, sizeof(b->uri));
+    memcpy(b->uri, uri, len);
+    if (!parse_uri(b->uri, b->host, sizeof(b->host), &b->port)) {
+        ESP_LOGW(TAG, "Unparsable broker URI '%s' -- ignored", b->uri);
+        return;
+    }
+    b->retry_at_us = 0;
+    b->backoff_us  = 0;
+    atomic_store(&b->rtt_ms, RTT_UNKNOWN);
+    atomic_store(&b->failures, 0);
+    atomic_store(&b->probe, PROBE_WORD(b->tag, MQTT_PROBE_NONE, 0));
+    b->probe_us  = 0;
+    b->probed_us = 0;
+    b->last      = MQTT_PROBE_NONE;
+    ESP_LOGI(TAG, "Broker %d: %s (%s:%u)%s", s_count, b->uri, b->host,
+             (unsigned)b->port, s_count == 0 ? " primary" : "");
+    s_count++;
+}
+
+static void update_rtt(broker_t *b, uint32_t ms)
+{
+    uint32_t old = atomic_load(&b->rtt_ms);
+    atomic_store(&b->rtt_ms, (old == RTT_UNKNOWN) ? ms : (3 * old + ms) / 4);
+}
+
+static bool available(const broker_t *b, int64_t now_us)
+{
+    return b->retry_at_us <= now_us;
+}
+
+static bool probe_stale(const broker_t *b, int64_t now_us)
+{
+    return b->probe_us == 0 &&
+           (b->probed_us == 0 || now_us - b->probed_us >= PROBE_FRESH_US);
+}
+
+/* TCP handshake with host:port, blocking for at most timeout_ms plus the
+ * name lookup.  @return handshake time in ms, or -1 */
+static int tcp_probe(const char *host, uint16_t port_num, uint32_t timeout_ms)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", (unsigned)port_num);
+    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) return -1;
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    int64_t t0 = esp_timer_get_time();
+    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if (rc != 0 && errno == EINPROGRESS) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(fd, &wfds);
+        struct timeval tv = {
+            .tv_sec  = timeout_ms / 1000,
+            .tv_usec = (timeout_ms % 1000) * 1000,
+        };
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (select(fd + 1, NULL, &wfds, NULL, &tv) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+            rc = 0;
+        }
+    }
+    close(fd);
+    if (rc != 0) return -1;
+    return (int)((esp_timer_get_time() - t0) / 1000);
+}
+
+static void probe_task(void *arg)
+{
+    (void)arg;
+    probe_req_t r;
+    for (;;) {
+        if (xQueueReceive(s_probe_q, &r, portMAX_DELAY) != pdTRUE) continue;
+        int ms = tcp_probe(r.host, r.port, PROBE_TIMEOUT_MS);
+
+        /* Only if the service still waits for this very probe */
+        uint64_t want = PROBE_WORD(r.tag, MQTT_PROBE_PENDING, 0);
+        uint64_t done = (ms >= 0) ? PROBE_WORD(r.tag, MQTT_PROBE_OK, ms)
+                                  : PROBE_WORD(r.tag, MQTT_PROBE_FAILED, 0);
+        atomic_compare_exchange_strong(&s_brokers[r.idx].probe, &want, done);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t mqtt_brokers_init(void)
+{
+    if (s_probe_q != NULL) return ESP_OK;
+    s_probe_q = xQueueCreate(MQTT_BROKERS_MAX, sizeof(probe_req_t));
+    if (s_probe_q == NULL) return ESP_ERR_NO_MEM;
+    if (xTaskCreate(probe_task, "mqtt-probe", PROBE_STACK, NULL,
+                    PRIO_MQTT_PROBE, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Probe task not created");
+        vQueueDelete(s_probe_q);
+        s_probe_q = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+int mqtt_brokers_load(const char *primary, const char *backups)
+{
+    s_count = 0;
+    atomic_store(&s_current, -1);
+    if (primary != NULL) add_broker(primary, strlen(primary));
+
+    const char *p = backups;
+    while (p != NULL && *p) {
+        p += strspn(p, ", ");
+        size_t n = strcspn(p, ", ");
+        if (n > 0) add_broker(p, n);
+        p += n;
+    }
+    return s_count;
+}
+
+int mqtt_brokers_count(void)
+{
+    return s_count;
+}
+
+const char *mqtt_brokers_uri(int idx)
+{
+    return (idx >= 0 && idx < s_count) ? s_brokers[idx].uri : NULL;
+}
+
+int mqtt_brokers_select(int64_t now_us, int64_t *ready_at_us)
+{
+    *ready_at_us = now_us;
+    if (s_count == 0) return -1;
+    if (available(&s_brokers[0], now_us)) return 0;
+
+    /* Primary is backing off: measure stale backups, take the fastest */
+    int  best    = -1;
+    bool waiting = false;
+    for (int i = 1; i < s_count; i++) {
+        broker_t *b = &s_brokers[i];
+        if (!available(b, now_us)) continue;
+        if (probe_stale(b, now_us)) mqtt_brokers_probe_start(i, now_us);
+        if (b->probe_us != 0) {
+            waiting = true;
+            continue;
+        }
+        if (best < 0 || atomic_load(&b->rtt_ms) < atomic_load(&s_brokers[best].rtt_ms)) {
+            best = i;
+        }
+    }
+    if (waiting) {
+        *ready_at_us = now_us + PROBE_POLL_US;
+        return best >= 0 ? best : 1;
+    }
+    if (best >= 0) return best;
+
+    /* Everyone is backing off -- wait for the first to come back */
+    best = 0;
+    for (int i = 1; i < s_count; i++) {
+        if (s_brokers[i].retry_at_us < s_brokers[best].retry_at_us) best = i;
+    }
+    *ready_at_us = s_brokers[best].retry_at_us;
+    return best;
+}
+
+void mqtt_brokers_on_connected(int idx)
+{
+    if (idx < 0 || idx >= s_count) return;
+    broker_t *b = &s_brokers[idx];
+    b->retry_at_us = 0;
+    b->backoff_us  = 0;
+    atomic_store(&s_current, idx);
+}
+
+void mqtt_brokers_on_failed(int idx, int64_t now_us)
+{
+    if (idx < 0 || idx >= s_count) return;
+    broker_t *b = &s_brokers[idx];
+    b->backoff_us  = (b->backoff_us == 0) ? BACKOFF_MIN_US
+                   : (b->backoff_us * 2 > BACKOFF_MAX_US) ? BACKOFF_MAX_US
+                   : b->backoff_us * 2;
+    b->retry_at_us = now_us + b->backoff_us;
+    atomic_fetch_add(&b->failures, 1);
+    ESP_LOGW(TAG, "Broker %d (%s) failed -- retry in %lld s", idx, b->uri,
+             (long long)(b->backoff_us / 1000000));
+}
+
+void mqtt_brokers_set_current(int idx)
+{
+    atomic_store(&s_current, idx);
+}
+
+void mqtt_brokers_on_switchover(uint32_t ms)
+{
+    atomic_fetch_add(&s_switches, 1);
+    atomic_store(&s_switch_ms, ms);
+}
+
+bool mqtt_brokers_probe_start(int idx, int64_t now_us)
+{
+    if (idx < 0 || idx >= s_count || s_probe_q == NULL) return false;
+    broker_t *b = &s_brokers[idx];
+    if (b->probe_us != 0) return true;
+
+    probe_req_t r = { .idx = (uint8_t)idx, .tag = ++b->tag, .port = b->port };
+    memcpy(r.host, b->host, sizeof(r.host));
+    atomic_store(&b->probe, PROBE_WORD(r.tag, MQTT_PROBE_PENDING, 0));
+    if (xQueueSend(s_probe_q, &r, 0) != pdTRUE) {
+        atomic_store(&b->probe, PROBE_WORD(r.tag, MQTT_PROBE_FAILED, 0));
+        b->probed_us = now_us;
+        b->last      = MQTT_PROBE_FAILED;
+        return false;
+    }
+    b->probe_us = now_us;
+    return true;
+}
+
+void mqtt_brokers_poll(int64_t now_us)
+{
+    for (int i = 0; i < s_count; i++) {
+        broker_t *b = &s_brokers[i];
+        if (b->probe_us == 0) continue;
+
+        uint64_t w = atomic_load(&b->probe);
+        if (PROBE_STATE(w) == MQTT_PROBE_PENDING) {
+            if (now_us - b->probe_us < PROBE_LOST_US) continue;
+            /* Stuck in DNS: give up; a late answer then finds no match */
+            uint64_t failed = PROBE_WORD(b->tag, MQTT_PROBE_FAILED, 0);
+            if (!atomic_compare_exchange_strong(&b->probe, &w, failed)) continue;
+            w = failed;
+        }
+
+        b->probe_us  = 0;
+        b->probed_us = now_us;
+        b->last      = PROBE_STATE(w);
+        if (b->last == MQTT_PROBE_OK) {
+            update_rtt(b, PROBE_MS(w));
+            b->retry_at_us = 0;
+            b->backoff_us  = 0;
+        } else {
+            atomic_store(&b->rtt_ms, RTT_UNKNOWN);
+        }
+    }
+}
+
+mqtt_probe_state_t mqtt_brokers_probe_state(int idx)
+{
+    if (idx < 0 || idx >= s_count) return MQTT_PROBE_NONE;
+    return (s_brokers[idx].probe_us != 0) ? MQTT_PROBE_PENDING : s_brokers[idx].last;
+}
+
+void mqtt_brokers_write_health(health_writer_t *hw)
+{
+    if (s_count < 2) return;
+
+    health_begin_object(hw, "brk");
+    health_field_int(hw, "cur", atomic_load(&s_current));
+    health_begin_array(hw, "rtt");
+    for (int i = 0; i < s_count; i++) {
+        uint32_t rtt = atomic_load(&s_brokers[i].rtt_ms);
+        if (rtt == RTT_UNKNOWN) health_field_null(hw, NULL);
+        else                    health_field_uint(hw, NULL, rtt);
+    }
+    health_end_array(hw);
+    health_begin_array(hw, "fail");
+    for (int i = 0; i < s_count; i++) {
+        health_field_uint(hw, NULL, atomic_load(&s_brokers[i].failures));
+    }
+    health_end_array(hw);
+    health_field_uint(hw, "sw",    atomic_load(&s_switches));
+    health_field_uint(hw, "sw_ms", atomic_load(&s_switch_ms));
+    health_end_object(hw);
+}
@@ -0,0 +1,105 @@
+/*
+ * mqtt_brokers.h - Broker list, health and selection for mqtt_service
+ *
+ * Entry 0 is the primary broker, the rest are backups.  Selection:
+ *   1. the primary, unless it is backing off after failed connects
+ *   2. otherwise the healthy backup with the lowest RTT; backups never
+ *      probed, or not within the last minute, are TCP-probed first and
+ *      select() says "not yet" until those probes are back
+ *   3. if every broker is backing off, the one whose back-off ends first
+ * A failed connect attempt doubles the broker's back-off (1 s .. 60 s); a
+ * successful connect or probe clears it.
+ *
+ * RTT: the TCP handshake time of a probe, kept as a moving average per
+ * broker; a failed probe forgets it, so the broker ranks last.  MQTT
+ * connect times (TLS handshake, CONNACK) are not mixed in -- they would
+ * rank a plain broker ahead of an equally near TLS one.
+ *
+ * Probes never block the caller: mqtt_brokers_probe_start() queues the
+ * broker for the "mqtt-probe" task, which resolves the host and connects
+ * with a 1 s limit; mqtt_brokers_poll() on the service loop picks up the
+ * results.  A DNS lookup that hangs only delays the probes behind it.
+ *
+ * Concurrency: the table is written by the mqtt_service task only.  The
+ * probe task hands back each result through one atomic word per broker
+ * (tag | state | ms), exchanged only while that probe is still the
+ * pending one, so a result of a reloaded list or a timed-out probe is
+ * dropped.  The counters the health provider reads (publish task) are
+ * atomics.
+ */
+
+#ifndef MQTT_BROKERS_H
+#define MQTT_BROKERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MQTT_BROKERS_MAX
+#define MQTT_BROKERS_MAX        4
+#endif
+#define MQTT_BROKER_URI_LEN     128
+
+typedef enum {
+    MQTT_PROBE_NONE,                /* never probed */
+    MQTT_PROBE_PENDING,
+    MQTT_PROBE_OK,
+    MQTT_PROBE_FAILED,
+} mqtt_probe_state_t;
+
+/** Create the probe task and its queue (once). */
+esp_err_t mqtt_brokers_init(void);
+
+/**
+ * Replace the list with `primary` followed by the backups in `backups`
+ * (comma / space separated, may be NULL or "").
+ * @return number of brokers loaded
+ */
+int  mqtt_brokers_load(const char *primary, const char *backups);
+
+int         mqtt_brokers_count(void);
+const char *mqtt_brokers_uri(int idx);
+
+/**
+ * Pick the broker for the next connect attempt (see header).  Never blocks.
+ * @param ready_at_us  set to the time the pick may be tried (<= now: at once;
+ *                     later while backoffs or probes are pending -- ask again)
+ */
+int  mqtt_brokers_select(int64_t now_us, int64_t *ready_at_us);
+
+void mqtt_brokers_on_connected(int idx);
+void mqtt_brokers_on_failed(int idx, int64_t now_us);
+
+/** Broker that carries the connection now (-1 = none), for health. */
+void mqtt_brokers_set_current(int idx);
+
+/** Record a completed switch to another broker that took `ms`. */
+void mqtt_brokers_on_switchover(uint32_t ms);
+
+/**
+ * Queue a TCP connect to the broker's host:port (see header).  A probe
+ * already pending for `idx` is kept.
+ * @return false if the probe queue is full (counts as a failed probe)
+ */
+bool mqtt_brokers_probe_start(int idx, int64_t now_us);
+
+/** Collect finished probes and time out lost ones; call every loop tick.
+ *  A success updates the RTT and clears back-off. */
+void mqtt_brokers_poll(int64_t now_us);
+
+/** PENDING while a probe of `idx` runs, else the result of the last one. */
+mqtt_probe_state_t mqtt_brokers_probe_state(int idx);
+
+/** Health provider body: "brk":{"cur":0,"rtt":[12,null],"fail":[0,3],"sw":1,"sw_ms":840} */
+void mqtt_brokers_write_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_BROKERS_H */
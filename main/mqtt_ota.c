@@ -0,0 +1,578 @@
+/*
+ * mqtt_ota.c - Streaming firmware update over MQTT
+ *
+ * Session ownership: begin / data / abort and the connect hook run on the
+ * esp-mqtt task, mqtt_ota_tick() on the mqtt service task.  Whoever wins
+ * `busy` (test-and-set) owns the session for that call; the tick skips a
+ * round when it loses, a chunk arriving while the tick holds it is
+ * dropped and answered with a NAK on the next one, which the controller
+ * handles like any other gap.
+ *
+ * The health provider reads the counters without the flag -- a torn
+ * read costs one sample, like the supervisor's crash counts.
+ *
+ * Delta sessions run the same transport (offsets, window, sha256 are the
+ * patch's) and push the data through ota_delta, whose sink is
+ * esp_ota_write(); the patch is checked against the running slot first.
+ */
+
+#include "mqtt_ota.h"
+#include "ota_delta.h"
+#include "mqtt_rpc.h"           /* mqtt_rpc_json_get() */
+#include "mqtt_service.h"
+#include "health_payload.h"
+#include "json_writer.h"
+#include "supervisor.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "mqtt-ota";
+
+#define OTA_ID_LEN          32
+#define OTA_TOPIC_LEN       64
+#define OTA_STATUS_LEN      192
+
+typedef enum {
+    OTA_IDLE = 0,
+    OTA_RX,
+    OTA_DONE,
+    OTA_ERR,
+} ota_state_t;
+
+static const char *const s_state_name[] = { "idle", "rx", "done", "err" };
+
+/* What the fragments of the message being received belong to */
+typedef enum {
+    CUR_NONE = 0,
+    CUR_WRITE,          /* chunk at the expected offset -- write fragments */
+    CUR_SKIP,           /* chunk dropped -- ignore its fragments */
+} cur_msg_t;
+
+typedef struct {
+    atomic_flag              busy;
+    ota_state_t              state;
+    char                     id[OTA_ID_LEN];
+    uint32_t                 size;
+    uint32_t                 next;          /* next expected image offset */
+    uint32_t                 acked;         /* `next` of the last ack sent */
+    uint8_t                  sha256[32];
+    mbedtls_sha256_context   sha;
+    esp_ota_handle_t         handle;
+    const esp_partition_t   *part;
+    ota_delta_t             *delta;         /* NULL = full image */
+    int64_t                  start_us;
+    int64_t                  last_rx_us;
+    int64_t                  reboot_at_us;  /* 0 = none */
+    uint32_t                 img_size;      /* delta: rebuilt image, 0 = full */
+    uint32_t                 ms;            /* begin -> verified */
+    uint32_t                 bps;
+    uint32_t                 naks;
+    uint32_t                 resumes;
+    const char              *err;
+    cur_msg_t                cur;
+    bool                     nak_sent;      /* one NAK per gap */
+    bool                     ack_pending;   /* retry from the tick */
+    bool                     status_pending;
+} ota_session_t;
+
+static ota_session_t s_ota = { .busy = ATOMIC_FLAG_INIT };
+static char          s_prefix[OTA_TOPIC_LEN - 16];
+static bool          s_app_confirmed;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static bool hex_to_bytes(const char *hex, uint8_t *out, size_t n)
+{
+    if (strlen(hex) != n * 2) return false;
+    for (size_t i = 0; i < n; i++) {
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        char *end;
+        unsigned long v = strtoul(byte, &end, 16);
+        if (*end != '\0') return false;
+        out[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+/* `topic` (not NUL-terminated) == <prefix><suffix>, suffix may be a prefix
+ * of the remaining text when `tail` is non-NULL */
+static bool topic_is(const char *topic, int topic_len, const char *suffix,
+                     const char **tail)
+{
+    size_t plen = strlen(s_prefix);
+    size_t slen = strlen(suffix);
+    if (plen == 0 || (size_t)topic_len < plen + slen) return false;
+    if (memcmp(topic, s_prefix, plen) != 0) return false;
+    if (memcmp(topic + plen, suffix, slen) != 0) return false;
+    if (tail != NULL) {
+        *tail = topic + plen + slen;
+        return true;
+    }
+    return (size_t)topic_len == plen + slen;
+}
+
+/* -------------------------------------------------------------------------
+ * Replies -- never block, the esp-mqtt task is the caller
+ * ------------------------------------------------------------------------- */
+
+static void send_ack(bool nak)
+{
+    char topic[OTA_TOPIC_LEN];
+    char buf[96];
+    snprintf(topic, sizeof(topic), "%s/ack", s_prefix);
+
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_begin_object(&w);
+    json_key(&w, "id");   json_put_str(&w, s_ota.id);
+    json_key(&w, "next"); json_put_uint(&w, s_ota.next);
+    if (nak) { json_key(&w, "nak"); json_put_bool(&w, true); }
+    json_end_object(&w);
+
+    if (mqtt_service_try_publish(topic, buf, json_writer_len(&w),
+                                 1 /*qos*/, false) == ESP_OK) {
+        s_ota.acked       = s_ota.next;
+        s_ota.ack_pending = false;
+    } else {
+        s_ota.ack_pending = true;
+    }
+}
+
+static void send_status(void)
+{
+    char topic[OTA_TOPIC_LEN];
+    char buf[OTA_STATUS_LEN];
+    snprintf(topic, sizeof(topic), "%s/status", s_prefix);
+
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_begin_object(&w);
+    json_key(&w, "id"); json_put_str(&w, s_ota.id);
+    json_key(&w, "st"); json_put_str(&w, s_state_name[s_ota.state]);
+    if (s_ota.state == OTA_ERR) {
+        json_key(&w, "err"); json_put_str(&w, s_ota.err ? s_ota.err : "?");
+    }
+    if (s_ota.state != OTA_DONE) {
+        json_key(&w, "next"); json_put_uint(&w, s_ota.next);
+    }
+    json_key(&w, "size"); json_put_uint(&w, s_ota.size);
+    if (s_ota.img_size != 0) {
+        json_key(&w, "img"); json_put_uint(&w, s_ota.img_size);
+    }
+    if (s_ota.state == OTA_DONE) {
+        json_key(&w, "ms");  json_put_uint(&w, s_ota.ms);
+        json_key(&w, "bps"); json_put_uint(&w, s_ota.bps);
+    }
+    json_end_object(&w);
+
+    s_ota.status_pending =
+        mqtt_service_try_publish(topic, buf, json_writer_len(&w),
+                                 1 /*qos*/, true /*retain*/) != ESP_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * Session
+ * ------------------------------------------------------------------------- */
+
+/* Drop the flash handle and hash of a receiving session */
+static void session_release(void)
+{
+    esp_ota_abort(s_ota.handle);
+    mbedtls_sha256_free(&s_ota.sha);
+    ota_delta_free(s_ota.delta);
+    s_ota.delta = NULL;
+}
+
+static esp_err_t delta_sink(const uint8_t *data, size_t len, void *ctx)
+{
+    (void)ctx;
+    return esp_ota_write(s_ota.handle, data, len);
+}
+
+
+static void session_fail(const char *err)
+{
+    ESP_LOGE(TAG, "'%s' failed at %" PRIu32 "/%" PRIu32 ": %s",
+             s_ota.id, s_ota.next, s_ota.size, err);
+    s_ota.state = OTA_ERR;
+    s_ota.err   = err;
+    s_ota.cur   = CUR_NONE;
+    send_status();
+}
+
+static void session_finish(void)
+{
+    uint8_t got[32];
+    mbedtls_sha256_finish(&s_ota.sha, got);
+
+    if (memcmp(got, s_ota.sha256, sizeof(got)) != 0) {
+        session_release();
+        session_fail("sha256");
+        return;
+    }
+    if (s_ota.delta != NULL) {
+        if (ota_delta_finish(s_ota.delta) != ESP_OK) {
+            const char *why = ota_delta_reason(s_ota.delta);
+            session_release();
+            session_fail(why);
+            return;
+        }
+        s_ota.img_size = ota_delta_new_size(s_ota.delta);
+        ota_delta_free(s_ota.delta);
+        s_ota.delta = NULL;
+    }
+    mbedtls_sha256_free(&s_ota.sha);
+
+    /* esp_ota_end() releases the handle whatever it returns */
+    esp_err_t ret = esp_ota_end(s_ota.handle);      /* image header + checksum */
+    if (ret == ESP_OK) ret = esp_ota_set_boot_partition(s_ota.part);
+    if (ret != ESP_OK) {
+        session_fail(esp_err_to_name(ret));
+        return;
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - s_ota.start_us;
+    s_ota.ms  = (uint32_t)(elapsed_us / 1000);
+    s_ota.bps = (elapsed_us > 0)
+        ? (uint32_t)((uint64_t)s_ota.size * 1000000u / (uint64_t)elapsed_us) : 0;
+    s_ota.state        = OTA_DONE;
+    s_ota.reboot_at_us = esp_timer_get_time()
+                       + (int64_t)CONFIG_MQTT_OTA_REBOOT_DELAY_MS * 1000;
+
+    ESP_LOGI(TAG, "'%s' verified: %" PRIu32 " bytes in %" PRIu32 " ms (%" PRIu32
+             " B/s, %" PRIu32 " NAKs, %" PRIu32 " resumes) -> %s",
+             s_ota.id, s_ota.size, s_ota.ms, s_ota.bps, s_ota.naks,
+             s_ota.resumes, s_ota.part->label);
+    if (s_ota.img_size != 0) {
+        ESP_LOGI(TAG, "Delta: %" PRIu32 " byte patch for a %" PRIu32
+                 " byte image (%" PRIu32 "%%)", s_ota.size, s_ota.img_size,
+                 (uint32_t)((uint64_t)s_ota.size * 100 / s_ota.img_size));
+    }
+    send_ack(false);
+    send_status();
+}
+
+static void handle_begin(const char *json)
+{
+    char id[OTA_ID_LEN] = "";
+    char size_s[16];
+    char hex[65];
+    char delta_s[8] = "";
+    uint8_t sha[32];
+
+    mqtt_rpc_json_get(json, "id", id, sizeof(id));
+    mqtt_rpc_json_get(json, "delta", delta_s, sizeof(delta_s));
+    const bool delta = (strcmp(delta_s, "true") == 0);
+    if (!mqtt_rpc_json_get(json, "size", size_s, sizeof(size_s)) ||
+        !mqtt_rpc_json_get(json, "sha256", hex, sizeof(hex)) ||
+        !hex_to_bytes(hex, sha, sizeof(sha))) {
+        ESP_LOGW(TAG, "Bad begin: %s", json);
+        return;
+    }
+    uint32_t size = (uint32_t)strtoul(size_s, NULL, 10);
+
+    /* Same image again (controller reconnected / retried): resume */
+    if (s_ota.state == OTA_RX && s_ota.size == size &&
+        (s_ota.delta != NULL) == delta &&
+        strcmp(s_ota.id, id) == 0 && memcmp(s_ota.sha256, sha, 32) == 0) {
+        s_ota.resumes++;
+        s_ota.nak_sent = false;
+        ESP_LOGI(TAG, "'%s' resumed at %" PRIu32 "/%" PRIu32, id, s_ota.next, size);
+        send_ack(false);
+        return;
+    }
+
+    if (s_ota.state == OTA_RX) {
+        ESP_LOGW(TAG, "'%s' replaced by '%s'", s_ota.id, id);
+        session_release();
+    }
+
+    memset(s_ota.id, 0, sizeof(s_ota.id));
+    strncpy(s_ota.id, id, sizeof(s_ota.id) - 1);
+    memcpy(s_ota.sha256, sha, sizeof(sha));
+    s_ota.size         = size;
+    s_ota.next         = 0;
+    s_ota.acked        = 0;
+    s_ota.naks         = 0;
+    s_ota.resumes      = 0;
+    s_ota.img_size     = 0;
+    s_ota.ms           = 0;
+    s_ota.bps          = 0;
+    s_ota.reboot_at_us = 0;
+    s_ota.nak_sent     = false;
+    s_ota.state        = OTA_IDLE;
+
+    s_ota.part = esp_ota_get_next_update_partition(NULL);
+    if (s_ota.part == NULL) {
+        session_fail("no ota slot");
+        return;
+    }
+    if (size == 0 || size > s_ota.part->size) {
+        session_fail("size");
+        return;
+    }
+    esp_err_t ret;
+    if (delta) {
+        ret = ota_delta_begin(&s_ota.delta, esp_ota_get_running_partition(),
+                              s_ota.part->size, delta_sink, NULL);
+        if (ret != ESP_OK) {
+            session_fail(esp_err_to_name(ret));
+            return;
+        }
+    }
+
+    /* Sequential writes: sectors are erased as the data reaches them
+     * instead of the whole slot up front (seconds on a 16 MB slot). */
+    ret = esp_ota_begin(s_ota.part, OTA_WITH_SEQUENTIAL_WRITES, &s_ota.handle);
+    if (ret != ESP_OK) {
+        ota_delta_free(s_ota.delta);
+        s_ota.delta = NULL;
+        session_fail(esp_err_to_name(ret));
+        return;
+    }
+    mbedtls_sha256_init(&s_ota.sha);
+    mbedtls_sha256_starts(&s_ota.sha, 0 /* SHA-256, not 224 */);
+
+    s_ota.state      = OTA_RX;
+    s_ota.start_us   = esp_timer_get_time();
+    s_ota.last_rx_us = s_ota.start_us;
+
+    ESP_LOGI(TAG, "'%s': %" PRIu32 " byte %s -> %s (window %d)",
+             s_ota.id, size, delta ? "patch" : "image", s_ota.part->label,
+             CONFIG_MQTT_OTA_WINDOW_BYTES);
+    send_status();
+    send_ack(false);
+}
+
+static void write_fragment(const uint8_t *data, int len)
+{
+    if (len <= 0) return;
+    if ((uint64_t)s_ota.next + (uint64_t)len > s_ota.size) {
+        session_release();
+        session_fail("past end");
+        return;
+    }
+
+    esp_err_t ret = s_ota.delta
+        ? ota_delta_feed(s_ota.delta, data, (size_t)len)
+        : esp_ota_write(s_ota.handle, data, (size_t)len);
+    if (ret != ESP_OK) {
+        const char *why = s_ota.delta ? ota_delta_reason(s_ota.delta)
+                                      : esp_err_to_name(ret);
+        session_release();
+        session_fail(why);
+        return;
+    }
+    mbedtls_sha256_update(&s_ota.sha, data, (size_t)len);
+    s_ota.next      += (uint32_t)len;
+    s_ota.last_rx_us = esp_timer_get_time();
+    s_ota.nak_sent   = false;
+
+    if (s_ota.next == s_ota.size) {
+        session_finish();
+    } else if (s_ota.next - s_ota.acked >= (uint32_t)CONFIG_MQTT_OTA_WINDOW_BYTES) {
+        send_ack(false);
+    }
+}
+
+/* First fragment of a data/<off> message */
+static void handle_chunk(const char *off_s, int off_len,
+                         const uint8_t *data, int len)
+{
+    char buf[12];
+    if (off_len <= 0 || off_len >= (int)sizeof(buf)) {
+        s_ota.cur = CUR_SKIP;
+        return;
+    }
+    memcpy(buf, off_s, off_len);
+    buf[off_len] = '\0';
+    char *end;
+    unsigned long off = strtoul(buf, &end, 10);
+
+    if (s_ota.state != OTA_RX || *end != '\0') {
+        s_ota.cur = CUR_SKIP;
+        return;
+    }
+    if (off != s_ota.next) {
+        s_ota.cur = CUR_SKIP;
+        s_ota.naks++;
+        if (!s_ota.nak_sent) {
+            ESP_LOGW(TAG, "Chunk at %lu, expected %" PRIu32 " -- NAK", off, s_ota.next);
+            s_ota.nak_sent = true;
+            send_ack(true);
+        }
+        return;
+    }
+
+    s_ota.cur = CUR_WRITE;
+    write_fragment(data, len);
+}
+
+/* -------------------------------------------------------------------------
+ * Health provider
+ *   "ota":{"st":"rx","next":65536,"size":1234567,"nak":0,"res":1}
+ *   "ota":{"st":"done","size":1234567,"ms":48210,"bps":25608,...}
+ * Omitted while no update has been attempted since boot.
+ * ------------------------------------------------------------------------- */
+
+static void ota_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    ota_state_t st = s_ota.state;
+    if (st == OTA_IDLE) return;
+
+    health_begin_object(hw, "ota");
+    health_field_str(hw, "st", s_state_name[st]);
+    if (st == OTA_ERR && s_ota.err) health_field_str(hw, "err", s_ota.err);
+    if (st != OTA_DONE) health_field_uint(hw, "next", s_ota.next);
+    health_field_uint(hw, "size", s_ota.size);
+    if (s_ota.img_size != 0) health_field_uint(hw, "img", s_ota.img_size);
+    if (st == OTA_DONE) {
+        health_field_uint(hw, "ms", s_ota.ms);
+        health_field_uint(hw, "bps", s_ota.bps);
+    }
+    health_field_uint(hw, "nak", s_ota.naks);
+    health_field_uint(hw, "res", s_ota.resumes);
+    health_end_object(hw);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t mqtt_ota_init(const char *topic_prefix)
+{
+    if (topic_prefix == NULL || strlen(topic_prefix) >= sizeof(s_prefix)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(s_prefix, topic_prefix);
+    return health_payload_register("ota", ota_health_fields, NULL);
+}
+
+const char *mqtt_ota_filter(int i, char *buf, size_t size)
+{
+    static const char *const suffix[] = { "/begin", "/data/+", "/abort" };
+    if (i < 0 || i >= (int)(sizeof(suffix) / sizeof(suffix[0]))) return NULL;
+    snprintf(buf, size, "%s%s", s_prefix, suffix[i]);
+    return buf;
+}
+
+bool mqtt_ota_on_raw(const char *topic, int topic_len, const uint8_t *data,
+                     int len, int offset, int total, void *ctx)
+{
+    (void)ctx;
+
+    /* Later fragment of a message claimed below */
+    if (topic == NULL) {
+        if (atomic_flag_test_and_set(&s_ota.busy)) {
+            s_ota.cur = CUR_SKIP;   /* tick holds the session -- resend via NAK */
+            return true;
+        }
+        if (s_ota.cur == CUR_WRITE && s_ota.state == OTA_RX) {
+            write_fragment(data, len);
+        }
+        atomic_flag_clear(&s_ota.busy);
+        return true;
+    }
+
+    const char *tail;
+    enum { M_BEGIN, M_DATA, M_ABORT } kind;
+    if (topic_is(topic, topic_len, "/data/", &tail)) {
+        kind = M_DATA;
+    } else if (topic_is(topic, topic_len, "/begin", NULL)) {
+        kind = M_BEGIN;
+    } else if (topic_is(topic, topic_len, "/abort", NULL)) {
+        kind = M_ABORT;
+    } else {
+        return false;
+    }
+
+    if (atomic_flag_test_and_set(&s_ota.busy)) {
+        s_ota.cur = CUR_SKIP;
+        return true;
+    }
+
+    s_ota.cur = CUR_NONE;
+    switch (kind) {
+    case M_DATA:
+        handle_chunk(tail, topic_len - (int)(tail - topic), data, len);
+        break;
+
+    case M_BEGIN: {
+        char json[160];
+        if (len != total || len >= (int)sizeof(json)) {
+            ESP_LOGW(TAG, "Begin payload too large (%d)", total);
+            break;
+        }
+        memcpy(json, data, len);
+        json[len] = '\0';
+        handle_begin(json);
+        break;
+    }
+
+    case M_ABORT:
+        if (s_ota.state == OTA_RX) {
+            session_release();
+            session_fail("aborted");
+        }
+        break;
+    }
+
+    atomic_flag_clear(&s_ota.busy);
+    return true;
+}
+
+void mqtt_ota_on_connect(void)
+{
+#ifdef CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    /* First broker contact of a freshly updated image: keep it */
+    if (!s_app_confirmed) {
+        esp_ota_img_states_t st;
+        if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &st) == ESP_OK &&
+            st == ESP_OTA_IMG_PENDING_VERIFY) {
+            esp_ota_mark_app_valid_cancel_rollback();
+            ESP_LOGI(TAG, "New image reached the broker -- rollback cancelled");
+        }
+    }
+#endif
+    s_app_confirmed = true;
+
+    if (atomic_flag_test_and_set(&s_ota.busy)) return;
+    if (s_ota.state == OTA_RX) {
+        s_ota.nak_sent = false;
+        send_ack(false);        /* resume point for the controller */
+    }
+    atomic_flag_clear(&s_ota.busy);
+}
+
+void mqtt_ota_tick(int64_t now_us)
+{
+    if (atomic_flag_test_and_set(&s_ota.busy)) return;
+
+    if (s_ota.state == OTA_RX) {
+        if (now_us - s_ota.last_rx_us > (int64_t)CONFIG_MQTT_OTA_IDLE_S * 1000000) {
+            session_release();
+            session_fail("idle");
+        } else if (s_ota.ack_pending) {
+            send_ack(false);
+        }
+    }
+    if (s_ota.status_pending) send_status();
+
+    bool reboot = (s_ota.state == OTA_DONE && s_ota.reboot_at_us != 0 &&
+                   now_us >= s_ota.reboot_at_us);
+    if (reboot) s_ota.reboot_at_us = 0;
+
+    atomic_flag_clear(&s_ota.busy);
+
+    if (reboot) supervisor_reboot("ota");
+}
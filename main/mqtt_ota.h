@@ -0,0 +1,106 @@
+/*
+ * mqtt_ota.h - Streaming firmware update over MQTT
+ *
+ * A controller pushes the image over the node's own topics and it is
+ * written straight into the inactive app slot (ota_1 while running from
+ * ota_0, and back) -- no per-node HTTP server, no full-image buffer:
+ *
+ *   /<MACID>/ota/begin        {"id":"v1.4.2","size":1234567,"sha256":"<64 hex>"}
+ *   /<MACID>/ota/data/<off>   raw image bytes starting at byte <off>
+ *   /<MACID>/ota/abort        any payload
+ *
+ * With "delta":true in begin the data is a patch made by tools/mkdelta.py
+ * against the running image (see ota_delta.h): size, sha256 and offsets
+ * are the patch's, and the rebuilt image is what gets written.
+ *
+ * The node answers on /<MACID>/ota/ack (QoS 1, not retained):
+ *
+ *   {"id":"v1.4.2","next":65536}            send from byte 65536 on
+ *   {"id":"v1.4.2","next":65536,"nak":true} a chunk at another offset was dropped
+ *
+ * and keeps /<MACID>/ota/status (retained) up to date:
+ *
+ *   {"id":"v1.4.2","st":"rx","next":0,"size":1234567}
+ *   {"id":"v1.4.2","st":"done","size":1234567,"ms":48210,"bps":25608}
+ *   {"id":"v1.4.3","st":"done","size":81234,"img":1236012,"ms":9120,"bps":8907}
+ *   {"id":"v1.4.2","st":"err","err":"sha256","next":1234567,"size":1234567}
+ *
+ * Flow control: the controller keeps at most CONFIG_MQTT_OTA_WINDOW_BYTES
+ * beyond the last acked offset in flight.  Acks go out each time a window
+ * has been written, on begin, on every (re)connect and with a NAK.
+ *
+ * Resume: the session (offset, running SHA-256, flash handle) stays in RAM
+ * across broker disconnects.  After a reconnect the node acks its next
+ * offset; a repeated begin with the same id, size and sha256 gets the same
+ * answer instead of starting over.  A reboot, an abort or
+ * CONFIG_MQTT_OTA_IDLE_S without data ends the session.
+ *
+ * Completion: at byte `size` the SHA-256 is compared (for a delta also the
+ * rebuilt image's hash and length), esp_ota_end() checks the image and
+ * the slot becomes the boot partition.  "ms" is begin -> verified, "bps"
+ * the bytes sent over that time ("img" is the image size of a delta).
+ * Once status "done" had
+ * CONFIG_MQTT_OTA_REBOOT_DELAY_MS to go out, supervisor_reboot("ota")
+ * quiesces the services and restarts.  With app rollback enabled the new
+ * image has to reach a broker once (mqtt_ota_on_connect()) or the
+ * bootloader falls back to the previous one.
+ *
+ * Chunks are written on the esp-mqtt task, so flash write time is
+ * back-pressure on the TCP stream.  A chunk may be larger than esp-mqtt's
+ * receive buffer; its fragments are written as they arrive.
+ */
+
+#ifndef MQTT_OTA_H
+#define MQTT_OTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_MQTT_OTA_WINDOW_BYTES
+#define CONFIG_MQTT_OTA_WINDOW_BYTES        16384
+#endif
+#ifndef CONFIG_MQTT_OTA_IDLE_S
+#define CONFIG_MQTT_OTA_IDLE_S              120
+#endif
+#ifndef CONFIG_MQTT_OTA_REBOOT_DELAY_MS
+#define CONFIG_MQTT_OTA_REBOOT_DELAY_MS     2000
+#endif
+
+/**
+ * Set the topic prefix (e.g. "/AABBCCA1B2C3/ota", copied) and register the
+ * "ota" health provider.  Safe to call again after a service restart; a
+ * running session is kept.
+ */
+esp_err_t mqtt_ota_init(const char *topic_prefix);
+
+/**
+ * Topic filters to subscribe: begin, data/+ and abort.
+ * @param i  0..2
+ * @return filter, or NULL past the end
+ */
+const char *mqtt_ota_filter(int i, char *buf, size_t size);
+
+/**
+ * Raw payload hook (app_mqtt mqtt_raw_cb_t).  Claims begin, data and abort
+ * messages; returns false for anything else.  esp-mqtt task only.
+ */
+bool mqtt_ota_on_raw(const char *topic, int topic_len, const uint8_t *data,
+                     int len, int offset, int total, void *ctx);
+
+/** Broker connection up: confirm a pending-verify image, re-ack a session. */
+void mqtt_ota_on_connect(void);
+
+/** Idle timeout, retried acks and the reboot after "done".  Call periodically. */
+void mqtt_ota_tick(int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_OTA_H */
@@ -0,0 +1,194 @@
+/*
+ * mqtt_props.c - MQTT 5 publish properties for mqtt_service
+ *
+ * Alias numbers are table index + 1 and stay bound to their topic for the
+ * life of the firmware; only the "announced on this connection" flag is
+ * cleared on reconnect.  The table is filled first-come: with the default
+ * of 8 aliases every per-node telemetry topic fits.
+ *
+ * Wire accounting (PUBLISH variable header, per message):
+ *   MQTT 3.1.1   2 + topic
+ *   MQTT 5       2 + topic-or-0 + 1 (property length) + properties
+ *   properties   alias 3, expiry 5, user property 5 + key + value
+ */
+
+#include "mqtt_props.h"
+#include "app_mqtt.h"
+#include "mqtt_stats.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "mqtt-props";
+
+#ifndef CONFIG_MQTT5_TOPIC_ALIAS_MAX
+#define CONFIG_MQTT5_TOPIC_ALIAS_MAX        8
+#endif
+#ifndef CONFIG_MQTT5_TELEMETRY_EXPIRY_S
+#define CONFIG_MQTT5_TELEMETRY_EXPIRY_S     300
+#endif
+#ifndef CONFIG_MQTT5_HEALTH_EXPIRY_S
+#define CONFIG_MQTT5_HEALTH_EXPIRY_S        90
+#endif
+#ifdef CONFIG_MQTT5_TS_USER_PROPERTY
+#define MQTT_PROPS_TS                       true
+#else
+#define MQTT_PROPS_TS                       false
+#endif
+
+#define ALIAS_TOPIC_LEN     96
+/* Before this, gettimeofday() is still counting from the 1970 boot default */
+#define CLOCK_SET_EPOCH_S   1700000000
+
+typedef struct {
+    char topic[ALIAS_TOPIC_LEN];
+    bool announced;             /* topic sent with this alias on this connection */
+} alias_slot_t;
+
+static alias_slot_t s_alias[CONFIG_MQTT5_TOPIC_ALIAS_MAX];
+static int          s_alias_used;
+static bool         s_alias_off;        /* broker refused an alias this connection */
+static unsigned     s_epoch_seen;
+static atomic_uint  s_epoch;
+
+static struct {
+    uint32_t published;
+    uint32_t alias_hits;
+    uint32_t topic_saved;       /* topic bytes not sent thanks to an alias */
+    uint32_t prop_bytes;        /* property bytes added, length field included */
+} s_wire;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static void sync_epoch(void)
+{
+    unsigned e = atomic_load(&s_epoch);
+    if (e == s_epoch_seen) return;
+    s_epoch_seen = e;
+    s_alias_off  = false;
+    for (int i = 0; i < s_alias_used; i++) s_alias[i].announced = false;
+}
+
+/* Index of the topic's alias, assigning a free one; -1 if the table is full */
+static int alias_for(const char *topic)
+{
+    for (int i = 0; i < s_alias_used; i++) {
+        if (strcmp(s_alias[i].topic, topic) == 0) return i;
+    }
+    if (s_alias_used >= CONFIG_MQTT5_TOPIC_ALIAS_MAX ||
+        strlen(topic) >= ALIAS_TOPIC_LEN) {
+        return -1;
+    }
+    int i = s_alias_used++;
+    strcpy(s_alias[i].topic, topic);
+    s_alias[i].announced = false;
+    ESP_LOGI(TAG, "Topic alias %d -> %s", i + 1, topic);
+    return i;
+}
+
+static void fill_timestamp(mqtt_client_pub_props_t *p, char *buf, size_t size)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec >= CLOCK_SET_EPOCH_S) {
+        p->user_key = "ts";
+        snprintf(buf, size, "%" PRId64,
+                 (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000);
+    } else {
+        p->user_key = "up";
+        snprintf(buf, size, "%" PRId64, esp_timer_get_time() / 1000);
+    }
+    p->user_value = buf;
+}
+
+static void account(size_t topic_len, bool alias_only,
+                    const mqtt_client_pub_props_t *p)
+{
+    uint32_t props = 1;
+    if (p->topic_alias)      props += 3;
+    if (p->message_expiry_s) props += 5;
+    if (p->user_key)         props += 5 + strlen(p->user_key) + strlen(p->user_value);
+
+    s_wire.published++;
+    s_wire.prop_bytes += props;
+    if (alias_only) {
+        s_wire.alias_hits++;
+        s_wire.topic_saved += topic_len;
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+int mqtt_props_publish(const char *topic, const char *data, size_t len,
+                       int qos, int retain)
+{
+    if (!mqtt_client_is_v5()) {
+        return mqtt_client_publish(topic, data, len, qos, retain);
+    }
+
+    sync_epoch();
+
+    mqtt_client_pub_props_t p = {0};
+    char ts[24];
+    const char *wire_topic = topic;
+    mqtt_topic_class_t cls = mqtt_stats_classify(topic);
+
+    int a = (qos == 0 && !s_alias_off) ? alias_for(topic) : -1;
+    if (a >= 0) {
+        p.topic_alias = (uint16_t)(a + 1);
+        if (s_alias[a].announced) wire_topic = "";
+    }
+
+    if (cls == MQTT_TOPIC_CLASS_TELEMETRY) {
+        p.message_expiry_s = CONFIG_MQTT5_TELEMETRY_EXPIRY_S;
+    } else if (cls == MQTT_TOPIC_CLASS_HEALTH) {
+        p.message_expiry_s = CONFIG_MQTT5_HEALTH_EXPIRY_S;
+    }
+    if (MQTT_PROPS_TS && (cls == MQTT_TOPIC_CLASS_TELEMETRY ||
+                          cls == MQTT_TOPIC_CLASS_HEALTH)) {
+        fill_timestamp(&p, ts, sizeof(ts));
+    }
+
+    int msg_id = mqtt_client_publish_props(wire_topic, data, len, qos, retain, &p);
+    if (msg_id < 0 && p.topic_alias != 0) {
+        /* Most likely above the broker's Topic Alias Maximum */
+        ESP_LOGW(TAG, "Publish with alias %u failed -- aliases off until reconnect",
+                 p.topic_alias);
+        s_alias_off   = true;
+        p.topic_alias = 0;
+        wire_topic    = topic;
+        msg_id = mqtt_client_publish_props(topic, data, len, qos, retain, &p);
+    }
+    if (msg_id < 0) return msg_id;
+
+    if (p.topic_alias != 0) s_alias[a].announced = true;
+    account(strlen(topic), wire_topic[0] == '\0', &p);
+    return msg_id;
+}
+
+void mqtt_props_on_connect(void)
+{
+    atomic_fetch_add(&s_epoch, 1);
+}
+
+void mqtt_props_write_health(health_writer_t *hw)
+{
+    if (!mqtt_client_is_v5()) return;
+
+    health_begin_object(hw, "v5");
+    health_field_uint(hw, "pub",    s_wire.published);
+    health_field_uint(hw, "alias",  s_wire.alias_hits);
+    health_field_uint(hw, "saved",  s_wire.topic_saved);
+    health_field_uint(hw, "props",  s_wire.prop_bytes);
+    health_field_int(hw,  "net",
+                     (int64_t)s_wire.topic_saved - (int64_t)s_wire.prop_bytes);
+    health_end_object(hw);
+}
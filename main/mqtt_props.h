@@ -0,0 +1,57 @@
+/*
+ * mqtt_props.h - MQTT 5 publish properties for mqtt_service
+ *
+ * With CONFIG_MQTT_USE_PROTOCOL_5 every publish made by the mqtt publish
+ * task goes through mqtt_props_publish(), which attaches:
+ *
+ *   Topic alias      QoS 0 topics get a 2-byte alias.  The first publish on
+ *                    a connection carries topic + alias, later ones an empty
+ *                    topic + alias.  QoS>0 publishes always carry the full
+ *                    topic: esp-mqtt retransmits them from its outbox after
+ *                    a reconnect, where the broker no longer knows the alias.
+ *   Message expiry   telemetry and health die at the broker once stale
+ *                    instead of being delivered to a subscriber that comes
+ *                    back hours later.
+ *   User property    "ts" = epoch ms when the clock is set, otherwise "up" =
+ *                    ms since boot.
+ *
+ * Bytes-on-wire: each publish adds its property bytes and, on an alias hit,
+ * the topic bytes it did not send.  The health payload reports both and
+ * their difference, so the net gain at the real publish rates is visible:
+ *   "v5":{"pub":1200,"alias":1150,"saved":31050,"props":30400,"net":650}
+ *
+ * Without MQTT 5 mqtt_props_publish() is a plain mqtt_client_publish().
+ *
+ * Concurrency: the alias table and counters belong to the mqtt publish
+ * task (publishes and health providers both run there).  Only
+ * mqtt_props_on_connect() is called from the esp-mqtt task; it bumps an
+ * atomic connection epoch that the publish task checks before each send.
+ */
+
+#ifndef MQTT_PROPS_H
+#define MQTT_PROPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Publish with the properties for this topic's class.
+ *  @return msg_id as mqtt_client_publish() */
+int  mqtt_props_publish(const char *topic, const char *data, size_t len,
+                        int qos, int retain);
+
+/** New connection: aliases must be announced again (esp-mqtt task). */
+void mqtt_props_on_connect(void);
+
+/** Health provider body: writes "v5":{...}; nothing unless MQTT 5 is on. */
+void mqtt_props_write_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_PROPS_H */
@@ -0,0 +1,328 @@
+/*
+ * mqtt_rate.c - Per-topic rate limiting for mqtt_service's outbound queue
+ *
+ * Buckets count milli-tokens so refill needs no floating point:
+ *   refill = elapsed_ms * rate   (rate in msgs/s)
+ * A publish costs 1000.  Milli-tokens and the time of the last refill (ms,
+ * wrapping) share one 64-bit atomic so any task can take a token with a
+ * compare-exchange.
+ *
+ * Held-slot credits: a coalesce-rule message admitted without a token
+ * takes one of MQTT_RATE_HELD_MAX credits; the credit is returned when its
+ * slot is sent, superseded by a newer value or cleared.  Credits never
+ * exceed slots, so the publish task always finds a slot for it.
+ *
+ * A topic with a held message never overtakes it: a newer value for the
+ * same topic replaces the held one, or -- if the newer one got a token --
+ * goes out in its place, so subscribers never see values out of order.
+ */
+
+#include "mqtt_rate.h"
+#include "mqtt_subs.h"          /* mqtt_subs_topic_matches() */
+#include "esp_log.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "mqtt-rate";
+
+#define TOKEN   1000
+
+typedef struct {
+    char        filter[MQTT_SUBS_FILTER_LEN];
+    uint32_t    rate;           /* msgs/s, 0 = exempt            */
+    uint32_t    burst;          /* bucket size, msgs             */
+    bool        coalesce;
+    _Atomic uint64_t bucket;    /* last refill ms << 32 | milli-tokens */
+    atomic_uint throttled;
+    uint32_t    coalesced;      /* publish task only             */
+} rate_rule_t;
+
+typedef struct {
+    bool            used;
+    int             rule;
+    mqtt_outbound_t msg;
+} held_slot_t;
+
+static rate_rule_t s_rules[MQTT_RATE_RULES_MAX];
+static int         s_rule_count;
+static held_slot_t s_held[MQTT_RATE_HELD_MAX];
+static atomic_int  s_held_credits;
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static int find_rule(const char *topic)
+{
+    for (int i = 0; i < s_rule_count; i++) {
+        if (mqtt_subs_topic_matches(s_rules[i].filter, topic)) return i;
+    }
+    return -1;
+}
+
+/* Bucket word after refilling it up to now_us */
+static uint64_t refilled(const rate_rule_t *r, uint64_t b, int64_t now_us)
+{
+    uint32_t now_ms = (uint32_t)(now_us / 1000);
+    uint32_t cap    = r->burst * TOKEN;
+    uint64_t tokens = (uint32_t)b + (uint64_t)(uint32_t)(now_ms - (uint32_t)(b >> 32)) * r->rate;
+    if (tokens > cap) tokens = cap;
+    return ((uint64_t)now_ms << 32) | tokens;
+}
+
+static bool take_token(rate_rule_t *r, int64_t now_us)
+{
+    uint64_t b = atomic_load(&r->bucket);
+    for (;;) {
+        uint64_t nb = refilled(r, b, now_us);
+        if ((uint32_t)nb < TOKEN) return false;
+        if (atomic_compare_exchange_weak(&r->bucket, &b, nb - TOKEN)) return true;
+    }
+}
+
+static void give_token(rate_rule_t *r)
+{
+    uint64_t b = atomic_load(&r->bucket);
+    for (;;) {
+        uint32_t tokens = (uint32_t)b + TOKEN;
+        if (tokens > r->burst * TOKEN) tokens = r->burst * TOKEN;
+        uint64_t nb = (b & 0xFFFFFFFF00000000ull) | tokens;
+        if (atomic_compare_exchange_weak(&r->bucket, &b, nb)) return;
+    }
+}
+
+static bool take_credit(void)
+{
+    int c = atomic_load(&s_held_credits);
+    while (c < MQTT_RATE_HELD_MAX) {
+        if (atomic_compare_exchange_weak(&s_held_credits, &c, c + 1)) return true;
+    }
+    return false;
+}
+
+static void give_credit(void)
+{
+    atomic_fetch_sub(&s_held_credits, 1);
+}
+
+static held_slot_t *find_held(const char *topic)
+{
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        if (s_held[i].used && strcmp(s_held[i].msg.topic, topic) == 0) {
+            return &s_held[i];
+        }
+    }
+    return NULL;
+}
+
+static held_slot_t *free_held(void)
+{
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        if (!s_held[i].used) return &s_held[i];
+    }
+    return NULL;
+}
+
+static int add_rule(const char *filter, size_t flen, uint32_t rate,
+                    uint32_t burst, bool coalesce)
+{
+    if (s_rule_count >= MQTT_RATE_RULES_MAX) {
+        ESP_LOGE(TAG, "Rule table full");
+        return -1;
+    }
+    if (flen == 0 || flen >= MQTT_SUBS_FILTER_LEN || (rate != 0 && burst == 0)) {
+        return -1;
+    }
+    rate_rule_t *r = &s_rules[s_rule_count++];
+    memset(r, 0, sizeof(*r));
+    memcpy(r->filter, filter, flen);
+    r->rate     = rate;
+    r->burst    = burst;
+    r->coalesce = coalesce;
+    atomic_store(&r->bucket, (uint64_t)burst * TOKEN);      /* full */
+    if (rate == 0) {
+        ESP_LOGI(TAG, "Rule %d: %s exempt", s_rule_count - 1, r->filter);
+    } else {
+        ESP_LOGI(TAG, "Rule %d: %s %u/s burst %u%s", s_rule_count - 1, r->filter,
+                 (unsigned)rate, (unsigned)burst, coalesce ? " (coalesce)" : "");
+    }
+    return 0;
+}
+
+/* One "<filter>=<rate>:<burst>[:c]" or "<filter>=0" entry in [p, end) */
+static int parse_one(const char *p, const char *end)
+{
+    const char *eq = memchr(p, '=', (size_t)(end - p));
+    if (eq == NULL) return -1;
+
+    char *q;
+    unsigned long rate = strtoul(eq + 1, &q, 10);
+    if (q == eq + 1) return -1;
+    unsigned long burst = 0;
+    if (rate != 0) {                                /* "=0": exempt */
+        if (*q != ':') return -1;
+        burst = strtoul(q + 1, &q, 10);
+    }
+
+    bool coalesce = false;
+    if (q + 1 < end && q[0] == ':' && q[1] == 'c') {
+        coalesce = true;
+        q += 2;
+    }
+    while (q < end && *q == ' ') q++;
+    if (q != end) return -1;
+
+    return add_rule(p, (size_t)(eq - p), (uint32_t)rate, (uint32_t)burst, coalesce);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+int mqtt_rate_parse(const char *spec)
+{
+    if (spec == NULL) return 0;
+
+    int added = 0;
+    const char *p = spec;
+    while (*p) {
+        while (*p == ';' || *p == ' ') p++;
+        if (*p == '\0') break;
+
+        const char *end = p;
+        while (*end && *end != ';') end++;
+        if (parse_one(p, end) != 0) {
+            ESP_LOGE(TAG, "Bad rule '%.*s'", (int)(end - p), p);
+            return -1;
+        }
+        added++;
+        p = end;
+    }
+    return added;
+}
+
+void mqtt_rate_clear(void)
+{
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        if (s_held[i].used) free(s_held[i].msg.data);
+        s_held[i].used = false;
+    }
+    atomic_store(&s_held_credits, 0);
+    s_rule_count = 0;
+}
+
+mqtt_rate_verdict_t mqtt_rate_admit(mqtt_outbound_t *m, int64_t now_us)
+{
+    m->rule = -1;
+    m->held = false;
+
+    int ri = find_rule(m->topic);
+    if (ri < 0 || s_rules[ri].rate == 0) return MQTT_RATE_SEND;
+    rate_rule_t *r = &s_rules[ri];
+    m->rule = (int8_t)ri;
+
+    if (take_token(r, now_us)) return MQTT_RATE_SEND;
+
+    if (r->coalesce && take_credit()) {
+        m->held = true;
+        return MQTT_RATE_HELD;
+    }
+
+    unsigned thr = atomic_fetch_add(&r->throttled, 1) + 1;
+    if (thr == 1 || (thr % 100) == 0) {
+        ESP_LOGW(TAG, "Throttling %s (rule %s, %u refused)",
+                 m->topic, r->filter, thr);
+    }
+    return MQTT_RATE_DROPPED;
+}
+
+void mqtt_rate_cancel(const mqtt_outbound_t *m)
+{
+    if (m->rule < 0) return;
+    if (m->held) give_credit();
+    else         give_token(&s_rules[m->rule]);
+}
+
+mqtt_rate_verdict_t mqtt_rate_check(mqtt_outbound_t *m)
+{
+    if (m->rule < 0) return MQTT_RATE_SEND;
+    rate_rule_t *r = &s_rules[m->rule];
+
+    held_slot_t *h = r->coalesce ? find_held(m->topic) : NULL;
+    if (h != NULL) {
+        /* Superseded by the newer value either way */
+        free(h->msg.data);
+        r->coalesced++;
+        give_credit();
+        if (!m->held) {
+            h->used = false;
+            return MQTT_RATE_SEND;          /* newer value, own token */
+        }
+        h->msg = *m;
+        return MQTT_RATE_HELD;
+    }
+
+    if (!m->held) return MQTT_RATE_SEND;
+
+    h = free_held();                        /* guaranteed by the credit */
+    h->used = true;
+    h->rule = m->rule;
+    h->msg  = *m;
+    return MQTT_RATE_HELD;
+}
+
+bool mqtt_rate_take_due(int64_t now_us, mqtt_outbound_t *out)
+{
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        held_slot_t *h = &s_held[i];
+        if (!h->used) continue;
+        if (!take_token(&s_rules[h->rule], now_us)) continue;
+        *out    = h->msg;
+        h->used = false;
+        give_credit();
+        return true;
+    }
+    return false;
+}
+
+int mqtt_rate_ms_until_due(int64_t now_us)
+{
+    int best = -1;
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        if (!s_held[i].used) continue;
+        rate_rule_t *r = &s_rules[s_held[i].rule];
+        uint32_t tokens = (uint32_t)refilled(r, atomic_load(&r->bucket), now_us);
+        int ms = (tokens >= TOKEN) ? 0 : (int)((TOKEN - tokens) / r->rate) + 1;
+        if (best < 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+void mqtt_rate_write_health(health_writer_t *hw)
+{
+    if (s_rule_count == 0) return;
+
+    uint32_t thr = 0, coal = 0, held = 0;
+    for (int i = 0; i < s_rule_count; i++) {
+        thr  += atomic_load(&s_rules[i].throttled);
+        coal += s_rules[i].coalesced;
+    }
+    for (int i = 0; i < MQTT_RATE_HELD_MAX; i++) {
+        if (s_held[i].used) held++;
+    }
+
+    health_begin_object(hw, "rate");
+    health_field_uint(hw, "thr",  thr);
+    health_field_uint(hw, "coal", coal);
+    health_field_uint(hw, "held", held);
+    health_begin_array(hw, "r");
+    for (int i = 0; i < s_rule_count; i++) {
+        health_begin_array(hw, NULL);
+        health_field_uint(hw, NULL, atomic_load(&s_rules[i].throttled));
+        health_field_uint(hw, NULL, s_rules[i].coalesced);
+        health_end_array(hw);
+    }
+    health_end_array(hw);
+    health_end_object(hw);
+}
@@ -0,0 +1,115 @@
+/*
+ * mqtt_rate.h - Per-topic rate limiting for mqtt_service's outbound queue
+ *
+ * Rules are MQTT topic filters, each with a token bucket (rate in
+ * messages/s, burst = bucket size).  A queued publish is checked against
+ * the first rule whose filter matches its topic; topics no rule matches
+ * are never limited.  Health is published by the publish task directly
+ * and is not subject to these rules -- protecting it is the point.
+ *
+ * The verdict is given when the message is queued, on the publishing task,
+ * so the producer learns about a drop from mqtt_service_try_publish()
+ * (MQTT_SERVICE_ERR_RATE_LIMITED) and can retry, instead of getting ESP_OK
+ * for a message the publish task discards later.
+ *
+ * Over the limit:
+ *   plain rule      the publish is refused             ("thr" counter)
+ *   coalesce rule   the publish is queued to be held, one slot per topic;
+ *                   a newer value for the same topic replaces the held one
+ *                   ("coal") and the held value goes out as soon as a
+ *                   token is back.  Use this for "state" topics where only
+ *                   the latest value matters (temperatures, relay states).
+ *                   Only when every held slot is spoken for is it refused.
+ *   exempt rule     "<filter>=0": never limited; list control topics
+ *                   before a catch-all so it cannot starve them
+ *
+ * Rule spec (CONFIG_MQTT_RATE_LIMITS), first match wins:
+ *   "<filter>=<rate>:<burst>[:c];<filter>=0;..."
+ *   e.g. "/+/temperature/#=5:10:c;/+/ota/#=0;#=20:40"
+ *
+ * Concurrency: rules are installed by the mqtt_service task before the
+ * client starts -- no publisher is let in before it connects -- and are
+ * read-only afterwards.  mqtt_rate_admit()
+ * runs on whichever task publishes: buckets are single atomic words and
+ * held slots are claimed with an atomic credit count, so a message
+ * admitted as HELD always finds a slot.  Everything else runs on the mqtt
+ * publish task.
+ */
+
+#ifndef MQTT_RATE_H
+#define MQTT_RATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MQTT_RATE_RULES_MAX
+#define MQTT_RATE_RULES_MAX     12
+#endif
+#ifndef MQTT_RATE_HELD_MAX
+#define MQTT_RATE_HELD_MAX      8
+#endif
+
+#define MQTT_OUTBOUND_TOPIC_LEN 96
+
+/* One queued publish.  `data` is a NUL-terminated heap copy owned by
+ * whoever currently holds the struct. */
+typedef struct {
+    char     topic[MQTT_OUTBOUND_TOPIC_LEN];
+    char    *data;
+    size_t   len;
+    int8_t   qos;
+    bool     retain;
+    int8_t   rule;          /* set by mqtt_rate_admit(), -1 = none   */
+    bool     held;          /* admitted without a token: to be held  */
+} mqtt_outbound_t;
+
+typedef enum {
+    MQTT_RATE_SEND,         /* token taken -- publish now           */
+    MQTT_RATE_HELD,         /* kept for later; ownership taken      */
+    MQTT_RATE_DROPPED,      /* over the limit -- do not queue it    */
+} mqtt_rate_verdict_t;
+
+/** Parse a rule spec (see header) and append its rules.
+ *  @return number of rules added, -1 on a malformed entry (rules before it stay) */
+int  mqtt_rate_parse(const char *spec);
+
+/** Forget all rules and held messages. */
+void mqtt_rate_clear(void);
+
+/**
+ * Admission, on the publishing task, before `m` is queued: take a token,
+ * or for a coalesce rule a held-slot credit.  Sets m->rule and m->held.
+ * @return MQTT_RATE_SEND or MQTT_RATE_HELD -- queue it; MQTT_RATE_DROPPED
+ *         -- refuse it (counted as "thr")
+ */
+mqtt_rate_verdict_t mqtt_rate_admit(mqtt_outbound_t *m, int64_t now_us);
+
+/** Give back what mqtt_rate_admit() took for a message that was not
+ *  queued after all. */
+void mqtt_rate_cancel(const mqtt_outbound_t *m);
+
+/** Publish task: an admitted message left the queue.  MQTT_RATE_SEND --
+ *  publish it now; MQTT_RATE_HELD -- m->data now belongs here. */
+mqtt_rate_verdict_t mqtt_rate_check(mqtt_outbound_t *m);
+
+/** Pop one held message whose bucket has a token again.
+ *  @return true and fills *out (caller frees out->data), false if none due */
+bool mqtt_rate_take_due(int64_t now_us, mqtt_outbound_t *out);
+
+/** Milliseconds until the next held message is due, -1 if nothing is held. */
+int  mqtt_rate_ms_until_due(int64_t now_us);
+
+/** Health provider body: "rate":{"thr":0,"coal":0,"held":0,"r":[[thr,coal],...]} */
+void mqtt_rate_write_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_RATE_H */
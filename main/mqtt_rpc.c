@@ -0,0 +1,413 @@
+/*
+ * mqtt_rpc.c - Request/response RPC over MQTT
+ *
+ * Request slots: a slot is claimed with a CAS on `busy` by the submitter
+ * and released only by the worker that dequeued it.  `answered` decides
+ * who replies: the worker with the result or mqtt_rpc_tick() with
+ * "timeout", whichever exchanges it first.  It is always true while a slot
+ * is free, so the tick never times out a slot that is still being filled.
+ *
+ * The queue carries slot indices and is as long as the slot table, so
+ * queueing a claimed slot cannot fail.
+ */
+
+#include "mqtt_rpc.h"
+#include "mqtt_service.h"
+#include "priorities.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "mqtt-rpc";
+
+#define RPC_SLOTS           (CONFIG_MQTT_RPC_WORKERS + CONFIG_MQTT_RPC_QUEUE_LEN)
+#define RPC_ID_LEN          40
+#define RPC_METHOD_LEN      24
+#define RPC_TOPIC_LEN       96
+#define RPC_WORKER_STACK    4096
+
+typedef struct {
+    const char         *name;
+    mqtt_rpc_handler_t  fn;
+    void               *ctx;
+    uint32_t            timeout_ms;
+    atomic_bool         ready;
+} method_slot_t;
+
+typedef struct {
+    atomic_bool          busy;
+    atomic_bool          answered;
+    const method_slot_t *m;
+    int64_t              t0_us;
+    int64_t              deadline_us;
+    char                 id[RPC_ID_LEN];
+    char                 reply_to[RPC_TOPIC_LEN];
+    char                 params[MQTT_RPC_PARAMS_LEN];
+} request_t;
+
+static method_slot_t s_methods[MQTT_RPC_METHODS_MAX];
+static atomic_int    s_reserved;
+
+static request_t     s_slots[RPC_SLOTS];
+static QueueHandle_t s_queue;
+static char          s_default_reply[RPC_TOPIC_LEN];
+
+static struct {
+    atomic_uint n;
+    atomic_uint err;
+    atomic_uint timeouts;
+    atomic_uint busy;
+} s_stats;
+
+/* -------------------------------------------------------------------------
+ * Flat JSON scanning
+ * ------------------------------------------------------------------------- */
+
+static const char *skip_ws(const char *p)
+{
+    while (isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+/* One past the JSON value starting at p, NULL if it is malformed */
+static const char *value_end(const char *p)
+{
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1]) p++;
+        }
+        return *p ? p + 1 : NULL;
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (*p) {
+            if (*p == '"') {
+                if ((p = value_end(p)) == NULL) return NULL;
+                continue;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                return p + 1;
+            }
+            p++;
+        }
+        return NULL;
+    }
+    while (*p && *p != ',' && *p != '}' && *p != ']' && !isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+bool mqtt_rpc_json_get(const char *json, const char *key, char *out, size_t size)
+{
+    if (json == NULL || key == NULL || out == NULL || size == 0) return false;
+
+    const char *p = skip_ws(json);
+    if (*p != '{') return false;
+    p = skip_ws(p + 1);
+    if (*p == '}') return false;
+
+    const size_t want = strlen(key);
+    for (;;) {
+        if (*p != '"') return false;
+        const char *k    = p + 1;
+        const char *kend = value_end(p);
+        if (kend == NULL) return false;
+
+        p = skip_ws(kend);
+        if (*p != ':') return false;
+        const char *v    = skip_ws(p + 1);
+        const char *vend = value_end(v);
+        if (vend == NULL || vend == v) return false;
+
+        if ((size_t)(kend - 1 - k) == want && memcmp(k, key, want) == 0) {
+            if (*v == '"') {
+                v++;
+                vend--;
+            }
+            size_t n = (size_t)(vend - v);
+            if (n >= size) return false;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return true;
+        }
+
+        p = skip_ws(vend);
+        if (*p != ',') return false;
+        p = skip_ws(p + 1);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Replies
+ * ------------------------------------------------------------------------- */
+
+static void publish_reply(const char *topic, const char *json, bool may_wait)
+{
+    esp_err_t err = may_wait
+        ? mqtt_service_publish(topic, json, 1 /*qos*/, false)
+        : mqtt_service_try_publish(topic, json, 0, 1 /*qos*/, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Reply to %s not queued: %s", topic, esp_err_to_name(err));
+    }
+}
+
+static void reply_error(const char *topic, const char *id, const char *err,
+                        bool may_wait)
+{
+    char buf[160];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf));
+    json_begin_object(&w);
+    json_key(&w, "id");  json_put_str(&w, id);
+    json_key(&w, "ok");  json_put_bool(&w, false);
+    json_key(&w, "err"); json_put_str(&w, err);
+    json_end_object(&w);
+    if (json_writer_ok(&w)) publish_reply(topic, buf, may_wait);
+    atomic_fetch_add(&s_stats.err, 1);
+}
+
+/* -------------------------------------------------------------------------
+ * Worker pool
+ * ------------------------------------------------------------------------- */
+
+static void run_request(request_t *r, char *buf, size_t size)
+{
+    health_writer_t hw = { .cbor = false };
+    json_writer_init(&hw.u.json, buf, size);
+
+    health_begin_object(&hw, NULL);
+    health_field_str(&hw, "id", r->id);
+    health_field_bool(&hw, "ok", true);
+    health_begin_object(&hw, "result");
+    esp_err_t ret = r->m->fn(r->params, &hw, r->m->ctx);
+    health_end_object(&hw);
+    health_field_uint(&hw, "ms", (esp_timer_get_time() - r->t0_us) / 1000);
+    health_end_object(&hw);
+
+    if (atomic_exchange(&r->answered, true)) {
+        ESP_LOGW(TAG, "'%s' (id %s) finished after its timeout", r->m->name, r->id);
+        return;
+    }
+    if (ret != ESP_OK) {
+        reply_error(r->reply_to, r->id, esp_err_to_name(ret), true);
+    } else if (!json_writer_ok(&hw.u.json)) {
+        reply_error(r->reply_to, r->id, "too large", true);
+    } else {
+        publish_reply(r->reply_to, buf, true);
+    }
+}
+
+static void rpc_worker(void *arg)
+{
+    (void)arg;
+    static char s_bufs[CONFIG_MQTT_RPC_WORKERS][MQTT_RPC_REPLY_LEN];
+    static atomic_int s_next_buf;
+    char *buf = s_bufs[atomic_fetch_add(&s_next_buf, 1) % CONFIG_MQTT_RPC_WORKERS];
+
+    for (;;) {
+        uint8_t idx;
+        if (xQueueReceive(s_queue, &idx, portMAX_DELAY) != pdTRUE) continue;
+
+        request_t *r = &s_slots[idx];
+        if (!atomic_load(&r->answered)) {       /* else timed out while queued */
+            run_request(r, buf, MQTT_RPC_REPLY_LEN);
+        }
+        atomic_store(&r->busy, false);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Built-in methods
+ * ------------------------------------------------------------------------- */
+
+static esp_err_t rpc_methods(const char *params, health_writer_t *result, void *ctx)
+{
+    (void)params;
+    (void)ctx;
+    int n = atomic_load(&s_reserved);
+    if (n > MQTT_RPC_METHODS_MAX) n = MQTT_RPC_METHODS_MAX;
+
+    health_begin_array(result, "methods");
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_methods[i].ready)) health_field_str(result, NULL, s_methods[i].name);
+    }
+    health_end_array(result);
+    return ESP_OK;
+}
+
+/* params {"name":"ds18b20"} -> that provider.  One per request: all of
+ * them together do not fit in a reply, which is why the periodic health
+ * payload is chunked.  A provider larger than the reply is "too large". */
+static esp_err_t rpc_stats(const char *params, health_writer_t *result, void *ctx)
+{
+    (void)ctx;
+    char name[24];
+    if (!mqtt_rpc_json_get(params, "name", name, sizeof(name))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return health_payload_write(result, name);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t mqtt_rpc_init(const char *default_reply_to)
+{
+    if (default_reply_to == NULL ||
+        strlen(default_reply_to) >= sizeof(s_default_reply)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(s_default_reply, default_reply_to);
+    if (s_queue != NULL) return ESP_OK;
+
+    for (int i = 0; i < RPC_SLOTS; i++) {
+        atomic_store(&s_slots[i].busy, false);
+        atomic_store(&s_slots[i].answered, true);
+    }
+    s_queue = xQueueCreate(RPC_SLOTS, sizeof(uint8_t));
+    if (s_queue == NULL) return ESP_ERR_NO_MEM;
+
+    for (int i = 0; i < CONFIG_MQTT_RPC_WORKERS; i++) {
+        if (xTaskCreate(rpc_worker, "mqtt-rpc", RPC_WORKER_STACK, NULL,
+                        PRIO_MQTT_RPC, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Worker %d not created", i);
+            if (i == 0) return ESP_ERR_NO_MEM;
+            break;
+        }
+    }
+
+    mqtt_rpc_register("methods", rpc_methods, NULL, 0);
+    mqtt_rpc_register("stats",   rpc_stats,   NULL, 0);
+    ESP_LOGI(TAG, "%d worker(s), %d slots, replies -> %s",
+             CONFIG_MQTT_RPC_WORKERS, RPC_SLOTS, s_default_reply);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_rpc_register(const char *method, mqtt_rpc_handler_t fn,
+                            void *ctx, uint32_t timeout_ms)
+{
+    if (method == NULL || fn == NULL || strlen(method) >= RPC_METHOD_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int n = atomic_load(&s_reserved);
+    if (n > MQTT_RPC_METHODS_MAX) n = MQTT_RPC_METHODS_MAX;
+    for (int i = 0; i < n; i++) {
+        if (atomic_load(&s_methods[i].ready) && strcmp(s_methods[i].name, method) == 0) {
+            return ESP_OK;
+        }
+    }
+
+    int idx = atomic_fetch_add(&s_reserved, 1);
+    if (idx >= MQTT_RPC_METHODS_MAX) {
+        ESP_LOGE(TAG, "Method table full -- '%s' not registered", method);
+        return ESP_ERR_NO_MEM;
+    }
+    s_methods[idx].name       = method;
+    s_methods[idx].fn         = fn;
+    s_methods[idx].ctx        = ctx;
+    s_methods[idx].timeout_ms = timeout_ms ? timeout_ms : CONFIG_MQTT_RPC_TIMEOUT_MS;
+    atomic_store(&s_methods[idx].ready, true);
+    return ESP_OK;
+}
+
+void mqtt_rpc_submit(const char *payload)
+{
+    if (s_queue == NULL || payload == NULL) return;
+    atomic_fetch_add(&s_stats.n, 1);
+
+    char id[RPC_ID_LEN] = "";
+    char method[RPC_METHOD_LEN];
+    char reply_to[RPC_TOPIC_LEN];
+    char tmo[12];
+
+    mqtt_rpc_json_get(payload, "id", id, sizeof(id));
+    if (!mqtt_rpc_json_get(payload, "reply_to", reply_to, sizeof(reply_to))) {
+        strcpy(reply_to, s_default_reply);
+    }
+    if (!mqtt_rpc_json_get(payload, "method", method, sizeof(method))) {
+        reply_error(reply_to, id, "bad request", false);
+        return;
+    }
+
+    const method_slot_t *m = NULL;
+    int n = atomic_load(&s_reserved);
+    if (n > MQTT_RPC_METHODS_MAX) n = MQTT_RPC_METHODS_MAX;
+    for (int i = 0; i < n && m == NULL; i++) {
+        if (atomic_load(&s_methods[i].ready) && strcmp(s_methods[i].name, method) == 0) {
+            m = &s_methods[i];
+        }
+    }
+    if (m == NULL) {
+        reply_error(reply_to, id, "unknown method", false);
+        return;
+    }
+
+    request_t *r = NULL;
+    uint8_t    idx;
+    for (idx = 0; idx < RPC_SLOTS; idx++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&s_slots[idx].busy, &expected, true)) {
+            r = &s_slots[idx];
+            break;
+        }
+    }
+    if (r == NULL) {
+        atomic_fetch_add(&s_stats.busy, 1);
+        reply_error(reply_to, id, "busy", false);
+        return;
+    }
+
+    uint32_t timeout_ms = m->timeout_ms;
+    if (mqtt_rpc_json_get(payload, "timeout_ms", tmo, sizeof(tmo))) {
+        uint32_t req = (uint32_t)strtoul(tmo, NULL, 10);
+        if (req > 0 && req < timeout_ms) timeout_ms = req;
+    }
+
+    r->m           = m;
+    r->t0_us       = esp_timer_get_time();
+    r->deadline_us = r->t0_us + timeout_ms * 1000LL;
+    strcpy(r->id, id);
+    strcpy(r->reply_to, reply_to);
+    if (!mqtt_rpc_json_get(payload, "params", r->params, sizeof(r->params))) {
+        r->params[0] = '\0';
+    }
+    atomic_store(&r->answered, false);
+    xQueueSend(s_queue, &idx, 0);
+}
+
+void mqtt_rpc_tick(int64_t now_us)
+{
+    for (int i = 0; i < RPC_SLOTS; i++) {
+        request_t *r = &s_slots[i];
+        if (!atomic_load(&r->busy) || atomic_load(&r->answered)) continue;
+        if (now_us < r->deadline_us) continue;
+        if (atomic_exchange(&r->answered, true)) continue;
+
+        atomic_fetch_add(&s_stats.timeouts, 1);
+        ESP_LOGW(TAG, "'%s' (id %s) timed out", r->m->name, r->id);
+        reply_error(r->reply_to, r->id, "timeout", true);
+    }
+}
+
+void mqtt_rpc_write_health(health_writer_t *hw)
+{
+    unsigned n = atomic_load(&s_stats.n);
+    if (n == 0) return;
+
+    health_begin_object(hw, "rpc");
+    health_field_uint(hw, "n",    n);
+    health_field_uint(hw, "err",  atomic_load(&s_stats.err));
+    health_field_uint(hw, "to",   atomic_load(&s_stats.timeouts));
+    health_field_uint(hw, "busy", atomic_load(&s_stats.busy));
+    health_end_object(hw);
+}
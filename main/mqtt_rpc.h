@@ -0,0 +1,120 @@
+/*
+ * mqtt_rpc.h - Request/response RPC over MQTT
+ *
+ * Requests are JSON objects published to /<MACID>/rpc:
+ *
+ *   {"id":"42","method":"temps","reply_to":"/ctl/resp","timeout_ms":1000,
+ *    "params":{...}}
+ *
+ *   id          correlation id, echoed in the reply (string; a number is
+ *               echoed as a string)
+ *   method      registered method name
+ *   reply_to    optional, default /<MACID>/rpc/resp
+ *   timeout_ms  optional, may shorten but not extend the method's timeout
+ *   params      optional, passed to the handler as raw JSON text
+ *
+ * Replies (QoS 1) carry the id and either the handler's result or an error:
+ *
+ *   {"id":"42","ok":true,"result":{"t":[16.44,16.50]},"ms":3}
+ *   {"id":"43","ok":false,"err":"timeout"}
+ *
+ * Errors: "bad request", "unknown method", "busy" (all workers and queue
+ * slots taken), "timeout", "too large" (result did not fit), or the
+ * handler's esp_err_t name.
+ *
+ * Execution: mqtt_rpc_submit() runs on the esp-mqtt task and only parses
+ * and queues; a small pool of worker tasks (CONFIG_MQTT_RPC_WORKERS) runs
+ * the handlers, so a slow method never stalls the MQTT client and at most
+ * WORKERS + QUEUE_LEN requests are accepted at once -- the rest are
+ * answered "busy" immediately.  mqtt_rpc_tick(), called from the service
+ * loop, answers "timeout" for requests past their deadline; a handler that
+ * finishes later has its result discarded.
+ *
+ * "ms" is request arrival -> handler return.
+ *
+ * Handlers write the members of the result object through the
+ * health_payload field API (JSON), so health providers double as queries.
+ * Built-in methods: "methods" (list), "stats" (one health provider, params
+ * {"name":"<provider>"} required).  Services register their own, e.g.
+ * "relays" (mqtt_service) and "temps" (ds18b20_temp).
+ *
+ * Registration is lock-free and idempotent by name, like health_payload.
+ */
+
+#ifndef MQTT_RPC_H
+#define MQTT_RPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_MQTT_RPC_WORKERS
+#define CONFIG_MQTT_RPC_WORKERS     2
+#endif
+#ifndef CONFIG_MQTT_RPC_QUEUE_LEN
+#define CONFIG_MQTT_RPC_QUEUE_LEN   4
+#endif
+#ifndef CONFIG_MQTT_RPC_TIMEOUT_MS
+#define CONFIG_MQTT_RPC_TIMEOUT_MS  2000
+#endif
+
+#ifndef MQTT_RPC_METHODS_MAX
+#define MQTT_RPC_METHODS_MAX        16
+#endif
+#define MQTT_RPC_PARAMS_LEN         192
+#define MQTT_RPC_REPLY_LEN          1024
+
+/**
+ * Method handler -- runs on an RPC worker task.
+ * @param params  raw JSON value of "params" ("" if absent)
+ * @param result  writer positioned inside the result object
+ * @return ESP_OK, or an error reported to the caller by name
+ */
+typedef esp_err_t (*mqtt_rpc_handler_t)(const char *params,
+                                        health_writer_t *result, void *ctx);
+
+/**
+ * Create the worker pool (once; later calls only update the default reply
+ * topic).  `default_reply_to` is copied.
+ */
+esp_err_t mqtt_rpc_init(const char *default_reply_to);
+
+/**
+ * Register a method.  `method` must point to static storage.
+ * @param timeout_ms  0 = CONFIG_MQTT_RPC_TIMEOUT_MS
+ */
+esp_err_t mqtt_rpc_register(const char *method, mqtt_rpc_handler_t fn,
+                            void *ctx, uint32_t timeout_ms);
+
+/** Parse and queue a request payload.  Never blocks. */
+void mqtt_rpc_submit(const char *payload);
+
+/** Answer requests past their deadline.  Call periodically. */
+void mqtt_rpc_tick(int64_t now_us);
+
+/**
+ * Copy the value of top-level `key` of a flat JSON object into `out`:
+ * strings without quotes (escapes are not decoded), anything else as raw
+ * text.  For handlers reading their params.
+ * @return false if the key is absent or the value does not fit
+ */
+bool mqtt_rpc_json_get(const char *json, const char *key, char *out, size_t size);
+
+/**
+ * Health provider body, omitted until the first request:
+ *   "rpc":{"n":12,"err":1,"to":0,"busy":0}
+ * err counts every error reply, timeouts and busy included.
+ */
+void mqtt_rpc_write_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_RPC_H */
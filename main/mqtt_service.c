@@ -1,5 +1,186 @@
 /*
- * mqtt_service.c  (v1.6 -- MAC address wait fix)
+ * mqtt_service.c  (v1.21 -- device shadow)
+ *
+ * CHANGES vs v1.20:
+ *  [24] Device shadow (see device_shadow.h): relay1..4 and cfg_gen are
+ *       registered as shadow keys and reported on every change, so relay
+ *       state is no longer write-only.  All relay writes go through
+ *       relay_set(), from the relay topics and from the shadow's apply
+ *       path alike.  /<MACID>/shadow/desired is subscribed at QoS 1 and
+ *       reconciled in the message callback; on connect the next
+ *       device_shadow_tick() (service loop, while connected) publishes the
+ *       full reported document, after that only deltas.
+ *
+ * CHANGES vs v1.19:
+ *  [23] Firmware updates over MQTT (see mqtt_ota.h): /<MACID>/ota/begin,
+ *       /<MACID>/ota/data/<offset> and /<MACID>/ota/abort are subscribed
+ *       and reach mqtt_ota through app_mqtt's raw callback -- binary and
+ *       unclipped, written to flash chunk by chunk as they arrive.  On
+ *       connect mqtt_ota re-acks a session in progress (resume) and
+ *       confirms a freshly booted image; the service loop runs
+ *       mqtt_ota_tick(), which ends with supervisor_reboot("ota") after a
+ *       verified image.  The "ota" command class times each message
+ *       including its flash write.
+ *
+ * CHANGES vs v1.18:
+ *  [22] /<MACID>/rpc carries JSON requests with a correlation id and an
+ *       optional reply topic (see mqtt_rpc.h).  The message callback only
+ *       hands the payload to mqtt_rpc_submit(); a bounded worker pool runs
+ *       the handler and the reply is published asynchronously to reply_to
+ *       (default /<MACID>/rpc/resp).  The service loop calls
+ *       mqtt_rpc_tick() so overdue requests are answered "timeout".
+ *       This file registers "relays" (state of the four outputs, tracked in
+ *       s_relay_bits since output-only GPIOs do not read back); health
+ *       carries "rpc":{...}.
+ *
+ * CHANGES vs v1.17:
+ *  [21] Broker list and health interval come from config_store and are
+ *       applied live on its change notifications -- no service restart:
+ *         - health: the publish task reschedules at once; 0 disables it
+ *         - brokers: the list is reloaded and the client moved to the new
+ *           primary through the failover path of [18]; broker_tick() now
+ *           drives reconnects with a single broker too, so a changed list
+ *           always has an owner
+ *       /<MACID>/config takes "key=value;..." updates (see config_store.h).
+ *       The payload is handed to the service loop through a one-slot
+ *       mailbox and applied there, all keys or none; the resulting config
+ *       is published retained on /<MACID>/config/state, with "err" added
+ *       when the update was rejected.  The state is also published on
+ *       every connect.
+ *       mqtt_service_set_config() while running goes through the store
+ *       as well instead of overwriting the live config under the task.
+ *
+ * CHANGES vs v1.16:
+ *  [20] Every inbound message is timed through mqtt_message_callback()
+ *       and added to a per-command histogram in mqtt_stats (relay, text,
+ *       time, ping, other; microseconds).  Messages that could not be
+ *       handed on (event queue full) count as drops.  Health carries
+ *       "cmd_us":{...} and "cmd_drop".
+ *       /<MACID>/ping is echoed unchanged to /<MACID>/pong so an external
+ *       load tool can measure broker -> node -> broker round trips while
+ *       it floods the relay / text / time topics.
+ *       The per-message "RX:" log is now debug level: at flood rates the
+ *       UART write dominated the measured time.
+ *       tools/mqtt_load.py is that load tool.
+ *
+ * CHANGES vs v1.15:
+ *  [19] mqtts:// broker URIs connect through mqtt_tls (see app_mqtt.c):
+ *       CA bundle or embedded CA, optional client certificate, and the TLS
+ *       session of the last connection to each broker is offered on
+ *       reconnect so the broker can skip the full handshake.  Handshake
+ *       count, resumptions and times are in the health payload
+ *       ("tls":{...}).
+ *
+ * CHANGES vs v1.14:
+ *  [18] Broker list: config.broker_uri is the primary, config.broker_backups
+ *       (default CONFIG_MQTT_BROKER_BACKUP_URIS) the backups, kept by
+ *       mqtt_brokers.  With one or more backups esp-mqtt's own reconnect
+ *       loop is disabled and broker_tick() in the service loop drives it:
+ *         - every attempt is bounded by CONFIG_MQTT_CONNECT_TIMEOUT_MS; a
+ *           refused or timed-out attempt backs the broker off (1..60 s)
+ *         - while the primary is backing off the healthy backup with the
+ *           lowest TCP handshake RTT is used; backups without a recent
+ *           one are probed first, on the mqtt-probe task so the service
+ *           loop never waits on DNS or a connect (attempt start ->
+ *           CONNACK is logged, not ranked)
+ *         - on a backup, the primary is TCP-probed every
+ *           CONFIG_MQTT_FAILBACK_PROBE_S; two good probes in a row
+ *           disconnect and fail back
+ *       Connection loss -> CONNACK on another broker is the switchover
+ *       time; health carries it with RTTs and failures ("brk":{...}).
+ *       With no backups nothing changes.
+ *
+ * CHANGES vs v1.13:
+ *  [17] Bounded outbound queue with explicit backpressure.  Besides the 16
+ *       slots, queued payload bytes are capped at
+ *       CONFIG_MQTT_OUTBOUND_BUDGET_BYTES.  mqtt_service_try_publish() never
+ *       waits: a full queue or an exhausted budget returns
+ *       MQTT_SERVICE_ERR_WOULD_BLOCK at once, a failed payload copy
+ *       ESP_ERR_NO_MEM.  mqtt_service_publish() keeps its short 10 ms wait
+ *       for a free slot.  Sensor and control tasks therefore never touch
+ *       the socket; only the publish task does.  Queue depth, bytes, peak
+ *       and rejections are in the health payload ("outq":{...}).
+ *
+ * CHANGES vs v1.12:
+ *  [16] Token-bucket limits per topic filter on the outbound queue
+ *       (mqtt_rate, rules from CONFIG_MQTT_RATE_LIMITS).  A flooding
+ *       producer is throttled in the publish task before it reaches the
+ *       esp-mqtt outbox, so QoS1 health keeps flowing.  Rules marked
+ *       coalesce ("state" topics) hold the latest value per topic instead
+ *       of dropping and send it when the bucket refills.  Throttled /
+ *       coalesced counts are in the health payload ("rate":{...}).
+ *       The verdict is taken in enqueue_publish(), on the caller's task:
+ *       an over-limit publish is refused with MQTT_SERVICE_ERR_RATE_LIMITED
+ *       instead of being accepted and dropped by the publish task later.
+ *       The default rules exempt the control topics (ota, rpc, config,
+ *       shadow, status) from the catch-all.
+ *
+ * CHANGES vs v1.11:
+ *  [15] All publishes go through one owner: mqtt_service_publish*() copy
+ *       topic + payload into an outbound queue item (payload on the heap,
+ *       freed by the consumer) and the mqtt publish task drains the queue
+ *       between health payloads.  esp-mqtt keeps MQTT 5 publish properties
+ *       in one per-client slot, so setting them from several tasks would
+ *       race; with a single publisher it cannot.  The "online" status from
+ *       the connection callback is queued the same way.
+ *       CONFIG_MQTT_USE_PROTOCOL_5 (default n) connects with MQTT 5 and
+ *       publishes through mqtt_props: topic aliases for QoS 0 topics,
+ *       message expiry for telemetry/health, a timestamp user property.
+ *       The "mqtt" health provider adds the bytes-on-wire accounting
+ *       ("v5":{...}, see mqtt_props.h).
+ *
+ * CHANGES vs v1.10:
+ *  [14] CONFIG_MQTT_PERSISTENT_SESSION connects with clean-session = 0 using
+ *       the MAC-derived client_id (stable across reboots and reflashes).
+ *       Command filters (cmd, text, relays) are subscribed at QoS 1 so the
+ *       broker queues commands sent while the node is offline; they are
+ *       delivered right after the reconnect.  When the CONNACK reports
+ *       session-present the registry is resumed (mqtt_subs_resume) instead
+ *       of re-sent, so a reconnect costs CONNECT + CONNACK only.
+ *       "sess" in the health payload shows the flag of the current session.
+ *
+ * CHANGES vs v1.9:
+ *  [13] Subscription registry (mqtt_subs).  The command, clock, text and
+ *       relay filters are registered once at start-up; on every connect the
+ *       registry goes out as ONE multi-filter SUBSCRIBE instead of seven
+ *       round trips, so a broker restart no longer triggers a per-node
+ *       SUBSCRIBE storm.  SUBACK codes are matched back to the filters and
+ *       mqtt_service_is_subscribed() reports when all were granted.
+ *       mqtt_service_subscribe() now registers the filter too, so runtime
+ *       subscriptions survive reconnects.
+ *       CONFIG_MQTT_SUBSCRIBE_NODE_WILDCARD (default n) covers every
+ *       /<MACID>/... filter with a single /<MACID>/# -- fewer filters, but
+ *       the broker then echoes this node's own status/health/temperature
+ *       publishes back to it; those are dropped in mqtt_message_callback()
+ *       by matching against the registry.
+ *
+ * CHANGES vs v1.8:
+ *  [12] Health payload assembled by health_payload from registered field
+ *       providers instead of hand-written snprintf variants.  This file
+ *       registers "core" (uptime/heap/ip/crash) and "mqtt" (outbox + ack
+ *       histograms); other services register their own.  One code path
+ *       serves JSON and CBOR, overflow is detected by the writers, and a
+ *       payload that outgrows the 512 B buffer is split into chunks that
+ *       share a "seq" number (see health_payload.h).
+ *
+ * CHANGES vs v1.7:
+ *  [11] Selectable payload encoding (mqtt_config_t.payload_format, default
+ *       from CONFIG_MQTT_PAYLOAD_CBOR).  In CBOR mode the health payload is
+ *       an RFC 8949 map built by cbor_writer (no heap, no snprintf) and is
+ *       published on <publish_topic>/health/cbor.  The "/cbor" suffix lets
+ *       subscribers pick a decoder by topic; JSON topics are unchanged.
+ *       mqtt_service_publish_bin() added for length-delimited payloads.
+ *
+ * CHANGES vs v1.6:
+ *  [10] QoS1 ack tracking.  Every publish made by this service goes through
+ *       tracked_publish(), which records the msg_id in mqtt_stats' in-flight
+ *       table.  MQTT_EVENT_PUBLISHED (via app_mqtt's published callback)
+ *       closes the entry and adds the enqueue->ack latency to a per-topic-
+ *       class histogram.  The health payload now carries the outbox size,
+ *       in-flight count, ack timeouts and the histograms:
+ *         ,"outbox":0,"inflight":0,"ack_to":0,"ack_unmatched":0,
+ *          "ack_ms":{"health":{"n":12,"avg":18,"max":41,"h":[3,6,3,0,0,0,0,0]}}
+ *       Health buffer raised from 256 B to 512 B to make room.
  *
  * CHANGES vs v1.5:
  *  [9] Fixed MAC address reading - now waits for valid MAC (not all zeros)
@@ -52,6 +233,17 @@
 
 #include "mqtt_service.h"
 #include "app_mqtt.h"
+#include "mqtt_stats.h"         /* [10] ack latency histograms */
+#include "health_payload.h"     /* [12] provider-based health payload */
+#include "mqtt_subs.h"          /* [13] subscription registry */
+#include "mqtt_props.h"         /* [15] MQTT 5 aliases / properties */
+#include "mqtt_rate.h"          /* [16] per-topic token buckets */
+#include "mqtt_brokers.h"       /* [18] broker list / failover */
+#include "mqtt_tls.h"           /* [19] TLS handshake stats */
+#include "config_store.h"       /* [21] runtime config */
+#include "mqtt_rpc.h"           /* [22] request/response RPC */
+#include "mqtt_ota.h"           /* [23] streaming firmware update */
+#include "device_shadow.h"      /* [24] desired / reported state */
 #include "network_service.h"    /* replaces ethernet_service.h */
 #include "supervisor.h"
 #include "priorities.h"
@@ -65,6 +257,8 @@
 #include "esp_timer.h"
 #include "esp_netif.h"
 #include "driver/gpio.h"        /* [8] relay GPIO control */
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>              /* [8] tolower() for case-insensitive payload */
@@ -86,6 +280,28 @@ static const struct {
     { "relay4", GPIO_NUM_32 },
 };
 
+/* [22] Bit i = relay i+1 on; written by the message callback */
+static atomic_uint s_relay_bits;
+
+/* [24] The one place a relay changes: GPIO, state bits, shadow */
+static void relay_set(int i, bool on)
+{
+    gpio_set_level(s_relays[i].gpio, on ? 1 : 0);
+    if (on) atomic_fetch_or(&s_relay_bits, 1u << i);
+    else    atomic_fetch_and(&s_relay_bits, ~(1u << i));
+    device_shadow_report_bool(s_relays[i].name, on);
+    ESP_LOGI(TAG, "Relay %s %-3s (GPIO%d)", s_relays[i].name, on ? "ON" : "OFF",
+             s_relays[i].gpio);
+}
+
+/* [24] Shadow apply: desired "true" / "false" */
+static esp_err_t relay_apply(const char *key, const char *value, void *ctx)
+{
+    (void)key;
+    relay_set((int)(intptr_t)ctx, strcmp(value, "true") == 0);
+    return ESP_OK;
+}
+
 /** Configure all relay GPIOs as push-pull outputs, default LOW (off). */
 static void relay_gpio_init(void)
 {
@@ -102,7 +318,11 @@ static void relay_gpio_init(void)
     gpio_config(&cfg);
     for (int i = 0; i < RELAY_COUNT; i++) {
         gpio_set_level(s_relays[i].gpio, 0);
+        device_shadow_register(s_relays[i].name, DEVICE_SHADOW_BOOL,
+                               relay_apply, (void *)(intptr_t)i);     /* [24] */
+        device_shadow_report_bool(s_relays[i].name, false);
     }
+    atomic_store(&s_relay_bits, 0);
     ESP_LOGI(TAG, "Relay GPIOs initialised (23,26,27,32) -- all OFF");
 }
 
@@ -184,6 +404,17 @@ static void mqtt_derive_node_id(void)
 #define CONFIG_MQTT_BROKER_URI "mqtt://192.168.1.1"
 #endif
 
+/* [18] Backups, tried when the primary broker is unreachable */
+#ifndef CONFIG_MQTT_BROKER_BACKUP_URIS
+#define CONFIG_MQTT_BROKER_BACKUP_URIS  ""
+#endif
+#ifndef CONFIG_MQTT_CONNECT_TIMEOUT_MS
+#define CONFIG_MQTT_CONNECT_TIMEOUT_MS  5000
+#endif
+#ifndef CONFIG_MQTT_FAILBACK_PROBE_S
+#define CONFIG_MQTT_FAILBACK_PROBE_S    30
+#endif
+
 #ifndef CONFIG_MQTT_CLIENT_ID_PREFIX
 #define CONFIG_MQTT_CLIENT_ID_PREFIX    ""
 #endif
@@ -196,6 +427,24 @@ static void mqtt_derive_node_id(void)
 #ifndef CONFIG_MQTT_HEALTH_INTERVAL_MS
 #define CONFIG_MQTT_HEALTH_INTERVAL_MS  30000   /* 30 s health publish */
 #endif
+/* [14] Commands need QoS 1 to be queued by the broker while we are away */
+#ifdef CONFIG_MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION         true
+#define MQTT_CMD_SUB_QOS                1
+#else
+#define MQTT_PERSISTENT_SESSION         false
+#define MQTT_CMD_SUB_QOS                0
+#endif
+#ifdef CONFIG_MQTT_USE_PROTOCOL_5
+#define MQTT_USE_V5                     true
+#else
+#define MQTT_USE_V5                     false
+#endif
+#ifdef CONFIG_MQTT_PAYLOAD_CBOR
+#define MQTT_DEFAULT_PAYLOAD_FORMAT     MQTT_PAYLOAD_FORMAT_CBOR
+#else
+#define MQTT_DEFAULT_PAYLOAD_FORMAT     MQTT_PAYLOAD_FORMAT_JSON
+#endif
 
 /* Derived topic helpers -- built at runtime from status_topic */
 /* status_topic  = publish_topic + "/status"  (e.g. /AABBCCA1B2C3/status) */
@@ -203,17 +452,55 @@ static void mqtt_derive_node_id(void)
 #define MQTT_STATUS_SUFFIX   "/status"
 #define MQTT_HEALTH_SUFFIX   "/health"
 
+/* [15] Outbound publish queue of mqtt_outbound_t (mqtt_rate.h), drained by
+ * mqtt_publish_task */
+#define MQTT_OUTBOUND_QUEUE_LEN     16
+
+/* [17] Payload bytes allowed to sit in the outbound queue */
+#ifndef CONFIG_MQTT_OUTBOUND_BUDGET_BYTES
+#define CONFIG_MQTT_OUTBOUND_BUDGET_BYTES   8192
+#endif
+
+/* [16] "<filter>=<msgs/s>:<burst>[:c];<filter>=0;..." -- see mqtt_rate.h */
+#ifndef CONFIG_MQTT_RATE_LIMITS
+#define CONFIG_MQTT_RATE_LIMITS     "/+/temperature/#=5:16:c;/+/ota/#=0;/+/rpc/#=0;/+/config/#=0;/+/shadow/#=0;/+/status=0;#=20:40"
+#endif
+
+/* [18] esp-mqtt reports a stuck CONNECT only after its own timeout */
+#define BROKER_ATTEMPT_MARGIN_MS    2000
+#define BROKER_FAILBACK_PROBES      2
+
+/* [21] Remote config: topic suffixes and mailbox */
+#define MQTT_CONFIG_SUFFIX          "/config"
+#define MQTT_CONFIG_STATE_SUFFIX    "/config/state"
+#define MQTT_CONFIG_RX_LEN          512
+#define MQTT_CONFIG_STATE_LEN       768
+
+/* [22] RPC request / default reply topic suffixes */
+#define MQTT_RPC_SUFFIX             "/rpc"
+#define MQTT_RPC_REPLY_SUFFIX       "/rpc/resp"
+
+/* [23] OTA topic prefix */
+#define MQTT_OTA_SUFFIX             "/ota"
+
+/* [24] Shadow topic prefix (/desired, /reported) */
+#define MQTT_SHADOW_SUFFIX          "/shadow"
+
+enum { CFG_RX_FREE, CFG_RX_WRITING, CFG_RX_READY };
+
 /* -------------------------------------------------------------------------
  * [1] Queue-send helper with drop warning
  * ------------------------------------------------------------------------- */
-static inline void queue_send_warn(QueueHandle_t q,
+static inline bool queue_send_warn(QueueHandle_t q,
                                    const mqtt_service_message_t *msg,
                                    const char *event_name)
 {
-    if (q == NULL) return;
+    if (q == NULL) return false;
     if (xQueueSend(q, msg, pdMS_TO_TICKS(10)) != pdTRUE) {
         ESP_LOGW(TAG, "Queue full -- dropped event: %s", event_name);
+        return false;
     }
+    return true;
 }
 
 /* -------------------------------------------------------------------------
@@ -221,6 +508,7 @@ static inline void queue_send_warn(QueueHandle_t q,
  * ------------------------------------------------------------------------- */
 typedef struct {
     QueueHandle_t   event_queue;
+    QueueHandle_t   out_queue;           /* [15] mqtt_outbound_t */
     TaskHandle_t    task_handle;
     TaskHandle_t    publish_task_handle;
     volatile bool   is_running;          /* [2] */
@@ -228,12 +516,127 @@ typedef struct {
     bool            publish_task_running;
     mqtt_config_t   config;
     uint32_t        message_counter;
+    int64_t         boot_us;             /* [12] publish task start, for uptime_s */
+    atomic_size_t   out_bytes;           /* [17] payload bytes in out_queue */
+    size_t          out_bytes_peak;      /* [17] publish task only */
+    atomic_uint     out_would_block;     /* [17] rejected: queue/budget full */
+    atomic_uint     out_no_mem;          /* [17] rejected: payload copy failed */
+    volatile int64_t connected_us;       /* [18] last CONNACK, esp-mqtt task */
+    volatile int64_t disconnected_us;    /* [18] last DISCONNECTED, esp-mqtt task */
+    atomic_uint     cfg_changed;         /* [21] pending CONFIG_CHANGED_* mask */
+    atomic_bool     health_resched;      /* [21] publish task: recompute next_health */
+    atomic_int      cfg_rx_state;        /* [21] CFG_RX_* */
+    char            cfg_rx[MQTT_CONFIG_RX_LEN];   /* [21] remote update payload */
 } mqtt_service_ctx_t;
 
+/* [18] Failover state -- mqtt_service task only */
+typedef struct {
+    bool     up;                /* connection state at the last tick */
+    int      idx;               /* broker of the current / last attempt, -1 = list reloaded */
+    int      lost_idx;          /* broker whose connection dropped, -1 = none */
+    int64_t  attempt_us;        /* pending attempt started, 0 = none */
+    int64_t  retry_at_us;       /* next attempt due, 0 = none scheduled */
+    int64_t  down_us;           /* connection lost at */
+    int64_t  next_probe_us;     /* next fail-back probe of the primary */
+    int      probe_ok;          /* consecutive good primary probes */
+    bool     probing;           /* fail-back probe of the primary pending */
+} broker_fsm_t;
+
 static mqtt_service_ctx_t s_ctx = {0};
+static broker_fsm_t       s_brk;
 
 static void mqtt_message_callback(const char *topic, const char *data, void *ctx);
+static bool mqtt_raw_callback(const char *topic, int topic_len,
+                              const uint8_t *data, int len,
+                              int offset, int total, void *ctx);
 static void mqtt_connection_callback(bool connected, void *ctx);
+static void mqtt_published_callback(int msg_id, void *ctx);
+static void mqtt_subscribed_callback(int msg_id, const uint8_t *codes, int n,
+                                     void *ctx);
+
+/* -------------------------------------------------------------------------
+ * [10] Publish + record in the ack-latency in-flight table
+ * [15] Publish task only -- everyone else goes through enqueue_publish()
+ * ------------------------------------------------------------------------- */
+static int tracked_publish(const char *topic, const char *data,
+                           size_t len, int qos, int retain)
+{
+    int64_t t0 = esp_timer_get_time();
+    int msg_id = mqtt_props_publish(topic, data, len, qos, retain);
+    if (qos > 0) {
+        mqtt_stats_publish_sent(msg_id, mqtt_stats_classify(topic), t0);
+    }
+    return msg_id;
+}
+
+/* -------------------------------------------------------------------------
+ * [15] Hand a publish to the publish task
+ * [17] Byte budget is reserved before the copy and given back by
+ *      outbound_taken() when the publish task dequeues the message.
+ * ------------------------------------------------------------------------- */
+static esp_err_t enqueue_publish(const char *topic, const void *data,
+                                 size_t len, int qos, bool retain,
+                                 TickType_t wait)
+{
+    if (!s_ctx.is_connected || !s_ctx.is_running || s_ctx.out_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* [16] Seen connected: read the rate rules after the flag, not before */
+    atomic_thread_fence(memory_order_acquire);
+    if (topic == NULL || strlen(topic) >= MQTT_OUTBOUND_TOPIC_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    mqtt_outbound_t m = { .len = len, .qos = (int8_t)qos, .retain = retain };
+    strcpy(m.topic, topic);
+
+    /* [16] Rate verdict now, so the caller knows; nothing is dropped later */
+    if (mqtt_rate_admit(&m, esp_timer_get_time()) == MQTT_RATE_DROPPED) {
+        return MQTT_SERVICE_ERR_RATE_LIMITED;
+    }
+
+    if (atomic_fetch_add(&s_ctx.out_bytes, len) + len > CONFIG_MQTT_OUTBOUND_BUDGET_BYTES) {
+        atomic_fetch_sub(&s_ctx.out_bytes, len);
+        atomic_fetch_add(&s_ctx.out_would_block, 1);
+        mqtt_rate_cancel(&m);
+        return MQTT_SERVICE_ERR_WOULD_BLOCK;
+    }
+
+    m.data = malloc(len + 1);
+    if (m.data == NULL) {
+        atomic_fetch_sub(&s_ctx.out_bytes, len);
+        atomic_fetch_add(&s_ctx.out_no_mem, 1);
+        mqtt_rate_cancel(&m);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(m.data, data, len);
+    m.data[len] = '\0';
+
+    if (xQueueSend(s_ctx.out_queue, &m, wait) != pdTRUE) {
+        free(m.data);
+        atomic_fetch_sub(&s_ctx.out_bytes, len);
+        atomic_fetch_add(&s_ctx.out_would_block, 1);
+        mqtt_rate_cancel(&m);
+        return MQTT_SERVICE_ERR_WOULD_BLOCK;
+    }
+    return ESP_OK;
+}
+
+/* [17] Message left the queue: release its share of the byte budget */
+static void outbound_taken(const mqtt_outbound_t *m)
+{
+    size_t before = atomic_fetch_sub(&s_ctx.out_bytes, m->len);
+    if (before > s_ctx.out_bytes_peak) s_ctx.out_bytes_peak = before;
+}
+
+static void drain_outbound(void)
+{
+    mqtt_outbound_t m;
+    while (s_ctx.out_queue != NULL && xQueueReceive(s_ctx.out_queue, &m, 0) == pdTRUE) {
+        outbound_taken(&m);
+        free(m.data);
+    }
+}
 
 /* -------------------------------------------------------------------------
  * cleanup_and_exit -- centralised error teardown
@@ -266,86 +669,438 @@ static void cleanup_and_exit(esp_err_t err_code, const char *err_msg,
 }
 
 /* -------------------------------------------------------------------------
- * [6] Health publish task
+ * [6] Health field providers
+ *
+ * JSON example (single chunk):
+ *   {"seq":12,"uptime_s":3742,"heap_free":187432,"ip":"192.168.1.42",
+ *    "crash":"ethernet","outbox":0,"inflight":0,"ack_to":0,
+ *    "ack_unmatched":0,"ack_ms":{...},"ds18b20":{...},...}
+ * "crash" key is only included when supervisor_get_last_crash() is non-NULL.
+ * [12] Both providers write flat keys to keep the v1.8 layout.
+ * ------------------------------------------------------------------------- */
+static void health_core_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+
+    /* Get IP via network_service -- transport-agnostic, no netif key needed */
+    const char *ip_p = network_service_get_ip();
+    const char *crash = supervisor_get_last_crash();
+
+    health_field_int(hw,  "uptime_s",
+                     (esp_timer_get_time() - s_ctx.boot_us) / 1000000LL);
+    health_field_uint(hw, "heap_free", esp_get_free_heap_size());
+    health_field_str(hw,  "ip", (ip_p && ip_p[0]) ? ip_p : "0.0.0.0");
+    if (crash) {
+        health_field_str(hw, "crash", crash);
+    }
+    uint32_t h_drop = health_payload_get_dropped();
+    if (h_drop) {
+        health_field_uint(hw, "h_drop", h_drop);
+    }
+}
+
+/* [10] Outbox, subscriptions, RPC and the outbound queue */
+static void health_mqtt_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    mqtt_stats_write_health(hw, mqtt_client_get_outbox_size());
+    health_field_int(hw, "subs",    mqtt_subs_count());        /* [13] */
+    health_field_int(hw, "subs_ok", mqtt_subs_acked_count());
+    health_field_bool(hw, "sess",   mqtt_client_session_present());   /* [14] */
+    mqtt_props_write_health(hw);                                      /* [15] */
+    mqtt_rpc_write_health(hw);                                        /* [22] */
+
+    /* [17] Outbound queue backpressure */
+    health_begin_object(hw, "outq");
+    health_field_uint(hw, "n",     s_ctx.out_queue ? uxQueueMessagesWaiting(s_ctx.out_queue) : 0);
+    health_field_uint(hw, "b",     atomic_load(&s_ctx.out_bytes));
+    health_field_uint(hw, "peak",  s_ctx.out_bytes_peak);
+    health_field_uint(hw, "wb",    atomic_load(&s_ctx.out_would_block));
+    health_field_uint(hw, "nomem", atomic_load(&s_ctx.out_no_mem));
+    health_end_object(hw);
+}
+
+/* [10] Publish -> PUBACK histograms */
+static void health_mqtt_ack_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    mqtt_stats_write_ack_health(hw);
+}
+
+/* [20] Inbound command histograms */
+static void health_mqtt_cmd_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    mqtt_stats_write_cmd_health(hw);
+}
+
+/* Rate limiter, broker list, TLS */
+static void health_mqtt_net_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    mqtt_rate_write_health(hw);                                       /* [16] */
+    mqtt_brokers_write_health(hw);                                    /* [18] */
+    mqtt_tls_write_health(hw);                                        /* [19] */
+}
+
+/* -------------------------------------------------------------------------
+ * [6] Health publish
  *
- * Publishes a JSON health payload to <publish_topic>/health every
+ * Publishes a health payload to <publish_topic>/health every
  * health_interval_ms.  Topic and LWT are both derived from publish_topic
  * so a single sdkconfig key controls the whole topic tree.
+ * [11] In CBOR mode the topic becomes <publish_topic>/health/cbor.
+ * ------------------------------------------------------------------------- */
+static void publish_health(const char *health_topic, bool cbor, uint32_t seq)
+{
+    /* [10] Reap in-flight entries whose PUBACK never arrived */
+    mqtt_stats_expire();
+
+    /* [12] One pass over the providers; usually a single chunk */
+    char payload[512];
+    health_payload_iter_t it;
+    health_payload_begin(&it, seq);
+
+    while (!it.done) {
+        size_t len = health_payload_next(&it, cbor, payload, sizeof(payload));
+        if (len == 0) {
+            ESP_LOGW(TAG, "Health payload build failed");
+            break;
+        }
+
+        int msg_id = tracked_publish(health_topic, payload, len,
+                                     1 /*qos*/, 0 /*retain*/);
+        if (msg_id < 0) {
+            ESP_LOGW(TAG, "Health publish failed");
+            break;
+        }
+
+        mqtt_service_message_t pub = {
+            .type = MQTT_SERVICE_EVENT_PUBLISHED,
+            .data.published.msg_id = msg_id,
+        };
+        strncpy(pub.data.published.topic, health_topic,
+                sizeof(pub.data.published.topic) - 1);
+        queue_send_warn(s_ctx.event_queue, &pub, "HEALTH");
+        if (cbor) {
+            ESP_LOGI(TAG, "Health: %u B CBOR", (unsigned)len);
+        } else {
+            ESP_LOGI(TAG, "Health: %s", payload);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * [15] Publish task -- the only caller of the MQTT publish functions
  *
- * Example payload:
- *   {"uptime_s":3742,"heap_free":187432,"ip":"192.168.1.42","crash":"ethernet"}
- * "crash" key is only included when supervisor_get_last_crash() is non-NULL.
+ * Health has priority: it is checked before every queue receive, so a
+ * steady stream of queued publishes cannot starve it.  The receive timeout
+ * is capped so a stop request is noticed within the shutdown grace period.
+ * [16] Held (coalesced) messages go out first once their bucket refills.
  * ------------------------------------------------------------------------- */
+static void send_outbound(mqtt_outbound_t *m)
+{
+    if (tracked_publish(m->topic, m->data, m->len, m->qos, m->retain) < 0) {
+        ESP_LOGW(TAG, "Publish failed: %s", m->topic);
+    }
+    free(m->data);
+}
+
 static void mqtt_publish_task(void *arg)
 {
-    ESP_LOGI(TAG, "Health publish task started");
+    ESP_LOGI(TAG, "Publish task started");
 
     /* Boot time in us for uptime calculation */
-    const int64_t boot_us = esp_timer_get_time();
+    s_ctx.boot_us = esp_timer_get_time();
+
+    const bool cbor = (s_ctx.config.payload_format == MQTT_PAYLOAD_FORMAT_CBOR);
 
     char health_topic[80];
-    snprintf(health_topic, sizeof(health_topic), "%s%s",
-             s_ctx.config.publish_topic, MQTT_HEALTH_SUFFIX);
+    snprintf(health_topic, sizeof(health_topic), "%s%s%s",
+             s_ctx.config.publish_topic, MQTT_HEALTH_SUFFIX,
+             cbor ? MQTT_CBOR_SUFFIX : "");
+
+    uint32_t   seq         = 0;
+    TickType_t next_health = xTaskGetTickCount();
 
     while (s_ctx.publish_task_running) {
-        if (!s_ctx.is_connected || !s_ctx.is_running) {
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            continue;
+        TickType_t now = xTaskGetTickCount();
+
+        if (atomic_exchange(&s_ctx.health_resched, false)) {      /* [21] */
+            next_health = now;
         }
-        if (!network_service_has_ip()) {
-            vTaskDelay(pdMS_TO_TICKS(2000));
-            continue;
+
+        if ((int32_t)(now - next_health) >= 0) {
+            if (!s_ctx.is_connected || !s_ctx.is_running) {
+                next_health = now + pdMS_TO_TICKS(1000);
+            } else if (s_ctx.config.health_interval_ms == 0) {     /* [21] off */
+                next_health = now + pdMS_TO_TICKS(1000);
+            } else if (!network_service_has_ip()) {
+                next_health = now + pdMS_TO_TICKS(2000);
+            } else {
+                publish_health(health_topic, cbor, seq++);
+                next_health = xTaskGetTickCount() +
+                              pdMS_TO_TICKS(s_ctx.config.health_interval_ms);
+            }
+            now = xTaskGetTickCount();
         }
 
-        /* Build JSON health payload */
-        char payload[256];
-        int64_t uptime_s = (esp_timer_get_time() - boot_us) / 1000000LL;
-        uint32_t heap    = esp_get_free_heap_size();
+        mqtt_outbound_t m;
+        while (mqtt_rate_take_due(esp_timer_get_time(), &m)) {     /* [16] */
+            send_outbound(&m);
+        }
 
-        /* Get IP via network_service -- transport-agnostic, no netif key needed */
-        char ip_str[16] = "0.0.0.0";
-        const char *ip_p = network_service_get_ip();
-        if (ip_p && ip_p[0]) {
-            strncpy(ip_str, ip_p, sizeof(ip_str) - 1);
+        TickType_t wait = next_health - now;
+        if ((int32_t)wait < 0)             wait = 0;
+        if (wait > pdMS_TO_TICKS(200))     wait = pdMS_TO_TICKS(200);
+        int due_ms = mqtt_rate_ms_until_due(esp_timer_get_time());
+        if (due_ms >= 0 && pdMS_TO_TICKS(due_ms) < wait) wait = pdMS_TO_TICKS(due_ms);
+
+        if (xQueueReceive(s_ctx.out_queue, &m, wait) == pdTRUE) {
+            outbound_taken(&m);                                     /* [17] */
+            if (mqtt_rate_check(&m) == MQTT_RATE_SEND) {           /* [16] */
+                send_outbound(&m);
+            }                                       /* else mqtt_rate owns it */
         }
+    }
 
-        /* Optional crash key */
-        const char *crash = supervisor_get_last_crash();
-        if (crash) {
-            snprintf(payload, sizeof(payload),
-                     "{\"uptime_s\":%" PRId64
-                     ",\"heap_free\":%" PRIu32
-                     ",\"ip\":\"%s\""
-                     ",\"crash\":\"%s\"}",
-                     uptime_s, heap, ip_str, crash);
-        } else {
-            snprintf(payload, sizeof(payload),
-                     "{\"uptime_s\":%" PRId64
-                     ",\"heap_free\":%" PRIu32
-                     ",\"ip\":\"%s\"}",
-                     uptime_s, heap, ip_str);
+    ESP_LOGI(TAG, "Publish task stopping");
+    vTaskDelete(NULL);
+}
+
+/* -------------------------------------------------------------------------
+ * [18] Broker failover
+ *
+ * Runs on every service-loop iteration (~100 ms).  esp-mqtt is in manual
+ * reconnect mode, so after a DISCONNECTED it waits for us: pick a broker
+ * with mqtt_brokers_select(), point the client at it and reconnect.  The
+ * attempt ends with a CONNACK (connected_us), a DISCONNECTED (refused /
+ * TLS / network error) or our own timeout.
+ * ------------------------------------------------------------------------- */
+static void broker_attempt_started(int idx, int64_t now_us)
+{
+    s_brk.idx         = idx;
+    s_brk.attempt_us  = now_us;
+    s_brk.retry_at_us = 0;
+}
+
+static void broker_on_up(int64_t now_us)
+{
+    int64_t rtt_us = s_ctx.connected_us - s_brk.attempt_us;
+    if (s_brk.attempt_us == 0 || rtt_us < 0) rtt_us = 0;
+    mqtt_brokers_on_connected(s_brk.idx);
+
+    if (s_brk.lost_idx >= 0 && s_brk.lost_idx != s_brk.idx) {
+        uint32_t ms = (uint32_t)((s_ctx.connected_us - s_brk.down_us) / 1000);
+        mqtt_brokers_on_switchover(ms);
+        ESP_LOGW(TAG, "Switched broker %d -> %d (%s) in %u ms",
+                 s_brk.lost_idx, s_brk.idx, mqtt_brokers_uri(s_brk.idx),
+                 (unsigned)ms);
+    }
+    ESP_LOGI(TAG, "Broker %d connect took %lld ms", s_brk.idx,
+             (long long)(rtt_us / 1000));
+
+    s_brk.attempt_us    = 0;
+    s_brk.retry_at_us   = 0;
+    s_brk.lost_idx      = -1;
+    s_brk.probe_ok      = 0;
+    s_brk.probing       = false;
+    s_brk.next_probe_us = now_us + CONFIG_MQTT_FAILBACK_PROBE_S * 1000000LL;
+}
+
+/* Connected to a backup: is the primary back?  The probe runs on the
+ * mqtt-probe task; its result is read on a later tick. */
+static void broker_failback_probe(int64_t now_us)
+{
+    if (s_brk.idx <= 0) return;
+    if (!s_brk.probing) {
+        if (now_us < s_brk.next_probe_us) return;
+        s_brk.next_probe_us = now_us + CONFIG_MQTT_FAILBACK_PROBE_S * 1000000LL;
+        s_brk.probing = mqtt_brokers_probe_start(0, now_us);
+        return;
+    }
+
+    mqtt_probe_state_t st = mqtt_brokers_probe_state(0);
+    if (st == MQTT_PROBE_PENDING) return;
+    s_brk.probing = false;
+    if (st != MQTT_PROBE_OK) {
+        s_brk.probe_ok = 0;
+        return;
+    }
+    if (++s_brk.probe_ok < BROKER_FAILBACK_PROBES) return;
+
+    ESP_LOGI(TAG, "Primary broker reachable again -- failing back");
+    s_brk.probe_ok = 0;
+    mqtt_client_disconnect();       /* DISCONNECTED -> select() picks 0 */
+}
+
+static void broker_tick(int64_t now_us)
+{
+    mqtt_brokers_poll(now_us);
+
+    bool up = s_ctx.is_connected;
+    if (up && !s_brk.up) {
+        broker_on_up(now_us);
+    } else if (!up && s_brk.up) {
+        mqtt_brokers_set_current(-1);
+        s_brk.lost_idx = s_brk.idx;
+        s_brk.down_us  = now_us;
+        if (s_brk.attempt_us == 0) s_brk.retry_at_us = now_us;
+    }
+    s_brk.up = up;
+
+    if (up) {
+        broker_failback_probe(now_us);
+        return;
+    }
+
+    if (s_brk.attempt_us != 0) {
+        bool refused   = s_ctx.disconnected_us >= s_brk.attempt_us;
+        bool timed_out = now_us - s_brk.attempt_us >=
+                         (CONFIG_MQTT_CONNECT_TIMEOUT_MS + BROKER_ATTEMPT_MARGIN_MS) * 1000LL;
+        if (!refused && !timed_out) return;
+
+        mqtt_brokers_on_failed(s_brk.idx, now_us);
+        if (s_brk.lost_idx < 0) {
+            s_brk.lost_idx = s_brk.idx;     /* never connected: time from here */
+            s_brk.down_us  = s_brk.attempt_us;
         }
+        s_brk.attempt_us  = 0;
+        s_brk.retry_at_us = now_us;
+    }
 
-        int msg_id = mqtt_client_publish(health_topic, payload,
-                                         strlen(payload), 1 /*qos*/, 0 /*retain*/);
-        if (msg_id >= 0) {
-            mqtt_service_message_t pub = {
-                .type = MQTT_SERVICE_EVENT_PUBLISHED,
-                .data.published.msg_id = msg_id,
-            };
-            strncpy(pub.data.published.topic, health_topic,
-                    sizeof(pub.data.published.topic) - 1);
-            queue_send_warn(s_ctx.event_queue, &pub, "HEALTH");
-            ESP_LOGI(TAG, "Health: %s", payload);
-        } else {
-            ESP_LOGW(TAG, "Health publish failed");
+    if (s_brk.retry_at_us == 0 || now_us < s_brk.retry_at_us) return;
+
+    int64_t ready_us;
+    int next = mqtt_brokers_select(now_us, &ready_us);
+    if (next < 0) return;
+    if (ready_us > now_us) {
+        s_brk.retry_at_us = ready_us;
+        return;
+    }
+
+    if (next != s_brk.idx) {
+        ESP_LOGI(TAG, "Trying broker %d: %s", next, mqtt_brokers_uri(next));
+        /* Across mqtt:// and mqtts:// this re-creates the client */
+        if (mqtt_client_set_uri(mqtt_brokers_uri(next)) != ESP_OK) {
+            s_brk.retry_at_us = now_us + 200000;
+            return;
         }
+    }
+    /* Fails while esp-mqtt is still tearing the old connection down */
+    if (mqtt_client_reconnect() != ESP_OK) {
+        s_brk.idx         = next;
+        s_brk.retry_at_us = now_us + 200000;
+        return;
+    }
+    broker_attempt_started(next, esp_timer_get_time());
+}
 
-        vTaskDelay(pdMS_TO_TICKS(s_ctx.config.health_interval_ms));
+/* -------------------------------------------------------------------------
+ * [21] Runtime config
+ *
+ * The store's listener only records what changed; the service loop applies
+ * it, so s_ctx.config and the broker state keep a single writer.
+ * ------------------------------------------------------------------------- */
+static void mqtt_config_changed(const app_config_t *cfg, uint32_t changed,
+                                void *ctx)
+{
+    (void)cfg;
+    (void)ctx;
+    atomic_fetch_or(&s_ctx.cfg_changed, changed);
+}
+
+/* Retained {"gen":..,...[,"err":".."]} on /<MACID>/config/state */
+static void publish_config_state(const char *err)
+{
+    char topic[80];
+    char json[MQTT_CONFIG_STATE_LEN];
+    snprintf(topic, sizeof(topic), "%s%s",
+             s_ctx.config.publish_topic, MQTT_CONFIG_STATE_SUFFIX);
+
+    size_t len = config_store_write_json(json, sizeof(json));
+    if (len == 0) return;
+    if (err != NULL) {
+        int n = snprintf(json + len - 1, sizeof(json) - len + 1,
+                         ",\"err\":\"%s\"}", err);
+        if (n <= 0 || (size_t)n >= sizeof(json) - len + 1) return;
+        len += (size_t)n - 1;
     }
+    enqueue_publish(topic, json, len, 1 /*qos*/, true /*retain*/, 0);
+}
 
-    ESP_LOGI(TAG, "Health publish task stopping");
-    vTaskDelete(NULL);
+/* New broker list: reconnect to its primary via the failover path */
+static void broker_reload(int64_t now_us)
+{
+    int n = mqtt_brokers_load(s_ctx.config.broker_uri, s_ctx.config.broker_backups);
+    ESP_LOGI(TAG, "Broker list reloaded (%d) -- moving to %s", n,
+             s_ctx.config.broker_uri);
+
+    s_brk.idx      = -1;            /* forces set_uri on the next attempt */
+    s_brk.lost_idx = -1;
+    s_brk.probe_ok = 0;
+    if (s_ctx.is_connected) {
+        mqtt_client_disconnect();   /* DISCONNECTED -> broker_tick reconnects */
+    } else {
+        s_brk.attempt_us  = 0;      /* abandon an attempt on the old list */
+        s_brk.retry_at_us = now_us;
+    }
+}
+
+static void apply_config_changes(int64_t now_us)
+{
+    uint32_t changed = atomic_exchange(&s_ctx.cfg_changed, 0);
+    if (changed == 0) return;
+
+    app_config_t cfg;
+    config_store_get(&cfg);
+
+    if (changed & CONFIG_CHANGED_HEALTH) {
+        s_ctx.config.health_interval_ms = cfg.health_interval_ms;
+        atomic_store(&s_ctx.health_resched, true);
+        ESP_LOGI(TAG, "Health interval now %u ms", (unsigned)cfg.health_interval_ms);
+    }
+    if (changed & CONFIG_CHANGED_BROKERS) {
+        strncpy(s_ctx.config.broker_uri, cfg.broker_uri,
+                sizeof(s_ctx.config.broker_uri) - 1);
+        strncpy(s_ctx.config.broker_backups, cfg.broker_backups,
+                sizeof(s_ctx.config.broker_backups) - 1);
+        broker_reload(now_us);
+    }
+    publish_config_state(NULL);
+    device_shadow_report_int("cfg_gen", config_store_generation());   /* [24] */
+}
+
+/* Payload parked by mqtt_message_callback() */
+static void handle_remote_config(void)
+{
+    if (atomic_load(&s_ctx.cfg_rx_state) != CFG_RX_READY) return;
+
+    const char *err = NULL;
+    uint32_t changed = 0;
+    esp_err_t ret = config_store_apply_text(s_ctx.cfg_rx, &err, &changed);
+    atomic_store(&s_ctx.cfg_rx_state, CFG_RX_FREE);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Remote config rejected: %s", err ? err : esp_err_to_name(ret));
+        publish_config_state(err ? err : esp_err_to_name(ret));
+    } else if (changed == 0) {
+        publish_config_state(NULL);     /* nothing to notify -- still answer */
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * [22] RPC "relays" -> {"relay1":false,"relay2":true,...}
+ * ------------------------------------------------------------------------- */
+static esp_err_t rpc_relays(const char *params, health_writer_t *result, void *ctx)
+{
+    (void)params;
+    (void)ctx;
+    unsigned bits = atomic_load(&s_relay_bits);
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        health_field_bool(result, s_relays[i].name, (bits >> i) & 1);
+    }
+    return ESP_OK;
 }
 
 /* -------------------------------------------------------------------------
@@ -370,6 +1125,54 @@ static void mqtt_rebuild_topics(void)
              s_ctx.config.subscribe_topic);
 }
 
+/* -------------------------------------------------------------------------
+ * [13] Register the node's subscriptions (sent on every connect)
+ * ------------------------------------------------------------------------- */
+static void mqtt_register_subscriptions(void)
+{
+    char topic[64];
+
+    mqtt_subs_add(s_ctx.config.subscribe_topic, MQTT_CMD_SUB_QOS);   /* [14] */
+    mqtt_subs_add("/SYS/time", 0);     /* [display] clock -- stale times useless */
+
+    /* [7] text-command topic is MAC-derived: /AABBCCA1B2C3/text */
+    snprintf(topic, sizeof(topic), "%s/%s/text", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
+    mqtt_subs_add(topic, MQTT_CMD_SUB_QOS);            /* [display] text zone */
+
+    /* [8] Relay command topics: /<MACID>/relay{1..4} */
+    for (int i = 0; i < RELAY_COUNT; i++) {
+        snprintf(topic, sizeof(topic), "%s/%s/%s",
+                 CONFIG_MQTT_TOPIC_ROOT, s_mac_id, s_relays[i].name);
+        mqtt_subs_add(topic, MQTT_CMD_SUB_QOS);
+    }
+
+    /* [20] Latency probe -- a lost ping is just a lost sample */
+    snprintf(topic, sizeof(topic), "%s/%s/ping", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
+    mqtt_subs_add(topic, 0);
+
+    /* [21] Remote config updates */
+    snprintf(topic, sizeof(topic), "%s%s", s_ctx.config.publish_topic, MQTT_CONFIG_SUFFIX);
+    mqtt_subs_add(topic, MQTT_CMD_SUB_QOS);
+
+    /* [22] RPC requests */
+    snprintf(topic, sizeof(topic), "%s%s", s_ctx.config.publish_topic, MQTT_RPC_SUFFIX);
+    mqtt_subs_add(topic, MQTT_CMD_SUB_QOS);
+
+    /* [23] OTA control + data -- QoS 1 so the broker does not shed chunks */
+    for (int i = 0; mqtt_ota_filter(i, topic, sizeof(topic)) != NULL; i++) {
+        mqtt_subs_add(topic, 1);
+    }
+
+    /* [24] Retained desired state -- re-sent by the broker on every connect,
+     * resumed sessions included, and reconciled */
+    mqtt_subs_add_retained(device_shadow_desired_topic(), MQTT_CMD_SUB_QOS);
+
+#ifdef CONFIG_MQTT_SUBSCRIBE_NODE_WILDCARD
+    snprintf(topic, sizeof(topic), "%s/%s/", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
+    mqtt_subs_set_collapse_prefix(topic);
+#endif
+}
+
 /* -------------------------------------------------------------------------
  * MQTT service main task
  * ------------------------------------------------------------------------- */
@@ -409,17 +1212,59 @@ static void mqtt_service_task(void *arg)
     /* [7] Derive MAC-based node ID (now guaranteed valid) */
     mqtt_derive_node_id();
 
-    /* Apply defaults from sdkconfig if not overridden by caller */
+    /* Apply defaults if not overridden by caller.
+     * [21] Broker list and health interval: config_store (sdkconfig
+     *      defaults, or whatever was stored at runtime). */
     if (strlen(s_ctx.config.broker_uri) == 0) {
-        strncpy(s_ctx.config.broker_uri, CONFIG_MQTT_BROKER_URI,
+        app_config_t cfg;
+        config_store_get(&cfg);
+        strncpy(s_ctx.config.broker_uri, cfg.broker_uri,
                 sizeof(s_ctx.config.broker_uri) - 1);
+        strncpy(s_ctx.config.broker_backups, cfg.broker_backups,
+                sizeof(s_ctx.config.broker_backups) - 1);             /* [18] */
 
         /* Build all topics using the valid MAC ID */
         mqtt_rebuild_topics();
 
         s_ctx.config.enabled             = true;
         s_ctx.config.publish_interval_ms = CONFIG_MQTT_PUBLISH_INTERVAL_MS;
-        s_ctx.config.health_interval_ms  = CONFIG_MQTT_HEALTH_INTERVAL_MS;
+        s_ctx.config.health_interval_ms  = cfg.health_interval_ms;
+        s_ctx.config.payload_format      = MQTT_DEFAULT_PAYLOAD_FORMAT;  /* [11] */
+    }
+
+    /* [21] Follow later changes; a restarted service re-registers harmlessly */
+    atomic_store(&s_ctx.cfg_changed, 0);
+    atomic_store(&s_ctx.cfg_rx_state, CFG_RX_FREE);
+    config_store_subscribe("mqtt", mqtt_config_changed, NULL);
+
+    /* [22] Worker pool is created once and outlives service restarts */
+    {
+        char reply_to[80];
+        snprintf(reply_to, sizeof(reply_to), "%s%s",
+                 s_ctx.config.publish_topic, MQTT_RPC_REPLY_SUFFIX);
+        if (mqtt_rpc_init(reply_to) == ESP_OK) {
+            mqtt_rpc_register("relays", rpc_relays, NULL, 0);
+        } else {
+            ESP_LOGW(TAG, "RPC unavailable");
+        }
+    }
+
+    /* [23] Keeps a session in progress across service restarts */
+    {
+        char prefix[48];
+        snprintf(prefix, sizeof(prefix), "%s%s",
+                 s_ctx.config.publish_topic, MQTT_OTA_SUFFIX);
+        mqtt_ota_init(prefix);
+    }
+
+    /* [24] Shadow keys owned here: relays (relay_gpio_init) and cfg_gen */
+    {
+        char prefix[48];
+        snprintf(prefix, sizeof(prefix), "%s%s",
+                 s_ctx.config.publish_topic, MQTT_SHADOW_SUFFIX);
+        device_shadow_init(prefix);
+        device_shadow_register("cfg_gen", DEVICE_SHADOW_INT, NULL, NULL);
+        device_shadow_report_int("cfg_gen", config_store_generation());
     }
 
     /* Build LWT topic: <publish_topic>/status */
@@ -464,6 +1309,16 @@ static void mqtt_service_task(void *arg)
         }
     }
 
+    /* [18] Bounded attempts, we pick the next broker
+     * [21] also with a single broker, so the list can change at runtime */
+    memset(&s_brk, 0, sizeof(s_brk));
+    s_brk.lost_idx = -1;
+    if (mqtt_brokers_init() != ESP_OK) {
+        ESP_LOGW(TAG, "No broker probe task -- backups are picked unmeasured");
+    }
+    mqtt_brokers_load(s_ctx.config.broker_uri, s_ctx.config.broker_backups);
+    mqtt_client_set_manual_reconnect(CONFIG_MQTT_CONNECT_TIMEOUT_MS);
+
     ESP_LOGI(TAG, "Connecting to broker: %s (client: %s, LWT: %s = offline)",
              s_ctx.config.broker_uri, s_ctx.config.client_id, lwt_topic);
     esp_err_t ret = mqtt_client_init(s_ctx.config.broker_uri,
@@ -471,26 +1326,59 @@ static void mqtt_service_task(void *arg)
                                       lwt_topic,      /* [5] LWT topic  */
                                       "offline",       /* [5] LWT message */
                                       1,               /* [5] LWT QoS    */
-                                      1);              /* [5] LWT retain */
+                                      1,               /* [5] LWT retain */
+                                      MQTT_PERSISTENT_SESSION,    /* [14] */
+                                      MQTT_USE_V5);               /* [15] */
     if (ret != ESP_OK) {
         cleanup_and_exit(ret, "MQTT init failed", false);
         return;
     }
 
     mqtt_client_set_message_callback(mqtt_message_callback, &s_ctx);
+    mqtt_client_set_raw_callback(mqtt_raw_callback, &s_ctx);              /* [23] */
     mqtt_client_set_connection_callback(mqtt_connection_callback, &s_ctx);
+    mqtt_client_set_published_callback(mqtt_published_callback, &s_ctx);  /* [10] */
+    mqtt_client_set_subscribed_callback(mqtt_subscribed_callback, &s_ctx); /* [13] */
+    mqtt_register_subscriptions();                                        /* [13] */
+
+    /* [16] Rules are read by every publishing task (mqtt_rate_admit()).
+     *      Publishers get past enqueue_publish() only once is_connected is
+     *      set, by the client's connection callback after mqtt_client_start()
+     *      below, so the table is complete before the first reader and
+     *      read-only until the next start. */
+    mqtt_rate_clear();
+    if (mqtt_rate_parse(CONFIG_MQTT_RATE_LIMITS) < 0) {
+        ESP_LOGW(TAG, "CONFIG_MQTT_RATE_LIMITS partly invalid -- see log");
+    }
+
+    /* [15] Outbound queue must exist before the first connect queues "online" */
+    s_ctx.out_queue = xQueueCreate(MQTT_OUTBOUND_QUEUE_LEN, sizeof(mqtt_outbound_t));
+    if (s_ctx.out_queue == NULL) {
+        cleanup_and_exit(ESP_ERR_NO_MEM, "outbound queue alloc failed", true);
+        return;
+    }
 
     ret = mqtt_client_start();
     if (ret != ESP_OK) {
+        vQueueDelete(s_ctx.out_queue);
+        s_ctx.out_queue = NULL;
         cleanup_and_exit(ret, "MQTT start failed", true);
         return;
     }
+    broker_attempt_started(0, esp_timer_get_time());                  /* [18] */
 
     {
         mqtt_service_message_t started = { .type = MQTT_SERVICE_EVENT_STARTED };
         queue_send_warn(s_ctx.event_queue, &started, "STARTED");
     }
 
+    /* [12] Register our health fields before the first publish */
+    health_payload_register("core", health_core_fields, NULL);
+    health_payload_register("mqtt", health_mqtt_fields, NULL);
+    health_payload_register("mqtt_ack", health_mqtt_ack_fields, NULL);
+    health_payload_register("mqtt_cmd", health_mqtt_cmd_fields, NULL);
+    health_payload_register("mqtt_net", health_mqtt_net_fields, NULL);
+
     /* Spawn publish task */
     s_ctx.publish_task_running = true;
     xTaskCreate(mqtt_publish_task, "mqtt-publish",
@@ -536,9 +1424,17 @@ static void mqtt_service_task(void *arg)
             if (s_ctx.is_running && network_service_has_ip()) {
                 ESP_LOGI(TAG, "Ethernet restored -- restarting MQTT");
                 mqtt_client_start();
+                broker_attempt_started(s_brk.idx, esp_timer_get_time());  /* [18] */
             }
         }
 
+        handle_remote_config();                                       /* [21] */
+        apply_config_changes(esp_timer_get_time());                   /* [21] */
+        mqtt_rpc_tick(esp_timer_get_time());                          /* [22] */
+        mqtt_ota_tick(esp_timer_get_time());                          /* [23] */
+        if (s_ctx.is_connected) device_shadow_tick();                 /* [24] */
+        broker_tick(esp_timer_get_time());                            /* [18] */
+
         /* [3] Pet heartbeat each iteration */
         supervisor_heartbeat("mqtt");
 
@@ -559,6 +1455,12 @@ static void mqtt_service_task(void *arg)
         s_ctx.publish_task_handle = NULL;
     }
 
+    /* [15] Whatever the publish task did not get to */
+    drain_outbound();
+    mqtt_rate_clear();                                              /* [16] */
+    vQueueDelete(s_ctx.out_queue);
+    s_ctx.out_queue = NULL;
+
     mqtt_client_deinit();
 
     {
@@ -584,7 +1486,15 @@ static void mqtt_service_task(void *arg)
  * ------------------------------------------------------------------------- */
 static void mqtt_message_callback(const char *topic, const char *data, void *ctx)
 {
-    ESP_LOGI(TAG, "RX: %s -> %s", topic, data);
+#ifdef CONFIG_MQTT_SUBSCRIBE_NODE_WILDCARD
+    /* [13] /<MACID>/# also delivers our own publishes -- drop the echoes */
+    if (!mqtt_subs_match(topic)) return;
+#endif
+
+    const int64_t t0 = esp_timer_get_time();                /* [20] */
+    mqtt_cmd_class_t cls = MQTT_CMD_CLASS_OTHER;
+
+    ESP_LOGD(TAG, "RX: %s -> %s", topic, data);
 
     if (strcmp(topic, s_ctx.config.subscribe_topic) == 0) {
         if      (strcmp(data, "led_on")  == 0) ESP_LOGI(TAG, "CMD: LED ON");
@@ -594,6 +1504,7 @@ static void mqtt_message_callback(const char *topic, const char *data, void *ctx
 
     /* Route topics to display service */
     if (strcmp(topic, "/SYS/time") == 0) {
+        cls = MQTT_CMD_CLASS_TIME;
         display_service_set_time(data);
     }
 
@@ -602,9 +1513,54 @@ static void mqtt_message_callback(const char *topic, const char *data, void *ctx
     snprintf(text_topic, sizeof(text_topic),
              "%s/%s/text", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
     if (strcmp(topic, text_topic) == 0) {
+        cls = MQTT_CMD_CLASS_TEXT;
         display_service_set_text(data);
     }
 
+    /* [21] Remote config -- parked for the service loop, one at a time */
+    char config_topic[48];
+    snprintf(config_topic, sizeof(config_topic), "%s%s",
+             s_ctx.config.publish_topic, MQTT_CONFIG_SUFFIX);
+    if (strcmp(topic, config_topic) == 0) {
+        int expected = CFG_RX_FREE;
+        if (atomic_compare_exchange_strong(&s_ctx.cfg_rx_state, &expected,
+                                           CFG_RX_WRITING)) {
+            strncpy(s_ctx.cfg_rx, data, sizeof(s_ctx.cfg_rx) - 1);
+            s_ctx.cfg_rx[sizeof(s_ctx.cfg_rx) - 1] = '\0';
+            atomic_store(&s_ctx.cfg_rx_state, CFG_RX_READY);
+        } else {
+            ESP_LOGW(TAG, "Config update still pending -- dropped");
+            mqtt_stats_command_dropped();
+        }
+    }
+
+    /* [22] RPC request -- parsed and queued, never run here */
+    char rpc_topic[48];
+    snprintf(rpc_topic, sizeof(rpc_topic), "%s%s",
+             s_ctx.config.publish_topic, MQTT_RPC_SUFFIX);
+    if (strcmp(topic, rpc_topic) == 0) {
+        cls = MQTT_CMD_CLASS_RPC;
+        mqtt_rpc_submit(data);
+    }
+
+    /* [24] Desired state: apply what differs from the reported state */
+    if (strcmp(topic, device_shadow_desired_topic()) == 0) {
+        cls = MQTT_CMD_CLASS_SHADOW;
+        device_shadow_set_desired(data);
+    }
+
+    /* [20] Echo for round-trip measurement: /<MACID>/ping -> /<MACID>/pong */
+    char ping_topic[48];
+    snprintf(ping_topic, sizeof(ping_topic),
+             "%s/%s/ping", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
+    if (strcmp(topic, ping_topic) == 0) {
+        cls = MQTT_CMD_CLASS_PING;
+        memcpy(ping_topic + strlen(ping_topic) - 4, "pong", 4);
+        if (mqtt_service_try_publish(ping_topic, data, 0, 0, false) != ESP_OK) {
+            mqtt_stats_command_dropped();
+        }
+    }
+
     /* [8] Relay control: /<MACID>/relay{1..4}  payload: "on" | "off" */
     for (int i = 0; i < RELAY_COUNT; i++) {
         char relay_topic[48];
@@ -612,17 +1568,16 @@ static void mqtt_message_callback(const char *topic, const char *data, void *ctx
                  "%s/%s/%s", CONFIG_MQTT_TOPIC_ROOT, s_mac_id,
                  s_relays[i].name);
         if (strcmp(topic, relay_topic) == 0) {
+            cls = MQTT_CMD_CLASS_RELAY;
             /* Case-insensitive compare: copy payload and lowercase it */
             char cmd[8] = {0};
             strncpy(cmd, data, sizeof(cmd) - 1);
             for (int j = 0; cmd[j]; j++) cmd[j] = (char)tolower((unsigned char)cmd[j]);
 
             if (strcmp(cmd, "on") == 0) {
-                gpio_set_level(s_relays[i].gpio, 1);
-                ESP_LOGI(TAG, "Relay %s ON  (GPIO%d)", s_relays[i].name, s_relays[i].gpio);
+                relay_set(i, true);                                   /* [24] */
             } else if (strcmp(cmd, "off") == 0) {
-                gpio_set_level(s_relays[i].gpio, 0);
-                ESP_LOGI(TAG, "Relay %s OFF (GPIO%d)", s_relays[i].name, s_relays[i].gpio);
+                relay_set(i, false);                                  /* [24] */
             } else {
                 ESP_LOGW(TAG, "Relay %s: unknown payload '%s' (expected on/off)",
                          s_relays[i].name, data);
@@ -634,12 +1589,34 @@ static void mqtt_message_callback(const char *topic, const char *data, void *ctx
     mqtt_service_message_t msg = { .type = MQTT_SERVICE_EVENT_MESSAGE_RECEIVED };
     strncpy(msg.data.message.topic, topic, sizeof(msg.data.message.topic) - 1);
     strncpy(msg.data.message.data,  data,  sizeof(msg.data.message.data)  - 1);
-    queue_send_warn(s_ctx.event_queue, &msg, "MSG_RECEIVED");
+    if (!queue_send_warn(s_ctx.event_queue, &msg, "MSG_RECEIVED")) {
+        mqtt_stats_command_dropped();                       /* [20] */
+    }
     s_ctx.message_counter++;
+
+    mqtt_stats_command_handled(cls, (uint32_t)(esp_timer_get_time() - t0));
+}
+
+/* [23] Binary-safe first look at every PUBLISH -- OTA only for now */
+static bool mqtt_raw_callback(const char *topic, int topic_len,
+                              const uint8_t *data, int len,
+                              int offset, int total, void *ctx)
+{
+    const int64_t t0 = esp_timer_get_time();
+    if (!mqtt_ota_on_raw(topic, topic_len, data, len, offset, total, NULL)) {
+        return false;
+    }
+    if (topic != NULL) s_ctx.message_counter++;
+    mqtt_stats_command_handled(MQTT_CMD_CLASS_OTA,
+                               (uint32_t)(esp_timer_get_time() - t0));
+    return true;
 }
 
 static void mqtt_connection_callback(bool connected, void *ctx)
 {
+    /* [18] Timestamps first: broker_tick() reads them once it sees the flag */
+    if (connected) s_ctx.connected_us    = esp_timer_get_time();
+    else           s_ctx.disconnected_us = esp_timer_get_time();
     s_ctx.is_connected = connected;
 
     mqtt_service_message_t msg = {
@@ -648,35 +1625,33 @@ static void mqtt_connection_callback(bool connected, void *ctx)
     };
 
     if (connected) {
-        ESP_LOGI(TAG, "MQTT connected");
-        mqtt_client_subscribe(s_ctx.config.subscribe_topic, 0);
-        mqtt_client_subscribe("/SYS/time", 0);        /* [display] clock topic    */
-
-        /* [7] text-command topic is MAC-derived: /AABBCCA1B2C3/text */
-        char text_topic[48];
-        snprintf(text_topic, sizeof(text_topic),
-                 "%s/%s/text", CONFIG_MQTT_TOPIC_ROOT, s_mac_id);
-        mqtt_client_subscribe(text_topic, 0);          /* [display] text zone      */
-
-        /* [8] Subscribe to relay command topics: /<MACID>/relay{1..4} */
-        for (int i = 0; i < RELAY_COUNT; i++) {
-            char relay_topic[48];
-            snprintf(relay_topic, sizeof(relay_topic),
-                     "%s/%s/%s", CONFIG_MQTT_TOPIC_ROOT, s_mac_id,
-                     s_relays[i].name);
-            mqtt_client_subscribe(relay_topic, 0);
-            ESP_LOGI(TAG, "Subscribed: %s -> GPIO%d", relay_topic, s_relays[i].gpio);
+        mqtt_props_on_connect();                     /* [15] re-announce aliases */
+
+        /* [14] Broker kept our session: subscriptions are still in place;
+         * [24] retained topics (shadow/desired) are SUBSCRIBEd again anyway */
+        if (mqtt_client_session_present()) {
+            ESP_LOGI(TAG, "MQTT connected -- session resumed");
+            mqtt_subs_resume();
+        } else {
+            ESP_LOGI(TAG, "MQTT connected -- new session");
+            /* [13] Whole registry in one SUBSCRIBE; SUBACK tracked per filter */
+            mqtt_subs_send_all();
         }
 
         /* [5] Publish "online" retained to status topic */
         char status_topic[80];
         snprintf(status_topic, sizeof(status_topic), "%s%s",
                  s_ctx.config.publish_topic, MQTT_STATUS_SUFFIX);
-        mqtt_client_publish(status_topic, "online",
-                            strlen("online"), 1 /*qos*/, 1 /*retain*/);
-        ESP_LOGI(TAG, "Published: %s = online (retained)", status_topic);
+        if (enqueue_publish(status_topic, "online", strlen("online"),
+                            1 /*qos*/, true /*retain*/, 0) == ESP_OK) {
+            ESP_LOGI(TAG, "Queued: %s = online (retained)", status_topic);
+        }
+        publish_config_state(NULL);                  /* [21] */
+        mqtt_ota_on_connect();                       /* [23] */
+        device_shadow_on_connect();                  /* [24] full resync */
     } else {
         ESP_LOGI(TAG, "MQTT disconnected");
+        mqtt_subs_reset_acks();                      /* [13] */
         display_service_set_mqtt_connected(false);   /* show ---- on display */
     }
 
@@ -684,6 +1659,26 @@ static void mqtt_connection_callback(bool connected, void *ctx)
                     connected ? "CONNECTED" : "DISCONNECTED");
 }
 
+/* [10] PUBACK received -- runs in the esp-mqtt task */
+static void mqtt_published_callback(int msg_id, void *ctx)
+{
+    mqtt_stats_publish_acked(msg_id);
+}
+
+/* [13] SUBACK received -- runs in the esp-mqtt task */
+static void mqtt_subscribed_callback(int msg_id, const uint8_t *codes, int n,
+                                     void *ctx)
+{
+    mqtt_subs_on_suback(msg_id, codes, n);
+
+    mqtt_service_message_t msg = {
+        .type = MQTT_SERVICE_EVENT_SUBSCRIBED,
+        .data.subscribed.msg_id = msg_id,
+        .data.subscribed.qos    = (n > 0 && codes[0] < 0x80) ? codes[0] : -1,
+    };
+    queue_send_warn(s_ctx.event_queue, &msg, "SUBSCRIBED");
+}
+
 /* -------------------------------------------------------------------------
  * Public API
  * ------------------------------------------------------------------------- */
@@ -714,22 +1709,60 @@ bool mqtt_service_can_publish(void) {
     return s_ctx.is_running && s_ctx.is_connected && network_service_has_ip();
 }
 
+/* [21] While running only the store-backed fields apply, through the store */
 void mqtt_service_set_config(const mqtt_config_t *c) {
-    if (c) memcpy(&s_ctx.config, c, sizeof(mqtt_config_t));
+    if (c == NULL) return;
+    if (!s_ctx.is_running) {
+        memcpy(&s_ctx.config, c, sizeof(mqtt_config_t));
+        return;
+    }
+    app_config_t cfg;
+    config_store_get(&cfg);
+    strncpy(cfg.broker_uri, c->broker_uri, sizeof(cfg.broker_uri) - 1);
+    strncpy(cfg.broker_backups, c->broker_backups, sizeof(cfg.broker_backups) - 1);
+    cfg.health_interval_ms = c->health_interval_ms;
+    if (config_store_set(&cfg) != ESP_OK) {
+        ESP_LOGW(TAG, "set_config rejected by config store");
+    }
 }
 void mqtt_service_get_config(mqtt_config_t *c) {
     if (c) memcpy(c, &s_ctx.config, sizeof(mqtt_config_t));
 }
 
+/* [15] Queued for the publish task; ESP_OK means accepted, not sent */
 esp_err_t mqtt_service_publish(const char *t, const char *d, int qos, bool retain) {
-    if (!s_ctx.is_connected || !s_ctx.is_running) return ESP_ERR_INVALID_STATE;
-    return (mqtt_client_publish(t, d, 0, qos, retain) >= 0) ? ESP_OK : ESP_FAIL;
+    if (d == NULL) return ESP_ERR_INVALID_ARG;
+    return enqueue_publish(t, d, strlen(d), qos, retain, pdMS_TO_TICKS(10));
 }
+esp_err_t mqtt_service_publish_bin(const char *t, const void *d, size_t len,
+                                   int qos, bool retain) {
+    if (d == NULL || len == 0) return ESP_ERR_INVALID_ARG;
+    return enqueue_publish(t, d, len, qos, retain, pdMS_TO_TICKS(10));
+}
+/* [17] Never waits */
+esp_err_t mqtt_service_try_publish(const char *t, const void *d, size_t len,
+                                   int qos, bool retain) {
+    if (d == NULL) return ESP_ERR_INVALID_ARG;
+    if (len == 0) len = strlen((const char *)d);
+    return enqueue_publish(t, d, len, qos, retain, 0);
+}
+mqtt_payload_format_t mqtt_service_get_payload_format(void) {
+    return s_ctx.config.payload_format;
+}
+/* [13] Registered filters are re-sent on every reconnect; while offline
+ * the filter is only registered and goes out with the next connect. */
 esp_err_t mqtt_service_subscribe(const char *t, int qos) {
-    if (!s_ctx.is_connected || !s_ctx.is_running) return ESP_ERR_INVALID_STATE;
-    return (mqtt_client_subscribe(t, qos) >= 0) ? ESP_OK : ESP_FAIL;
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+    if (mqtt_subs_add(t, qos) != 0) return ESP_ERR_NO_MEM;
+    if (!s_ctx.is_connected || !s_ctx.is_running) return ESP_OK;
+    return (mqtt_subs_send_one(t) >= 0) ? ESP_OK : ESP_FAIL;
 }
 esp_err_t mqtt_service_unsubscribe(const char *t) {
-    if (!s_ctx.is_connected || !s_ctx.is_running) return ESP_ERR_INVALID_STATE;
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+    mqtt_subs_remove(t);
+    if (!s_ctx.is_connected || !s_ctx.is_running) return ESP_OK;
     return (mqtt_client_unsubscribe(t) >= 0) ? ESP_OK : ESP_FAIL;
+}
+bool mqtt_service_is_subscribed(void) {
+    return s_ctx.is_connected && mqtt_subs_all_acked();
 }
\ No newline at end of file
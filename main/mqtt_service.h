@@ -1,5 +1,43 @@
 /*
- * mqtt_service.h  (v1.3 -- LWT + health publish)
+ * mqtt_service.h  (v1.8 -- broker failover)
+ *
+ * CHANGES vs v1.7:
+ *  - mqtt_config_t gains broker_backups: comma-separated backup broker URIs
+ *    tried after broker_uri (default CONFIG_MQTT_BROKER_BACKUP_URIS).  With
+ *    at least one backup the service drives reconnects itself: bounded
+ *    connect attempts, fastest healthy backup while the primary is down,
+ *    fail-back once the primary answers again (see mqtt_brokers.h).
+ *  - MQTT_SERVICE_ERR_RATE_LIMITED: the topic's CONFIG_MQTT_RATE_LIMITS
+ *    rule refused the publish.  The verdict used to be taken later by the
+ *    publish task, after the caller had already been told ESP_OK.
+ *
+ * CHANGES vs v1.6:
+ *  - mqtt_service_try_publish(): never blocks.  Returns
+ *    MQTT_SERVICE_ERR_WOULD_BLOCK when the outbound queue or its byte
+ *    budget is full and ESP_ERR_NO_MEM when the payload copy fails; the
+ *    caller decides whether to drop, retry next cycle or aggregate.
+ *  - A full queue now returns MQTT_SERVICE_ERR_WOULD_BLOCK from
+ *    mqtt_service_publish() too (was ESP_ERR_TIMEOUT).
+ *
+ * CHANGES vs v1.5:
+ *  - mqtt_service_publish() / _bin() copy the message into the service's
+ *    outbound queue and return; the mqtt publish task sends it.  ESP_OK now
+ *    means "accepted", ESP_ERR_TIMEOUT that the queue was full and
+ *    ESP_ERR_NO_MEM that the payload copy could not be allocated.
+ *
+ * CHANGES vs v1.4:
+ *  - mqtt_service_subscribe() registers the filter so it is re-sent (in one
+ *    batched SUBSCRIBE with the built-in filters) after every reconnect.
+ *    Calling it while disconnected is no longer an error.
+ *  - mqtt_service_is_subscribed(): true once every registered filter has
+ *    been granted by a SUBACK on the current connection.
+ *  - MQTT_SERVICE_EVENT_SUBSCRIBED is now posted for each SUBACK.
+ *
+ * CHANGES vs v1.3:
+ *  - mqtt_config_t gains payload_format (JSON | CBOR).  CBOR payloads are
+ *    published on the JSON topic plus MQTT_CBOR_SUFFIX, e.g.
+ *    <publish_topic>/health/cbor.
+ *  - mqtt_service_publish_bin() for binary (length-delimited) payloads.
  *
  * CHANGES vs v1.2:
  *  - mqtt_config_t gains health_interval_ms (0 = disabled)
@@ -8,6 +46,7 @@
  * Topic layout (all derived from publish_topic):
  *   <publish_topic>/status  -- "online" | "offline" (LWT, retain=1, qos=1)
  *   <publish_topic>/health  -- JSON health payload   (retain=0, qos=1)
+ *   <publish_topic>/health/cbor -- same, CBOR encoded (payload_format=CBOR)
  *
  * Node-RED usage:
  *   Subscribe to <publish_topic>/status with retain=true.
@@ -22,6 +61,7 @@
 #include "freertos/queue.h"
 #include "esp_err.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -51,14 +91,30 @@ typedef struct {
     } data;
 } mqtt_service_message_t;
 
+/* Suffix appended to a topic whose payload is CBOR rather than JSON/text */
+#define MQTT_CBOR_SUFFIX   "/cbor"
+
+/* Backpressure: outbound queue or its byte budget is full -- try later */
+#define MQTT_SERVICE_ERR_BASE           0x7100
+#define MQTT_SERVICE_ERR_WOULD_BLOCK    (MQTT_SERVICE_ERR_BASE + 1)
+/* Over the topic's CONFIG_MQTT_RATE_LIMITS rule -- not queued, try later */
+#define MQTT_SERVICE_ERR_RATE_LIMITED   (MQTT_SERVICE_ERR_BASE + 2)
+
+typedef enum {
+    MQTT_PAYLOAD_FORMAT_JSON = 0,   /* JSON objects / plain-text values */
+    MQTT_PAYLOAD_FORMAT_CBOR,       /* RFC 8949, topic + MQTT_CBOR_SUFFIX */
+} mqtt_payload_format_t;
+
 typedef struct {
     char broker_uri[128];
+    char broker_backups[192];  /* [v1.8] "mqtt://a:1883,mqtts://b" ("" = none) */
     char client_id[64];
     char publish_topic[64];    /* base topic; /status and /health are derived */
     char subscribe_topic[64];
     bool enabled;
     int  publish_interval_ms;  /* retained for back-compat; unused by health task */
     int  health_interval_ms;   /* [v1.3] health publish interval; 0 = disabled */
+    mqtt_payload_format_t payload_format;  /* health + sensor payload encoding */
 } mqtt_config_t;
 
 void           mqtt_service_start(void);
@@ -71,9 +127,21 @@ bool           mqtt_service_can_publish(void);
 void           mqtt_service_set_config(const mqtt_config_t *config);
 void           mqtt_service_get_config(mqtt_config_t *config);
 
+/* Topic up to 95 chars.  Queued, not sent, on return (see v1.6 notes).
+ * Waits up to 10 ms for a free queue slot. */
 esp_err_t      mqtt_service_publish(const char *topic, const char *data, int qos, bool retain);
+esp_err_t      mqtt_service_publish_bin(const char *topic, const void *data, size_t len,
+                                        int qos, bool retain);
+/* Non-blocking variant for sensor/control tasks; len 0 = strlen(data).
+ * @return ESP_OK, MQTT_SERVICE_ERR_WOULD_BLOCK, MQTT_SERVICE_ERR_RATE_LIMITED,
+ *         ESP_ERR_NO_MEM, ESP_ERR_INVALID_STATE (not connected) or
+ *         ESP_ERR_INVALID_ARG */
+esp_err_t      mqtt_service_try_publish(const char *topic, const void *data, size_t len,
+                                        int qos, bool retain);
+mqtt_payload_format_t mqtt_service_get_payload_format(void);
 esp_err_t      mqtt_service_subscribe(const char *topic, int qos);
 esp_err_t      mqtt_service_unsubscribe(const char *topic);
+bool           mqtt_service_is_subscribed(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,247 @@
+/*
+ * mqtt_stats.c - Publish acknowledgement tracking for mqtt_service
+ *
+ * In-flight table layout:
+ *   msg_id ==  0  slot free
+ *   msg_id == -1  slot claimed, being filled or drained by one task
+ *   msg_id  >  0  waiting for the PUBACK with that id
+ *
+ * Only the task that won the compare-exchange touches the other fields of a
+ * slot, so sent_us / cls need no further protection.
+ *
+ * Known gap: esp-mqtt may process the PUBACK before mqtt_stats_publish_sent()
+ * has recorded the msg_id (the publishing task is pre-empted between the
+ * return of esp_mqtt_client_publish() and the insert).  Such acks are counted
+ * in `unmatched` and the orphaned entry is later reaped as a timeout.
+ */
+
+#include "mqtt_stats.h"
+#include "esp_timer.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define SLOT_FREE     0
+#define SLOT_BUSY    -1
+
+typedef struct {
+    atomic_int          msg_id;
+    int64_t             sent_us;
+    mqtt_topic_class_t  cls;
+} inflight_slot_t;
+
+typedef struct {
+    atomic_uint buckets[MQTT_STATS_BUCKETS];
+    atomic_uint count;
+    atomic_uint sum;
+    atomic_uint max;
+} class_hist_t;
+
+static inflight_slot_t s_inflight[MQTT_STATS_INFLIGHT_MAX];
+static class_hist_t    s_hist[MQTT_TOPIC_CLASS_COUNT];
+static atomic_uint     s_timeouts;
+static atomic_uint     s_unmatched;
+static class_hist_t    s_cmd_hist[MQTT_CMD_CLASS_COUNT];
+static atomic_uint     s_cmd_total;
+static atomic_uint     s_cmd_dropped;
+
+static const uint32_t s_bucket_ms[MQTT_STATS_BUCKETS - 1] = {
+    10, 25, 50, 100, 250, 500, 1000
+};
+
+static const uint32_t s_cmd_bucket_us[MQTT_STATS_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 10000
+};
+
+static const char *const s_class_names[MQTT_TOPIC_CLASS_COUNT] = {
+    "status", "health", "telemetry", "other"
+};
+
+static const char *const s_cmd_class_names[MQTT_CMD_CLASS_COUNT] = {
+    "relay", "text", "time", "ping", "rpc", "ota", "shadow", "other"
+};
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static bool ends_with_n(const char *s, size_t ls, const char *suffix)
+{
+    size_t lx = strlen(suffix);
+    return ls >= lx && memcmp(s + ls - lx, suffix, lx) == 0;
+}
+
+static void hist_add(class_hist_t *h, const uint32_t *bounds, uint32_t v)
+{
+    int b = 0;
+    while (b < MQTT_STATS_BUCKETS - 1 && v >= bounds[b]) b++;
+
+    atomic_fetch_add(&h->buckets[b], 1);
+    atomic_fetch_add(&h->count, 1);
+    atomic_fetch_add(&h->sum, v);
+
+    unsigned int prev = atomic_load(&h->max);
+    while (v > prev &&
+           !atomic_compare_exchange_weak(&h->max, &prev, v)) {
+        /* prev reloaded by the failed exchange */
+    }
+}
+
+static void hist_get(class_hist_t *h, mqtt_stats_class_t *out)
+{
+    for (int b = 0; b < MQTT_STATS_BUCKETS; b++) {
+        out->buckets[b] = atomic_load(&h->buckets[b]);
+    }
+    out->acked  = atomic_load(&h->count);
+    out->sum_ms = atomic_load(&h->sum);
+    out->max_ms = atomic_load(&h->max);
+}
+
+/* One {"n","avg","max","h"} object per class with samples */
+static void write_hists(health_writer_t *hw, const char *key, class_hist_t *hists,
+                        const char *const *names, int count)
+{
+    health_begin_object(hw, key);
+    for (int c = 0; c < count; c++) {
+        mqtt_stats_class_t st;
+        hist_get(&hists[c], &st);
+        if (st.acked == 0) continue;
+
+        health_begin_object(hw, names[c]);
+        health_field_uint(hw, "n",   st.acked);
+        health_field_uint(hw, "avg", st.sum_ms / st.acked);
+        health_field_uint(hw, "max", st.max_ms);
+        health_begin_array(hw, "h");
+        for (int b = 0; b < MQTT_STATS_BUCKETS; b++) {
+            health_field_uint(hw, NULL, st.buckets[b]);
+        }
+        health_end_array(hw);
+        health_end_object(hw);
+    }
+    health_end_object(hw);
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+mqtt_topic_class_t mqtt_stats_classify(const char *topic)
+{
+    if (topic == NULL) return MQTT_TOPIC_CLASS_OTHER;
+
+    size_t len = strlen(topic);
+    if (ends_with_n(topic, len, "/cbor")) len -= strlen("/cbor");
+
+    if (ends_with_n(topic, len, "/status"))  return MQTT_TOPIC_CLASS_STATUS;
+    if (ends_with_n(topic, len, "/health"))  return MQTT_TOPIC_CLASS_HEALTH;
+    if (strstr(topic, "/temperature"))       return MQTT_TOPIC_CLASS_TELEMETRY;
+    return MQTT_TOPIC_CLASS_OTHER;
+}
+
+void mqtt_stats_publish_sent(int msg_id, mqtt_topic_class_t cls, int64_t start_us)
+{
+    if (msg_id <= 0) return;
+    if (cls >= MQTT_TOPIC_CLASS_COUNT) cls = MQTT_TOPIC_CLASS_OTHER;
+
+    for (int i = 0; i < MQTT_STATS_INFLIGHT_MAX; i++) {
+        int expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&s_inflight[i].msg_id,
+                                           &expected, SLOT_BUSY)) {
+            s_inflight[i].sent_us = start_us;
+            s_inflight[i].cls     = cls;
+            atomic_store(&s_inflight[i].msg_id, msg_id);
+            return;
+        }
+    }
+    /* Table full: this publish goes untracked (inflight == MAX signals it) */
+}
+
+void mqtt_stats_publish_acked(int msg_id)
+{
+    if (msg_id <= 0) return;
+
+    for (int i = 0; i < MQTT_STATS_INFLIGHT_MAX; i++) {
+        int expected = msg_id;
+        if (atomic_compare_exchange_strong(&s_inflight[i].msg_id,
+                                           &expected, SLOT_BUSY)) {
+            int64_t dt_us = esp_timer_get_time() - s_inflight[i].sent_us;
+            mqtt_topic_class_t cls = s_inflight[i].cls;
+            atomic_store(&s_inflight[i].msg_id, SLOT_FREE);
+
+            hist_add(&s_hist[cls], s_bucket_ms,
+                     dt_us > 0 ? (uint32_t)(dt_us / 1000) : 0);
+            return;
+        }
+    }
+    atomic_fetch_add(&s_unmatched, 1);
+}
+
+void mqtt_stats_expire(void)
+{
+    const int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < MQTT_STATS_INFLIGHT_MAX; i++) {
+        int id = atomic_load(&s_inflight[i].msg_id);
+        if (id <= 0) continue;
+        if (!atomic_compare_exchange_strong(&s_inflight[i].msg_id, &id, SLOT_BUSY)) {
+            continue;   /* acked (or reused) under our feet */
+        }
+        if (now - s_inflight[i].sent_us >= (int64_t)MQTT_STATS_ACK_TIMEOUT_MS * 1000) {
+            atomic_fetch_add(&s_timeouts, 1);
+            atomic_store(&s_inflight[i].msg_id, SLOT_FREE);
+        } else {
+            atomic_store(&s_inflight[i].msg_id, id);
+        }
+    }
+}
+
+void mqtt_stats_command_handled(mqtt_cmd_class_t cls, uint32_t us)
+{
+    if (cls >= MQTT_CMD_CLASS_COUNT) cls = MQTT_CMD_CLASS_OTHER;
+    hist_add(&s_cmd_hist[cls], s_cmd_bucket_us, us);
+    atomic_fetch_add(&s_cmd_total, 1);
+}
+
+void mqtt_stats_command_dropped(void)
+{
+    atomic_fetch_add(&s_cmd_dropped, 1);
+}
+
+void mqtt_stats_get_class(mqtt_topic_class_t cls, mqtt_stats_class_t *out)
+{
+    if (out == NULL) return;
+    memset(out, 0, sizeof(*out));
+    if (cls >= MQTT_TOPIC_CLASS_COUNT) return;
+    hist_get(&s_hist[cls], out);
+}
+
+int mqtt_stats_get_inflight(void)
+{
+    int n = 0;
+    for (int i = 0; i < MQTT_STATS_INFLIGHT_MAX; i++) {
+        if (atomic_load(&s_inflight[i].msg_id) > 0) n++;
+    }
+    return n;
+}
+
+uint32_t mqtt_stats_get_timeouts(void)  { return atomic_load(&s_timeouts);  }
+uint32_t mqtt_stats_get_unmatched(void) { return atomic_load(&s_unmatched); }
+
+void mqtt_stats_write_health(health_writer_t *hw, int outbox_bytes)
+{
+    health_field_int(hw,  "outbox",        outbox_bytes);
+    health_field_int(hw,  "inflight",      mqtt_stats_get_inflight());
+    health_field_uint(hw, "ack_to",        atomic_load(&s_timeouts));
+    health_field_uint(hw, "ack_unmatched", atomic_load(&s_unmatched));
+}
+
+void mqtt_stats_write_ack_health(health_writer_t *hw)
+{
+    write_hists(hw, "ack_ms", s_hist, s_class_names, MQTT_TOPIC_CLASS_COUNT);
+}
+
+void mqtt_stats_write_cmd_health(health_writer_t *hw)
+{
+    if (atomic_load(&s_cmd_total) == 0 && atomic_load(&s_cmd_dropped) == 0) return;
+    write_hists(hw, "cmd_us", s_cmd_hist, s_cmd_class_names, MQTT_CMD_CLASS_COUNT);
+    health_field_uint(hw, "cmd_drop", atomic_load(&s_cmd_dropped));
+}
@@ -0,0 +1,135 @@
+/*
+ * mqtt_stats.h - Publish acknowledgement tracking for mqtt_service
+ *
+ * Every QoS>0 publish made by mqtt_service is recorded in a small in-flight
+ * table keyed by the esp-mqtt msg_id.  When MQTT_EVENT_PUBLISHED arrives the
+ * enqueue->ack latency is added to a fixed-bucket histogram for the topic
+ * class the message belonged to.  A slow broker therefore shows up as a
+ * shift to the right in these histograms (and a growing outbox) well before
+ * it shows up as dropped messages.
+ *
+ * Histogram bucket upper bounds (ms):
+ *   [0] <10   [1] <25   [2] <50    [3] <100
+ *   [4] <250  [5] <500  [6] <1000  [7] >=1000
+ *
+ * Inbound commands get the same treatment: mqtt_service times each
+ * message through mqtt_message_callback() (topic match, GPIO / display
+ * hand-off, event queue) and adds it to a per-command-class histogram in
+ * microseconds:
+ *   [0] <50   [1] <100  [2] <250   [3] <500
+ *   [4] <1000 [5] <2500 [6] <10000 [7] >=10000
+ * Messages the callback could not pass on (event queue full, pong not
+ * queued) are counted as drops.
+ *
+ * Concurrency: publishes are recorded from whichever task called publish,
+ * acks arrive from the esp-mqtt task.  Slots are claimed and released with
+ * atomic compare-exchange on msg_id and every counter is an atomic -- no
+ * locks, same approach as supervisor_heartbeat().
+ */
+
+#ifndef MQTT_STATS_H
+#define MQTT_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of unacknowledged publishes tracked at once */
+#ifndef MQTT_STATS_INFLIGHT_MAX
+#define MQTT_STATS_INFLIGHT_MAX     32
+#endif
+
+/* An in-flight entry older than this is counted as a timeout and freed */
+#ifndef MQTT_STATS_ACK_TIMEOUT_MS
+#define MQTT_STATS_ACK_TIMEOUT_MS   30000
+#endif
+
+#define MQTT_STATS_BUCKETS          8
+
+typedef enum {
+    MQTT_TOPIC_CLASS_STATUS,      /* <base>/status  -- retained online flag */
+    MQTT_TOPIC_CLASS_HEALTH,      /* <base>/health  -- periodic health JSON */
+    MQTT_TOPIC_CLASS_TELEMETRY,   /* .../temperature... -- sensor data      */
+    MQTT_TOPIC_CLASS_OTHER,
+    MQTT_TOPIC_CLASS_COUNT
+} mqtt_topic_class_t;
+
+typedef enum {
+    MQTT_CMD_CLASS_RELAY,         /* /<MACID>/relayN  */
+    MQTT_CMD_CLASS_TEXT,          /* /<MACID>/text    */
+    MQTT_CMD_CLASS_TIME,          /* /SYS/time        */
+    MQTT_CMD_CLASS_PING,          /* /<MACID>/ping    */
+    MQTT_CMD_CLASS_RPC,           /* /<MACID>/rpc -- parse + queue only */
+    MQTT_CMD_CLASS_OTA,           /* /<MACID>/ota/... -- incl. flash write */
+    MQTT_CMD_CLASS_SHADOW,        /* /<MACID>/shadow/desired -- incl. apply */
+    MQTT_CMD_CLASS_OTHER,
+    MQTT_CMD_CLASS_COUNT
+} mqtt_cmd_class_t;
+
+typedef struct {
+    uint32_t buckets[MQTT_STATS_BUCKETS];
+    uint32_t acked;        /* total acks matched for this class     */
+    uint32_t sum_ms;       /* sum of latencies, for a cheap average */
+    uint32_t max_ms;       /* worst latency seen since boot         */
+} mqtt_stats_class_t;
+
+/** Map a topic string onto a class by its suffix / path component.
+ *  A trailing "/cbor" format suffix is ignored. */
+mqtt_topic_class_t mqtt_stats_classify(const char *topic);
+
+/**
+ * Record a publish that is now waiting for its PUBACK.
+ *
+ * @param msg_id    value returned by esp_mqtt_client_publish(); ignored
+ *                  when <= 0 (QoS 0 or failure -- no ack will arrive)
+ * @param cls       topic class for the histogram
+ * @param start_us  esp_timer_get_time() taken just before the publish call
+ */
+void mqtt_stats_publish_sent(int msg_id, mqtt_topic_class_t cls, int64_t start_us);
+
+/** Called from the MQTT_EVENT_PUBLISHED handler. */
+void mqtt_stats_publish_acked(int msg_id);
+
+/** Free entries older than MQTT_STATS_ACK_TIMEOUT_MS (counted as timeouts). */
+void mqtt_stats_expire(void);
+
+/** Inbound message handled by mqtt_message_callback() in `us`. */
+void mqtt_stats_command_handled(mqtt_cmd_class_t cls, uint32_t us);
+
+/** Inbound message that could not be passed on. */
+void mqtt_stats_command_dropped(void);
+
+/** Snapshot of one class histogram. */
+void mqtt_stats_get_class(mqtt_topic_class_t cls, mqtt_stats_class_t *out);
+
+int      mqtt_stats_get_inflight(void);
+uint32_t mqtt_stats_get_timeouts(void);
+uint32_t mqtt_stats_get_unmatched(void);
+
+/**
+ * Health provider bodies, written as flat members of the health object and
+ * registered as separate providers so each stays well inside one message:
+ *
+ *   mqtt_stats_write_health:      "outbox":0,"inflight":1,"ack_to":0,"ack_unmatched":0
+ *   mqtt_stats_write_ack_health:  "ack_ms":{"health":{"n":12,"avg":18,"max":41,"h":[...]}}
+ *   mqtt_stats_write_cmd_health:  "cmd_us":{"relay":{...}},"cmd_drop":0
+ *
+ * Classes with no samples yet are omitted; "cmd_us" / "cmd_drop" only once
+ * a command has arrived.
+ *
+ * @param outbox_bytes  value from mqtt_client_get_outbox_size()
+ */
+void mqtt_stats_write_health(health_writer_t *hw, int outbox_bytes);
+void mqtt_stats_write_ack_health(health_writer_t *hw);
+void mqtt_stats_write_cmd_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_STATS_H */
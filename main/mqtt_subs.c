@@ -0,0 +1,339 @@
+/*
+ * mqtt_subs.c - Subscription registry for mqtt_service
+ *
+ * Slot layout:
+ *   state == FREE   unused
+ *   state == BUSY   claimed, filter being written by one task
+ *   state == USED   live entry
+ *
+ * Each live entry records the msg_id of the SUBSCRIBE it last went out in
+ * and its position inside that packet, so a SUBACK's return-code array can
+ * be mapped straight back to entries.  Covered (collapsed) entries share
+ * the position of the "<prefix>#" filter.
+ *
+ * Known gap: a SUBACK for mqtt_subs_send_one() can be processed by the
+ * esp-mqtt task before the caller has stored the msg_id.  The entry then
+ * stays pending until the next reconnect re-sends the registry.
+ */
+
+#include "mqtt_subs.h"
+#include "app_mqtt.h"
+#include "esp_log.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "mqtt-subs";
+
+#define SLOT_FREE   0
+#define SLOT_BUSY   1
+#define SLOT_USED   2
+
+#define ACK_PENDING 0
+#define ACK_OK      1
+#define ACK_FAILED  -1
+#define ACK_STALE   2       /* granted on a previous connection */
+
+typedef struct {
+    atomic_int  state;
+    char        filter[MQTT_SUBS_FILTER_LEN];
+    int         qos;
+    atomic_int  msg_id;     /* SUBSCRIBE this entry was last sent in, 0 = never */
+    atomic_int  pos;        /* index of its filter within that SUBSCRIBE        */
+    atomic_int  ack;        /* ACK_PENDING / ACK_OK / ACK_FAILED / ACK_STALE    */
+    atomic_bool retained;   /* re-SUBSCRIBE on every connect                    */
+    atomic_bool wildcard;   /* last sent as part of "<prefix>#"                 */
+} sub_slot_t;
+
+static sub_slot_t s_subs[MQTT_SUBS_MAX];
+static char       s_prefix[MQTT_SUBS_FILTER_LEN];   /* set before connect */
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static sub_slot_t *find(const char *filter)
+{
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        if (atomic_load(&s_subs[i].state) == SLOT_USED &&
+            strcmp(s_subs[i].filter, filter) == 0) {
+            return &s_subs[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_covered(const sub_slot_t *s)
+{
+    size_t lp = strlen(s_prefix);
+    return lp > 0 && strncmp(s->filter, s_prefix, lp) == 0;
+}
+
+/* "<prefix>#" is granted on this connection at `qos` or above: some other
+ * entry went out in it and is acked (the wildcard's QoS is their highest) */
+static bool wildcard_granted(const sub_slot_t *except, int qos)
+{
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        const sub_slot_t *s = &s_subs[i];
+        if (s == except || atomic_load(&s->state) != SLOT_USED) continue;
+        if (atomic_load(&s->wildcard) && atomic_load(&s->ack) == ACK_OK &&
+            s->qos >= qos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+bool mqtt_subs_topic_matches(const char *filter, const char *topic)
+{
+    if (filter == NULL || topic == NULL) return false;
+
+    const char *f = filter, *t = topic;
+    while (*f) {
+        if (*f == '+') {                        /* one whole level */
+            while (*t && *t != '/') t++;
+            f++;
+        } else if (*f == '#') {                 /* everything below */
+            return true;
+        } else if (*f == *t) {
+            f++;
+            t++;
+        } else {
+            /* "a/#" also matches the parent level "a" */
+            return *t == '\0' && strcmp(f, "/#") == 0;
+        }
+    }
+    return *t == '\0';
+}
+
+int mqtt_subs_add(const char *filter, int qos)
+{
+    if (filter == NULL || strlen(filter) >= MQTT_SUBS_FILTER_LEN) return -1;
+    if (find(filter) != NULL) return 0;
+
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        int expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&s_subs[i].state, &expected, SLOT_BUSY)) {
+            strncpy(s_subs[i].filter, filter, sizeof(s_subs[i].filter) - 1);
+            s_subs[i].filter[sizeof(s_subs[i].filter) - 1] = '\0';
+            s_subs[i].qos = qos;
+            atomic_store(&s_subs[i].msg_id, 0);
+            atomic_store(&s_subs[i].ack, ACK_PENDING);
+            atomic_store(&s_subs[i].retained, false);
+            atomic_store(&s_subs[i].wildcard, false);
+            atomic_store(&s_subs[i].state, SLOT_USED);
+            return 0;
+        }
+    }
+    ESP_LOGE(TAG, "Registry full -- '%s' not added", filter);
+    return -1;
+}
+
+int mqtt_subs_add_retained(const char *filter, int qos)
+{
+    if (mqtt_subs_add(filter, qos) != 0) return -1;
+    sub_slot_t *s = find(filter);
+    if (s == NULL) return -1;
+    atomic_store(&s->retained, true);
+    return 0;
+}
+
+void mqtt_subs_remove(const char *filter)
+{
+    sub_slot_t *s = (filter != NULL) ? find(filter) : NULL;
+    if (s == NULL) return;
+    int expected = SLOT_USED;
+    if (atomic_compare_exchange_strong(&s->state, &expected, SLOT_BUSY)) {
+        s->filter[0] = '\0';
+        atomic_store(&s->state, SLOT_FREE);
+    }
+}
+
+void mqtt_subs_set_collapse_prefix(const char *prefix)
+{
+    if (prefix == NULL || strlen(prefix) + 2 > sizeof(s_prefix)) {
+        s_prefix[0] = '\0';
+        return;
+    }
+    strncpy(s_prefix, prefix, sizeof(s_prefix) - 1);
+}
+
+/* One SUBSCRIBE for every live entry, or only those not currently ACK_OK */
+static int send_registry(bool only_missing)
+{
+    const char *topics[MQTT_SUBS_MAX + 1];
+    int         qos[MQTT_SUBS_MAX + 1];
+    int         slot_pos[MQTT_SUBS_MAX];
+    int         n = 0;
+
+    char wildcard[MQTT_SUBS_FILTER_LEN + 2];
+    int  wildcard_pos = -1;
+
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        slot_pos[i] = -1;
+        sub_slot_t *s = &s_subs[i];
+        if (atomic_load(&s->state) != SLOT_USED) continue;
+        if (only_missing && atomic_load(&s->ack) == ACK_OK) continue;
+
+        /* A kept session redelivers nothing under the wildcard: own filter */
+        if (is_covered(s) && !(only_missing && atomic_load(&s->retained))) {
+            if (wildcard_pos < 0) {
+                snprintf(wildcard, sizeof(wildcard), "%s#", s_prefix);
+                wildcard_pos = n;
+                topics[n] = wildcard;
+                qos[n]    = s->qos;
+                n++;
+            } else if (s->qos > qos[wildcard_pos]) {
+                qos[wildcard_pos] = s->qos;     /* highest QoS of covered entries */
+            }
+            slot_pos[i] = wildcard_pos;
+        } else {
+            slot_pos[i] = n;
+            topics[n] = s->filter;
+            qos[n]    = s->qos;
+            n++;
+        }
+    }
+    if (n == 0) return only_missing ? 0 : -1;
+
+    int msg_id = mqtt_client_subscribe_multiple(topics, qos, n);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "SUBSCRIBE (%d filters) failed", n);
+        return -1;
+    }
+
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        if (slot_pos[i] < 0) continue;
+        atomic_store(&s_subs[i].ack, ACK_PENDING);
+        atomic_store(&s_subs[i].pos, slot_pos[i]);
+        atomic_store(&s_subs[i].wildcard, slot_pos[i] == wildcard_pos);
+        atomic_store(&s_subs[i].msg_id, msg_id);
+    }
+
+    ESP_LOGI(TAG, "SUBSCRIBE msg_id=%d: %d filter(s) on the wire, %d registered",
+             msg_id, n, mqtt_subs_count());
+    for (int i = 0; i < n; i++) {
+        ESP_LOGI(TAG, "  [%d] %s (qos %d)", i, topics[i], qos[i]);
+    }
+    return msg_id;
+}
+
+int mqtt_subs_send_all(void)
+{
+    return send_registry(false);
+}
+
+int mqtt_subs_resume(void)
+{
+    int restored = 0;
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        int expected = ACK_STALE;
+        if (atomic_compare_exchange_strong(&s_subs[i].ack, &expected, ACK_OK)) {
+            restored++;
+            /* Retained topic: SUBSCRIBE again so the broker resends it */
+            if (atomic_load(&s_subs[i].retained)) {
+                atomic_store(&s_subs[i].ack, ACK_PENDING);
+                restored--;
+            }
+        }
+    }
+    ESP_LOGI(TAG, "Session resumed: %d filter(s) kept by broker, %d to send",
+             restored, mqtt_subs_count() - mqtt_subs_acked_count());
+    return send_registry(true);
+}
+
+int mqtt_subs_send_one(const char *filter)
+{
+    sub_slot_t *s = (filter != NULL) ? find(filter) : NULL;
+    if (s == NULL) return -1;
+
+    if (is_covered(s) && wildcard_granted(s, s->qos)) {
+        /* Already delivered by the prefix wildcard */
+        atomic_store(&s->wildcard, true);
+        atomic_store(&s->ack, ACK_OK);
+        return 0;
+    }
+
+    int msg_id = mqtt_client_subscribe(s->filter, s->qos);
+    if (msg_id < 0) return -1;
+    atomic_store(&s->ack, ACK_PENDING);
+    atomic_store(&s->pos, 0);
+    atomic_store(&s->wildcard, false);
+    atomic_store(&s->msg_id, msg_id);
+    return msg_id;
+}
+
+void mqtt_subs_on_suback(int msg_id, const uint8_t *codes, int n)
+{
+    int ok = 0, failed = 0;
+
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        sub_slot_t *s = &s_subs[i];
+        if (atomic_load(&s->state) != SLOT_USED) continue;
+        if (atomic_load(&s->msg_id) != msg_id)   continue;
+
+        int pos = atomic_load(&s->pos);
+        bool granted = (codes == NULL || pos >= n) || codes[pos] < 0x80;
+        atomic_store(&s->ack, granted ? ACK_OK : ACK_FAILED);
+        if (granted) {
+            ok++;
+        } else {
+            failed++;
+            ESP_LOGW(TAG, "Broker refused '%s' (code 0x%02X)", s->filter, codes[pos]);
+        }
+    }
+
+    ESP_LOGI(TAG, "SUBACK msg_id=%d: %d granted, %d refused -- %d/%d subscribed",
+             msg_id, ok, failed, mqtt_subs_acked_count(), mqtt_subs_count());
+}
+
+void mqtt_subs_reset_acks(void)
+{
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        int was = atomic_load(&s_subs[i].ack);
+        atomic_store(&s_subs[i].ack,
+                     (was == ACK_OK || was == ACK_STALE) ? ACK_STALE : ACK_PENDING);
+        atomic_store(&s_subs[i].msg_id, 0);
+    }
+}
+
+int mqtt_subs_count(void)
+{
+    int n = 0;
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        if (atomic_load(&s_subs[i].state) == SLOT_USED) n++;
+    }
+    return n;
+}
+
+static int count_ack(int ack)
+{
+    int n = 0;
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        if (atomic_load(&s_subs[i].state) != SLOT_USED) continue;
+        if (atomic_load(&s_subs[i].ack) == ack) n++;
+    }
+    return n;
+}
+
+int mqtt_subs_acked_count(void)  { return count_ack(ACK_OK);     }
+int mqtt_subs_failed_count(void) { return count_ack(ACK_FAILED); }
+
+bool mqtt_subs_all_acked(void)
+{
+    int total = mqtt_subs_count();
+    return total > 0 && mqtt_subs_acked_count() == total;
+}
+
+bool mqtt_subs_match(const char *topic)
+{
+    for (int i = 0; i < MQTT_SUBS_MAX; i++) {
+        if (atomic_load(&s_subs[i].state) != SLOT_USED) continue;
+        if (mqtt_subs_topic_matches(s_subs[i].filter, topic)) return true;
+    }
+    return false;
+}
@@ -0,0 +1,120 @@
+/*
+ * mqtt_subs.h - Subscription registry for mqtt_service
+ *
+ * Every topic filter the node needs is registered once.  On (re)connect the
+ * whole registry goes out in a single multi-filter SUBSCRIBE instead of one
+ * round trip per filter, and the SUBACK return codes are matched back to
+ * the entries so mqtt_subs_all_acked() tells whether the node is fully
+ * subscribed.
+ *
+ * Node-prefix collapse (optional): when a collapse prefix is set, e.g.
+ * "/AABBCCA1B2C3/", every filter under it is covered by one "<prefix>#"
+ * filter on the wire.  The covered entries stay in the registry so that
+ * mqtt_subs_match() can still tell a command topic from an echo of the
+ * node's own publishes under the same prefix.
+ *
+ * Persistent sessions: after a reconnect where the broker reports that it
+ * kept the session, mqtt_subs_resume() restores the previous SUBACK state
+ * instead of re-sending the registry.  Entries added with
+ * mqtt_subs_add_retained() are the exception: they are SUBSCRIBEd again on
+ * every connect, because only a SUBSCRIBE makes the broker send a retained
+ * message again -- a kept session would otherwise never see the current
+ * one.  On resume such an entry goes out under its own filter even when
+ * the node prefix covers it; the overlap can deliver a message twice.
+ *
+ * Concurrency: entries are added from the mqtt_service task and from
+ * callers of mqtt_service_subscribe(); SUBSCRIBE/SUBACK processing runs on
+ * the esp-mqtt task.  Slots are claimed with compare-exchange and every
+ * per-slot status is an atomic -- same scheme as mqtt_stats.
+ */
+
+#ifndef MQTT_SUBS_H
+#define MQTT_SUBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MQTT_SUBS_MAX
+#define MQTT_SUBS_MAX           16
+#endif
+
+#define MQTT_SUBS_FILTER_LEN    64
+
+/**
+ * Register a filter (idempotent).  Does not send anything.
+ * @return 0 on success, -1 if the table is full or the filter too long
+ */
+int  mqtt_subs_add(const char *filter, int qos);
+
+/** mqtt_subs_add() for a topic whose retained message must be received on
+ *  every connect, resumed sessions included (see header). */
+int  mqtt_subs_add_retained(const char *filter, int qos);
+
+/** Remove a filter from the registry.  Does not send UNSUBSCRIBE. */
+void mqtt_subs_remove(const char *filter);
+
+/**
+ * Cover every filter starting with `prefix` (which must end in '/') by a
+ * single "<prefix>#" subscription.  NULL or "" disables the collapse.
+ * Takes effect on the next mqtt_subs_send_all().
+ */
+void mqtt_subs_set_collapse_prefix(const char *prefix);
+
+/**
+ * Send the registry as one SUBSCRIBE.  Marks every entry pending until its
+ * SUBACK code arrives via mqtt_subs_on_suback().
+ * @return msg_id of the SUBSCRIBE, or -1 on failure / empty registry
+ */
+int  mqtt_subs_send_all(void);
+
+/**
+ * Send one entry on its own (used for subscriptions added while connected).
+ * An entry under the collapse prefix is only marked acked, without a
+ * SUBSCRIBE, if "<prefix>#" was already granted at its QoS or above.
+ * @return msg_id, 0 if covered by the wildcard, or -1
+ */
+int  mqtt_subs_send_one(const char *filter);
+
+/**
+ * SUBACK received.  `codes` holds one return code per filter in the order
+ * they were sent (0x00-0x02 = granted QoS, >= 0x80 = failure).  n may be 0
+ * if the client did not expose the codes; the SUBACK then counts as success.
+ */
+void mqtt_subs_on_suback(int msg_id, const uint8_t *codes, int n);
+
+/**
+ * Connection lost: every entry becomes unacknowledged.  Entries that were
+ * granted are remembered as "granted on a previous connection" so that
+ * mqtt_subs_resume() can restore them if the broker kept the session.
+ */
+void mqtt_subs_reset_acks(void);
+
+/**
+ * Reconnected with CONNACK session-present = 1: the broker still holds the
+ * subscriptions granted on the previous connection, so mark those acked
+ * again and SUBSCRIBE only the entries it never granted (e.g. added while
+ * offline) and the retained ones.
+ * @return msg_id of the SUBSCRIBE, 0 if nothing had to be sent, -1 on failure
+ */
+int  mqtt_subs_resume(void);
+
+bool mqtt_subs_all_acked(void);
+int  mqtt_subs_count(void);
+int  mqtt_subs_acked_count(void);
+int  mqtt_subs_failed_count(void);
+
+/** True if `topic` matches any registered filter (MQTT '+' / '#' rules). */
+bool mqtt_subs_match(const char *topic);
+
+/** MQTT topic-filter match, exposed for callers that route by filter. */
+bool mqtt_subs_topic_matches(const char *filter, const char *topic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_SUBS_H */
@@ -0,0 +1,301 @@
+/*
+ * mqtt_tls.c - TLS transport for mqtts:// with session resumption
+ *
+ * The read / write / poll callbacks mirror tcp_transport's own SSL
+ * transport (select() on the socket, mbedTLS' buffered bytes first) so
+ * esp-mqtt sees the same return codes; only connect differs, by passing
+ * the cached session in esp_tls_cfg_t.client_session.
+ *
+ * A session is fetched again at close: TLS 1.3 servers send their ticket
+ * after the handshake, so right after connect there may be none yet.
+ */
+
+#include "mqtt_tls.h"
+#include "esp_tls.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#ifdef CONFIG_MQTT_TLS_CRT_BUNDLE
+#include "esp_crt_bundle.h"
+#endif
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/types.h>
+
+static const char *TAG = "mqtt-tls";
+
+#ifdef CONFIG_MQTT_TLS_CA_PEM
+extern const char mqtt_ca_pem_start[]     asm("_binary_mqtt_ca_pem_start");
+extern const char mqtt_ca_pem_end[]       asm("_binary_mqtt_ca_pem_end");
+#endif
+#ifdef CONFIG_MQTT_TLS_CLIENT_CERT
+extern const char mqtt_client_crt_start[] asm("_binary_mqtt_client_crt_start");
+extern const char mqtt_client_crt_end[]   asm("_binary_mqtt_client_crt_end");
+extern const char mqtt_client_key_start[] asm("_binary_mqtt_client_key_start");
+extern const char mqtt_client_key_end[]   asm("_binary_mqtt_client_key_end");
+#endif
+
+#define HOST_LEN    64
+
+typedef struct {
+    char                      host[HOST_LEN];
+    int                       port;
+    esp_tls_client_session_t *session;
+} session_slot_t;
+
+typedef struct {
+    esp_tls_t      *tls;
+    session_slot_t *slot;       /* cache entry of the connected broker */
+} tls_conn_t;
+
+static session_slot_t s_sessions[MQTT_TLS_SESSION_CACHE];
+static int            s_next_slot;      /* round-robin replacement */
+
+static struct {
+    atomic_uint n;
+    atomic_uint resumed;        /* handshakes that offered a cached session */
+    atomic_uint fail;
+    atomic_uint last_ms;
+    atomic_uint full_ms_sum;
+    atomic_uint res_ms_sum;
+} s_stats;
+
+/* -------------------------------------------------------------------------
+ * Session cache
+ * ------------------------------------------------------------------------- */
+
+static session_slot_t *slot_for(const char *host, int port)
+{
+    for (int i = 0; i < MQTT_TLS_SESSION_CACHE; i++) {
+        if (s_sessions[i].port == port && strcmp(s_sessions[i].host, host) == 0) {
+            return &s_sessions[i];
+        }
+    }
+    if (strlen(host) >= HOST_LEN) return NULL;
+
+    session_slot_t *s = &s_sessions[s_next_slot];
+    s_next_slot = (s_next_slot + 1) % MQTT_TLS_SESSION_CACHE;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (s->session) esp_tls_free_client_session(s->session);
+#endif
+    s->session = NULL;
+    strcpy(s->host, host);
+    s->port = port;
+    return s;
+}
+
+static void slot_save(session_slot_t *s, esp_tls_t *tls)
+{
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (s == NULL) return;
+    esp_tls_client_session_t *fresh = esp_tls_get_client_session(tls);
+    if (fresh == NULL) return;
+    if (s->session) esp_tls_free_client_session(s->session);
+    s->session = fresh;
+#else
+    (void)s;
+    (void)tls;
+#endif
+}
+
+static void slot_drop(session_slot_t *s)
+{
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (s != NULL && s->session != NULL) {
+        esp_tls_free_client_session(s->session);
+        s->session = NULL;
+    }
+#else
+    (void)s;
+#endif
+}
+
+/* -------------------------------------------------------------------------
+ * Transport callbacks (esp-mqtt task)
+ * ------------------------------------------------------------------------- */
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port,
+                       int timeout_ms)
+{
+    tls_conn_t *c = esp_transport_get_context_data(t);
+
+    esp_tls_cfg_t cfg = {
+        .timeout_ms = timeout_ms,
+#ifdef CONFIG_MQTT_TLS_CRT_BUNDLE
+        .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+#ifdef CONFIG_MQTT_TLS_CA_PEM
+        .cacert_buf   = (const unsigned char *)mqtt_ca_pem_start,
+        .cacert_bytes = mqtt_ca_pem_end - mqtt_ca_pem_start,
+#endif
+#ifdef CONFIG_MQTT_TLS_CLIENT_CERT
+        .clientcert_buf   = (const unsigned char *)mqtt_client_crt_start,
+        .clientcert_bytes = mqtt_client_crt_end - mqtt_client_crt_start,
+        .clientkey_buf    = (const unsigned char *)mqtt_client_key_start,
+        .clientkey_bytes  = mqtt_client_key_end - mqtt_client_key_start,
+#endif
+    };
+
+    c->slot = slot_for(host, port);
+    bool offered = false;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (c->slot != NULL && c->slot->session != NULL) {
+        cfg.client_session = c->slot->session;
+        offered = true;
+    }
+#endif
+
+    c->tls = esp_tls_init();
+    if (c->tls == NULL) return -1;
+
+    int64_t t0 = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, c->tls) != 1) {
+        ESP_LOGW(TAG, "TLS connect to %s:%d failed%s", host, port,
+                 offered ? " (dropping cached session)" : "");
+        atomic_fetch_add(&s_stats.fail, 1);
+        slot_drop(c->slot);
+        esp_tls_conn_destroy(c->tls);
+        c->tls = NULL;
+        return -1;
+    }
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+
+    atomic_fetch_add(&s_stats.n, 1);
+    atomic_store(&s_stats.last_ms, ms);
+    if (offered) {
+        atomic_fetch_add(&s_stats.resumed, 1);
+        atomic_fetch_add(&s_stats.res_ms_sum, ms);
+    } else {
+        atomic_fetch_add(&s_stats.full_ms_sum, ms);
+    }
+    ESP_LOGI(TAG, "TLS to %s:%d in %u ms (%s)", host, port, (unsigned)ms,
+             offered ? "session offered" : "full handshake");
+
+    slot_save(c->slot, c->tls);
+    return 0;
+}
+
+static int tls_poll(esp_transport_handle_t t, int timeout_ms, bool for_write)
+{
+    tls_conn_t *c = esp_transport_get_context_data(t);
+    if (c->tls == NULL) return -1;
+    if (!for_write && esp_tls_get_bytes_avail(c->tls) > 0) return 1;
+
+    int fd = -1;
+    if (esp_tls_get_conn_sockfd(c->tls, &fd) != ESP_OK || fd < 0) return -1;
+
+    fd_set set, err;
+    FD_ZERO(&set);
+    FD_ZERO(&err);
+    FD_SET(fd, &set);
+    FD_SET(fd, &err);
+    struct timeval tv = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    int ret = select(fd + 1, for_write ? NULL : &set, for_write ? &set : NULL,
+                     &err, timeout_ms < 0 ? NULL : &tv);
+    if (ret > 0 && FD_ISSET(fd, &err)) return -1;
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, true);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buf, int len, int timeout_ms)
+{
+    tls_conn_t *c = esp_transport_get_context_data(t);
+
+    int poll = tls_poll(t, timeout_ms, false);
+    if (poll == 0) return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    if (poll < 0)  return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+
+    ssize_t n = esp_tls_conn_read(c->tls, buf, len);
+    if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_TIMEOUT) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (n == 0) return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    if (n < 0)  return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    return (int)n;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buf, int len, int timeout_ms)
+{
+    tls_conn_t *c = esp_transport_get_context_data(t);
+
+    int poll = tls_poll(t, timeout_ms, true);
+    if (poll <= 0) return poll;
+
+    ssize_t n = esp_tls_conn_write(c->tls, buf, len);
+    if (n == ESP_TLS_ERR_SSL_WANT_WRITE) return 0;
+    return (n < 0) ? -1 : (int)n;
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    tls_conn_t *c = esp_transport_get_context_data(t);
+    if (c->tls == NULL) return 0;
+
+    slot_save(c->slot, c->tls);     /* late TLS 1.3 ticket */
+    int ret = esp_tls_conn_destroy(c->tls);
+    c->tls  = NULL;
+    return ret;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    tls_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+bool mqtt_tls_uri_is_tls(const char *uri)
+{
+    return uri != NULL && strncmp(uri, "mqtts://", 8) == 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport_create(void)
+{
+    tls_conn_t *c = calloc(1, sizeof(*c));
+    if (c == NULL) return NULL;
+
+    esp_transport_handle_t t = esp_transport_init();
+    if (t == NULL) {
+        free(c);
+        return NULL;
+    }
+    esp_transport_set_context_data(t, c);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close,
+                           tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(t, 8883);
+    return t;
+}
+
+void mqtt_tls_write_health(health_writer_t *hw)
+{
+    unsigned n    = atomic_load(&s_stats.n);
+    unsigned res  = atomic_load(&s_stats.resumed);
+    unsigned fail = atomic_load(&s_stats.fail);
+    if (n == 0 && fail == 0) return;
+
+    health_begin_object(hw, "tls");
+    health_field_uint(hw, "n",       n);
+    health_field_uint(hw, "res",     res);
+    health_field_uint(hw, "ms",      atomic_load(&s_stats.last_ms));
+    health_field_uint(hw, "full_ms", (n > res) ? atomic_load(&s_stats.full_ms_sum) / (n - res) : 0);
+    health_field_uint(hw, "res_ms",  res ? atomic_load(&s_stats.res_ms_sum) / res : 0);
+    health_field_uint(hw, "fail",    fail);
+    health_end_object(hw);
+}
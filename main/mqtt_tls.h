@@ -0,0 +1,66 @@
+/*
+ * mqtt_tls.h - TLS transport for mqtts:// with session resumption
+ *
+ * esp-mqtt's built-in SSL transport does a full handshake on every
+ * connect: ECDHE key exchange plus certificate chain verification, the
+ * expensive part on this MCU.  This module supplies esp-mqtt with its own
+ * transport (esp_mqtt_client_config_t.network.transport) built directly on
+ * esp-tls, so it can keep the TLS session of the last connection to each
+ * broker and offer it on the next connect (RFC 5077 session ticket, TLS
+ * 1.3 PSK).  A broker that accepts it skips the certificate exchange and
+ * the asymmetric operations.  Sessions live in RAM for the current boot.
+ *
+ * Trust / identity (Kconfig):
+ *   CONFIG_MQTT_TLS_CRT_BUNDLE    verify against the IDF CA bundle
+ *   CONFIG_MQTT_TLS_CA_PEM        verify against main/certs/mqtt_ca.pem
+ *   CONFIG_MQTT_TLS_CLIENT_CERT   mutual TLS with main/certs/mqtt_client.crt
+ *                                 and main/certs/mqtt_client.key
+ *
+ * Resumption needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS (set in
+ * sdkconfig.defaults); without it every connect is a full handshake.
+ *
+ * Concurrency: transport callbacks run on the esp-mqtt task only; the
+ * counters read by the health provider are atomics.
+ */
+
+#ifndef MQTT_TLS_H
+#define MQTT_TLS_H
+
+#include <stdbool.h>
+#include "esp_transport.h"
+#include "health_payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Brokers whose last session is remembered (one per failover broker) */
+#ifndef MQTT_TLS_SESSION_CACHE
+#define MQTT_TLS_SESSION_CACHE  4
+#endif
+
+/** True for URIs this transport should carry ("mqtts://..."). */
+bool mqtt_tls_uri_is_tls(const char *uri);
+
+/**
+ * New transport for esp_mqtt_client_config_t.network.transport.  esp-mqtt
+ * owns it from then on and destroys it with the client; the session cache
+ * is not part of it and survives client re-creation.
+ * @return NULL on allocation failure
+ */
+esp_transport_handle_t mqtt_tls_transport_create(void);
+
+/**
+ * Health provider body:
+ *   "tls":{"n":9,"res":8,"ms":61,"full_ms":1450,"res_ms":75,"fail":0}
+ * n = handshakes, res = of those with a cached session offered,
+ * ms = last, *_ms = averages (TCP connect + TLS handshake).
+ * Omitted until the first mqtts:// connect attempt.
+ */
+void mqtt_tls_write_health(health_writer_t *hw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTT_TLS_H */
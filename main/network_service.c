@@ -18,21 +18,40 @@
  *    callbacks passed directly into transport->init()
  *  - supervisor_heartbeat tag changed from "ethernet" to transport->name
  *    so the supervisor registry entry name still matches
+ *
+ *  [5] Health payload provider
+ *      Link-up / link-down / DHCP-lease counters and queue drops, registered
+ *      with health_payload as "net".  Counters are atomics because the
+ *      transport callbacks run on the event-loop task, not ours.
  */
 
 #include "network_service.h"
 #include "network_transport.h"
 #include "supervisor.h"
 #include "priorities.h"
+#include "health_payload.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
 #include "esp_task_wdt.h"
 #include <string.h>
+#include <stdatomic.h>
 
 static const char *TAG = "net-service";
 
+/* -------------------------------------------------------------------------
+ * [5] Health counters -- survive service restarts
+ * ------------------------------------------------------------------------- */
+typedef struct {
+    atomic_uint link_up;        /* link came up                       */
+    atomic_uint link_down;      /* link lost (callback or poll)       */
+    atomic_uint got_ip;         /* DHCP leases acquired               */
+    atomic_uint q_drops;        /* [1] events dropped on a full queue */
+} net_counters_t;
+
+static net_counters_t s_counters;
+
 /* -------------------------------------------------------------------------
  * [1] Queue-send helper -- logs on drop
  * ------------------------------------------------------------------------- */
@@ -41,6 +60,7 @@ static inline void queue_send_warn(QueueHandle_t q,
                                    const char *event_name)
 {
     if (xQueueSend(q, msg, pdMS_TO_TICKS(10)) != pdTRUE) {
+        atomic_fetch_add(&s_counters.q_drops, 1);
         ESP_LOGW(TAG, "Queue full -- dropped event: %s", event_name);
     }
 }
@@ -60,6 +80,7 @@ typedef struct {
 
 static net_service_ctx_t s_ctx = {0};
 
+
 /* -------------------------------------------------------------------------
  * Transport callbacks -- fired from the transport's event handler task.
  * Must only post to the queue (ISR/event-task safe).
@@ -73,8 +94,10 @@ static void on_ip_acquired(const char *ip_str)
      * it may consume NET_EVENT_GOT_IP before the task sees it.
      * State must not depend on the message being processed by the task. */
     strncpy(s_ctx.ip, ip_str, sizeof(s_ctx.ip) - 1);
+    if (!s_ctx.is_connected) atomic_fetch_add(&s_counters.link_up, 1);
     s_ctx.is_connected = true;
     s_ctx.has_ip       = true;
+    atomic_fetch_add(&s_counters.got_ip, 1);
 
     net_service_message_t msg = { .type = NET_EVENT_GOT_IP };
     strncpy(msg.data.got_ip.ip, ip_str, sizeof(msg.data.got_ip.ip) - 1);
@@ -86,6 +109,7 @@ static void on_disconnected(void)
     if (s_ctx.event_queue == NULL) return;
 
     /* Clear state immediately -- same reason, don't wait for queue processing */
+    if (s_ctx.is_connected) atomic_fetch_add(&s_counters.link_down, 1);
     s_ctx.is_connected = false;
     s_ctx.has_ip       = false;
     memset(s_ctx.ip, 0, sizeof(s_ctx.ip));
@@ -195,6 +219,8 @@ static void network_service_task(void *arg)
         bool hw_connected = transport->is_connected();
         if (hw_connected != s_ctx.is_connected) {
             s_ctx.is_connected = hw_connected;
+            atomic_fetch_add(hw_connected ? &s_counters.link_up
+                                          : &s_counters.link_down, 1);
             net_service_message_t status = {
                 .type = hw_connected ? NET_EVENT_CONNECTED
                                      : NET_EVENT_DISCONNECTED
@@ -234,6 +260,22 @@ static void network_service_task(void *arg)
     vTaskDelete(NULL);
 }
 
+/* -------------------------------------------------------------------------
+ * [5] Health payload provider -- runs on the mqtt publish task
+ *   "net":{"link":true,"up":1,"down":0,"dhcp":1,"qdrop":0}
+ * ------------------------------------------------------------------------- */
+static void net_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    health_begin_object(hw, "net");
+    health_field_bool(hw, "link",  s_ctx.is_connected);
+    health_field_uint(hw, "up",    atomic_load(&s_counters.link_up));
+    health_field_uint(hw, "down",  atomic_load(&s_counters.link_down));
+    health_field_uint(hw, "dhcp",  atomic_load(&s_counters.got_ip));
+    health_field_uint(hw, "qdrop", atomic_load(&s_counters.q_drops));
+    health_end_object(hw);
+}
+
 /* -------------------------------------------------------------------------
  * Public API
  * ------------------------------------------------------------------------- */
@@ -248,6 +290,8 @@ void network_service_start(const network_transport_t *transport)
         return;
     }
 
+    health_payload_register("net", net_health_fields, NULL);  /* [5] */
+
     xTaskCreate(network_service_task, "net-service",
                 12288, (void *)transport, PRIO_ETH_SERVICE,
                 &s_ctx.task_handle);
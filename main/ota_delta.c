@@ -0,0 +1,381 @@
+/*
+ * ota_delta.c - Streaming binary patch applier for delta OTA
+ *
+ * A byte-level state machine: op codes and varints are parsed one byte at
+ * a time, literal runs (insert, add literals) and base copies are moved in
+ * blocks.  Output is collected in `out` and handed to the sink whenever it
+ * fills, so the sink sees few, large writes; base bytes for 'A' come
+ * through a one-block read cache since adds walk the base sequentially.
+ */
+
+#include "ota_delta.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ota-delta";
+
+typedef enum {
+    ST_HDR,
+    ST_OP,
+    ST_ARG,             /* varint args of the current op */
+    ST_INSERT,          /* literal bytes of 'I' */
+    ST_ADD_TOKEN,       /* varint token of 'A' */
+    ST_ADD_LIT,         /* literal diff bytes of an 'A' token */
+    ST_DONE,            /* 'E' seen */
+    ST_ERR,
+} delta_state_t;
+
+struct ota_delta {
+    const esp_partition_t  *base;
+    uint32_t                max_out;
+    ota_delta_sink_t        sink;
+    void                   *sink_ctx;
+
+    delta_state_t           state;
+    const char             *reason;
+
+    uint8_t                 hdr[OTA_DELTA_HDR_LEN];
+    size_t                  hdr_len;
+    uint32_t                old_size;
+    uint32_t                new_size;
+
+    /* Current op */
+    uint8_t                 op;
+    int                     nargs;
+    int                     argi;
+    uint32_t                args[2];
+    uint32_t                varint;
+    int                     shift;
+    uint32_t                old_off;        /* 'A': base position */
+    uint32_t                remaining;      /* op bytes still to produce */
+    uint32_t                lit_left;       /* 'A': literals of this token */
+
+    /* Output */
+    mbedtls_sha256_context  sha;
+    uint32_t                out_total;
+    size_t                  out_len;
+    uint8_t                 out[OTA_DELTA_BUF_LEN];
+
+    /* Base read cache */
+    uint32_t                cache_off;
+    size_t                  cache_len;
+    uint8_t                 cache[OTA_DELTA_BUF_LEN];
+};
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+static esp_err_t fail(ota_delta_t *d, const char *reason, esp_err_t err)
+{
+    if (d->state != ST_ERR) {
+        ESP_LOGE(TAG, "%s (out %" PRIu32 "/%" PRIu32 ")",
+                 reason, d->out_total, d->new_size);
+        d->state  = ST_ERR;
+        d->reason = reason;
+    }
+    return err;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t flush(ota_delta_t *d)
+{
+    if (d->out_len == 0) return ESP_OK;
+    mbedtls_sha256_update(&d->sha, d->out, d->out_len);
+    esp_err_t ret = d->sink(d->out, d->out_len, d->sink_ctx);
+    d->out_len = 0;
+    return (ret == ESP_OK) ? ESP_OK : fail(d, "write", ret);
+}
+
+/* Room in `out`, flushing first when it is full */
+static esp_err_t out_room(ota_delta_t *d, size_t *room)
+{
+    if (d->out_len == sizeof(d->out)) {
+        esp_err_t ret = flush(d);
+        if (ret != ESP_OK) return ret;
+    }
+    *room = sizeof(d->out) - d->out_len;
+    return ESP_OK;
+}
+
+static esp_err_t base_byte(ota_delta_t *d, uint32_t off, uint8_t *b)
+{
+    if (off < d->cache_off || off >= d->cache_off + d->cache_len) {
+        size_t n = d->old_size - off;
+        if (n > sizeof(d->cache)) n = sizeof(d->cache);
+        esp_err_t ret = esp_partition_read(d->base, off, d->cache, n);
+        if (ret != ESP_OK) return fail(d, "base read", ret);
+        d->cache_off = off;
+        d->cache_len = n;
+    }
+    *b = d->cache[off - d->cache_off];
+    return ESP_OK;
+}
+
+/* `len` base bytes from `off` straight into the output ('C', zero runs) */
+static esp_err_t copy_base(ota_delta_t *d, uint32_t off, uint32_t len)
+{
+    while (len > 0) {
+        size_t room;
+        esp_err_t ret = out_room(d, &room);
+        if (ret != ESP_OK) return ret;
+        size_t n = (len < room) ? len : room;
+        ret = esp_partition_read(d->base, off, d->out + d->out_len, n);
+        if (ret != ESP_OK) return fail(d, "base read", ret);
+        d->out_len += n;
+        off        += n;
+        len        -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t check_base(ota_delta_t *d)
+{
+    if (memcmp(d->hdr, OTA_DELTA_MAGIC, 4) != 0) {
+        return fail(d, "magic", ESP_ERR_INVALID_VERSION);
+    }
+    d->old_size = get_le32(d->hdr + 4);
+    d->new_size = get_le32(d->hdr + 8);
+    if (d->old_size > d->base->size || d->new_size == 0 || d->new_size > d->max_out) {
+        return fail(d, "size", ESP_ERR_INVALID_SIZE);
+    }
+
+    /* Same build as the patch was made against?  Hashing the base is a
+     * one-off flash read of old_size bytes, through the output buffer. */
+    mbedtls_sha256_context sha;
+    uint8_t got[32];
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t off = 0; off < d->old_size; ) {
+        size_t n = d->old_size - off;
+        if (n > sizeof(d->out)) n = sizeof(d->out);
+        if (esp_partition_read(d->base, off, d->out, n) != ESP_OK) {
+            mbedtls_sha256_free(&sha);
+            return fail(d, "base read", ESP_FAIL);
+        }
+        mbedtls_sha256_update(&sha, d->out, n);
+        off += n;
+    }
+    mbedtls_sha256_finish(&sha, got);
+    mbedtls_sha256_free(&sha);
+
+    if (memcmp(got, d->hdr + 12, sizeof(got)) != 0) {
+        return fail(d, "base", ESP_ERR_INVALID_VERSION);
+    }
+    ESP_LOGI(TAG, "Base %s matches (%" PRIu32 " bytes) -> %" PRIu32 " bytes",
+             d->base->label, d->old_size, d->new_size);
+    d->state = ST_OP;
+    return ESP_OK;
+}
+
+/* All args of the current op read */
+static esp_err_t op_ready(ota_delta_t *d)
+{
+    uint32_t len = (d->op == 'I') ? d->args[0] : d->args[1];
+    if ((uint64_t)d->out_total + len > d->new_size) {
+        return fail(d, "patch", ESP_ERR_INVALID_SIZE);
+    }
+    if (d->op != 'I' && (uint64_t)d->args[0] + len > d->old_size) {
+        return fail(d, "patch", ESP_ERR_INVALID_SIZE);
+    }
+    d->out_total += len;
+    d->remaining  = len;
+
+    switch (d->op) {
+    case 'C':
+        d->state = ST_OP;
+        return copy_base(d, d->args[0], len);
+    case 'A':
+        d->old_off = d->args[0];
+        d->state   = (len > 0) ? ST_ADD_TOKEN : ST_OP;
+        break;
+    default:    /* 'I' */
+        d->state = (len > 0) ? ST_INSERT : ST_OP;
+        break;
+    }
+    d->varint = 0;
+    d->shift  = 0;
+    return ESP_OK;
+}
+
+/* One byte of a varint; *done once the value is complete */
+static esp_err_t varint_byte(ota_delta_t *d, uint8_t b, bool *done)
+{
+    if (d->shift > 28) return fail(d, "patch", ESP_ERR_INVALID_ARG);
+    d->varint |= (uint32_t)(b & 0x7f) << d->shift;
+    d->shift  += 7;
+    *done = (b & 0x80) == 0;
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ------------------------------------------------------------------------- */
+
+esp_err_t ota_delta_begin(ota_delta_t **out, const esp_partition_t *base,
+                          uint32_t max_out, ota_delta_sink_t sink, void *ctx)
+{
+    if (out == NULL || base == NULL || sink == NULL) return ESP_ERR_INVALID_ARG;
+
+    ota_delta_t *d = calloc(1, sizeof(*d));
+    if (d == NULL) return ESP_ERR_NO_MEM;
+    d->base     = base;
+    d->max_out  = max_out;
+    d->sink     = sink;
+    d->sink_ctx = ctx;
+    d->state    = ST_HDR;
+    mbedtls_sha256_init(&d->sha);
+    mbedtls_sha256_starts(&d->sha, 0);
+    *out = d;
+    return ESP_OK;
+}
+
+esp_err_t ota_delta_feed(ota_delta_t *d, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    esp_err_t ret = ESP_OK;
+    bool done;
+
+    while (i < len && ret == ESP_OK) {
+        switch (d->state) {
+        case ST_HDR: {
+            size_t n = sizeof(d->hdr) - d->hdr_len;
+            if (n > len - i) n = len - i;
+            memcpy(d->hdr + d->hdr_len, data + i, n);
+            d->hdr_len += n;
+            i          += n;
+            if (d->hdr_len == sizeof(d->hdr)) ret = check_base(d);
+            break;
+        }
+
+        case ST_OP:
+            d->op = data[i++];
+            d->argi   = 0;
+            d->varint = 0;
+            d->shift  = 0;
+            switch (d->op) {
+            case 'C': case 'A': d->nargs = 2; d->state = ST_ARG; break;
+            case 'I':           d->nargs = 1; d->state = ST_ARG; break;
+            case 'E':
+                d->state = ST_DONE;
+                ret = flush(d);
+                break;
+            default:
+                ret = fail(d, "patch", ESP_ERR_INVALID_ARG);
+                break;
+            }
+            break;
+
+        case ST_ARG:
+            ret = varint_byte(d, data[i++], &done);
+            if (ret != ESP_OK || !done) break;
+            d->args[d->argi++] = d->varint;
+            d->varint = 0;
+            d->shift  = 0;
+            if (d->argi == d->nargs) ret = op_ready(d);
+            break;
+
+        case ST_INSERT: {
+            size_t room;
+            ret = out_room(d, &room);
+            if (ret != ESP_OK) break;
+            size_t n = d->remaining;
+            if (n > room)    n = room;
+            if (n > len - i) n = len - i;
+            memcpy(d->out + d->out_len, data + i, n);
+            d->out_len   += n;
+            d->remaining -= n;
+            i            += n;
+            if (d->remaining == 0) d->state = ST_OP;
+            break;
+        }
+
+        case ST_ADD_TOKEN: {
+            ret = varint_byte(d, data[i++], &done);
+            if (ret != ESP_OK || !done) break;
+            uint32_t count = d->varint >> 1;
+            bool     lit   = d->varint & 1;
+            d->varint = 0;
+            d->shift  = 0;
+            if (count == 0 || count > d->remaining) {
+                ret = fail(d, "patch", ESP_ERR_INVALID_ARG);
+                break;
+            }
+            if (lit) {
+                d->lit_left = count;
+                d->state    = ST_ADD_LIT;
+                break;
+            }
+            ret = copy_base(d, d->old_off, count);
+            d->old_off   += count;
+            d->remaining -= count;
+            if (d->remaining == 0) d->state = ST_OP;
+            break;
+        }
+
+        case ST_ADD_LIT: {
+            uint8_t b;
+            size_t room;
+            ret = out_room(d, &room);
+            if (ret == ESP_OK) ret = base_byte(d, d->old_off, &b);
+            if (ret != ESP_OK) break;
+            d->out[d->out_len++] = (uint8_t)(b + data[i++]);
+            d->old_off++;
+            d->remaining--;
+            if (--d->lit_left == 0) {
+                d->state = (d->remaining == 0) ? ST_OP : ST_ADD_TOKEN;
+            }
+            break;
+        }
+
+        case ST_DONE:
+            ret = fail(d, "trailing data", ESP_ERR_INVALID_SIZE);
+            break;
+
+        case ST_ERR:
+        default:
+            return ESP_FAIL;
+        }
+    }
+    return ret;
+}
+
+esp_err_t ota_delta_finish(ota_delta_t *d)
+{
+    if (d->state == ST_ERR) return ESP_FAIL;
+    if (d->state != ST_DONE) return fail(d, "truncated", ESP_ERR_INVALID_SIZE);
+    if (d->out_total != d->new_size) return fail(d, "size", ESP_ERR_INVALID_SIZE);
+
+    uint8_t got[32];
+    mbedtls_sha256_finish(&d->sha, got);
+    if (memcmp(got, d->hdr + 44, sizeof(got)) != 0) {
+        return fail(d, "sha256 out", ESP_ERR_INVALID_CRC);
+    }
+    return ESP_OK;
+}
+
+const char *ota_delta_reason(const ota_delta_t *d)
+{
+    return (d && d->reason) ? d->reason : "delta";
+}
+
+uint32_t ota_delta_new_size(const ota_delta_t *d)
+{
+    return d ? d->new_size : 0;
+}
+
+void ota_delta_free(ota_delta_t *d)
+{
+    if (d == NULL) return;
+    mbedtls_sha256_free(&d->sha);
+    free(d);
+}
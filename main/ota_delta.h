@@ -0,0 +1,84 @@
+/*
+ * ota_delta.h - Streaming binary patch applier for delta OTA
+ *
+ * Rebuilds a new app image from the running one and a patch made on the
+ * host by tools/mkdelta.py, feeding the output to a sink (esp_ota_write()
+ * into the inactive slot).  The patch is consumed as it arrives, in any
+ * split, and RAM stays bounded at sizeof(ota_delta_t) (two
+ * OTA_DELTA_BUF_LEN buffers) whatever the image size.
+ *
+ * Patch format (integers little endian, varints LEB128):
+ *
+ *   header   "MDL1"  u32 old_size  u32 new_size
+ *            u8 old_sha256[32]  u8 new_sha256[32]
+ *   ops      'C' off len           copy base[off, off+len)
+ *            'A' off len tokens    add: out = base[off+i] + diff[i] (mod 256),
+ *                                  diff given as tokens until len is covered:
+ *                                    t even  -> t/2 zero bytes (base unchanged)
+ *                                    t odd   -> t/2 literal diff bytes follow
+ *            'I' len bytes         insert literal bytes
+ *            'E'                   end of patch
+ *
+ * 'A' is the bsdiff idea without the compressor: code that only moved
+ * differs from the base in a few address bytes, so its diff is mostly zero
+ * runs.
+ *
+ * Verification: when the header is complete the first old_size bytes of
+ * the base partition must hash to old_sha256 -- a patch made against
+ * another build is refused before anything is written.  ota_delta_finish()
+ * checks the output length and new_sha256.
+ */
+
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_DELTA_MAGIC         "MDL1"
+#define OTA_DELTA_HDR_LEN       76
+#ifndef OTA_DELTA_BUF_LEN
+#define OTA_DELTA_BUF_LEN       4096
+#endif
+
+/** Receives the rebuilt image in order, OTA_DELTA_BUF_LEN bytes at most per call. */
+typedef esp_err_t (*ota_delta_sink_t)(const uint8_t *data, size_t len, void *ctx);
+
+typedef struct ota_delta ota_delta_t;
+
+/**
+ * Start applying a patch against `base` (the running partition).
+ * @param max_out  upper bound for new_size (the target slot's size)
+ * @return ESP_ERR_NO_MEM if the state could not be allocated
+ */
+esp_err_t ota_delta_begin(ota_delta_t **out, const esp_partition_t *base,
+                          uint32_t max_out, ota_delta_sink_t sink, void *ctx);
+
+/**
+ * Apply the next `len` patch bytes.  On error the reason is available
+ * from ota_delta_reason() and every later call fails.
+ */
+esp_err_t ota_delta_feed(ota_delta_t *d, const uint8_t *data, size_t len);
+
+/** Whole patch fed: flush, then check END, output size and new_sha256. */
+esp_err_t ota_delta_finish(ota_delta_t *d);
+
+/** Short reason of the first error ("base", "patch", "sha256 out", ...). */
+const char *ota_delta_reason(const ota_delta_t *d);
+
+/** Size of the rebuilt image (0 until the header was read). */
+uint32_t ota_delta_new_size(const ota_delta_t *d);
+
+void ota_delta_free(ota_delta_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OTA_DELTA_H */
@@ -14,6 +14,8 @@
  *   10  ds18b20_temp_supervisor
  *    5  ds18b20-temp-task (inner)
  *    5  mqtt-publish (inner)
+ *    5  mqtt-rpc workers (inner)
+ *    5  mqtt-probe (inner)       - broker TCP probes, blocks in DNS / select
  *    4  display-service (inner)  - low priority, purely I/O bound
  */
 
@@ -28,6 +30,8 @@
 #define PRIO_MQTT_SUPERVISOR        20
 #define PRIO_MQTT_SERVICE           19
 #define PRIO_MQTT_PUBLISH           5
+#define PRIO_MQTT_RPC               5
+#define PRIO_MQTT_PROBE             5
 
 /* DS18B20 temperature layer */
 #define PRIO_DS18B20_SUPERVISOR     10
@@ -1,5 +1,14 @@
 /*
- * supervisor.c - ESP-IDF v5.x  (v1.2 — hardened)
+ * supervisor.c - ESP-IDF v5.x  (v1.3 — orderly reboot)
+ *
+ * CHANGES vs v1.2:
+ *
+ *  [6] supervisor_reboot()
+ *      Records the reason and wakes the supervisor task (the poll delay
+ *      is now a task-notification wait).  The task then suspends every
+ *      service wrapper so nothing is restarted behind its back, calls
+ *      the quiesce hooks newest-first and restarts.  A service with no
+ *      hook is simply cut off by the restart, as before.
  *
  * HARDENING vs v1.1:
  *
@@ -26,6 +35,11 @@
  *      Prevents the compiler optimising away cross-core reads on the
  *      dual-core ESP32-P4.  (Full atomics are overkill for a single
  *      bool written only by the supervisor task itself.)
+ *
+ *  [5] Health payload provider
+ *      Registers "crashes" with health_payload: per-service crash counts
+ *      (services that never crashed are omitted) plus the total number of
+ *      supervised services.
  */
 
 #include "supervisor.h"
@@ -36,6 +50,7 @@
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "health_payload.h"
 
 /* =========================================================================
  * Internal types
@@ -66,6 +81,10 @@ static uint8_t        s_count = 0;
 /* Static buffer for last crash reason read from NVS [3] */
 static char s_last_crash[64] = {0};
 
+/* [6] Pending reboot request (NULL = none) and the task to wake */
+static _Atomic(const char *) s_reboot_reason = NULL;
+static TaskHandle_t          s_supervisor_task = NULL;
+
 /* =========================================================================
  * NVS helpers [3]
  * ========================================================================= */
@@ -302,6 +321,54 @@ static void handle_service_death(service_slot_t *slot)
     }
 }
 
+/* =========================================================================
+ * Health payload provider [5]
+ *   "crashes":{"svc":4,"mqtt":1}
+ * Runs on the mqtt publish task -- reads crash_count (a byte) without a lock.
+ * ========================================================================= */
+
+static void supervisor_health_fields(health_writer_t *hw, void *ctx)
+{
+    (void)ctx;
+    health_begin_object(hw, "crashes");
+    health_field_uint(hw, "svc", s_count);
+    for (int i = 0; i < MAX_SERVICES; i++) {
+        const service_def_t *def = s_table[i].def;
+        if (def == NULL || s_table[i].crash_count == 0) continue;
+        health_field_uint(hw, def->name, s_table[i].crash_count);
+    }
+    health_end_object(hw);
+}
+
+/* =========================================================================
+ * quiesce_and_restart [6]
+ *
+ * Slots were filled in registry order, so walking them backwards stops
+ * dependents (display, sensors) before what they depend on (mqtt, net).
+ * ========================================================================= */
+
+static void quiesce_and_restart(const char *reason)
+{
+    ESP_LOGW(SUPERVISOR_TAG, "Reboot requested (%s) -- quiescing services", reason);
+
+    for (int i = 0; i < MAX_SERVICES; i++) {
+        if (s_table[i].def == NULL || s_table[i].handle == NULL) continue;
+        if (eTaskGetState(s_table[i].handle) != eDeleted) {
+            vTaskSuspend(s_table[i].handle);
+        }
+    }
+
+    for (int i = MAX_SERVICES - 1; i >= 0; i--) {
+        const service_def_t *def = s_table[i].def;
+        if (def == NULL || def->quiesce == NULL) continue;
+        ESP_LOGI(SUPERVISOR_TAG, "Quiescing '%s'", def->name);
+        def->quiesce();
+    }
+
+    ESP_LOGW(SUPERVISOR_TAG, "Restarting (%s)", reason);
+    esp_restart();
+}
+
 /* =========================================================================
  * supervisor_main task
  * ========================================================================= */
@@ -310,6 +377,8 @@ static void supervisor_main(void *arg)
 {
     const service_def_t *defs = (const service_def_t *)arg;
 
+    s_supervisor_task = xTaskGetCurrentTaskHandle();           /* [6] */
+
     /* [3] Load last crash reason from NVS so it appears in the boot log */
     nvs_load_last_crash();
 
@@ -352,12 +421,17 @@ static void supervisor_main(void *arg)
         vTaskDelay(pdMS_TO_TICKS(50));
     }
 
+    health_payload_register("crashes", supervisor_health_fields, NULL);  /* [5] */
+
     print_debug();
     ESP_LOGI(SUPERVISOR_TAG, "All services started. Entering supervision loop...");
 
     uint32_t loop_count = 0;
 
     while (1) {
+        const char *reason = atomic_load(&s_reboot_reason);    /* [6] */
+        if (reason != NULL) quiesce_and_restart(reason);
+
         loop_count++;
         TickType_t now = xTaskGetTickCount();
         bool any_event = false;
@@ -389,7 +463,8 @@ static void supervisor_main(void *arg)
             print_debug();
         }
 
-        vTaskDelay(pdMS_TO_TICKS(SUPERVISOR_CHECK_MS));
+        /* [6] supervisor_reboot() cuts the wait short */
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SUPERVISOR_CHECK_MS));
     }
 }
 
@@ -452,3 +527,17 @@ const char *supervisor_get_last_crash(void)
 {
     return (s_last_crash[0] != '\0') ? s_last_crash : NULL;
 }
+
+void supervisor_reboot(const char *reason)
+{
+    if (reason == NULL) reason = "request";
+    const char *expected = NULL;
+    if (!atomic_compare_exchange_strong(&s_reboot_reason, &expected, reason)) {
+        return;     /* already on its way down */
+    }
+    if (s_supervisor_task == NULL) {
+        ESP_LOGW(SUPERVISOR_TAG, "Reboot (%s) before supervisor start", reason);
+        esp_restart();
+    }
+    xTaskNotifyGive(s_supervisor_task);
+}
@@ -1,5 +1,10 @@
 /*
- * supervisor.h - ESP-IDF v5.x  (v1.2 — hardened)
+ * supervisor.h - ESP-IDF v5.x  (v1.3 — orderly reboot)
+ *
+ * CHANGES vs v1.2:
+ *  - service_def_t gains an optional quiesce hook, called by
+ *    supervisor_reboot() before the restart.
+ *  - supervisor_reboot() added to public API.
  *
  * HARDENING changes vs v1.1:
  *  - service_def_t gains optional heartbeat_timeout_s field.
@@ -93,6 +98,16 @@ typedef struct {
      * e.g. if the task blocks 5 s on a queue receive, use 15.
      */
     uint16_t          heartbeat_timeout_s;
+
+    /*
+     * quiesce -- optional, NULL = nothing to do.
+     *
+     * Called from the supervisor task by supervisor_reboot(), in reverse
+     * start order, after restarts have been stopped.  Should bring the
+     * service down cleanly (flush, close the connection) and return; it
+     * may block briefly.
+     */
+    void            (*quiesce)(void);
 } service_def_t;
 
 /* =========================================================================
@@ -129,6 +144,17 @@ void supervisor_heartbeat(const char *name);
  */
 const char *supervisor_get_last_crash(void);
 
+/**
+ * @brief Request an orderly reboot.  Returns at once; the supervisor task
+ *        stops restarting services, runs their quiesce hooks in reverse
+ *        start order and then calls esp_restart().
+ *
+ * Safe to call from any task.  Only the first request counts.
+ *
+ * @param reason  Static string, logged (e.g. "ota").
+ */
+void supervisor_reboot(const char *reason);
+
 #ifdef __cplusplus
 }
 #endif
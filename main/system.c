@@ -237,8 +237,8 @@ void ds18b20_temp_supervisor(void *arg)
         ds18b20_reading_t reading;
 
         if (xQueueReceive(queue, &reading, pdMS_TO_TICKS(1000)) == pdTRUE) {
-            ESP_LOGI(TAG, "Sensor[%d]: %.2f°C",
-                     reading.sensor_index, reading.temperature);
+            ESP_LOGI(TAG, "Sensor %016" PRIX64 ": %.2f°C",
+                     reading.rom, reading.temperature);
             stale_seconds = 0;
         } else {
             uint32_t current_count = ds18b20_temp_service_get_message_count();
@@ -306,13 +306,17 @@ void display_supervisor(void *arg)
  *       Therefore keep the registry name as "ethernet" while using
  *       ethernet_transport, and change it to "wifi" (or "network")
  *       when you switch -- it just has to match transport->name.
+ *
+ * quiesce: run by supervisor_reboot() bottom-up (display first).  The
+ *       network has none -- it has to stay up while mqtt closes its
+ *       session, and the restart takes it down anyway.
  * ========================================================================= */
 
 const service_def_t services[] = {
-    /* name        entry                stack   priority               restart        essential  ctx   hb_s */
-    {"ethernet",   network_supervisor,  12288, PRIO_ETH_SUPERVISOR,  RESTART_ALWAYS, true,  NULL, 30},
-    {"mqtt",       mqtt_supervisor,      8192, PRIO_MQTT_SUPERVISOR, RESTART_ALWAYS, false, NULL, 30},
-    {"ds18b20-temp", ds18b20_temp_supervisor, 4096, PRIO_DS18B20_SUPERVISOR, RESTART_ALWAYS, false, NULL, 60},
-    {"display",    display_supervisor,   4096, PRIO_DS18B20_SUPERVISOR, RESTART_ALWAYS, false, NULL, 0},
-    {NULL, NULL, 0, 0, RESTART_NEVER, false, NULL, 0}  /* sentinel */
+    /* name        entry                stack   priority               restart        essential  ctx   hb_s  quiesce */
+    {"ethernet",   network_supervisor,  12288, PRIO_ETH_SUPERVISOR,  RESTART_ALWAYS, true,  NULL, 30, NULL},
+    {"mqtt",       mqtt_supervisor,      8192, PRIO_MQTT_SUPERVISOR, RESTART_ALWAYS, false, NULL, 30, mqtt_service_stop},
+    {"ds18b20-temp", ds18b20_temp_supervisor, 4096, PRIO_DS18B20_SUPERVISOR, RESTART_ALWAYS, false, NULL, 60, ds18b20_temp_service_stop},
+    {"display",    display_supervisor,   4096, PRIO_DS18B20_SUPERVISOR, RESTART_ALWAYS, false, NULL, 0, display_service_stop},
+    {NULL, NULL, 0, 0, RESTART_NEVER, false, NULL, 0, NULL}  /* sentinel */
 };
@@ -0,0 +1,144 @@
+/*
+ * bench_payload.c - JSON vs CBOR: bytes and cycles per message
+ *
+ * Builds ds18b20_temp.c (included below) on the simulated bus of
+ * test_onewire with 16 sensors, one cycle read, and times the publish
+ * code itself in both payload formats:
+ *
+ *   single   publish_single(): one sensor value on its own topic
+ *   batch    publish_batch_part(): one frame of 16 sensors
+ *   health   health_payload_next(): the "ds18b20" health member
+ *
+ * Every message is built REPS times; the median per message is printed,
+ * in TSC cycles on x86 (ns elsewhere) on the build host -- compare the
+ * columns with each other, not with the ESP32-P4.  Topic formatting and
+ * the (stubbed) publish call are inside the timed region, as on the node.
+ */
+
+#include "../../main/ds18b20_temp.c"
+#include "onewire_sim.h"
+#include "ds18b20_env.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT        "cycles"
+static inline uint64_t now_ticks(void) { return __rdtsc(); }
+#else
+#include <time.h>
+#define UNIT        "ns"
+static inline uint64_t now_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#define SENSORS     16
+#define REPS        2001
+
+int64_t host_time_us = -1;          /* follow the monotonic clock */
+
+typedef struct {
+    size_t   bytes;                 /* per message */
+    uint64_t ticks;                 /* median per message */
+} result_t;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t median(uint64_t *t)
+{
+    qsort(t, REPS, sizeof(*t), cmp_u64);
+    return t[REPS / 2];
+}
+
+/* ---- the three messages ---- */
+
+static void msg_single(void)
+{
+    publish_single("D506473B2D600028", sensor_at(0)->cur.temperature);
+}
+
+static void msg_batch(void)
+{
+    static int idx[SENSORS];
+    for (int i = 0; i < SENSORS; i++) idx[i] = i;
+    char topic[72];
+    snprintf(topic, sizeof(topic), "%s/%s/temperature/batch%s", MQTT_TOPIC_ROOT,
+             s_mac_id, host_payload_format == MQTT_PAYLOAD_FORMAT_CBOR ? MQTT_CBOR_SUFFIX : "");
+    publish_batch_part(topic, 0, idx, SENSORS, SENSORS, false,
+                       esp_timer_get_time() / 1000);
+}
+
+static void msg_health(void)
+{
+    static uint8_t buf[512];                        /* publish_health() buffer */
+    health_payload_iter_t it;
+    health_payload_begin(&it, 1);
+    while (!it.done) {
+        size_t n = health_payload_next(&it, host_payload_format == MQTT_PAYLOAD_FORMAT_CBOR,
+                                       buf, sizeof(buf));
+        if (n == 0) break;
+        mqtt_service_try_publish("/AABBCCA1B2C3/health", buf, n, 0, false);
+    }
+}
+
+static result_t run(void (*msg)(void), mqtt_payload_format_t fmt)
+{
+    static uint64_t t[REPS];
+    host_payload_format = fmt;
+
+    host_publishes = 0;
+    host_publish_bytes = 0;
+    msg();
+    result_t r = { .bytes = host_publish_bytes / (host_publishes ? host_publishes : 1) };
+
+    for (int i = 0; i < REPS; i++) {
+        unsigned n0 = host_publishes;
+        uint64_t t0 = now_ticks();
+        msg();
+        uint64_t dt = now_ticks() - t0;
+        unsigned n = host_publishes - n0;
+        t[i] = dt / (n ? n : 1);
+    }
+    r.ticks = median(t);
+    return r;
+}
+
+int main(void)
+{
+    onewire_sim_init(SENSORS, 21.5f);
+    atomic_store(&s_ctx.filter_ema, 100);
+    if (hw_init() != ESP_OK || s_ctx.sensor_count != SENSORS) {
+        printf("FAIL: %d sensors on the simulated bus\n", s_ctx.sensor_count);
+        return 1;
+    }
+    run_cycle(1);
+    health_payload_register("ds18b20", ds18b20_health_fields, NULL);
+
+    static const struct {
+        const char *name;
+        void      (*fn)(void);
+    } msgs[] = {
+        { "single", msg_single },
+        { "batch",  msg_batch  },
+        { "health", msg_health },
+    };
+
+    printf("%-8s %8s %8s %9s   %11s %11s %9s\n", "message",
+           "json B", "cbor B", "cbor/json", "json " UNIT, "cbor " UNIT, "cbor/json");
+    for (size_t m = 0; m < sizeof(msgs) / sizeof(msgs[0]); m++) {
+        result_t j = run(msgs[m].fn, MQTT_PAYLOAD_FORMAT_JSON);
+        result_t c = run(msgs[m].fn, MQTT_PAYLOAD_FORMAT_CBOR);
+        printf("%-8s %8zu %8zu %8.0f%%   %11llu %11llu %8.0f%%\n", msgs[m].name,
+               j.bytes, c.bytes, 100.0 * c.bytes / j.bytes,
+               (unsigned long long)j.ticks, (unsigned long long)c.ticks,
+               100.0 * c.ticks / j.ticks);
+    }
+    hw_cleanup();
+    return 0;
+}
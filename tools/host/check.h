@@ -0,0 +1,32 @@
+/*
+ * check.h - failure counting shared by the host checks
+ *
+ * CHECK() prints the failing line with a printf-style message and counts
+ * it; main() ends with `return check_result();`.  One per test binary.
+ */
+
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+
+static int s_fail;
+
+#define CHECK(c, ...)                                               \
+    do {                                                            \
+        if (!(c)) {                                                 \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);             \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+            s_fail++;                                               \
+        }                                                           \
+    } while (0)
+
+/* Print the verdict; the process exit code */
+static inline int check_result(void)
+{
+    printf("%s\n", s_fail ? "FAILED" : "OK");
+    return s_fail ? 1 : 0;
+}
+
+#endif /* HOST_CHECK_H */
@@ -0,0 +1,211 @@
+/*
+ * broker_host.c - app_mqtt.h on top of an in-process broker stand-in
+ *
+ * No sockets: a publish is handed to the test's hook, an inbound message
+ * goes straight to the message callback, and the replies esp-mqtt would
+ * deliver later (SUBACK, PUBACK) wait in a small ring until the test
+ * thread next delivers something.
+ */
+
+#include "app_mqtt.h"
+#include "broker_host.h"
+#include "esp_timer.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLIES_MAX     64
+
+typedef struct {
+    bool sub;                   /* SUBACK, else PUBACK */
+    int  msg_id;
+} reply_t;
+
+static struct {
+    mqtt_message_cb_t     msg_cb;
+    void                 *msg_ctx;
+    mqtt_raw_cb_t         raw_cb;
+    void                 *raw_ctx;
+    mqtt_connection_cb_t  conn_cb;
+    void                 *conn_ctx;
+    mqtt_published_cb_t   pub_cb;
+    void                 *pub_ctx;
+    mqtt_subscribed_cb_t  sub_cb;
+    void                 *sub_ctx;
+
+    broker_host_publish_fn on_publish;
+    atomic_bool            started;
+    atomic_bool            connected;
+    atomic_int             next_id;
+    atomic_uint            published;
+
+    pthread_mutex_t lock;                   /* replies */
+    reply_t         replies[REPLIES_MAX];
+    int             n_replies;
+} s_b = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int new_id(void)
+{
+    return atomic_fetch_add(&s_b.next_id, 1) % 0xFFFF + 1;
+}
+
+static void owe(bool sub, int msg_id)
+{
+    pthread_mutex_lock(&s_b.lock);
+    if (s_b.n_replies < REPLIES_MAX) {
+        s_b.replies[s_b.n_replies++] = (reply_t){ .sub = sub, .msg_id = msg_id };
+    }
+    pthread_mutex_unlock(&s_b.lock);
+}
+
+/* Deliver what is owed -- on the test thread, like esp-mqtt's task */
+static void pay_replies(void)
+{
+    reply_t r[REPLIES_MAX];
+    pthread_mutex_lock(&s_b.lock);
+    int n = s_b.n_replies;
+    memcpy(r, s_b.replies, (size_t)n * sizeof(r[0]));
+    s_b.n_replies = 0;
+    pthread_mutex_unlock(&s_b.lock);
+
+    static const uint8_t granted[1] = { 1 };
+    for (int i = 0; i < n; i++) {
+        if (r[i].sub) {
+            if (s_b.sub_cb) s_b.sub_cb(r[i].msg_id, granted, 1, s_b.sub_ctx);
+        } else if (s_b.pub_cb) {
+            s_b.pub_cb(r[i].msg_id, s_b.pub_ctx);
+        }
+    }
+}
+
+/* ---- test side ---- */
+
+void broker_host_on_publish(broker_host_publish_fn fn) { s_b.on_publish = fn; }
+
+bool broker_host_wait_started(uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; !atomic_load(&s_b.started); waited++) {
+        if (waited >= timeout_ms) return false;
+        struct timespec ts = { 0, 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    return true;
+}
+
+void broker_host_connect(void)
+{
+    atomic_store(&s_b.connected, true);
+    if (s_b.conn_cb) s_b.conn_cb(true, s_b.conn_ctx);
+    pay_replies();
+}
+
+void broker_host_deliver(const char *topic, const char *data)
+{
+    pay_replies();
+    if (s_b.raw_cb && s_b.raw_cb(topic, (int)strlen(topic), (const uint8_t *)data,
+                                 (int)strlen(data), 0, (int)strlen(data),
+                                 s_b.raw_ctx)) {
+        return;
+    }
+    if (s_b.msg_cb) s_b.msg_cb(topic, data, s_b.msg_ctx);
+}
+
+unsigned broker_host_published(void) { return atomic_load(&s_b.published); }
+
+/* ---- app_mqtt.h ---- */
+
+esp_err_t mqtt_client_init(const char *broker_uri, const char *client_id,
+                           const char *lwt_topic, const char *lwt_message,
+                           int lwt_qos, int lwt_retain,
+                           bool persistent_session, bool mqtt5)
+{
+    return ESP_OK;
+}
+
+esp_err_t mqtt_client_start(void)
+{
+    atomic_store(&s_b.started, true);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_client_stop(void)
+{
+    atomic_store(&s_b.connected, false);
+    return ESP_OK;
+}
+
+void mqtt_client_deinit(void)                             { mqtt_client_stop(); }
+void mqtt_client_set_manual_reconnect(uint32_t timeout)  { (void)timeout; }
+esp_err_t mqtt_client_set_uri(const char *uri)            { return ESP_OK; }
+esp_err_t mqtt_client_reconnect(void)                     { return ESP_ERR_INVALID_STATE; }
+esp_err_t mqtt_client_disconnect(void)                    { return mqtt_client_stop(); }
+
+int mqtt_client_publish(const char *topic, const char *data, size_t len,
+                        int qos, int retain)
+{
+    if (!atomic_load(&s_b.connected)) return -1;
+    if (len == 0) len = strlen(data);
+    atomic_fetch_add(&s_b.published, 1);
+    if (s_b.on_publish) s_b.on_publish(topic, data, len, qos, esp_timer_get_time());
+    if (qos == 0) return 0;
+    int id = new_id();
+    owe(false, id);
+    return id;
+}
+
+int mqtt_client_publish_props(const char *topic, const char *data, size_t len,
+                              int qos, int retain,
+                              const mqtt_client_pub_props_t *props)
+{
+    return mqtt_client_publish(topic, data, len, qos, retain);
+}
+
+bool mqtt_client_is_v5(void)            { return false; }
+int  mqtt_client_get_outbox_size(void)  { return 0; }
+bool mqtt_client_session_present(void)  { return false; }
+
+int mqtt_client_subscribe(const char *topic, int qos)
+{
+    int id = new_id();
+    owe(true, id);
+    return id;
+}
+
+int mqtt_client_subscribe_multiple(const char *const *topics, const int *qos,
+                                   int count)
+{
+    return mqtt_client_subscribe(topics[0], qos[0]);
+}
+
+int mqtt_client_unsubscribe(const char *topic)  { return new_id(); }
+
+void mqtt_client_set_message_callback(mqtt_message_cb_t cb, void *ctx)
+{
+    s_b.msg_cb  = cb;
+    s_b.msg_ctx = ctx;
+}
+
+void mqtt_client_set_raw_callback(mqtt_raw_cb_t cb, void *ctx)
+{
+    s_b.raw_cb  = cb;
+    s_b.raw_ctx = ctx;
+}
+
+void mqtt_client_set_connection_callback(mqtt_connection_cb_t cb, void *ctx)
+{
+    s_b.conn_cb  = cb;
+    s_b.conn_ctx = ctx;
+}
+
+void mqtt_client_set_published_callback(mqtt_published_cb_t cb, void *ctx)
+{
+    s_b.pub_cb  = cb;
+    s_b.pub_ctx = ctx;
+}
+
+void mqtt_client_set_subscribed_callback(mqtt_subscribed_cb_t cb, void *ctx)
+{
+    s_b.sub_cb  = cb;
+    s_b.sub_ctx = ctx;
+}
@@ -0,0 +1,39 @@
+/*
+ * broker_host.h - Broker stand-in behind app_mqtt.h (broker_host.c)
+ *
+ * mqtt_service runs unchanged on top of it.  The test thread plays the
+ * esp-mqtt task: CONNACK, inbound PUBLISHes and the SUBACK / PUBACK
+ * replies are all delivered from the thread that calls
+ * broker_host_connect() / broker_host_deliver(), as esp-mqtt delivers
+ * every event from its own task.
+ *
+ * Publishes reach the test through the broker_host_on_publish() hook on
+ * the publishing task (mqtt_service's publish task), with the clock read
+ * before the hook runs.
+ */
+
+#ifndef HOST_BROKER_HOST_H
+#define HOST_BROKER_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*broker_host_publish_fn)(const char *topic, const char *data,
+                                       size_t len, int qos, int64_t now_us);
+
+void broker_host_on_publish(broker_host_publish_fn fn);
+
+/** Wait until mqtt_client_start() was called; false after timeout_ms. */
+bool broker_host_wait_started(uint32_t timeout_ms);
+
+/** CONNACK (new session), then the SUBACKs of what was subscribed. */
+void broker_host_connect(void);
+
+/** One inbound PUBLISH, after any SUBACK / PUBACK still owed. */
+void broker_host_deliver(const char *topic, const char *data);
+
+/** Publishes accepted by the stand-in since start. */
+unsigned broker_host_published(void);
+
+#endif /* HOST_BROKER_HOST_H */
@@ -0,0 +1,38 @@
+/*
+ * driver/gpio.h - Host stand-in: outputs are accepted and forgotten
+ */
+
+#ifndef HOST_DRIVER_GPIO_H
+#define HOST_DRIVER_GPIO_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+#define GPIO_NUM_23             23
+#define GPIO_NUM_26             26
+#define GPIO_NUM_27             27
+#define GPIO_NUM_32             32
+
+#define GPIO_MODE_OUTPUT        2
+#define GPIO_PULLUP_DISABLE     0
+#define GPIO_PULLDOWN_DISABLE   0
+#define GPIO_INTR_DISABLE       0
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    int      mode;
+    int      pull_up_en;
+    int      pull_down_en;
+    int      intr_type;
+} gpio_config_t;
+
+static inline esp_err_t gpio_config(const gpio_config_t *cfg) { (void)cfg; return ESP_OK; }
+static inline esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    (void)gpio; (void)level;
+    return ESP_OK;
+}
+
+#endif /* HOST_DRIVER_GPIO_H */
@@ -0,0 +1,35 @@
+/*
+ * ds18b20.h - Host stand-in for the ds18b20 component's API
+ *
+ * Implemented by onewire_sim.c the way the component does it: every call
+ * is its own bus transaction (reset, Match ROM, function command).
+ */
+
+#ifndef HOST_DS18B20_H
+#define HOST_DS18B20_H
+
+#include "onewire_bus.h"
+
+typedef struct ds18b20_device_t *ds18b20_device_handle_t;
+
+typedef struct {
+    int reserved;
+} ds18b20_config_t;
+
+typedef enum {
+    DS18B20_RESOLUTION_9B,
+    DS18B20_RESOLUTION_10B,
+    DS18B20_RESOLUTION_11B,
+    DS18B20_RESOLUTION_12B,
+} ds18b20_resolution_t;
+
+esp_err_t ds18b20_new_device_from_enumeration(onewire_device_t *device,
+                                              const ds18b20_config_t *config,
+                                              ds18b20_device_handle_t *ret_ds18b20);
+esp_err_t ds18b20_del_device(ds18b20_device_handle_t ds18b20);
+esp_err_t ds18b20_set_resolution(ds18b20_device_handle_t ds18b20,
+                                 ds18b20_resolution_t resolution);
+esp_err_t ds18b20_trigger_temperature_conversion(ds18b20_device_handle_t ds18b20);
+esp_err_t ds18b20_get_temperature(ds18b20_device_handle_t ds18b20, float *temperature);
+
+#endif /* HOST_DS18B20_H */
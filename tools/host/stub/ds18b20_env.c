@@ -0,0 +1,83 @@
+/*
+ * ds18b20_env.c - Host stand-ins around ds18b20_temp.c (see ds18b20_env.h)
+ */
+
+#include "ds18b20_env.h"
+#include "config_store.h"
+#include "ds18b20_history.h"
+#include "mqtt_rpc.h"
+#include "supervisor.h"
+#include <stdio.h>
+#include <string.h>
+
+mqtt_payload_format_t host_payload_format = MQTT_PAYLOAD_FORMAT_JSON;
+unsigned              host_publishes;
+size_t                host_publish_bytes;
+
+char s_mac_id[13] = "AABBCCA1B2C3";
+
+/* ---- config_store: defaults, 12-bit sensors ---- */
+
+void config_store_get(app_config_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    snprintf(out->sensor_bits, sizeof(out->sensor_bits), "12");
+}
+
+esp_err_t config_store_subscribe(const char *name, config_listener_t fn, void *ctx)
+{
+    return ESP_OK;
+}
+
+/* ---- mqtt_service / mqtt_rpc ---- */
+
+bool mqtt_service_can_publish(void)
+{
+    return true;
+}
+
+esp_err_t mqtt_service_try_publish(const char *topic, const void *data, size_t len,
+                                   int qos, bool retain)
+{
+    host_publishes++;
+    host_publish_bytes += len ? len : strlen(data);
+    return ESP_OK;
+}
+
+mqtt_payload_format_t mqtt_service_get_payload_format(void)
+{
+    return host_payload_format;
+}
+
+esp_err_t mqtt_rpc_register(const char *method, mqtt_rpc_handler_t fn,
+                            void *ctx, uint32_t timeout_ms)
+{
+    return ESP_OK;
+}
+
+bool mqtt_rpc_json_get(const char *json, const char *key, char *out, size_t size)
+{
+    return false;
+}
+
+void supervisor_heartbeat(const char *name)
+{
+}
+
+/* ---- ds18b20_history: nothing kept ---- */
+
+void ds18b20_history_add(uint64_t rom, int64_t now_us, float temp)
+{
+}
+
+esp_err_t ds18b20_history_query(uint64_t rom, ds18b20_history_tier_t tier,
+                                int64_t from_ms, int64_t to_ms,
+                                ds18b20_history_point_t *out, int max,
+                                int *count, int64_t *next_ms)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+uint32_t ds18b20_history_step_ms(ds18b20_history_tier_t tier) { return 0; }
+int      ds18b20_history_series(void)                         { return 0; }
+uint32_t ds18b20_history_kb(void)                             { return 0; }
@@ -0,0 +1,20 @@
+/*
+ * ds18b20_env.h - Host stand-ins for what ds18b20_temp.c talks to beyond
+ * the bus: config_store, mqtt_service, mqtt_rpc, supervisor and the PSRAM
+ * history (ds18b20_env.c)
+ *
+ * Publishes are accepted and only measured; the payload format is the
+ * caller's to set.
+ */
+
+#ifndef HOST_DS18B20_ENV_H
+#define HOST_DS18B20_ENV_H
+
+#include <stddef.h>
+#include "mqtt_service.h"
+
+extern mqtt_payload_format_t host_payload_format;
+extern unsigned              host_publishes;        /* accepted publishes */
+extern size_t                host_publish_bytes;    /* their payload bytes */
+
+#endif /* HOST_DS18B20_ENV_H */
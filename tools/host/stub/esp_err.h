@@ -0,0 +1,32 @@
+/*
+ * esp_err.h - Host stand-in for the ESP-IDF header of the same name
+ *
+ * Just enough for the main/ sources the host checks compile.
+ */
+
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_INVALID_SIZE        0x104
+#define ESP_ERR_NOT_FOUND           0x105
+#define ESP_ERR_NOT_SUPPORTED       0x106
+#define ESP_ERR_TIMEOUT             0x107
+#define ESP_ERR_INVALID_RESPONSE    0x108
+#define ESP_ERR_INVALID_CRC         0x109
+#define ESP_ERR_INVALID_VERSION     0x10A
+
+static inline const char *esp_err_to_name(esp_err_t e)
+{
+    return e == ESP_OK ? "ESP_OK" : "ESP_ERR";
+}
+
+#endif /* HOST_ESP_ERR_H */
@@ -0,0 +1,10 @@
+/*
+ * esp_netif.h - Host stand-in: nothing the host checks call
+ */
+
+#ifndef HOST_ESP_NETIF_H
+#define HOST_ESP_NETIF_H
+
+#include "esp_err.h"
+
+#endif /* HOST_ESP_NETIF_H */
@@ -0,0 +1,27 @@
+/*
+ * esp_partition.h - Host stand-in: a partition is a buffer in RAM
+ */
+
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+
+typedef struct {
+    const char    *label;
+    uint32_t       size;
+    const uint8_t *data;        /* host only: the partition contents */
+} esp_partition_t;
+
+static inline esp_err_t esp_partition_read(const esp_partition_t *p, size_t off,
+                                           void *dst, size_t len)
+{
+    if (off > p->size || len > p->size - off) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, p->data + off, len);
+    return ESP_OK;
+}
+
+#endif /* HOST_ESP_PARTITION_H */
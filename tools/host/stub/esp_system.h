@@ -0,0 +1,13 @@
+/*
+ * esp_system.h - Host stand-in: heap query only
+ */
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+static inline uint32_t esp_get_free_heap_size(void) { return 256 * 1024; }
+
+#endif /* HOST_ESP_SYSTEM_H */
@@ -0,0 +1,10 @@
+/*
+ * esp_task_wdt.h - Host stand-in: no watchdog (CONFIG_ESP_TASK_WDT unset)
+ */
+
+#ifndef HOST_ESP_TASK_WDT_H
+#define HOST_ESP_TASK_WDT_H
+
+#include "esp_err.h"
+
+#endif /* HOST_ESP_TASK_WDT_H */
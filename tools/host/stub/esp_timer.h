@@ -0,0 +1,22 @@
+/*
+ * esp_timer.h - Host stand-in: esp_timer_get_time() is set by the test,
+ * or follows the monotonic clock while host_time_us is negative
+ */
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+extern int64_t host_time_us;
+
+static inline int64_t esp_timer_get_time(void)
+{
+    if (host_time_us >= 0) return host_time_us;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif /* HOST_ESP_TIMER_H */
@@ -0,0 +1,10 @@
+/*
+ * esp_transport.h - Host stand-in: the handle type mqtt_tls.h names
+ */
+
+#ifndef HOST_ESP_TRANSPORT_H
+#define HOST_ESP_TRANSPORT_H
+
+typedef struct esp_transport_item_t *esp_transport_handle_t;
+
+#endif /* HOST_ESP_TRANSPORT_H */
@@ -0,0 +1,23 @@
+/*
+ * freertos/FreeRTOS.h - Host stand-in: types and macros of the FreeRTOS
+ * API the host checks use; tasks are pthreads (freertos_host.c)
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFFu)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+#endif /* HOST_FREERTOS_H */
@@ -0,0 +1,20 @@
+/*
+ * freertos/queue.h - Host stand-in: fixed-size item ring under a mutex
+ */
+
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size);
+void          vQueueDelete(QueueHandle_t q);
+BaseType_t    xQueueSend(QueueHandle_t q, const void *item, TickType_t wait);
+BaseType_t    xQueueReceive(QueueHandle_t q, void *item, TickType_t wait);
+BaseType_t    xQueueReset(QueueHandle_t q);
+BaseType_t    xQueuePeek(QueueHandle_t q, void *item, TickType_t wait);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t q);
+
+#endif /* HOST_FREERTOS_QUEUE_H */
@@ -0,0 +1,31 @@
+/*
+ * freertos/task.h - Host stand-in: a task is a detached pthread, a tick
+ * one millisecond
+ */
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *handle);
+void       vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+void       vTaskDelete(TaskHandle_t task);
+
+/* Handles are not tracked: every task is "running", its handle NULL */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+eTaskState   eTaskGetState(TaskHandle_t task);
+
+/* One notification count for the whole process, not one per task: enough
+ * for the single waiter of the code under test */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t   ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+
+#endif /* HOST_FREERTOS_TASK_H */
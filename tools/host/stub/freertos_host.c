@@ -0,0 +1,221 @@
+/*
+ * freertos_host.c - pthread implementation of the FreeRTOS stand-ins
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    UBaseType_t     len, size, head, count;
+    uint8_t        *items;
+};
+
+typedef struct {
+    TaskFunction_t fn;
+    void          *arg;
+} task_start_t;
+
+static void *task_main(void *p)
+{
+    task_start_t t = *(task_start_t *)p;
+    free(p);
+    t.fn(t.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+    (void)name; (void)stack; (void)prio;
+    task_start_t *t = malloc(sizeof(*t));
+    if (t == NULL) return pdFAIL;
+    t->fn  = fn;
+    t->arg = arg;
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, task_main, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(th);
+    if (handle) *handle = NULL;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { ticks / 1000, (long)(ticks % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL) pthread_exit(NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+eTaskState eTaskGetState(TaskHandle_t task)
+{
+    (void)task;
+    return eRunning;
+}
+
+static pthread_mutex_t s_notify_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  s_notify_changed = PTHREAD_COND_INITIALIZER;
+static uint32_t        s_notify;
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    (void)task;
+    pthread_mutex_lock(&s_notify_lock);
+    s_notify++;
+    pthread_cond_broadcast(&s_notify_changed);
+    pthread_mutex_unlock(&s_notify_lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec  += wait / 1000;
+    until.tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&s_notify_lock);
+    while (s_notify == 0 && wait != 0) {
+        int rc = wait == portMAX_DELAY
+               ? pthread_cond_wait(&s_notify_changed, &s_notify_lock)
+               : pthread_cond_timedwait(&s_notify_changed, &s_notify_lock, &until);
+        if (rc == ETIMEDOUT) break;
+    }
+    uint32_t n = s_notify;
+    if (n > 0) s_notify = clear ? 0 : n - 1;
+    pthread_mutex_unlock(&s_notify_lock);
+    return n;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    QueueHandle_t q = calloc(1, sizeof(*q));
+    if (q == NULL) return NULL;
+    q->items = calloc(len, item_size);
+    if (q->items == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->len  = len;
+    q->size = item_size;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q == NULL) return;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+    free(q->items);
+    free(q);
+}
+
+/* Wait on q->changed until ok(q) or `wait` ms pass; lock held */
+static int wait_until(QueueHandle_t q, TickType_t wait, int (*ok)(QueueHandle_t))
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec  += wait / 1000;
+    until.tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    while (!ok(q)) {
+        if (wait == 0) return 0;
+        int rc = (wait == portMAX_DELAY)
+               ? pthread_cond_wait(&q->changed, &q->lock)
+               : pthread_cond_timedwait(&q->changed, &q->lock, &until);
+        if (rc == ETIMEDOUT) return ok(q);
+    }
+    return 1;
+}
+
+static int has_room(QueueHandle_t q)  { return q->count < q->len; }
+static int has_items(QueueHandle_t q) { return q->count > 0; }
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    int ok = wait_until(q, wait, has_room);
+    if (ok) {
+        memcpy(q->items + ((q->head + q->count) % q->len) * q->size, item, q->size);
+        q->count++;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    int ok = wait_until(q, wait, has_items);
+    if (ok) {
+        memcpy(item, q->items + q->head * q->size, q->size);
+        q->head = (q->head + 1) % q->len;
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->head  = 0;
+    q->count = 0;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    int ok = wait_until(q, wait, has_items);
+    if (ok) memcpy(item, q->items + q->head * q->size, q->size);
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
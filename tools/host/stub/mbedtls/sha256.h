@@ -0,0 +1,25 @@
+/*
+ * mbedtls/sha256.h - Host stand-in: the mbedtls SHA-256 calls ota_delta.c
+ * makes, on a plain FIPS 180-4 implementation (sha256_host.c)
+ */
+
+#ifndef HOST_MBEDTLS_SHA256_H
+#define HOST_MBEDTLS_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t total;             /* bytes hashed */
+    uint8_t  buf[64];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+int  mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224);
+int  mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input,
+                           size_t ilen);
+int  mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]);
+
+#endif /* HOST_MBEDTLS_SHA256_H */
@@ -0,0 +1,54 @@
+/*
+ * mqtt_env.c - Host stand-ins around mqtt_service.c (see mqtt_env.h)
+ */
+
+#include "mqtt_env.h"
+#include "display_service.h"
+#include "mqtt_ota.h"
+#include "mqtt_tls.h"
+#include "network_service.h"
+#include "supervisor.h"
+#include <string.h>
+
+atomic_uint host_display_texts;
+atomic_uint host_display_times;
+
+/* ---- display_service ---- */
+
+void display_service_set_text(const char *text)       { atomic_fetch_add(&host_display_texts, 1); }
+void display_service_set_time(const char *time_str)   { atomic_fetch_add(&host_display_times, 1); }
+void display_service_set_mqtt_connected(bool connected) {}
+
+/* ---- network_service ---- */
+
+bool network_service_has_ip(void)          { return true; }
+const char *network_service_get_ip(void)   { return "127.0.0.1"; }
+
+esp_err_t network_service_get_mac(uint8_t mac[6])
+{
+    static const uint8_t k_mac[6] = { 0xAA, 0xBB, 0xCC, 0xA1, 0xB2, 0xC3 };
+    memcpy(mac, k_mac, sizeof(k_mac));
+    return ESP_OK;
+}
+
+/* ---- supervisor ---- */
+
+void supervisor_heartbeat(const char *name)      {}
+const char *supervisor_get_last_crash(void)      { return ""; }
+
+/* ---- mqtt_ota: no session, nothing claimed ---- */
+
+esp_err_t mqtt_ota_init(const char *topic_prefix)          { return ESP_OK; }
+const char *mqtt_ota_filter(int i, char *buf, size_t size) { return NULL; }
+void mqtt_ota_on_connect(void)                             {}
+void mqtt_ota_tick(int64_t now_us)                         {}
+
+bool mqtt_ota_on_raw(const char *topic, int topic_len, const uint8_t *data,
+                     int len, int offset, int total, void *ctx)
+{
+    return false;
+}
+
+/* ---- mqtt_tls: plain connections only ---- */
+
+void mqtt_tls_write_health(health_writer_t *hw) {}
@@ -0,0 +1,17 @@
+/*
+ * mqtt_env.h - Host stand-ins for what mqtt_service.c talks to beyond the
+ * MQTT client (mqtt_env.c): display, network, supervisor, OTA and TLS
+ *
+ * The network is up with MAC AA:BB:CC:A1:B2:C3; the display only counts
+ * what it is handed.
+ */
+
+#ifndef HOST_MQTT_ENV_H
+#define HOST_MQTT_ENV_H
+
+#include <stdatomic.h>
+
+extern atomic_uint host_display_texts;
+extern atomic_uint host_display_times;
+
+#endif /* HOST_MQTT_ENV_H */
@@ -0,0 +1,46 @@
+/*
+ * nvs.h - Host stand-in: an NVS that stays empty (reads find nothing,
+ * writes are dropped)
+ */
+
+#ifndef HOST_NVS_H
+#define HOST_NVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+#define ESP_ERR_NVS_NOT_FOUND       0x1102
+
+static inline esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *h)
+{
+    (void)ns;
+    *h = 1;
+    return mode == NVS_READONLY ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+static inline void nvs_close(nvs_handle_t h) { (void)h; }
+static inline esp_err_t nvs_commit(nvs_handle_t h) { (void)h; return ESP_OK; }
+static inline esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *len)
+{
+    (void)h; (void)key; (void)out; (void)len;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+static inline esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *v, size_t len)
+{
+    (void)h; (void)key; (void)v; (void)len;
+    return ESP_OK;
+}
+static inline esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+    (void)h; (void)key;
+    return ESP_OK;
+}
+
+#endif /* HOST_NVS_H */
@@ -0,0 +1,14 @@
+/*
+ * onewire_cmd.h - Host stand-in: 1-Wire ROM commands
+ */
+
+#ifndef HOST_ONEWIRE_CMD_H
+#define HOST_ONEWIRE_CMD_H
+
+#define ONEWIRE_CMD_SEARCH_NORMAL   0xF0
+#define ONEWIRE_CMD_MATCH_ROM       0x55
+#define ONEWIRE_CMD_SKIP_ROM        0xCC
+#define ONEWIRE_CMD_SEARCH_ALARM    0xEC
+#define ONEWIRE_CMD_READ_POWER_SUPPLY 0xB4
+
+#endif /* HOST_ONEWIRE_CMD_H */
@@ -0,0 +1,13 @@
+/*
+ * onewire_crc.h - Host stand-in: Dallas CRC-8 (onewire_sim.c)
+ */
+
+#ifndef HOST_ONEWIRE_CRC_H
+#define HOST_ONEWIRE_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t onewire_crc8(uint8_t init_crc, uint8_t *input, size_t input_size);
+
+#endif /* HOST_ONEWIRE_CRC_H */
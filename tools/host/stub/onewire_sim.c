@@ -0,0 +1,342 @@
+/*
+ * onewire_sim.c - Simulated 1-Wire bus and the DS18B20 component calls on
+ * top of it (see onewire_sim.h)
+ */
+
+#include "onewire_sim.h"
+#include "onewire_cmd.h"
+#include "onewire_crc.h"
+#include "ds18b20.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CMD_CONVERT_T       0x44
+#define CMD_READ_SP         0xBE
+#define CMD_WRITE_SP        0x4E
+#define CMD_READ_POWER      0xB4
+
+typedef enum {
+    ST_IDLE,                    /* after a transaction: needs a reset */
+    ST_ROM,                     /* after reset: ROM command */
+    ST_MATCH,                   /* collecting 8 ROM bytes */
+    ST_FUNC,                    /* function command */
+    ST_WRITE_SP,                /* TH, TL, config */
+    ST_READ_SP,
+    ST_POWER,
+} sim_state_t;
+
+typedef struct {
+    uint64_t rom;
+    int16_t  raw;               /* 1/16 degC */
+    uint8_t  sp[9];
+    bool     fresh;             /* converted since the last read */
+    bool     corrupt;
+} sim_dev_t;
+
+struct onewire_bus_t {
+    int dummy;
+};
+
+struct ds18b20_device_t {
+    onewire_bus_handle_t bus;
+    uint64_t             rom;
+};
+
+struct onewire_device_iter_t {
+    int next;
+};
+
+static struct onewire_bus_t s_bus;
+static sim_dev_t           s_dev[ONEWIRE_SIM_DEVICES_MAX];
+static int                 s_n;
+static onewire_sim_stats_t s_stats;
+
+static sim_state_t s_state;
+static int         s_sel;       /* -1 none, -2 all, else device index */
+static uint8_t     s_match[8];
+static int         s_match_len;
+static int         s_sp_len;
+static int         s_busy;      /* read slots still answering 0 */
+
+/* ---- CRC ---- */
+
+uint8_t onewire_crc8(uint8_t crc, uint8_t *p, size_t n)
+{
+    while (n--) {
+        uint8_t b = *p++;
+        for (int i = 0; i < 8; i++) {
+            uint8_t mix = (crc ^ b) & 1;
+            crc >>= 1;
+            if (mix) crc ^= 0x8C;
+            b >>= 1;
+        }
+    }
+    return crc;
+}
+
+/* ---- simulation control ---- */
+
+static void set_sp(sim_dev_t *d, int16_t raw)
+{
+    d->sp[0] = (uint8_t)raw;
+    d->sp[1] = (uint8_t)(raw >> 8);
+    d->sp[8] = onewire_crc8(0, d->sp, 8);
+}
+
+void onewire_sim_init(int n, float base)
+{
+    if (n > ONEWIRE_SIM_DEVICES_MAX) n = ONEWIRE_SIM_DEVICES_MAX;
+    s_n = n;
+    for (int i = 0; i < n; i++) {
+        sim_dev_t *d = &s_dev[i];
+        memset(d, 0, sizeof(*d));
+        uint8_t r[8] = { 0x28, (uint8_t)i, (uint8_t)(i >> 8), 0xA5, 0x5A, 0x11, 0x22, 0 };
+        r[7] = onewire_crc8(0, r, 7);
+        for (int k = 7; k >= 0; k--) d->rom = (d->rom << 8) | r[k];
+        d->raw = (int16_t)(base * 16.0f + 0.5f) + (int16_t)i;
+        static const uint8_t por[9] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0 };
+        memcpy(d->sp, por, sizeof(por));
+        set_sp(d, 0x0550);                          /* 85 degC power-on */
+    }
+    s_state = ST_IDLE;
+    onewire_sim_clear_stats();
+}
+
+uint64_t onewire_sim_rom(int i)
+{
+    return (i >= 0 && i < s_n) ? s_dev[i].rom : 0;
+}
+
+void onewire_sim_corrupt_next(int i)
+{
+    if (i >= 0 && i < s_n) s_dev[i].corrupt = true;
+}
+
+onewire_sim_stats_t onewire_sim_stats(void)
+{
+    return s_stats;
+}
+
+void onewire_sim_clear_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+/* ---- onewire_bus ---- */
+
+esp_err_t onewire_new_bus_rmt(const onewire_bus_config_t *bus_config,
+                              const onewire_bus_rmt_config_t *rmt_config,
+                              onewire_bus_handle_t *ret_bus)
+{
+    *ret_bus = &s_bus;
+    return ESP_OK;
+}
+
+esp_err_t onewire_bus_del(onewire_bus_handle_t bus)
+{
+    return ESP_OK;
+}
+
+esp_err_t onewire_bus_reset(onewire_bus_handle_t bus)
+{
+    s_stats.resets++;
+    s_state = ST_ROM;
+    s_sel   = -1;
+    return s_n > 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static void convert(int i)
+{
+    set_sp(&s_dev[i], s_dev[i].raw);
+    s_dev[i].fresh = true;
+}
+
+static void on_byte(uint8_t b)
+{
+    switch (s_state) {
+    case ST_ROM:
+        if (b == ONEWIRE_CMD_SKIP_ROM) {
+            s_sel   = -2;
+            s_state = ST_FUNC;
+        } else if (b == ONEWIRE_CMD_MATCH_ROM) {
+            s_match_len = 0;
+            s_state     = ST_MATCH;
+        } else {
+            s_state = ST_IDLE;
+        }
+        break;
+    case ST_MATCH:
+        s_match[s_match_len++] = b;
+        if (s_match_len == 8) {
+            uint64_t rom = 0;
+            for (int k = 7; k >= 0; k--) rom = (rom << 8) | s_match[k];
+            s_sel = -1;
+            for (int i = 0; i < s_n; i++) {
+                if (s_dev[i].rom == rom) s_sel = i;
+            }
+            s_state = ST_FUNC;
+        }
+        break;
+    case ST_FUNC:
+        if (b == CMD_CONVERT_T) {
+            if (s_sel == -2) {
+                for (int i = 0; i < s_n; i++) convert(i);
+                s_stats.convert_all++;
+            } else if (s_sel >= 0) {
+                convert(s_sel);
+                s_stats.convert_one++;
+            }
+            s_busy  = 1;
+            s_state = ST_IDLE;
+        } else if (b == CMD_READ_SP && s_sel >= 0) {
+            s_stats.reads++;
+            if (!s_dev[s_sel].fresh) s_stats.stale++;
+            s_dev[s_sel].fresh = false;
+            s_sp_len = 0;
+            s_state  = ST_READ_SP;
+        } else if (b == CMD_WRITE_SP) {
+            s_sp_len = 0;
+            s_state  = ST_WRITE_SP;
+        } else if (b == CMD_READ_POWER) {
+            s_state = ST_POWER;
+        } else {
+            s_state = ST_IDLE;
+        }
+        break;
+    case ST_WRITE_SP:
+        for (int i = 0; i < s_n; i++) {
+            if (s_sel == -2 || s_sel == i) {
+                s_dev[i].sp[2 + s_sp_len] = b;
+                set_sp(&s_dev[i], (int16_t)(s_dev[i].sp[0] | (s_dev[i].sp[1] << 8)));
+            }
+        }
+        if (++s_sp_len == 3) s_state = ST_IDLE;
+        break;
+    default:
+        break;
+    }
+}
+
+esp_err_t onewire_bus_write_bytes(onewire_bus_handle_t bus, const uint8_t *tx_data,
+                                  uint8_t tx_data_size)
+{
+    for (int i = 0; i < tx_data_size; i++) on_byte(tx_data[i]);
+    s_stats.bytes_out += tx_data_size;
+    return ESP_OK;
+}
+
+esp_err_t onewire_bus_read_bytes(onewire_bus_handle_t bus, uint8_t *rx_buf,
+                                 size_t rx_buf_size)
+{
+    s_stats.bytes_in += (unsigned)rx_buf_size;
+    for (size_t i = 0; i < rx_buf_size; i++) {
+        uint8_t v = 0xFF;                           /* nobody drives the bus */
+        if (s_state == ST_READ_SP && s_sp_len < 9) {
+            sim_dev_t *d = &s_dev[s_sel];
+            v = d->sp[s_sp_len++];
+            if (s_sp_len == 9 && d->corrupt) {
+                v ^= 0x01;
+                d->corrupt = false;
+            }
+        }
+        rx_buf[i] = v;
+    }
+    return ESP_OK;
+}
+
+esp_err_t onewire_bus_write_bit(onewire_bus_handle_t bus, uint8_t tx_bit)
+{
+    return ESP_OK;
+}
+
+esp_err_t onewire_bus_read_bit(onewire_bus_handle_t bus, uint8_t *rx_bit)
+{
+    s_stats.bits_in++;
+    if (s_state == ST_POWER) {
+        *rx_bit = 1;                                /* every device on VDD */
+        s_state = ST_IDLE;
+    } else if (s_busy > 0) {
+        *rx_bit = 0;
+        s_busy--;
+    } else {
+        *rx_bit = 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t onewire_new_device_iter(onewire_bus_handle_t bus,
+                                  onewire_device_iter_handle_t *ret_iter)
+{
+    *ret_iter = calloc(1, sizeof(**ret_iter));
+    return *ret_iter ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t onewire_del_device_iter(onewire_device_iter_handle_t iter)
+{
+    free(iter);
+    return ESP_OK;
+}
+
+esp_err_t onewire_device_iter_get_next(onewire_device_iter_handle_t iter,
+                                       onewire_device_t *dev)
+{
+    if (iter->next >= s_n) return ESP_ERR_NOT_FOUND;
+    dev->bus     = &s_bus;
+    dev->address = s_dev[iter->next++].rom;
+    return ESP_OK;
+}
+
+/* ---- ds18b20 component: one transaction per call ---- */
+
+static esp_err_t select_dev(ds18b20_device_handle_t ds, uint8_t cmd)
+{
+    uint8_t tx[10] = { ONEWIRE_CMD_MATCH_ROM };
+    for (int k = 0; k < 8; k++) tx[1 + k] = (uint8_t)(ds->rom >> (8 * k));
+    tx[9] = cmd;
+    esp_err_t err = onewire_bus_reset(ds->bus);
+    if (err == ESP_OK) err = onewire_bus_write_bytes(ds->bus, tx, sizeof(tx));
+    return err;
+}
+
+esp_err_t ds18b20_new_device_from_enumeration(onewire_device_t *device,
+                                              const ds18b20_config_t *config,
+                                              ds18b20_device_handle_t *ret_ds18b20)
+{
+    ds18b20_device_handle_t ds = calloc(1, sizeof(*ds));
+    if (ds == NULL) return ESP_ERR_NO_MEM;
+    ds->bus = device->bus;
+    ds->rom = device->address;
+    *ret_ds18b20 = ds;
+    return ESP_OK;
+}
+
+esp_err_t ds18b20_del_device(ds18b20_device_handle_t ds18b20)
+{
+    free(ds18b20);
+    return ESP_OK;
+}
+
+esp_err_t ds18b20_set_resolution(ds18b20_device_handle_t ds18b20,
+                                 ds18b20_resolution_t resolution)
+{
+    esp_err_t err = select_dev(ds18b20, CMD_WRITE_SP);
+    uint8_t tx[3] = { 0x4B, 0x46, (uint8_t)(0x1F | (resolution << 5)) };
+    if (err == ESP_OK) err = onewire_bus_write_bytes(ds18b20->bus, tx, sizeof(tx));
+    return err;
+}
+
+esp_err_t ds18b20_trigger_temperature_conversion(ds18b20_device_handle_t ds18b20)
+{
+    return select_dev(ds18b20, CMD_CONVERT_T);
+}
+
+esp_err_t ds18b20_get_temperature(ds18b20_device_handle_t ds18b20, float *temperature)
+{
+    uint8_t sp[9];
+    esp_err_t err = select_dev(ds18b20, CMD_READ_SP);
+    if (err == ESP_OK) err = onewire_bus_read_bytes(ds18b20->bus, sp, sizeof(sp));
+    if (err != ESP_OK) return err;
+    if (onewire_crc8(0, sp, 8) != sp[8]) return ESP_ERR_INVALID_CRC;
+    *temperature = (float)(int16_t)(sp[0] | (sp[1] << 8)) / 16.0f;
+    return ESP_OK;
+}
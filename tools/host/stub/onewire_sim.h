@@ -0,0 +1,45 @@
+/*
+ * onewire_sim.h - Simulated 1-Wire bus of DS18B20s behind the host
+ * onewire_bus.h / ds18b20.h stand-ins
+ *
+ * One bus.  Every device answers Skip ROM and Match ROM, Convert T, Read /
+ * Write Scratchpad and Read Power Supply (all externally powered).  A
+ * Convert T loads the device's temperature into its scratchpad; the bus
+ * then reads busy (0) for one read-slot poll.  Reading a scratchpad that
+ * no conversion has refreshed since the last read counts as stale.
+ *
+ * The counters are what the DS18B20 code costs on a real bus: every reset
+ * pulse starts a transaction.
+ */
+
+#ifndef HOST_ONEWIRE_SIM_H
+#define HOST_ONEWIRE_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "onewire_bus.h"
+
+#define ONEWIRE_SIM_DEVICES_MAX     128
+
+typedef struct {
+    unsigned resets;            /* transactions */
+    unsigned bytes_out;
+    unsigned bytes_in;
+    unsigned bits_in;           /* read slots (busy polls, power query) */
+    unsigned convert_all;       /* Skip ROM + Convert T */
+    unsigned convert_one;       /* Match ROM + Convert T */
+    unsigned reads;             /* scratchpads read */
+    unsigned stale;             /* ... without a conversion since the last */
+} onewire_sim_stats_t;
+
+/** n devices with valid ROM codes; device i reads base + i * 0.0625. */
+void     onewire_sim_init(int n, float base);
+uint64_t onewire_sim_rom(int i);
+
+/** Scratchpad of device i fails its CRC on the next read. */
+void     onewire_sim_corrupt_next(int i);
+
+onewire_sim_stats_t onewire_sim_stats(void);
+void     onewire_sim_clear_stats(void);
+
+#endif /* HOST_ONEWIRE_SIM_H */
@@ -0,0 +1,171 @@
+/*
+ * test_brokers.c - Broker failover against two local broker stand-ins
+ *
+ * Two listening sockets on 127.0.0.1 stand in for the primary and a
+ * backup; a port nobody listens on is a second backup that refuses.  The
+ * test drives mqtt_brokers the way broker_tick() does -- poll(), then
+ * select() every service-loop tick -- with the real probe task (a pthread
+ * here) doing the TCP probes.
+ *
+ * Checks:
+ *   - no poll() / select() call blocks (each well under one tick)
+ *   - primary down -> the reachable backup is picked, the refusing one
+ *     never; the switchover time (primary failure -> pick) is printed
+ *   - the RTT is the probe's TCP handshake: a connect does not change it
+ *   - fail-back probes of the primary: FAILED while it is down, OK once it
+ *     listens again
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "health_payload.h"
+#include "mqtt_brokers.h"
+#include "check.h"
+
+#define TICK_MS         100         /* mqtt_service loop period */
+#define CALL_MAX_US     5000        /* "does not block" */
+
+int64_t host_time_us = -1;          /* follow the monotonic clock */
+
+/* ---- stand-ins ---- */
+
+/* Listen on 127.0.0.1:port (0 = any); the kernel completes handshakes
+ * from the backlog, which is all a probe needs */
+static int stand_in(uint16_t *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons(*port) };
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    socklen_t len = sizeof(a);
+    getsockname(fd, (struct sockaddr *)&a, &len);
+    *port = ntohs(a.sin_port);
+    return fd;
+}
+
+/* A port that refuses: bound once, then released */
+static uint16_t dead_port(void)
+{
+    uint16_t port = 0;
+    close(stand_in(&port));
+    return port;
+}
+
+/* ---- helpers ---- */
+
+static int64_t s_call_max_us;
+
+/* One broker_tick(): poll, then select; track the longest call */
+static int tick(int64_t *ready_at_us)
+{
+    int64_t t0 = esp_timer_get_time();
+    mqtt_brokers_poll(t0);
+    int idx = mqtt_brokers_select(t0, ready_at_us);
+    int64_t dt = esp_timer_get_time() - t0;
+    if (dt > s_call_max_us) s_call_max_us = dt;
+    return idx;
+}
+
+static void rtt_json(char *out, size_t size)
+{
+    static char buf[256];
+    health_writer_t hw = { .cbor = false };
+    json_writer_init(&hw.u.json, buf, sizeof(buf));
+    health_begin_object(&hw, NULL);
+    mqtt_brokers_write_health(&hw);
+    health_end_object(&hw);
+    const char *r = strstr(buf, "\"rtt\":[");
+    const char *e = r ? strchr(r, ']') : NULL;
+    snprintf(out, size, "%.*s", (r && e) ? (int)(e - r + 1) : 0, r ? r : "");
+}
+
+static mqtt_probe_state_t probe_wait(int idx)
+{
+    mqtt_brokers_probe_start(idx, esp_timer_get_time());
+    for (int i = 0; i < 300; i++) {                  /* 3 s in 10 ms steps */
+        int64_t ready;
+        tick(&ready);
+        mqtt_probe_state_t st = mqtt_brokers_probe_state(idx);
+        if (st != MQTT_PROBE_PENDING) return st;
+        usleep(10000);
+    }
+    return MQTT_PROBE_PENDING;
+}
+
+int main(void)
+{
+    uint16_t pa = 0, pb = 0, pd = dead_port();
+    int a = stand_in(&pa);
+    int b = stand_in(&pb);
+    CHECK(a >= 0 && b >= 0, "stand-ins not listening");
+
+    char primary[64], backups[128];
+    snprintf(primary, sizeof(primary), "mqtt://127.0.0.1:%u", pa);
+    snprintf(backups, sizeof(backups), "mqtt://127.0.0.1:%u,mqtt://127.0.0.1:%u", pd, pb);
+
+    CHECK(mqtt_brokers_init() == ESP_OK, "probe task");
+    CHECK(mqtt_brokers_load(primary, backups) == 3, "3 brokers");
+
+    /* Primary healthy: picked at once, nothing probed */
+    int64_t ready;
+    int idx = tick(&ready);
+    CHECK(idx == 0 && ready <= esp_timer_get_time(), "primary first: got %d", idx);
+    CHECK(mqtt_brokers_probe_state(1) == MQTT_PROBE_NONE &&
+          mqtt_brokers_probe_state(2) == MQTT_PROBE_NONE, "probed too early");
+
+    /* Primary goes away: its connect fails, select must find broker 2 */
+    close(a);
+    int64_t down_us = esp_timer_get_time();
+    mqtt_brokers_on_failed(0, down_us);
+    int picked = -1, ticks = 0;
+    while (ticks++ < 50) {
+        idx = tick(&ready);
+        if (ready <= esp_timer_get_time()) {
+            picked = idx;
+            break;
+        }
+        usleep(TICK_MS * 1000);
+    }
+    int64_t switch_ms = (esp_timer_get_time() - down_us) / 1000;
+    CHECK(picked == 2, "picked broker %d, want 2", picked);
+    CHECK(mqtt_brokers_probe_state(1) == MQTT_PROBE_FAILED, "refusing backup not failed");
+    CHECK(mqtt_brokers_probe_state(2) == MQTT_PROBE_OK, "reachable backup not ok");
+    CHECK(switch_ms < 1000, "switchover took %lld ms", (long long)switch_ms);
+    printf("switchover: broker %d after %lld ms (%d ticks of %d ms)\n",
+           picked, (long long)switch_ms, ticks, TICK_MS);
+
+    /* One RTT measure: a connect leaves it alone */
+    char before[64], after[64];
+    rtt_json(before, sizeof(before));
+    mqtt_brokers_on_connected(2);
+    rtt_json(after, sizeof(after));
+    CHECK(strcmp(before, after) == 0, "connect changed rtt: %s -> %s", before, after);
+    CHECK(strstr(before, "[null,null,") != NULL, "rtt %s: want [null,null,<ms>]", before);
+    printf("rtt after switchover: %s\n", before);
+
+    /* Fail-back probes of the primary */
+    CHECK(probe_wait(0) == MQTT_PROBE_FAILED, "probe of a closed primary");
+    a = stand_in(&pa);
+    CHECK(a >= 0, "primary stand-in back on %u", pa);
+    CHECK(probe_wait(0) == MQTT_PROBE_OK, "probe of a listening primary");
+    idx = tick(&ready);
+    CHECK(idx == 0 && ready <= esp_timer_get_time(), "fail back: got %d", idx);
+
+    printf("longest poll+select: %lld us\n", (long long)s_call_max_us);
+    CHECK(s_call_max_us < CALL_MAX_US, "a call blocked for %lld us",
+          (long long)s_call_max_us);
+
+    close(a);
+    close(b);
+    return check_result();
+}
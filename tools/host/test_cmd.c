@@ -0,0 +1,236 @@
+/*
+ * test_cmd.c - Inbound command path of mqtt_service under a flood
+ *
+ * mqtt_service.c runs as on the node -- service task, publish task,
+ * config_store, mqtt_subs / mqtt_rate / mqtt_rpc / device_shadow -- on
+ * top of an in-process broker stand-in (stub/broker_host.c).  This thread
+ * plays the esp-mqtt task: it connects, then floods relay1..4 on/off,
+ * text and /SYS/time round-robin at RATE messages/s and sends PING_RATE
+ * timestamped pings a second to /<node>/ping.  The node echoes each one
+ * to /<node>/pong through its outbound queue and publish task, so every
+ * pong is one callback -> publish round trip measured under the flood.
+ * A stand-in of the mqtt supervisor drains the service's event queue.
+ *
+ *   ./test_cmd [RATE [PING_RATE [SECONDS]]]     (make load RATE=5000 ...)
+ *
+ * Checks (the regression gate, at any rate):
+ *   - every ping answered, cmd_drop 0
+ *   - every text / time reached the display, every relay command was
+ *     counted in the "relay" class
+ *   - round trip p99 under RTT_P99_MAX_US; no command class took longer
+ *     than CB_MAX_US in the callback
+ * PING_RATE above the default "#=20:40" rate rule is answered with drops
+ * by design.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "broker_host.h"
+#include "mqtt_env.h"
+#include "config_store.h"
+#include "health_payload.h"
+#include "mqtt_service.h"
+#include "check.h"
+
+#define RATE_DEFAULT        1000    /* flood messages/s */
+#define PING_RATE_DEFAULT   10      /* under the "#" rule's 20/s */
+#define SECS_DEFAULT        2
+#define GRACE_MS            500     /* for the last pongs */
+#define RTT_P99_MAX_US      20000
+#define CB_MAX_US           10000
+
+int64_t host_time_us = -1;          /* follow the monotonic clock */
+extern char s_mac_id[];
+
+static char          s_pong_topic[48];
+static int64_t      *s_rtt;         /* per ping seq, 0 = no pong yet */
+static int           s_pings_max;
+static atomic_int    s_pongs;
+
+/* ---- broker side ---- */
+
+static void on_publish(const char *topic, const char *data, size_t len,
+                       int qos, int64_t now_us)
+{
+    if (strcmp(topic, s_pong_topic) != 0) return;
+    char    buf[48];
+    int     seq;
+    int64_t t0;
+    snprintf(buf, sizeof(buf), "%.*s", (int)len, data);
+    if (sscanf(buf, "%d %" SCNd64, &seq, &t0) != 2 || seq < 0 || seq >= s_pings_max) return;
+    if (s_rtt[seq] == 0) {
+        s_rtt[seq] = now_us - t0;
+        atomic_fetch_add(&s_pongs, 1);
+    }
+}
+
+/* mqtt_supervisor (system.c) without the logging */
+static void event_drain(void *arg)
+{
+    QueueHandle_t q;
+    while ((q = mqtt_service_get_queue()) == NULL) vTaskDelay(10);
+    for (;;) {
+        mqtt_service_message_t msg;
+        xQueueReceive(q, &msg, pdMS_TO_TICKS(1000));
+    }
+}
+
+static void sleep_until(int64_t t_us)
+{
+    int64_t d = t_us - esp_timer_get_time();
+    if (d <= 0) return;
+    struct timespec ts = { d / 1000000, (long)(d % 1000000) * 1000L };
+    nanosleep(&ts, NULL);
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* "<key>":{"n":N,"avg":A,"max":M of the mqtt_cmd provider; false if absent */
+static bool cmd_class(const char *json, const char *key, unsigned *n, unsigned *max)
+{
+    char pat[24];
+    snprintf(pat, sizeof(pat), "\"%s\":{", key);
+    const char *p = strstr(json, pat);
+    unsigned avg;
+    return p != NULL &&
+           sscanf(p + strlen(pat), "\"n\":%u,\"avg\":%u,\"max\":%u", n, &avg, max) == 3;
+}
+
+int main(int argc, char **argv)
+{
+    const int rate      = argc > 1 ? atoi(argv[1]) : RATE_DEFAULT;
+    const int ping_rate = argc > 2 ? atoi(argv[2]) : PING_RATE_DEFAULT;
+    const int secs      = argc > 3 ? atoi(argv[3]) : SECS_DEFAULT;
+    if (rate <= 0 || ping_rate <= 0 || secs <= 0) {
+        fprintf(stderr, "usage: %s [RATE [PING_RATE [SECONDS]]]\n", argv[0]);
+        return 2;
+    }
+
+    s_pings_max = ping_rate * secs + 1;
+    s_rtt = calloc((size_t)s_pings_max, sizeof(s_rtt[0]));
+    if (s_rtt == NULL) return 2;
+
+    broker_host_on_publish(on_publish);
+    config_store_init();
+    mqtt_service_start();
+    xTaskCreate(event_drain, "mqtt-super", 4096, NULL, 1, NULL);
+
+    CHECK(broker_host_wait_started(5000), "service never started the client");
+    broker_host_connect();
+    for (int i = 0; i < 1000 && !mqtt_service_can_publish(); i++) vTaskDelay(1);
+    CHECK(mqtt_service_can_publish(), "service not ready to publish");
+    if (s_fail) return check_result();
+
+    /* Topics: the node id is derived from the stand-in MAC at start */
+    char relay[4][48], text[48], ping[48];
+    for (int r = 0; r < 4; r++) snprintf(relay[r], sizeof(relay[r]), "/%s/relay%d", s_mac_id, r + 1);
+    snprintf(text, sizeof(text), "/%s/text", s_mac_id);
+    snprintf(ping, sizeof(ping), "/%s/ping", s_mac_id);
+    snprintf(s_pong_topic, sizeof(s_pong_topic), "/%s/pong", s_mac_id);
+
+    unsigned n_relay = 0, n_text = 0, n_time = 0;
+    int      n_ping  = 0;
+    const int64_t flood_step = 1000000 / rate;
+    const int64_t ping_step  = 1000000 / ping_rate;
+    const int64_t start      = esp_timer_get_time();
+    const int64_t end        = start + (int64_t)secs * 1000000;
+    int64_t next_flood = start, next_ping = start + ping_step / 2;
+
+    for (unsigned k = 0;;) {
+        const bool is_ping = next_ping <= next_flood;
+        const int64_t t = is_ping ? next_ping : next_flood;
+        if (t >= end) break;
+        sleep_until(t);
+
+        if (is_ping) {
+            char payload[32];
+            if (n_ping < s_pings_max) {
+                snprintf(payload, sizeof(payload), "%d %" PRId64, n_ping++,
+                         esp_timer_get_time());
+                broker_host_deliver(ping, payload);
+            }
+            next_ping += ping_step;
+            continue;
+        }
+        const unsigned slot = k % 6, round = k / 6;
+        k++;
+        switch (slot) {
+        case 0: case 1: case 2: case 3:
+            broker_host_deliver(relay[slot], (round & 1) ? "on" : "OFF");
+            n_relay++;
+            break;
+        case 4:
+            broker_host_deliver(text, "Coldroom 1: 4.2 C");
+            n_text++;
+            break;
+        default:
+            broker_host_deliver("/SYS/time", "12:34:56");
+            n_time++;
+            break;
+        }
+        next_flood += flood_step;
+    }
+    const double took_s = (double)(esp_timer_get_time() - start) / 1e6;
+    vTaskDelay(pdMS_TO_TICKS(GRACE_MS));
+
+    /* Round trips of the pongs that came back */
+    int     got = atomic_load(&s_pongs);
+    int64_t *rtt = malloc((size_t)(got > 0 ? got : 1) * sizeof(rtt[0]));
+    int      m   = 0;
+    for (int i = 0; i < n_ping && rtt != NULL; i++) {
+        if (s_rtt[i] > 0 && m < got) rtt[m++] = s_rtt[i];
+    }
+    if (rtt != NULL) qsort(rtt, (size_t)m, sizeof(rtt[0]), cmp_i64);
+#define PCT(p) (m > 0 ? (long long)rtt[(m - 1) * (p) / 100] : -1LL)
+
+    /* The node's own view: per-class callback time and drops */
+    char json[1024] = "";
+    health_writer_t hw = { .cbor = false };
+    json_writer_init(&hw.u.json, json, sizeof(json));
+    health_begin_object(&hw, NULL);
+    health_payload_write(&hw, "mqtt_cmd");
+    health_end_object(&hw);
+    unsigned drops = 0;
+    const char *d = strstr(json, "\"cmd_drop\":");
+    if (d != NULL) drops = (unsigned)strtoul(d + 11, NULL, 10);
+
+    printf("flood %d/s + %d pings/s for %.1f s: relay %u, text %u, time %u, ping %d\n",
+           rate, ping_rate, took_s, n_relay, n_text, n_time, n_ping);
+    printf("pongs %d/%d, round trip us p50 %lld p90 %lld p99 %lld max %lld\n",
+           got, n_ping, PCT(50), PCT(90), PCT(99), PCT(100));
+
+    static const char *const classes[] = { "relay", "text", "time", "ping" };
+    const unsigned sent[] = { n_relay, n_text, n_time, (unsigned)n_ping };
+    printf("callback max us:");
+    for (int c = 0; c < 4; c++) {
+        unsigned n = 0, max = 0;
+        bool have = cmd_class(json, classes[c], &n, &max);
+        printf(" %s %u", classes[c], max);
+        CHECK(have && n == sent[c], "%s: %u handled, %u sent", classes[c], n, sent[c]);
+        CHECK(max < CB_MAX_US, "%s: callback took %u us", classes[c], max);
+    }
+    printf(", cmd_drop %u\n", drops);
+
+    CHECK(got == n_ping, "%d of %d pings not answered", n_ping - got, n_ping);
+    CHECK(drops == 0, "cmd_drop %u", drops);
+    CHECK(atomic_load(&host_display_texts) == n_text, "display got %u of %u texts",
+          atomic_load(&host_display_texts), n_text);
+    CHECK(atomic_load(&host_display_times) == n_time, "display got %u of %u times",
+          atomic_load(&host_display_times), n_time);
+    CHECK(m > 0 && PCT(99) < RTT_P99_MAX_US, "round trip p99 %lld us", PCT(99));
+
+    free(rtt);
+    free(s_rtt);
+    return check_result();
+}
@@ -0,0 +1,158 @@
+/*
+ * test_delta.c - ota_delta.c on the host, applying a tools/mkdelta.py patch
+ *
+ *   test_delta [old.bin new.bin patch.mdl]
+ *
+ * Default inputs are the ones the Makefile builds: two consecutive builds
+ * of a host binary (delta_old.bin, delta_new.bin) and their patch.  The
+ * base partition is old.bin padded with erased flash (0xFF) to a slot of
+ * SLOT_LEN, as on the node.
+ *
+ * Checks:
+ *   - the patch rebuilds new.bin byte for byte, fed whole, in 1-byte
+ *     pieces and in random pieces up to an MQTT chunk, and
+ *     ota_delta_finish() accepts it
+ *   - a base that is not old.bin is refused ("base") before any output
+ *   - a truncated patch fails "truncated", a corrupted one never passes
+ * and prints the patch size next to the host apply time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ota_delta.h"
+#include "check.h"
+
+#define SLOT_LEN        (4u << 20)      /* ota_0 / ota_1 */
+#define CHUNK_MAX       4096            /* OTA chunk size of the tool */
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+} blob_t;
+
+static blob_t load(const char *path)
+{
+    blob_t b = { 0 };
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return b;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    b.data = malloc(n > 0 ? (size_t)n : 1);
+    if (b.data != NULL && n > 0 && fread(b.data, 1, (size_t)n, f) == (size_t)n) b.len = (size_t)n;
+    fclose(f);
+    return b;
+}
+
+/* ---- the sink: the inactive slot ---- */
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+    size_t   writes;
+} slot_t;
+
+static esp_err_t slot_write(const uint8_t *data, size_t len, void *ctx)
+{
+    slot_t *s = ctx;
+    if (s->len + len > SLOT_LEN) return ESP_ERR_INVALID_SIZE;
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    s->writes++;
+    return ESP_OK;
+}
+
+/* Feed `patch` in pieces of `piece` bytes (0 = random 1..CHUNK_MAX) */
+static esp_err_t apply(const esp_partition_t *base, const blob_t *patch, size_t piece,
+                       slot_t *slot, const char **reason)
+{
+    ota_delta_t *d;
+    slot->len = slot->writes = 0;
+    esp_err_t err = ota_delta_begin(&d, base, SLOT_LEN, slot_write, slot);
+    if (err != ESP_OK) return err;
+    for (size_t off = 0; off < patch->len && err == ESP_OK; ) {
+        size_t n = piece ? piece : (size_t)(rand() % CHUNK_MAX) + 1;
+        if (n > patch->len - off) n = patch->len - off;
+        err = ota_delta_feed(d, patch->data + off, n);
+        off += n;
+    }
+    if (err == ESP_OK) err = ota_delta_finish(d);
+    *reason = ota_delta_reason(d);
+    ota_delta_free(d);
+    return err;
+}
+
+static double ms_since(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    const char *paths[3] = { "delta_old.bin", "delta_new.bin", "delta.mdl" };
+    if (argc == 4) {
+        paths[0] = argv[1];
+        paths[1] = argv[2];
+        paths[2] = argv[3];
+    }
+    blob_t old = load(paths[0]), new = load(paths[1]), patch = load(paths[2]);
+    if (old.len == 0 || new.len == 0 || patch.len == 0 || old.len > SLOT_LEN) {
+        printf("FAIL: cannot read %s / %s / %s\n", paths[0], paths[1], paths[2]);
+        return 1;
+    }
+
+    uint8_t *flash = malloc(SLOT_LEN);
+    slot_t slot = { .data = malloc(SLOT_LEN) };
+    memset(flash, 0xFF, SLOT_LEN);
+    memcpy(flash, old.data, old.len);
+    esp_partition_t base = { .label = "ota_0", .size = SLOT_LEN, .data = flash };
+    const char *reason;
+
+    /* Rebuild, whole patch, timed */
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    esp_err_t err = apply(&base, &patch, patch.len, &slot, &reason);
+    double ms = ms_since(&t0);
+    CHECK(err == ESP_OK, "apply: %s", reason);
+    CHECK(slot.len == new.len && memcmp(slot.data, new.data, new.len) == 0,
+          "output differs from %s (%zu / %zu bytes)", paths[1], slot.len, new.len);
+
+    /* Any split of the patch gives the same image */
+    static const size_t pieces[] = { 1, 0, 0, 0 };
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        err = apply(&base, &patch, pieces[i], &slot, &reason);
+        CHECK(err == ESP_OK && slot.len == new.len &&
+              memcmp(slot.data, new.data, new.len) == 0,
+              "pieces of %zu: %s", pieces[i], reason);
+    }
+
+    /* Another build in the running slot */
+    flash[old.len / 2] ^= 0x01;
+    err = apply(&base, &patch, patch.len, &slot, &reason);
+    CHECK(err != ESP_OK && strcmp(reason, "base") == 0 && slot.writes == 0,
+          "wrong base: %s, %zu writes", reason, slot.writes);
+    flash[old.len / 2] ^= 0x01;
+
+    /* Truncated, then corrupted patches */
+    blob_t cut = { patch.data, patch.len - 1 };
+    err = apply(&base, &cut, 0, &slot, &reason);
+    CHECK(err != ESP_OK && strcmp(reason, "truncated") == 0, "truncated: %s", reason);
+
+    int passed = 0;
+    for (int i = 0; i < 16; i++) {
+        size_t  at  = OTA_DELTA_HDR_LEN + (size_t)rand() % (patch.len - OTA_DELTA_HDR_LEN);
+        uint8_t bit = (uint8_t)(1u << (rand() % 8));
+        patch.data[at] ^= bit;
+        if (apply(&base, &patch, 0, &slot, &reason) == ESP_OK) passed++;
+        patch.data[at] ^= bit;
+    }
+    CHECK(passed == 0, "%d corrupted patches accepted", passed);
+
+    printf("old %zu B, new %zu B, patch %zu B (%.1f%% of new), host apply %.1f ms\n",
+           old.len, new.len, patch.len, 100.0 * patch.len / new.len, ms);
+    return check_result();
+}
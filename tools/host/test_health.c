@@ -0,0 +1,157 @@
+/*
+ * test_health.c - health_payload chunking against providers of every shape
+ *
+ * Every member name below is unique, so a member's presence in a chunk is
+ * a plain substring search.  Checks, for JSON and CBOR:
+ *   - no chunk is longer than the 512 B publish buffer
+ *   - every member arrives exactly once, except the one that cannot fit
+ *     in any message, which is dropped and counted
+ *   - a parent object cut between its members is reopened in the next
+ *     chunk (JSON; in CBOR the same object fits one message)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "health_payload.h"
+#include "check.h"
+
+#define BUF_LEN     512         /* publish_health() buffer */
+#define CHUNKS_MAX  16
+
+/* ---- providers ---- */
+
+static void small_fields(health_writer_t *hw, void *ctx)
+{
+    health_field_uint(hw, "sa", 1);
+    health_field_str(hw,  "sb", "192.168.100.200");
+}
+
+/* Flat keys, like "mqtt": 40 * ~17 B does not fit one message */
+static void flat_fields(health_writer_t *hw, void *ctx)
+{
+    char *names = ctx;
+    for (int i = 0; i < 40; i++) {
+        health_field_uint(hw, &names[i * 4], 999999999u);
+    }
+}
+
+/* One object of histograms, like "cmd_us" */
+static void hist_fields(health_writer_t *hw, void *ctx)
+{
+    static const char *const cls[] = { "hA", "hB", "hC", "hD", "hE", "hF", "hG", "hH" };
+    health_begin_object(hw, "hist");
+    for (int c = 0; c < 8; c++) {
+        health_begin_object(hw, cls[c]);
+        health_field_uint(hw, "n", 999999999u);
+        health_field_uint(hw, "avg", 99999);
+        health_field_uint(hw, "max", 9999999);
+        health_begin_array(hw, "h");
+        for (int b = 0; b < 8; b++) health_field_uint(hw, NULL, 99999999u);
+        health_end_array(hw);
+        health_end_object(hw);
+    }
+    health_end_object(hw);
+    health_begin_object(hw, "hempty");
+    health_end_object(hw);
+    health_field_uint(hw, "htail", 7);
+}
+
+/* A member no message can hold */
+static void huge_fields(health_writer_t *hw, void *ctx)
+{
+    static char big[600];
+    memset(big, 'x', sizeof(big) - 1);
+    health_field_uint(hw, "ua", 1);
+    health_field_str(hw,  "ub", big);
+    health_field_uint(hw, "uc", 3);
+}
+
+static void named_fields(health_writer_t *hw, void *ctx)
+{
+    health_begin_object(hw, "named");
+    health_field_bool(hw, "na", true);
+    health_begin_array(hw, "nt");
+    for (int i = 0; i < 4; i++) health_field_float(hw, NULL, 16.5f + i, 2);
+    health_end_array(hw);
+    health_end_object(hw);
+}
+
+/* ---- checks ---- */
+
+static int count_in(char chunks[][BUF_LEN], const size_t *len, int n,
+                    const char *needle, size_t nlen)
+{
+    int hits = 0;
+    for (int c = 0; c < n; c++) {
+        for (size_t i = 0; i + nlen <= len[c]; i++) {
+            if (memcmp(&chunks[c][i], needle, nlen) == 0) hits++;
+        }
+    }
+    return hits;
+}
+
+static void run(bool cbor, const char *flat_names)
+{
+    static char chunks[CHUNKS_MAX][BUF_LEN];
+    size_t      len[CHUNKS_MAX];
+    int         n = 0;
+    uint32_t    dropped = health_payload_get_dropped();
+
+    health_payload_iter_t it;
+    health_payload_begin(&it, 41);
+    while (!it.done && n < CHUNKS_MAX) {
+        len[n] = health_payload_next(&it, cbor, chunks[n], BUF_LEN);
+        CHECK(len[n] > 0 && len[n] <= BUF_LEN, "%s chunk %d: %zu B",
+              cbor ? "cbor" : "json", n, len[n]);
+        if (len[n] == 0) return;
+        if (!cbor) printf("  %3zu B  %.*s\n", len[n], (int)len[n], chunks[n]);
+        n++;
+    }
+    CHECK(it.done, "did not finish in %d chunks", CHUNKS_MAX);
+    printf("%s: %d chunks\n", cbor ? "cbor" : "json", n);
+
+    const char *once[] = { "sa", "sb", "hA", "hB", "hC", "hD", "hE", "hF",
+                           "hG", "hH", "hempty", "htail", "ua", "uc",
+                           "named", "na", "nt" };
+    for (size_t i = 0; i < sizeof(once) / sizeof(once[0]); i++) {
+        /* JSON keys are quoted; CBOR text keys carry a 0x6N length byte */
+        char   key[16];
+        size_t klen = strlen(once[i]);
+        if (cbor) { key[0] = (char)(0x60 + klen); memcpy(&key[1], once[i], klen); }
+        else      { key[0] = '"'; memcpy(&key[1], once[i], klen); key[klen + 1] = '"'; }
+        int hits = count_in(chunks, len, n, key, klen + (cbor ? 1 : 2));
+        CHECK(hits == 1, "%s: \"%s\" seen %d times", cbor ? "cbor" : "json",
+              once[i], hits);
+    }
+    for (int i = 0; i < 40; i++) {
+        const char *k = &flat_names[i * 4];
+        char key[8];
+        if (cbor) { key[0] = 0x63; memcpy(&key[1], k, 3); }
+        else      { key[0] = '"'; memcpy(&key[1], k, 3); key[4] = '"'; }
+        int hits = count_in(chunks, len, n, key, cbor ? 4 : 5);
+        CHECK(hits == 1, "flat member %s seen %d times", k, hits);
+    }
+
+    if (!cbor) {
+        CHECK(count_in(chunks, len, n, "\"hist\"", 6) >= 2, "\"hist\" was not split");
+    }
+    CHECK(health_payload_get_dropped() == dropped + 1,
+          "dropped %u, want 1", (unsigned)(health_payload_get_dropped() - dropped));
+}
+
+int main(void)
+{
+    static char flat_names[40 * 4];
+    for (int i = 0; i < 40; i++) snprintf(&flat_names[i * 4], 4, "f%02d", i);
+
+    health_payload_register("small", small_fields, NULL);
+    health_payload_register("flat",  flat_fields,  flat_names);
+    health_payload_register("hist",  hist_fields,  NULL);
+    health_payload_register("huge",  huge_fields,  NULL);
+    health_payload_register("named", named_fields, NULL);
+
+    run(false, flat_names);
+    run(true, flat_names);
+
+    return check_result();
+}
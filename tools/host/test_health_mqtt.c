@@ -0,0 +1,180 @@
+/*
+ * test_health_mqtt.c - Size check of the mqtt health providers
+ *
+ * Fills mqtt_stats as after a long busy run -- 100k acks in every topic
+ * class and 100k commands in every command class, spread over all
+ * histogram buckets -- and registers the providers the way mqtt_service
+ * does.  mqtt_stats writes its members for real; the other mqtt modules
+ * are stood in for by fields of the same shape at their worst (3 brokers,
+ * 8 rate rules, every optional object present).
+ *
+ * Checks, for JSON and CBOR:
+ *   - "mqtt", "mqtt_ack" and "mqtt_net" each fit one message on their own
+ *   - the whole payload goes out in chunks of at most 512 B, nothing dropped
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "health_payload.h"
+#include "mqtt_stats.h"
+#include "check.h"
+
+#define BUF_LEN     512         /* publish_health() buffer */
+#define N_SAMPLES   100000
+
+int64_t host_time_us;
+
+/* ---- providers, split as in mqtt_service.c ---- */
+
+static void mqtt_fields(health_writer_t *hw, void *ctx)
+{
+    mqtt_stats_write_health(hw, 65535);
+    health_field_int(hw, "subs", 12);
+    health_field_int(hw, "subs_ok", 12);
+    health_field_bool(hw, "sess", false);
+    health_begin_object(hw, "v5");                  /* mqtt_props */
+    health_field_uint(hw, "pub", 999999999);
+    health_field_uint(hw, "alias", 999999999);
+    health_field_uint(hw, "saved", 999999999);
+    health_field_uint(hw, "props", 999999999);
+    health_field_int(hw, "net", -999999999);
+    health_end_object(hw);
+    health_begin_object(hw, "rpc");                 /* mqtt_rpc */
+    health_field_uint(hw, "n", 999999999);
+    health_field_uint(hw, "err", 999999);
+    health_field_uint(hw, "to", 999999);
+    health_field_uint(hw, "busy", 999999);
+    health_end_object(hw);
+    health_begin_object(hw, "outq");
+    health_field_uint(hw, "n", 16);
+    health_field_uint(hw, "b", 8192);
+    health_field_uint(hw, "peak", 8192);
+    health_field_uint(hw, "wb", 999999999);
+    health_field_uint(hw, "nomem", 999999);
+    health_end_object(hw);
+}
+
+static void ack_fields(health_writer_t *hw, void *ctx) { mqtt_stats_write_ack_health(hw); }
+static void cmd_fields(health_writer_t *hw, void *ctx) { mqtt_stats_write_cmd_health(hw); }
+
+static void net_fields(health_writer_t *hw, void *ctx)
+{
+    health_begin_object(hw, "rate");                /* mqtt_rate */
+    health_field_uint(hw, "thr", 999999999);
+    health_field_uint(hw, "coal", 999999999);
+    health_field_uint(hw, "held", 8);
+    health_begin_array(hw, "r");
+    for (int i = 0; i < 8; i++) {
+        health_begin_array(hw, NULL);
+        health_field_uint(hw, NULL, 99999999);
+        health_field_uint(hw, NULL, 99999999);
+        health_end_array(hw);
+    }
+    health_end_array(hw);
+    health_end_object(hw);
+    health_begin_object(hw, "brk");                 /* mqtt_brokers */
+    health_field_int(hw, "cur", 2);
+    health_begin_array(hw, "rtt");
+    for (int i = 0; i < 3; i++) health_field_uint(hw, NULL, 10000);
+    health_end_array(hw);
+    health_begin_array(hw, "fail");
+    for (int i = 0; i < 3; i++) health_field_uint(hw, NULL, 999999);
+    health_end_array(hw);
+    health_field_uint(hw, "sw", 999999);
+    health_field_uint(hw, "sw_ms", 60000);
+    health_end_object(hw);
+    health_begin_object(hw, "tls");                 /* mqtt_tls */
+    health_field_uint(hw, "n", 999999);
+    health_field_uint(hw, "res", 999999);
+    health_field_uint(hw, "ms", 9999);
+    health_field_uint(hw, "full_ms", 9999);
+    health_field_uint(hw, "res_ms", 9999);
+    health_field_uint(hw, "fail", 999999);
+    health_end_object(hw);
+}
+
+/* ---- stats ---- */
+
+static void fill_stats(void)
+{
+    static const uint32_t ack_ms[] = { 5, 20, 40, 80, 200, 400, 800, 29999 };
+    static const uint32_t cmd_us[] = { 40, 90, 200, 400, 900, 2000, 9000, 9999999 };
+
+    for (int i = 0; i < N_SAMPLES; i++) {
+        for (int c = 0; c < MQTT_TOPIC_CLASS_COUNT; c++) {
+            int id = 1 + c;
+            host_time_us = 0;
+            mqtt_stats_publish_sent(id, (mqtt_topic_class_t)c, 0);
+            host_time_us = (int64_t)ack_ms[i % 8] * 1000;
+            mqtt_stats_publish_acked(id);
+        }
+        for (int c = 0; c < MQTT_CMD_CLASS_COUNT; c++) {
+            mqtt_stats_command_handled((mqtt_cmd_class_t)c, cmd_us[i % 8]);
+        }
+    }
+    mqtt_stats_command_dropped();
+}
+
+/* Largest provider output a chunk can hold: buffer less the tail reserve,
+ * the opening {"seq":4294967295,"part":255, and a closing ,"more":true} */
+static size_t provider_budget(void)
+{
+    return BUF_LEN - 16 - strlen("{\"seq\":4294967295,\"part\":255,");
+}
+
+static size_t provider_len(bool cbor, const char *name)
+{
+    static uint8_t big[4096];
+    health_writer_t hw = { .cbor = cbor };
+    if (cbor) cbor_writer_init(&hw.u.cbor, big, sizeof(big));
+    else      json_writer_init(&hw.u.json, (char *)big, sizeof(big));
+    health_begin_object(&hw, NULL);
+    size_t before = cbor ? cbor_writer_len(&hw.u.cbor) : json_writer_len(&hw.u.json);
+    health_payload_write(&hw, name);
+    return (cbor ? cbor_writer_len(&hw.u.cbor) : json_writer_len(&hw.u.json)) - before;
+}
+
+static void run(bool cbor)
+{
+    const char *fmt = cbor ? "cbor" : "json";
+    static const char *const names[] = { "mqtt", "mqtt_ack", "mqtt_cmd", "mqtt_net" };
+    for (int i = 0; i < 4; i++) {
+        size_t len = provider_len(cbor, names[i]);
+        printf("%s %-8s %4zu B\n", fmt, names[i], len);
+        if (strcmp(names[i], "mqtt_cmd") != 0) {
+            CHECK(len <= provider_budget(), "%s: %s is %zu B, budget %zu B",
+                  fmt, names[i], len, provider_budget());
+        }
+    }
+
+    static char buf[BUF_LEN];
+    uint32_t dropped = health_payload_get_dropped();
+    int      chunks  = 0;
+    health_payload_iter_t it;
+    health_payload_begin(&it, 4294967295u);
+    while (!it.done && chunks < 32) {
+        size_t len = health_payload_next(&it, cbor, buf, sizeof(buf));
+        CHECK(len > 0 && len <= BUF_LEN, "%s chunk %d: %zu B", fmt, chunks, len);
+        if (len == 0) break;
+        chunks++;
+    }
+    CHECK(it.done, "%s: not done after %d chunks", fmt, chunks);
+    CHECK(health_payload_get_dropped() == dropped, "%s: %u members dropped", fmt,
+          (unsigned)(health_payload_get_dropped() - dropped));
+    printf("%s payload: %d chunks\n", fmt, chunks);
+}
+
+int main(void)
+{
+    fill_stats();
+
+    health_payload_register("mqtt",     mqtt_fields, NULL);
+    health_payload_register("mqtt_ack", ack_fields,  NULL);
+    health_payload_register("mqtt_cmd", cmd_fields,  NULL);
+    health_payload_register("mqtt_net", net_fields,  NULL);
+
+    run(false);
+    run(true);
+
+    return check_result();
+}
@@ -0,0 +1,132 @@
+/*
+ * test_onewire.c - DS18B20 bus transactions against a simulated 1-Wire bus
+ *
+ * Builds ds18b20_temp.c itself (included below, so its static bus code is
+ * reachable) on top of stub/onewire_sim.c: the onewire_bus / ds18b20 calls
+ * go to a simulated bus of N externally powered sensors that counts every
+ * reset, Convert T and scratchpad read.  The rest of the firmware the
+ * sensor task talks to is stood in for by stub/ds18b20_env.c.
+ *
+ * For N = 1, 16 and 64, one run_bus() cycle must take:
+ *   - one Skip ROM + Convert T (convert_all), no per-sensor Convert T
+ *   - N + 1 resets: the broadcast plus one Match ROM read per sensor
+ *   - N scratchpad reads, none stale, every reading ok and exact
+ * next to the per-sensor sequence it replaced (trigger + read per sensor,
+ * 2N resets), which is printed for comparison.  A scratchpad with a bad
+ * CRC must fail its sensor's read and count as a CRC error.  A bus with
+ * no sensors must be probed again within EMPTY_RETRY_S, not rebuilt.
+ */
+
+#include "../../main/ds18b20_temp.c"
+#include "onewire_sim.h"
+#include "check.h"
+
+#define BASE_C      20.0f
+
+int64_t host_time_us = -1;          /* follow the monotonic clock */
+
+/* ---- helpers ---- */
+
+static void setup(int n)
+{
+    hw_cleanup();
+    onewire_sim_init(n, BASE_C);
+    atomic_store(&s_ctx.filter_ema, 100);           /* readings unfiltered */
+    CHECK(hw_init() == ESP_OK, "hw_init with %d sensors", n);
+    CHECK(s_ctx.sensor_count == n, "%d sensors found, want %d", s_ctx.sensor_count, n);
+    CHECK(!s_ctx.buses[0].parasite, "bus reported parasite power");
+}
+
+/* The old per-sensor trigger: reset + Match ROM + Convert T each, then the reads */
+static void per_sensor_cycle(const bus_t *b)
+{
+    for (int i = b->first; i < b->first + b->count; i++) {
+        ds18b20_trigger_temperature_conversion(sensor_at(i)->handle);
+    }
+    for (int i = b->first; i < b->first + b->count; i++) {
+        float t;
+        ds18b20_get_temperature(sensor_at(i)->handle, &t);
+    }
+}
+
+static void test_cycle(int n)
+{
+    setup(n);
+    bus_t *b = &s_ctx.buses[0];
+
+    onewire_sim_clear_stats();
+    run_bus(b, 1);
+    onewire_sim_stats_t st = onewire_sim_stats();
+
+    CHECK(st.convert_all == 1, "N=%d: %u broadcasts", n, st.convert_all);
+    CHECK(st.convert_one == 0, "N=%d: %u per-sensor Convert T", n, st.convert_one);
+    CHECK(st.resets == (unsigned)n + 1, "N=%d: %u resets, want %d", n, st.resets, n + 1);
+    CHECK(st.reads == (unsigned)n, "N=%d: %u reads", n, st.reads);
+    CHECK(st.stale == 0, "N=%d: %u stale scratchpads", n, st.stale);
+    for (int i = 0; i < n; i++) {
+        const sensor_t *s = sensor_at(i);
+        int k = (int)((s->address >> 8) & 0xFFFF);          /* sim device index */
+        float want = BASE_C + k / 16.0f;
+        CHECK(s->cur.ok && s->cur.temperature == want,
+              "N=%d: sensor %d ok=%d %.4f, want %.4f", n, i, s->cur.ok,
+              s->cur.temperature, want);
+    }
+
+    onewire_sim_clear_stats();
+    per_sensor_cycle(b);
+    onewire_sim_stats_t ref = onewire_sim_stats();
+    CHECK(ref.resets == 2u * n, "N=%d: per-sensor reference %u resets", n, ref.resets);
+
+    printf("N=%-3d broadcast: %3u resets %4u bytes out, %u polls, %ums | "
+           "per-sensor: %3u resets %4u bytes out\n",
+           n, st.resets, st.bytes_out, st.bits_in, (unsigned)b->conv_ms,
+           ref.resets, ref.bytes_out);
+}
+
+static void test_crc(void)
+{
+    setup(4);
+    unsigned crc0 = atomic_load(&s_ctx.crc_errors);
+    onewire_sim_corrupt_next(2);
+    run_bus(&s_ctx.buses[0], 1);
+
+    int bad = -1;
+    for (int i = 0; i < s_ctx.sensor_count; i++) {
+        if (sensor_at(i)->address == onewire_sim_rom(2)) bad = i;
+    }
+    CHECK(bad >= 0 && !sensor_at(bad)->cur.ok, "corrupt scratchpad read as ok");
+    CHECK(bad >= 0 && sensor_at(bad)->crc_errors == 1, "sensor CRC error not counted");
+    CHECK(atomic_load(&s_ctx.crc_errors) == crc0 + 1, "CRC error total");
+    for (int i = 0; i < s_ctx.sensor_count; i++) {
+        CHECK(i == bad || sensor_at(i)->cur.ok, "sensor %d hit by another's CRC", i);
+    }
+}
+
+/* A bus with nobody on it: no bus kept, probed again within EMPTY_RETRY_S */
+static void test_empty(void)
+{
+    hw_cleanup();
+    onewire_sim_init(0, BASE_C);
+    const int64_t t0 = esp_timer_get_time();
+    CHECK(hw_init() == ESP_ERR_NOT_FOUND, "hw_init with no sensors");
+    CHECK(s_ctx.bus_count == 0 && s_ctx.empty_count == 1, "%d buses, %d empty",
+          s_ctx.bus_count, s_ctx.empty_count);
+    CHECK(s_ctx.next_init_us <= t0 + (EMPTY_RETRY_S + 1) * 1000000LL,
+          "empty table not retried within %d s", EMPTY_RETRY_S);
+    CHECK(!empty_answers(), "empty bus answered the reset");
+
+    onewire_sim_init(2, BASE_C);
+    CHECK(empty_answers(), "sensors plugged in, probe missed them");
+}
+
+int main(void)
+{
+    test_cycle(1);
+    test_cycle(16);
+    test_cycle(DS18B20_MAX_SENSORS);
+    test_crc();
+    test_empty();
+    hw_cleanup();
+
+    return check_result();
+}
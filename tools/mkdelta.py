@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+mkdelta.py - Build a delta OTA patch for main/ota_delta.c
+
+    mkdelta.py old.bin new.bin -o patch.mdl
+
+old.bin must be the exact app image the nodes are running (the build's
+<project>.bin); the node refuses the patch if its running slot does not
+hash to it.  new.bin is the image to install.  The patch is applied back
+in-process and compared with new.bin before it is written, and the size
+reduction is reported.
+
+Format: see ota_delta.h.  Matching is bsdiff-like: 16-byte seeds from an
+index of the old image, extended backwards and forwards exactly, then
+forwards approximately while more bytes match than differ.  Approximate
+regions become 'A' ops, whose diff is mostly zero runs for code that only
+moved; what matches nothing goes out as 'I'.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+
+MAGIC = b"MDL1"
+SEED = 16           # bytes that must match exactly to start a region
+INDEX_STEP = 4      # old image offsets indexed (every 4th)
+GIVE_UP = 128       # stop extending once this far below the best score
+MIN_ZERO_RUN = 3    # shorter zero runs inside an 'A' stay literal
+
+
+def varint(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        if n:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def read_varint(buf, pos):
+    n = shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        n |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return n, pos
+
+
+def build_index(old):
+    index = {}
+    for i in range(0, len(old) - SEED + 1, INDEX_STEP):
+        index.setdefault(old[i:i + SEED], i)
+    return index
+
+
+def extend(old, new, o, p, lo_new):
+    """Grow the seed at old[o]/new[p]: back over unmatched new bytes, then
+    forward exactly and approximately.  Returns (o, p, length)."""
+    while p > lo_new and o > 0 and old[o - 1] == new[p - 1]:
+        o -= 1
+        p -= 1
+
+    n = 0
+    limit = min(len(old) - o, len(new) - p)
+    while n < limit and old[o + n] == new[p + n]:
+        n += 1
+
+    # bsdiff's rule: keep the prefix where 2 * matches - length is largest
+    best_len, best_score = n, n
+    s = n
+    i = n
+    while i < limit:
+        if old[o + i] == new[p + i]:
+            s += 1
+        score = 2 * s - (i + 1)
+        if score > best_score:
+            best_score, best_len = score, i + 1
+        elif score < best_score - GIVE_UP:
+            break
+        i += 1
+    return o, p, best_len
+
+
+def encode_add(old, new, o, p, length):
+    diff = bytes((new[p + i] - old[o + i]) & 0xFF for i in range(length))
+    if not any(diff):
+        return b"C" + varint(o) + varint(length)
+
+    out = bytearray(b"A" + varint(o) + varint(length))
+    i = 0
+    while i < length:
+        j = i
+        while j < length and diff[j] == 0:
+            j += 1
+        if j - i >= MIN_ZERO_RUN or j == length:
+            out += varint((j - i) << 1)
+            i = j
+            continue
+        # literal run: up to the next zero run worth a token
+        j = i
+        while j < length:
+            if diff[j] == 0:
+                k = j
+                while k < length and diff[k] == 0:
+                    k += 1
+                if k - j >= MIN_ZERO_RUN or k == length:
+                    break
+                j = k
+            else:
+                j += 1
+        out += varint(((j - i) << 1) | 1) + diff[i:j]
+        i = j
+    return bytes(out)
+
+
+def make_patch(old, new):
+    index = build_index(old)
+    ops = []
+    stats = {"C": 0, "A": 0, "I": 0}
+    lit_start = 0
+    p = 0
+    while p + SEED <= len(new):
+        o = index.get(new[p:p + SEED])
+        if o is None:
+            p += 1
+            continue
+        o, q, length = extend(old, new, o, p, lit_start)
+        if q > lit_start:
+            ops.append(b"I" + varint(q - lit_start) + new[lit_start:q])
+            stats["I"] += 1
+        op = encode_add(old, new, o, q, length)
+        ops.append(op)
+        stats[chr(op[0])] += 1
+        p = lit_start = q + length
+    if lit_start < len(new):
+        ops.append(b"I" + varint(len(new) - lit_start) + new[lit_start:])
+        stats["I"] += 1
+    ops.append(b"E")
+
+    header = (MAGIC + struct.pack("<II", len(old), len(new)) +
+              hashlib.sha256(old).digest() + hashlib.sha256(new).digest())
+    return header + b"".join(ops), stats
+
+
+def apply_patch(old, patch):
+    """Reference applier, same checks as the device."""
+    if patch[:4] != MAGIC:
+        raise ValueError("magic")
+    old_size, new_size = struct.unpack_from("<II", patch, 4)
+    if hashlib.sha256(old[:old_size]).digest() != patch[12:44]:
+        raise ValueError("base")
+    out = bytearray()
+    pos = 76
+    while True:
+        op = patch[pos:pos + 1]
+        pos += 1
+        if op == b"E":
+            break
+        if op == b"I":
+            n, pos = read_varint(patch, pos)
+            out += patch[pos:pos + n]
+            pos += n
+            continue
+        off, pos = read_varint(patch, pos)
+        n, pos = read_varint(patch, pos)
+        if op == b"C":
+            out += old[off:off + n]
+        elif op == b"A":
+            end = off + n
+            while off < end:
+                t, pos = read_varint(patch, pos)
+                cnt = t >> 1
+                if t & 1:
+                    out += bytes((old[off + i] + patch[pos + i]) & 0xFF
+                                 for i in range(cnt))
+                    pos += cnt
+                else:
+                    out += old[off:off + cnt]
+                off += cnt
+        else:
+            raise ValueError("op %r at %d" % (op, pos - 1))
+    if pos != len(patch):
+        raise ValueError("trailing data")
+    if len(out) != new_size or hashlib.sha256(out).digest() != patch[44:76]:
+        raise ValueError("sha256 out")
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    ap.add_argument("old", help="app image running on the nodes")
+    ap.add_argument("new", help="app image to install")
+    ap.add_argument("-o", "--output", required=True, help="patch file")
+    args = ap.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+
+    t0 = time.monotonic()
+    patch, stats = make_patch(old, new)
+    t1 = time.monotonic()
+    if apply_patch(old, patch) != new:
+        sys.exit("patch does not reproduce %s" % args.new)
+
+    with open(args.output, "wb") as f:
+        f.write(patch)
+
+    print("old   %9d bytes" % len(old))
+    print("new   %9d bytes" % len(new))
+    print("patch %9d bytes  (%.1f%% of new, %.1fx smaller)"
+          % (len(patch), 100.0 * len(patch) / len(new), len(new) / len(patch)))
+    print("ops   C=%d A=%d I=%d   diff %.1f s"
+          % (stats["C"], stats["A"], stats["I"], t1 - t0))
+    print("sha256 %s" % hashlib.sha256(patch).hexdigest())
+
+
+if __name__ == "__main__":
+    main()
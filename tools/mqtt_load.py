@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+mqtt_load.py - Flood a node's command topics and measure ping round trips
+
+    mqtt_load.py --broker 192.168.1.10 --node AABBCCA1B2C3 --rate 200 -t 30
+
+Publishes relay1..4 on/off, text and /SYS/time round-robin at --rate
+messages/s, and --ping-rate times a second a timestamped ping to
+/<node>/ping.  The node echoes pings unchanged to /<node>/pong (see
+"Command Latency" in the README), so every pong gives one broker -> node
+-> broker round trip measured under the flood.
+
+Reported at the end:
+  - messages sent per topic class
+  - pings sent / pongs received; a ping without a pong within --grace
+    seconds of the end counts as dropped
+  - round trip p50 / p90 / p99 / max in ms
+  - the node's own cmd_drop, from the first and last health payload seen
+    during the run (its chunks merged one object level deep)
+
+Needs paho-mqtt (pip install paho-mqtt); works with 1.x and 2.x.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import threading
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("mqtt_load.py needs paho-mqtt: pip install paho-mqtt")
+
+PING_FMT = "<Iq"        # sequence number, send time in ns
+
+
+def new_client(client_id):
+    try:
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id)
+    except AttributeError:                          # paho-mqtt 1.x
+        return mqtt.Client(client_id=client_id)
+
+
+def percentile(sorted_ms, p):
+    if not sorted_ms:
+        return float("nan")
+    i = min(len(sorted_ms) - 1, int(round(p / 100.0 * (len(sorted_ms) - 1))))
+    return sorted_ms[i]
+
+
+class Health:
+    """Merge health chunks of one seq; keep the first and the last payload."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.seq = None
+        self.cur = {}
+        self.first = None
+        self.last = None
+
+    def add(self, payload):
+        try:
+            chunk = json.loads(payload)
+        except ValueError:
+            return
+        with self.lock:
+            if chunk.get("seq") != self.seq:
+                self.seq = chunk.get("seq")
+                self.cur = {}
+            for k, v in chunk.items():
+                if isinstance(v, dict) and isinstance(self.cur.get(k), dict):
+                    self.cur[k].update(v)
+                else:
+                    self.cur[k] = v
+            if not chunk.get("more"):
+                if self.first is None:
+                    self.first = dict(self.cur)
+                self.last = dict(self.cur)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--broker", required=True, help="host[:port]")
+    ap.add_argument("--node", required=True, help="node MAC id, e.g. AABBCCA1B2C3")
+    ap.add_argument("--root", default="", help="CONFIG_MQTT_TOPIC_ROOT of the node")
+    ap.add_argument("--rate", type=float, default=100.0, help="flood messages/s")
+    ap.add_argument("--ping-rate", type=float, default=10.0, help="pings/s")
+    ap.add_argument("-t", "--duration", type=float, default=30.0, help="seconds")
+    ap.add_argument("--qos", type=int, default=0, choices=(0, 1))
+    ap.add_argument("--grace", type=float, default=2.0,
+                    help="seconds to wait for late pongs")
+    args = ap.parse_args()
+
+    host, _, port = args.broker.partition(":")
+    base = "%s/%s" % (args.root, args.node)
+    flood = [("relay", "%s/relay%d" % (base, n)) for n in (1, 2, 3, 4)]
+    flood += [("text", base + "/text"), ("time", "/SYS/time")]
+
+    sent_at = {}
+    rtt_ms = []
+    health = Health()
+    lock = threading.Lock()
+
+    def on_message(client, userdata, msg):
+        if msg.topic == base + "/pong" and len(msg.payload) == struct.calcsize(PING_FMT):
+            seq, t0 = struct.unpack(PING_FMT, msg.payload)
+            with lock:
+                if sent_at.pop(seq, None) is not None:
+                    rtt_ms.append((time.monotonic_ns() - t0) / 1e6)
+        elif msg.topic == base + "/health":
+            health.add(msg.payload)
+
+    c = new_client("mqtt-load-%d" % (time.time_ns() % 1000000))
+    c.on_message = on_message
+    c.connect(host, int(port or 1883))
+    c.subscribe([(base + "/pong", 0), (base + "/health", 0)])
+    c.loop_start()
+    time.sleep(0.5)                                 # let the SUBACK arrive
+
+    counts = {"relay": 0, "text": 0, "time": 0}
+    pings = 0
+    t_start = time.monotonic()
+    t_end = t_start + args.duration
+    next_flood = next_ping = t_start
+    i = 0
+    while True:
+        now = time.monotonic()
+        if now >= t_end:
+            break
+        if now >= next_ping:
+            with lock:
+                sent_at[pings] = True
+            c.publish(base + "/ping", struct.pack(PING_FMT, pings, time.monotonic_ns()), 0)
+            pings += 1
+            next_ping += 1.0 / args.ping_rate
+        if now >= next_flood:
+            cls, topic = flood[i % len(flood)]
+            if cls == "relay":
+                payload = "on" if (i // len(flood)) % 2 == 0 else "off"
+            elif cls == "text":
+                payload = "load %d" % i
+            else:
+                payload = time.strftime("%H:%M:%S")
+            c.publish(topic, payload, args.qos)
+            counts[cls] += 1
+            i += 1
+            next_flood += 1.0 / args.rate
+        time.sleep(max(0.0, min(next_flood, next_ping) - time.monotonic()))
+
+    elapsed = time.monotonic() - t_start
+    time.sleep(args.grace)
+    c.loop_stop()
+    c.disconnect()
+
+    with lock:
+        lost = len(sent_at)
+        rtt = sorted(rtt_ms)
+
+    total = sum(counts.values())
+    print("flood   %d msgs in %.1f s (%.0f/s): relay %d, text %d, time %d"
+          % (total, elapsed, total / elapsed, counts["relay"], counts["text"], counts["time"]))
+    print("ping    sent %d, pong %d, dropped %d (%.1f%%)"
+          % (pings, len(rtt), lost, 100.0 * lost / pings if pings else 0.0))
+    print("rtt ms  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f"
+          % (percentile(rtt, 50), percentile(rtt, 90), percentile(rtt, 99),
+             rtt[-1] if rtt else float("nan")))
+    if health.first is not None and health.last is not None:
+        d0 = health.first.get("cmd_drop", 0)
+        d1 = health.last.get("cmd_drop", 0)
+        print("node    cmd_drop %d -> %d (+%d)" % (d0, d1, d1 - d0))
+        for cls in ("relay", "text", "time", "ping"):
+            h = health.last.get("cmd_us", {}).get(cls)
+            if h:
+                print("node    %-5s n %d avg %d us max %d us" % (cls, h["n"], h["avg"], h["max"]))
+    else:
+        print("node    no complete health payload seen (raise -t above the health interval)")
+    return 1 if lost else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())